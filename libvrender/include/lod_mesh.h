@@ -0,0 +1,158 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOD_MESH_H_INCLUDED
+#define LOD_MESH_H_INCLUDED
+
+#include <pthread.h>
+#include "common.h"
+#include "math/vector.h"
+#include "volume_pyramid.h"
+#include "marching_cubes.h"
+#include "thread_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ячеек исходного поля в чанке по каждой оси
+#define LOD_MESH_CHUNK_CELLS 32
+
+// самый грубый уровень детализации (ячейка чанка - 2^level ячеек поля)
+#define LOD_MESH_MAX_LEVEL 4
+
+// диапазон элементов буфера
+typedef struct {
+	unsigned first, count;
+} lod_mesh_range_t;
+
+/*
+ * Буфер OpenGL, поделённый на диапазоны чанков (size элементов по element_size байт).
+ * Свободные диапазоны хранятся по возрастанию начала, соседние объединяются
+ */
+typedef struct {
+	GLuint buffer;
+	unsigned element_size, size;
+
+	lod_mesh_range_t *free;
+	unsigned num_free, max_free;
+} lod_mesh_pool_t;
+
+/*
+ * Сетка чанка в общих буферах: вершины [first_vertex, first_vertex + max_vertices),
+ * индексы [first_index, first_index + max_elements), заняты num_vertices и num_elements.
+ * min_value/max_value - границы значений узлов, по которым построена сетка
+ */
+typedef struct {
+	unsigned first_vertex, num_vertices, max_vertices;
+	unsigned first_index, num_elements, max_elements;
+	float min_value, max_value;
+} lod_mesh_chunk_t;
+
+/*
+ * Изоповерхность из чанков по LOD_MESH_CHUNK_CELLS^3 ячеек поля. Чанк уровня l строится
+ * по уровню l пирамиды с ячейками 2^l, уровень выбирается по расстоянию до наблюдателя,
+ * соседние чанки (в т.ч. по рёбрам и вершинам) отличаются не больше чем на 1 уровень.
+ * Ячейки грубого чанка на границе с более детальным соседом - переходные: их грани и
+ * рёбра на границе делятся пополам и берут значения детального соседа, поэтому сетки
+ * чанков смыкаются без щелей. Чанки перестраиваются в пуле потоков, только когда
+ * меняется уровень чанка или его соседей, изо-уровень проходит через значения его узлов
+ * или меняется поле в его области, и загружаются все вместе по завершении. Задачи выполняют
+ * потоки пула и отдельный поток перестройки, поток отрисовки только проверяет завершение
+ * и загружает сетки. Сетки чанков
+ * лежат в общих буферах вершин и индексов и рисуются одним вызовом.
+ * Используется только в режиме LOD: в единой сетке при изменении изо-уровня перестраивался
+ * бы каждый чанк с поверхностью, поэтому она обновляется по слоям (marching_cubes_update_vbos)
+ */
+typedef struct {
+	// кол-во ячеек поля и чанков по осям
+	vector3ui cells, num_chunks;
+	lod_mesh_chunk_t *chunks;
+
+	// общие буферы и VAO чанков
+	GLuint vao;
+	lod_mesh_pool_t vertices, indices;
+
+	// непустые чанки для glMultiDrawElements
+	GLsizei *draw_counts;
+	const GLvoid **draw_offsets;
+	unsigned num_draws;
+
+	// чанки, которые нужно перестроить независимо от уровней и изо-уровня
+	unsigned char *dirty;
+
+	// уровни чанков, с которыми построены сетки, и выбранные на последнем обновлении
+	unsigned char *lods, *new_lods;
+
+	// изо-уровень построенных сеток; is_stale - сетки нужно перестроить целиком
+	float isolevel;
+	int is_stale;
+
+	// перестройка в пуле потоков, которую ожидает поток thread (has_thread - он запущен)
+	thread_pool_job_t job;
+	int is_building;
+	pthread_t thread;
+	int has_thread;
+	struct lod_mesh_build_s *build;
+} lod_mesh_t;
+
+void lod_mesh_init(lod_mesh_t *mesh);
+
+/*
+ * Выбрать уровни чанков для наблюдателя viewer (в координатах сетки, поле - куб [0,1]):
+ * чанк ближе distance строится по исходному полю, каждое удвоение расстояния огрубляет
+ * его на уровень. Загружает перестроенные чанки, если работа пула завершилась, и
+ * отправляет новую, если уровни или isolevel изменились. Вызывается с текущим контекстом
+ * OpenGL; attr_position - атрибут вершин для VAO общих буферов
+ */
+void lod_mesh_update(lod_mesh_t *mesh, const volume_pyramid_t *pyramid, float isolevel,
+					 vector3f viewer, float distance, GLint attr_position);
+
+/* Нарисовать загруженные чанки */
+void lod_mesh_draw(const lod_mesh_t *mesh);
+
+/*
+ * Дождаться работы пула и отбросить её результат; сетки перестраиваются на следующем
+ * обновлении. Вызывается перед изменением или освобождением поля пирамиды
+ */
+void lod_mesh_invalidate(lod_mesh_t *mesh);
+
+/*
+ * Перестроить на следующем обновлении чанки, значения которых зависят от узлов
+ * [begin, end] исходного поля (после правки поля на месте). Работа пула ожидается,
+ * её чанки тоже перестраиваются. Пирамида должна быть обновлена до следующего обновления
+ */
+void lod_mesh_invalidate_region(lod_mesh_t *mesh, vector3ui begin, vector3ui end);
+
+/*
+ * Построить в пуле потоков сетки всех чанков с уровнями, выбранными для viewer и distance
+ * как в lod_mesh_update, без OpenGL и собрать их в массивы *vertices (в координатах сетки)
+ * и *triangles (номера вершин массива); вершины на границах чанков повторяются в каждом.
+ * Массивы освобождает вызывающий. Возвращает 0 при ошибке
+ */
+int lod_mesh_extract(const volume_pyramid_t *pyramid, float isolevel, vector3f viewer, float distance,
+					 vector3f **vertices, unsigned *num_vertices, triangle_t **triangles, unsigned *num_triangles);
+
+/* Освободить буферы (mesh снова можно обновлять, как после lod_mesh_init) */
+void lod_mesh_destroy(lod_mesh_t *mesh);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOD_MESH_H_INCLUDED */
@@ -31,21 +31,78 @@ typedef struct {
 	unsigned int indices[3];
 } triangle_t;
 
+/*
+ * Сетка marching_cubes_update_mesh: у каждого слоя ячеек своё место в массивах с запасом
+ * (незанятые треугольники вырождены). layout меняется при размещении слоёв заново,
+ * versions[k] - при перестройке треугольников слоя k; вершины [first_vertex, last_vertex)
+ * содержат все вершины треугольников и сдвигаются при каждом обновлении
+ */
+typedef struct {
+	const vector3f *vertices;
+	const triangle_t *triangles;
+	unsigned num_vertices, num_triangles;
+
+	// начала мест треугольников слоёв (num_layers + 1, последнее - num_triangles)
+	unsigned num_layers;
+	const unsigned *triangle_bases, *versions;
+	unsigned layout;
+
+	unsigned first_vertex, last_vertex;
+} mc_layers_t;
+
+// размещение и версии слоёв, загруженные в буферы (layout = 0 - буферы загружаются целиком)
+typedef struct {
+	unsigned layout;
+	unsigned *versions;
+	unsigned max_versions;
+} mc_layers_upload_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 /*
  * Полигонизировать одну ячейку алгоритмом Marching Cubes
+ * (out_vertices - до 12 вершин, out_triangles - до 5 треугольников)
  */
 int marching_cubes_polygonise(cell_t cell, float isolevel, vector3f *out_vertices, 
 							  unsigned short *number_of_vertices, triangle_t *out_triangles, 
 							  unsigned short *number_of_triangles);
+/*
+ * welded - 1 (по-умолчанию): соседние ячейки используют общие вершины на рёбрах,
+ * получается связная сетка; 0: у каждой ячейки свои вершины
+ */
+void marching_cubes_set_welded(int welded);
+
+/*
+ * Упрощать сетку перед загрузкой в буферы (marching_cubes_upload_vbos и функции, которые
+ * её используют) до ratio от числа треугольников с ошибкой не больше max_error шагов сетки
+ * (mesh_decimate). ratio >= 1 (по-умолчанию) - без упрощения
+ */
+void marching_cubes_set_decimation(float ratio, float max_error);
+
+/*
+ * Сбросить min/max блоков скалярного поля и сетку marching_cubes_update_mesh. Блоки строятся
+ * при первой полигонизации и используются для любого изо-уровня, пока не изменятся указатель
+ * на volume или размеры, поэтому после изменения значений volume на месте или удаления
+ * буферов нужно вызвать эту функцию
+ */
+void marching_cubes_invalidate(void);
+
+/*
+ * Учесть правку на месте узлов [begin, end] поля volume размера volume_size: min/max
+ * блоков пересчитываются только в задетых слоях блоков, а в сетке marching_cubes_update_mesh
+ * при следующем вызове заново строятся только слои с этими узлами (вместо marching_cubes_invalidate)
+ */
+void marching_cubes_invalidate_region(const float *volume, vector3ui volume_size, vector3ui begin, vector3ui end);
+
 /* 
  * Полигонизировать volume с размером volume_size.
  * grid_size - размер сетки
  * isolevel - изо-значение в скалярном поле volume на основе котрого проиходит полигонизация
  * out_vertices, out_triangles -  выходные вершины и треугольники (индексы)
+ * Функции полигонизации используют общие внутренние буферы, их нельзя вызывать
+ * из нескольких потоков одновременно
  */
 int marching_cubes_create(const float *volume, vector3ui volume_size, vector3ui grid_size, 
 						  float isolevel, vector3f *out_vertices, unsigned int *number_of_vertices, 
@@ -55,15 +112,71 @@ int marching_cubes_create(const float *volume, vector3ui volume_size, vector3ui
  * grid_size - размер сетки
  * isolevel - изо-значение в скалярном поле volume на основе котрого проиходит полигонизация
  * vertex_vbo, index_vbo - вершинные буферы, куда нужно загрузить данные
+ * (сначала считается точное кол-во вершин и треугольников, буферы под них 
+ * сохраняются до следующего вызова)
  * Опционально:
  * normal_vbo - вершинный буфер для нормалей
  * function - указатель на функцию для вычисления нормалей
+ * (вызывается одновременно из потоков пула)
  */
 int marching_cubes_create_vbos(const float *volume, vector3ui volume_size, 
 							  vector3ui grid_size, float isolevel,
 							   GLuint vertex_vbo, GLuint index_vbo, GLuint normal_vbo,
 							   float (*function)(vector3f pos), unsigned *num_elements);
 
+/*
+ * Полигонизировать volume без загрузки в буферы OpenGL (можно вызывать из любого потока,
+ * но не одновременно с другими функциями полигонизации). Вершины и треугольники - во
+ * внутренних буферах, действительных до следующего вызова. Возвращает 0 при ошибке
+ */
+int marching_cubes_create_mesh(const float *volume, vector3ui volume_size, vector3ui grid_size, float isolevel,
+							   const vector3f **vertices, unsigned *n_vertices,
+							   const triangle_t **triangles, unsigned *n_triangles);
+
+/*
+ * Упростить сетку по параметрам marching_cubes_set_decimation (на месте указателей -
+ * внутренние буферы mesh_decimate); без упрощения или при ошибке сетка не меняется
+ */
+void marching_cubes_decimate_mesh(vector3ui grid_size, const vector3f **vertices, unsigned *n_vertices,
+								  const triangle_t **triangles, unsigned *n_triangles);
+
+/*
+ * Загрузить готовую сетку в vertex_vbo и index_vbo (и нормали в normal_vbo, если задан),
+ * как это делает marching_cubes_create_vbos, упростив её при marching_cubes_set_decimation.
+ * Используется и другими способами построения сетки
+ */
+int marching_cubes_upload_vbos(const float *volume, vector3ui volume_size, vector3ui grid_size,
+							   const vector3f *vertices, unsigned n_vertices,
+							   const triangle_t *triangles, unsigned n_triangles,
+							   GLuint vertex_vbo, GLuint index_vbo, GLuint normal_vbo,
+							   float (*function)(vector3f pos), unsigned *num_elements);
+
+/*
+ * Полигонизировать volume без нормалей, сохраняя сетку между вызовами: у каждого слоя ячеек
+ * своё место с запасом, и при изменении только isolevel заново строятся лишь слои,
+ * где узлы сменили принадлежность объёму (в остальных сдвигаются вершины), а после
+ * marching_cubes_invalidate_region - ещё и слои с изменёнными узлами. Без OpenGL, как
+ * marching_cubes_create_mesh; массивы mesh действительны до следующего вызова.
+ * Возвращает 0 при ошибке
+ */
+int marching_cubes_update_mesh(const float *volume, vector3ui volume_size, vector3ui grid_size, float isolevel,
+							   mc_layers_t *mesh);
+
+/*
+ * Загрузить сетку marching_cubes_update_mesh (или её копию) в буферы, в которые загружалась
+ * upload: при новом размещении - целиком, иначе через glBufferSubData вершины и слои,
+ * перестроенные после прошлой загрузки (в т.ч. пропущенными обновлениями). Возвращает 0 при ошибке
+ */
+int marching_cubes_upload_layers(const mc_layers_t *mesh, mc_layers_upload_t *upload, GLuint vertex_vbo, GLuint index_vbo);
+
+/*
+ * marching_cubes_update_mesh с загрузкой в буферы (marching_cubes_upload_layers). Буферы
+ * нельзя изменять между вызовами. num_elements включает вырожденные треугольники запаса.
+ * Возвращает 0 при ошибке
+ */
+int marching_cubes_update_vbos(const float *volume, vector3ui volume_size, vector3ui grid_size, float isolevel,
+							   GLuint vertex_vbo, GLuint index_vbo, unsigned *num_elements);
+
 #ifdef __cplusplus
 }
 #endif
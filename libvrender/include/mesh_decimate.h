@@ -0,0 +1,55 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MESH_DECIMATE_H_INCLUDED
+#define MESH_DECIMATE_H_INCLUDED
+
+#include "common.h"
+#include "math/vector.h"
+#include "marching_cubes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Упростить связную сетку стягиванием рёбер по квадрикам ошибки (Garland-Heckbert):
+ * вершина переносится в соседнюю, если среднее квадрата расстояния до плоскостей исходных
+ * треугольников обеих вершин не больше max_error^2. Стягивания идут проходами: стоимости
+ * считаются в пуле потоков, затем выбираются самые дешёвые непересекающиеся стягивания.
+ * Граничные и неманифолдные рёбра сохраняются, треугольники не переворачиваются.
+ * Упрощение останавливается на target_triangles треугольниках или когда стягиваний в
+ * пределах ошибки не осталось. Для сетки без общих вершин (marching_cubes_set_welded(0))
+ * стягивать нечего.
+ * Результат - во внутренних буферах модуля (out_vertices, out_triangles), действительных
+ * до следующего вызова. Возвращает 0 при ошибке
+ */
+int mesh_decimate(const vector3f *vertices, unsigned n_vertices,
+				  const triangle_t *triangles, unsigned n_triangles,
+				  unsigned target_triangles, float max_error,
+				  const vector3f **out_vertices, unsigned *out_n_vertices,
+				  const triangle_t **out_triangles, unsigned *out_n_triangles);
+
+/* Освободить внутренние буферы */
+void mesh_decimate_release(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MESH_DECIMATE_H_INCLUDED */
@@ -0,0 +1,128 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MESH_WORKER_H_INCLUDED
+#define MESH_WORKER_H_INCLUDED
+
+#include <pthread.h>
+#include "common.h"
+#include "math/vector.h"
+#include "marching_cubes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// параметры построения сетки; method передаётся функции построения как есть
+typedef struct {
+	const float *volume;
+	vector3ui volume_size, grid_size;
+	float isolevel;
+	int method;
+} mesh_request_t;
+
+// сетка, построенная потоком (is_valid = 0 - построение не удалось)
+typedef struct {
+	mesh_request_t request;
+	int is_valid;
+
+	vector3f *vertices;
+	unsigned num_vertices, max_vertices;
+	triangle_t *triangles;
+	unsigned num_triangles, max_triangles;
+
+	// копия сетки по слоям (mesh_buffer_store_layers) на массивах выше и layer_data,
+	// layers.layout = 0 - сетка без слоёв (mesh_buffer_store)
+	mc_layers_t layers;
+	unsigned *layer_data;
+	unsigned max_layer_data;
+} mesh_buffer_t;
+
+/*
+ * Построить сетку по запросу (в потоке построения) и сохранить её в mesh через
+ * mesh_buffer_store или mesh_buffer_store_layers. Возвращает 0 при ошибке
+ */
+typedef int (*mesh_build_func_t)(const mesh_request_t *request, mesh_buffer_t *mesh);
+
+/*
+ * Поток построения сеток: запросы не ждут друг друга, поток берёт последний - запрос,
+ * отправленный во время построения, заменяет ещё не взятый. Готовая сетка передаётся
+ * потоку рендера через тройной буфер: поток строит в back, затем атомарно меняет его с
+ * middle, поток рендера забирает свежий middle в front. Ни один из потоков не ждёт
+ * другого, поток рендера получает только целые сетки
+ */
+typedef struct {
+	pthread_t thread;
+	mesh_build_func_t build;
+
+	// запрос, флаги и ожидание их изменения
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	mesh_request_t request;
+	int has_request, is_busy, is_quit;
+
+	// удерживается потоком на время построения (функции полигонизации не потокобезопасны)
+	pthread_mutex_t build_mutex;
+
+	// back - у потока, front - у рендера, middle - с флагом MESH_WORKER_FRESH, если не забран
+	mesh_buffer_t buffers[3];
+	unsigned back, middle, front;
+
+	int is_running;
+} mesh_worker_t;
+
+/* Запустить поток построения с функцией build. Возвращает 0 при ошибке */
+int mesh_worker_start(mesh_worker_t *worker, mesh_build_func_t build);
+
+/* Отправить запрос, заменив ещё не взятый потоком */
+void mesh_worker_request(mesh_worker_t *worker, const mesh_request_t *request);
+
+/*
+ * Забрать свежую сетку (поток рендера): NULL, если новой сетки нет. Сетка действительна
+ * до следующего вызова
+ */
+const mesh_buffer_t *mesh_worker_acquire(mesh_worker_t *worker);
+
+/*
+ * Отбросить невзятый запрос и незабранную сетку, дождавшись текущего построения.
+ * Вызывается перед изменением или освобождением поля запросов и параметров построения
+ */
+void mesh_worker_cancel(mesh_worker_t *worker);
+
+/* Занять функции полигонизации (дождавшись текущего построения) и освободить их */
+void mesh_worker_lock(mesh_worker_t *worker);
+void mesh_worker_unlock(mesh_worker_t *worker);
+
+/* Остановить поток и освободить буферы */
+void mesh_worker_stop(mesh_worker_t *worker);
+
+/* Скопировать сетку в буфер (для функции построения). Возвращает 0 при ошибке */
+int mesh_buffer_store(mesh_buffer_t *mesh, const vector3f *vertices, unsigned n_vertices,
+					  const triangle_t *triangles, unsigned n_triangles);
+
+/*
+ * Скопировать сетку marching_cubes_update_mesh вместе с местами и версиями слоёв, чтобы
+ * рендер загрузил только изменившиеся слои (marching_cubes_upload_layers). Возвращает 0 при ошибке
+ */
+int mesh_buffer_store_layers(mesh_buffer_t *mesh, const mc_layers_t *layers);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MESH_WORKER_H_INCLUDED */
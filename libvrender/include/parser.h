@@ -22,11 +22,28 @@
 #define MAX_NUM_USER_VARS 20
 #define MAX_NUM_TOKENS 256
 #define MAX_NUM_FUNC_ARGS 7
+#define MAX_NUM_INSTRUCTIONS (MAX_NUM_TOKENS * 4)
+#define MAX_NUM_REGISTERS (MAX_NUM_TOKENS * 4)
+#define MAX_NUM_LOOPS (MAX_NUM_TOKENS / 4)
+
+// границы цикла a..b по модулю (пока i точно представимо во float)
+// и наибольшее число итераций одного цикла; иначе - ошибка выполнения 18
+#define MAX_LOOP_BOUND 16777216
+#define MAX_LOOP_ITERATIONS 65536
+
+// кол-во точек, вычисляемых одновременно в parser_program_eval_row
+#define PARSER_BATCH_SIZE 16
 
 typedef struct {
 	int type;
 	char *data;
 	int data_size;
+	
+	// номер идентификатора (см. resolve_identifiers)
+	int id;
+	
+	// значение числовой константы
+	float value;
 } token_t;
 
 typedef struct {
@@ -40,23 +57,87 @@ typedef struct {
 	float value;
 } float_var_value_t;
 
+// регистры встроенных переменных
+enum {
+	PARSER_REG_D = 0, PARSER_REG_X, PARSER_REG_Y, PARSER_REG_Z, PARSER_REG_I,
+	PARSER_NUM_BUILTIN_REGS
+};
+
+// коды инструкций
+enum {
+	OP_CONST = 1, OP_MOV,
+	OP_NEG, OP_FACT,
+	OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_FDIV, OP_POW,
+	OP_GT, OP_LT, OP_GE, OP_LE, OP_EQ, OP_NE,
+	OP_CALL, OP_JZ, OP_JMP,
+	OP_LOOP_BEGIN, OP_LOOP_NEXT
+};
+
+/* 
+ * Инструкция скомпилированной программы.
+ * dst - номер регистра-результата, args - номера регистров-операндов,
+ * target - переход (для ветвлений и циклов), либо глобальный номер функции,
+ * func - указатель на встроенную функцию
+ */
+typedef struct {
+	unsigned short opcode;
+	unsigned short n_args;
+	unsigned short dst;
+	unsigned short args[MAX_NUM_FUNC_ARGS - 1];
+	int target;
+	float value;
+	void *func;
+} instruction_t;
+
+/* 
+ * Скомпилированная функция (неизменяемая, может использоваться несколькими потоками).
+ * Регистры: встроенные переменные (PARSER_REG_*), затем num_user_vars 
+ * пользовательских переменных, затем временные значения.
+ * Инструкции упорядочены по этапам: [0, row_begin) не зависят от x и y,
+ * [row_begin, voxel_begin) не зависят от x, остальные вычисляются для каждой точки
+ */
+typedef struct {
+	instruction_t *instructions;
+	unsigned num_instructions;
+	unsigned num_registers;
+	unsigned num_loops;
+	unsigned num_user_vars;
+
+	unsigned row_begin;
+	unsigned voxel_begin;
+
+	// регистры, которые этап точек берёт из предыдущих этапов
+	unsigned short *voxel_inputs;
+	unsigned num_voxel_inputs;
+
+	// машинный код программы (NULL, если JIT недоступен) и его размер
+	void *jit_code;
+	unsigned jit_size;
+
+	// библиотека из parser_program_compile_native, её функции и функции инструкций
+	void *native_handle;
+	void *native_eval;
+	void *native_eval_row;
+	void **native_funcs;
+} parser_program_t;
+
 typedef struct {
-		
-	float_var_value_t *float_builtin_vars;
 	
 	identifier_t user_identifiers[MAX_NUM_USER_VARS];
-	float_var_value_t float_user_vars[MAX_NUM_USER_VARS];
 	unsigned num_user_ids;
-	unsigned num_user_vars;
-	int last_var_global_id;
 	
-	float_var_value_t *float_extra_vars;
 	token_t tokens[MAX_NUM_TOKENS];
 	unsigned num_tokens;
+	
+	// арена для текста токенов и имён пользовательских переменных
+	char *token_arena;
+	unsigned token_arena_used;
 	unsigned index;
 	int error;
 	int init;
-	int skip_expr;
+	
+	// программа для parser_parse_text
+	parser_program_t program;
 	
 } parser_t;
 
@@ -70,6 +151,65 @@ int parser_create(parser_t *parser);
 /* Парсить строку text использую таблицу переменных var_table */
 int parser_parse_text(parser_t *parser, const char *text, float_var_value_t *var_table);
 
+/* 
+ * Скомпилировать строку text в программу program, оптимизировать её
+ * и, если возможно, перевести в машинный код (после выполнения программы 
+ * верно только значение d).
+ * Возвращает 0 или номер ошибки (как и parser_parse_text)
+ */
+int parser_compile(parser_t *parser, const char *text, parser_program_t *program);
+
+/* 
+ * Вычислить программу. registers - массив из program->num_registers регистров,
+ * в котором должны быть установлены x, y, z (PARSER_REG_X, ...). 
+ * Значение d возвращается в registers[PARSER_REG_D].
+ * Возвращает 0 или номер ошибки времени выполнения
+ */
+int parser_program_eval(const parser_program_t *program, float *registers);
+
+/* 
+ * Вычислить программу для count точек (x0 + k, y, z), k = 0..count-1, 
+ * сразу по PARSER_BATCH_SIZE точек (SSE2/AVX2/AVX-512 в зависимости от процессора),
+ * либо по одной точке, если ветвления и циклы в пакете расходятся.
+ * Значения d записываются в result[k] (0 для точек с ошибкой).
+ * Возвращает 0 или номер ошибки времени выполнения
+ */
+int parser_program_eval_row(const parser_program_t *program, float x0, float y, float z,
+							unsigned count, float *result);
+
+/* 
+ * Вычислять по одной точке (parser_program_eval и точки, которые 
+ * parser_program_eval_row не может вычислить пакетом) машинным кодом, 
+ * созданным parser_compile (x86-64 Linux), - enable = 1 (по-умолчанию), 
+ * или интерпретатором - enable = 0. Возвращает 1, если JIT доступен
+ */
+int parser_set_jit(int enable);
+
+/* 
+ * Перевести программу в код на C, скомпилировать его системным компилятором
+ * ($CC или cc, -O3 -march=native) в библиотеку в каталоге cache_dir и загрузить её.
+ * Библиотека той же программы берётся из кэша без компиляции. 
+ * После этого parser_program_eval и parser_program_eval_row выполняют её.
+ * Возвращает 0 или -1, если компиляция или загрузка не удались (программа не меняется)
+ */
+int parser_program_compile_native(parser_program_t *program, const char *cache_dir);
+
+/* Выгрузить библиотеку parser_program_compile_native (программа выполняется как раньше) */
+void parser_program_destroy_native(parser_program_t *program);
+
+/* 
+ * Вычислить программу для count_x * count_y точек (x0 + i, y0 + j, z) слоя z:
+ * части программы, не зависящие от x и y, вычисляются один раз на слой,
+ * не зависящие от x - один раз на строку. Значения d записываются 
+ * в result[i + j * stride] (0 для точек с ошибкой), stride >= count_x.
+ * Возвращает 0 или номер ошибки времени выполнения
+ */
+int parser_program_eval_slice(const parser_program_t *program, float x0, float y0, float z,
+							  unsigned count_x, unsigned count_y, unsigned stride, float *result);
+
+/* Освободить ресурсы программы */
+void parser_program_destroy(parser_program_t *program);
+
 /* Глобально остановить все парсеры (для случаев зацикливания) */
 void parser_stop();
 
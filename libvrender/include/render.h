@@ -27,6 +27,10 @@
 	if((__render_gl_error = glGetError()) != GL_NO_ERROR) \
 		ERROR_MSG("OpenGL error #%i in file %s on line %i \n", __render_gl_error, __FILE__, __LINE__)
 	
+// методы построения изоповерхности (render_set_mesh_method)
+#define RENDER_MESH_MARCHING_CUBES 0
+#define RENDER_MESH_SURFACE_NETS 1
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -60,6 +64,30 @@ void render_set_light_rot_step(float step);
 /* rebuild - если 1, то перестроить скалярное поле из функции */
 void render_set_volume_size(vector3ui volume_size, int rebuild);
 void render_set_grid_size(vector3ui grid_size);
+/* Выбрать метод построения изоповерхности (RENDER_MESH_*) */
+void render_set_mesh_method(int method);
+/*
+ * Упрощать сетку (отображаемую и экспортируемую) до ratio от числа треугольников с ошибкой
+ * не больше max_error шагов сетки. ratio >= 1 - без упрощения
+ */
+void render_set_decimation(float ratio, float max_error);
+/*
+ * Строить отображаемую изоповерхность по чанкам с уровнем детализации по расстоянию
+ * от камеры: чанки ближе distance (в размерах объекта) - по исходному полю, каждое
+ * удвоение расстояния огрубляет чанк вдвое. Чанки перестраиваются в фоне при изменении
+ * уровней, изо-уровня или поля, размер сетки, метод и упрощение в этом режиме не используются
+ * (экспорт - без LOD). При distance = HUGE_VALF все чанки строятся по исходному полю
+ */
+void render_set_lod(int enable, float distance);
+/*
+ * Строить единую сетку в фоновом потоке (по-умолчанию): изменение изо-уровня, сетки или
+ * метода отправляет запрос, и кадр рисуется с последней готовой сеткой, пока не будет
+ * построена новая; из запросов, пришедших во время построения, строится последний.
+ * Marching cubes без упрощения и в фоне обновляет сохранённую сетку по слоям, а в буферы
+ * загружаются только слои, изменившиеся после прошлой загрузки.
+ * 0 - сетка строится в вызывающем потоке
+ */
+void render_set_background_meshing(int enable);
 void render_set_material_color(vector3f front_color, vector3f back_color);
 void render_set_material_shininess(float shininess);
 void render_set_ambient_factor(float ambient);
@@ -70,6 +98,10 @@ void render_set_camera_step(float step);
 void render_set_camera_move_speed(float speed);
 void render_set_camera_fov(float fov);
 void render_set_number_of_threads(unsigned num);
+/* enable - вычислять функцию машинным кодом (JIT), возвращает 1, если JIT доступен */
+int render_set_jit(int enable);
+/* cache_dir - каталог для компиляции функции системным компилятором (NULL - не компилировать) */
+void render_set_native_cache(const char *cache_dir);
 int render_set_function_text(const char *function_text);
 
 /* Получить текущее значение изо-уровня */
@@ -106,6 +138,15 @@ void render_get_current_volume(float **volume, vector3ui *size);
 /* Установить импортированное скалярное поле */
 void render_set_external_volume(float *volume_ptr, vector3ui size);
 
+/*
+ * Обновить после правки на месте (по указателю render_get_current_volume) узлы поля
+ * [begin, end]: в пирамиде и текстуре обновляются только узлы, зависящие от области,
+ * из сетки по чанкам (render_set_lod) перестраиваются только задетые чанки, из единой
+ * сетки marching cubes без упрощения - только задетые слои ячеек. Сетки surface nets
+ * и упрощённые строятся заново целиком
+ */
+void render_update_volume_region(vector3ui begin, vector3ui end);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,80 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCHEDULER_H_INCLUDED
+#define SCHEDULER_H_INCLUDED
+
+#include <stdint.h>
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// максимальное кол-во потоков планировщика
+#define SCHEDULER_MAX_THREADS 256
+
+/*
+ * Очередь задач одного потока: непрерывный интервал номеров [next, end),
+ * упакованный в одно 64-битное слово (next - младшие 32 бита), чтобы
+ * владелец и воры меняли его одной атомарной операцией.
+ * Каждая очередь занимает свою строку кэша
+ */
+typedef struct {
+	uint64_t range;
+
+	// статистика потока
+	unsigned num_tasks;
+	unsigned num_steals;
+	double busy_time;
+	double task_start;
+	int has_task;
+} __attribute__((aligned(64))) scheduler_queue_t;
+
+typedef struct {
+	scheduler_queue_t *queues;
+	void *memory;
+	unsigned num_threads;
+	unsigned num_tasks;
+	double start_time;
+} scheduler_t;
+
+/*
+ * Распределить задачи 0..num_tasks-1 непрерывными блоками по num_threads потокам.
+ * Возвращает 0 при ошибке
+ */
+int scheduler_create(scheduler_t *scheduler, unsigned num_threads, unsigned num_tasks);
+
+/*
+ * Получить следующую задачу потока thread: сначала из своей очереди,
+ * затем половину оставшихся задач самой длинной чужой очереди.
+ * Время между вызовами засчитывается потоку как занятое.
+ * Возвращает 0, когда задачи закончились
+ */
+int scheduler_next(scheduler_t *scheduler, unsigned thread, unsigned *task);
+
+/* Вывести в лог время работы и простоя каждого потока */
+void scheduler_report(const scheduler_t *scheduler);
+
+void scheduler_destroy(scheduler_t *scheduler);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCHEDULER_H_INCLUDED */
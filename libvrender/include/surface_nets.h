@@ -0,0 +1,57 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SURFACE_NETS_H_INCLUDED
+#define SURFACE_NETS_H_INCLUDED
+
+#include "common.h"
+#include "math/vector.h"
+#include "marching_cubes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Полигонизация методом Surface Nets: одна вершина в каждой ячейке, через которую
+ * проходит изоповерхность (среднее точек пересечения рёбер ячейки), и четырёхугольник
+ * из двух треугольников на каждое пересечённое ребро сетки между четырьмя его ячейками.
+ * Вершины общие по построению. Параметры и результат как у marching_cubes_create
+ * (в т.ч. кол-ва на 1 больше), буферы должны вмещать вершину на ячейку и 6 треугольников
+ * на ячейку
+ */
+int surface_nets_create(const float *volume, vector3ui volume_size, vector3ui grid_size,
+						float isolevel, vector3f *out_vertices, unsigned *number_of_vertices,
+						triangle_t *out_triangles, unsigned *number_of_triangles);
+
+/* То же во внутренние буферы, параметры как у marching_cubes_create_mesh */
+int surface_nets_create_mesh(const float *volume, vector3ui volume_size, vector3ui grid_size, float isolevel,
+							 const vector3f **vertices, unsigned *n_vertices,
+							 const triangle_t **triangles, unsigned *n_triangles);
+
+/* То же с загрузкой в буферы OpenGL, параметры как у marching_cubes_create_vbos */
+int surface_nets_create_vbos(const float *volume, vector3ui volume_size,
+							 vector3ui grid_size, float isolevel,
+							 GLuint vertex_vbo, GLuint index_vbo, GLuint normal_vbo,
+							 float (*function)(vector3f pos), unsigned *num_elements);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SURFACE_NETS_H_INCLUDED */
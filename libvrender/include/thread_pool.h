@@ -0,0 +1,85 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREAD_POOL_H_INCLUDED
+#define THREAD_POOL_H_INCLUDED
+
+#include "common.h"
+#include "scheduler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Задача номер task работы; thread - номер потока в работе (0..scheduler.num_threads-1),
+ * один поток не выполняет две задачи одной работы одновременно
+ */
+typedef void (*thread_pool_func_t)(void *data, unsigned thread, unsigned task);
+
+/* Работа из num_tasks задач, распределяемых планировщиком между потоками пула */
+typedef struct thread_pool_job_s {
+	thread_pool_func_t func;
+	void *data;
+
+	scheduler_t scheduler;
+
+	// номер ожидающего потока в планировщике (он тоже выполняет задачи)
+	unsigned caller;
+	// кол-во потоков пула, выполняющих задачи работы
+	unsigned num_active;
+	// работа в очереди пула
+	int is_queued;
+
+	struct thread_pool_job_s *next;
+} thread_pool_job_t;
+
+/*
+ * Установить кол-во потоков пула вместе с вызывающим (1 - без дополнительных потоков).
+ * Потоки перезапускаются, когда в пуле не будет работ
+ */
+void thread_pool_set_num_threads(unsigned num);
+
+/*
+ * Отправить работу в пул: потоки начинают выполнять задачи сразу,
+ * вызывающий поток может заняться другим до thread_pool_wait.
+ * Возвращает 0 при ошибке
+ */
+int thread_pool_submit(thread_pool_job_t *job, thread_pool_func_t func, void *data, unsigned num_tasks);
+
+/*
+ * Выполнять оставшиеся задачи работы в вызывающем потоке и дождаться её завершения.
+ * Нельзя вызывать из задачи пула. После ожидания в job->scheduler остаётся
+ * статистика потоков (scheduler_report)
+ */
+void thread_pool_wait(thread_pool_job_t *job);
+
+/* Освободить завершённую работу */
+void thread_pool_release(thread_pool_job_t *job);
+
+/* Выполнить задачи 0..num_tasks-1 в пуле и дождаться их завершения */
+int thread_pool_run(thread_pool_func_t func, void *data, unsigned num_tasks);
+
+/* Остановить потоки пула */
+void thread_pool_destroy(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* THREAD_POOL_H_INCLUDED */
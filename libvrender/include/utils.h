@@ -34,6 +34,9 @@ long utils_file_get_size(const char *filename);
  * Возвращает -1, если произошла ошибка
  */
 int utils_read_file(const char *filename, char *buffer);
+
+/* Монотонное время в секундах (для замеров) */
+double utils_get_time(void);
 	
 #ifdef __cplusplus
 }
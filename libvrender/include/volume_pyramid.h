@@ -0,0 +1,80 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VOLUME_PYRAMID_H_INCLUDED
+#define VOLUME_PYRAMID_H_INCLUDED
+
+#include "common.h"
+#include "math/vector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// максимальное кол-во уровней вместе с исходным полем
+#define VOLUME_PYRAMID_MAX_LEVELS 8
+
+/*
+ * Пирамида скалярного поля: узел i уровня l+1 соответствует узлу 2i уровня l
+ * (узел i * 2^l исходного поля), поэтому сетка с шагом 2^l по исходному полю
+ * совпадает с сеткой с шагом 1 по уровню l. Значения уровня - среднее
+ * узлов 2i-1, 2i, 2i+1 предыдущего уровня с весами 1/4, 1/2, 1/4 по каждой оси
+ * (NaN не учитываются), min/max - границы исходных значений в той же окрестности
+ * (NaN считается +HUGE_VALF, как в marching cubes)
+ */
+typedef struct {
+	unsigned num_levels;
+	vector3ui sizes[VOLUME_PYRAMID_MAX_LEVELS];
+
+	// average[0] - исходное поле (не принадлежит пирамиде), min/max[0] не строятся
+	const float *average[VOLUME_PYRAMID_MAX_LEVELS];
+	float *min[VOLUME_PYRAMID_MAX_LEVELS], *max[VOLUME_PYRAMID_MAX_LEVELS];
+
+	// буферы уровней, сохраняемые между построениями
+	float *memory;
+	size_t memory_size;
+} volume_pyramid_t;
+
+void volume_pyramid_init(volume_pyramid_t *pyramid);
+
+/*
+ * Построить уровни для volume размера size в пуле потоков (уровни меньше 2 узлов
+ * по какой-либо оси не строятся). volume должен существовать, пока используется пирамида.
+ * Возвращает 0 при ошибке
+ */
+int volume_pyramid_build(volume_pyramid_t *pyramid, const float *volume, vector3ui size);
+
+/*
+ * Перестроить узлы уровней, зависящие от узлов [begin, end] исходного поля, после правки
+ * поля на месте (узел уровня l - от исходных на расстоянии до 2^l - 1). Возвращает 0 при ошибке
+ */
+int volume_pyramid_update_region(volume_pyramid_t *pyramid, vector3ui begin, vector3ui end);
+
+/*
+ * Самый грубый уровень, по которому сетка grid_size строится с теми же узлами, что
+ * и по исходному полю с шагом size / grid_size (0, если шаг не делится на степень двойки)
+ */
+unsigned volume_pyramid_level(const volume_pyramid_t *pyramid, vector3ui grid_size);
+
+void volume_pyramid_destroy(volume_pyramid_t *pyramid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VOLUME_PYRAMID_H_INCLUDED */
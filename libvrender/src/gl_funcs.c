@@ -50,6 +50,8 @@ PFNGLTEXIMAGE2DPROC glTexImage2D = 0;
 #endif
 
 PFNGLTEXIMAGE3DPROC glTexImage3D = 0;
+PFNGLTEXSUBIMAGE3DPROC glTexSubImage3D = 0;
+PFNGLMULTIDRAWELEMENTSPROC glMultiDrawElements = 0;
 
 PFNGLGENVERTEXARRAYSPROC glGenVertexArrays = 0;
 PFNGLBINDVERTEXARRAYPROC glBindVertexArray = 0;
@@ -58,6 +60,7 @@ PFNGLBINDBUFFERPROC glBindBuffer = 0;
 PFNGLBUFFERDATAPROC glBufferData = 0;
 PFNGLBUFFERSUBDATAPROC glBufferSubData = 0;
 PFNGLGETBUFFERSUBDATAPROC glGetBufferSubData = 0;
+PFNGLCOPYBUFFERSUBDATAPROC glCopyBufferSubData = 0;
 PFNGLVERTEXATTRIBPOINTERPROC glVertexAttribPointer = 0;
 PFNGLENABLEVERTEXATTRIBARRAYPROC glEnableVertexAttribArray = 0;
 PFNGLDISABLEVERTEXATTRIBARRAYPROC glDisableVertexAttribArray = 0;
@@ -138,6 +141,8 @@ void gl_funcs_init(void)
     #endif
 
 	GL_GET_PROC_ADR(PFNGLTEXIMAGE3DPROC, glTexImage3D);
+	GL_GET_PROC_ADR(PFNGLTEXSUBIMAGE3DPROC, glTexSubImage3D);
+	GL_GET_PROC_ADR(PFNGLMULTIDRAWELEMENTSPROC, glMultiDrawElements);
 	
 	GL_GET_PROC_ADR(PFNGLGENVERTEXARRAYSPROC, glGenVertexArrays);
 	GL_GET_PROC_ADR(PFNGLBINDVERTEXARRAYPROC, glBindVertexArray);
@@ -146,6 +151,7 @@ void gl_funcs_init(void)
 	GL_GET_PROC_ADR(PFNGLBUFFERDATAPROC, glBufferData);
     GL_GET_PROC_ADR(PFNGLBUFFERSUBDATAPROC, glBufferSubData);
 	GL_GET_PROC_ADR(PFNGLGETBUFFERSUBDATAPROC, glGetBufferSubData);
+	GL_GET_PROC_ADR(PFNGLCOPYBUFFERSUBDATAPROC, glCopyBufferSubData);
 	GL_GET_PROC_ADR(PFNGLVERTEXATTRIBPOINTERPROC, glVertexAttribPointer);
 	GL_GET_PROC_ADR(PFNGLENABLEVERTEXATTRIBARRAYPROC, glEnableVertexAttribArray);
     GL_GET_PROC_ADR(PFNGLDISABLEVERTEXATTRIBARRAYPROC, glDisableVertexAttribArray);
@@ -18,14 +18,18 @@ int log_init()
 
 void log_printf(const char *format, ...)
 {
-	va_list ap;
+	va_list ap, ap_copy;
 	va_start(ap, format);
 
+	// список аргументов используется дважды, поэтому нужна копия
+	va_copy(ap_copy, ap);
+
 	vfprintf(log_file, format, ap);
 	fflush(log_file);
 
-	vprintf(format, ap);
+	vprintf(format, ap_copy);
 
+	va_end(ap_copy);
 	va_end(ap);
 }
 
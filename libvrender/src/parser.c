@@ -21,9 +21,25 @@
 
 #include "math/dmath.h"
 #include "math/noise.h"
+#include "utils.h"
 #include <ctype.h>
 #include <string.h>
-#include <locale.h>
+
+// JIT-компиляция в машинный код (см. jit_compile)
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+#define PARSER_JIT
+#include <sys/mman.h>
+#endif
+
+// компиляция сгенерированного кода на C системным компилятором (см. parser_program_compile_native)
+#if defined(__GNUC__) && defined(__unix__)
+#define PARSER_NATIVE
+#include <dlfcn.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 /////////////// -------
 
@@ -463,82 +479,162 @@ static identifier_t builtin_identifiers[] =
 		{0, "", 0}
 	};
 
-// последний глобальный индекс переменных
-static int last_var_global_id = 7;
 //static int last_func_global_id = 139;
 
-static void eval_expr(parser_t *p,float *value);
-static void eval_expr0(parser_t *p,float *value);
-static void eval_expr1(parser_t *p,float *value);
-static void eval_expr2(parser_t *p,float *value);
-static void eval_expr3(parser_t *p,float *value);
-static void eval_expr4(parser_t *p,float *value);
-static void eval_expr5(parser_t *p,float *value);
-static void eval_expr6(parser_t *p,float *value);
-static void eval_expr7(parser_t *p,float *value);
-static void eval_expr8(parser_t *p,float *value);
-static void eval_expr9(parser_t *p,float *value);
-static void eval_expr10(parser_t *p,float *value);
-static void eval_expr11(parser_t *p,float *value);
-static void atom(parser_t *p,float *value);
+// глобальный номер переменной цикла "i"
+#define LOOP_VAR_GLOBAL_ID 6
+
+static int compile_expr(parser_t *p, parser_program_t *prog);
+static int compile_expr0(parser_t *p, parser_program_t *prog);
+static int compile_expr1(parser_t *p, parser_program_t *prog);
+static int compile_expr2(parser_t *p, parser_program_t *prog);
+static int compile_expr3(parser_t *p, parser_program_t *prog);
+static int compile_expr4(parser_t *p, parser_program_t *prog);
+static int compile_expr5(parser_t *p, parser_program_t *prog);
+static int compile_expr6(parser_t *p, parser_program_t *prog);
+static int compile_expr7(parser_t *p, parser_program_t *prog);
+static int compile_expr8(parser_t *p, parser_program_t *prog);
+static int compile_expr9(parser_t *p, parser_program_t *prog);
+static int compile_expr10(parser_t *p, parser_program_t *prog);
+static int compile_expr11(parser_t *p, parser_program_t *prog);
+static int compile_atom(parser_t *p, parser_program_t *prog);
 
 static int is_stopping = 0;
 
-INLINE static int find_identifier(parser_t *p,const char *name, int type);
+// выполнять программы машинным кодом, если он есть (parser_set_jit)
+static int use_jit = 1;
+
+typedef int (*jit_func_t)(float *registers);
+
+// функции библиотеки, созданной parser_program_compile_native
+typedef int (*native_eval_t)(void *const *funcs, const int *stop, float *registers);
+typedef int (*native_eval_row_t)(void *const *funcs, const int *stop, float x0, float y, float z,
+								 unsigned count, float *result);
+
 char* get_var_name(parser_t *p,int global_id);
 INLINE static void set_error(parser_t *p,const char *error_text, int error_num);
-static int create_user_var(parser_t *p,const char *name);
-static float call_func(parser_t *p,int func_id);
-static void assign_variable(parser_t *p,int var_id, float value);
-static float get_var_value(parser_t *p,int global_id);
+static int create_user_var(parser_t *p);
 
 static int lexer_parser(parser_t *p, const char *text);
-static void syntax_parser(parser_t *p);
+static int resolve_identifiers(parser_t *p);
+static void syntax_parser(parser_t *p, parser_program_t *prog);
+
+#define find_var(p) (find_identifier(p, VARIABLE))
+#define find_func(p) (find_identifier(p, FUNCTION))
 
-#define find_var(p, name) (find_identifier(p, name, VARIABLE))
-#define find_func(p, name) (find_identifier(p, name, FUNCTION))
+// тип текущего и следующего токена (0, если токены закончились)
+#define TOKEN(p) ((p)->index < (p)->num_tokens ? (p)->tokens[(p)->index].type : 0)
+#define NEXT_TOKEN(p) ((p)->index + 1 < (p)->num_tokens ? (p)->tokens[(p)->index + 1].type : 0)
 
 //#define DMSG(text, ...) TRACE_MSG(text, ##__VA_ARGS__)
 #define DMSG(text, ...)
 
-// найти идентификатор в таблицах
-INLINE static int find_identifier(parser_t *p, const char *name, int type)
+// регистр встроенной переменной по её глобальному номеру
+static int builtin_var_register(int global_id)
 {
-	IF_FAILED_RET(name, -1);
-	
-	int i = 0;	
-	while(builtin_identifiers[i].type != 0) {
-		if(!strcmp(builtin_identifiers[i].name, name)) {
-			if(builtin_identifiers[i].type == type)
-				return builtin_identifiers[i].global_id;
-		}
-		i++;
+	switch(global_id) {
+		case 1:
+			return PARSER_REG_D;
+		case 2:
+			return PARSER_REG_X;
+		case 3:
+			return PARSER_REG_Y;
+		case 4:
+			return PARSER_REG_Z;
+		case LOOP_VAR_GLOBAL_ID:
+			return PARSER_REG_I;
 	}
 
-	for(i = 0; i < p->num_user_ids; i++) {
-		if(!strcmp(p->user_identifiers[i].name, name)) {
-			if(p->user_identifiers[i].type == type)
-				return p->user_identifiers[i].global_id;
+	return -1;
+}
+
+// разрешение идентификаторов: один раз на текст функции сопоставляем каждому
+// идентификатору номер встроенного идентификатора (id >= 0) или номер 
+// пользовательского (id < 0), чтобы при компиляции не сравнивать строки
+static int resolve_identifiers(parser_t *p)
+{
+	p->num_user_ids = 0;
+
+	for(unsigned t = 0; t < p->num_tokens; t++) {
+		token_t *token = &p->tokens[t];
+
+		if(token->type != IDENTIFIER)
+			continue;
+
+		int i = 0, found = 0;
+		while(builtin_identifiers[i].type != 0) {
+			if(!strcmp(builtin_identifiers[i].name, token->data)) {
+				token->id = i;
+				found = 1;
+				break;
+			}
+			i++;
+		}
+
+		for(i = 0; !found && i < p->num_user_ids; i++) {
+			if(!strcmp(p->user_identifiers[i].name, token->data)) {
+				token->id = -(i + 1);
+				found = 1;
+			}
+		}
+
+		if(found)
+			continue;
+
+		// проверить на превышение кол-ва пользовательских переменных
+		if(p->num_user_ids >= MAX_NUM_USER_VARS-1) {
+			p->index = t;
+			set_error(p, "max count user vars encountered", 12);
+			return p->error;
 		}
+
+		// новый пользовательский идентификатор (переменная создается при первом присваивании)
+		i = p->num_user_ids++;
+		p->user_identifiers[i].type = 0;
+		p->user_identifiers[i].name = token->data;
+		p->user_identifiers[i].global_id = PARSER_NUM_BUILTIN_REGS + i;
+
+		token->id = -(i + 1);
 	}
-	
+
+	return 0;
+}
+
+// найти идентификатор текущего токена (для переменных возвращается номер регистра)
+INLINE static int find_identifier(parser_t *p, int type)
+{
+	const token_t *token = &p->tokens[p->index];
+
+	if(token->id >= 0) {
+		if(builtin_identifiers[token->id].type != type)
+			return -1;
+
+		if(type == VARIABLE)
+			return builtin_var_register(builtin_identifiers[token->id].global_id);
+
+		return builtin_identifiers[token->id].global_id;
+	}
+
+	if(p->user_identifiers[-token->id - 1].type == type)
+		return p->user_identifiers[-token->id - 1].global_id;
+
 	return -1;
 }
 
-// получить имя переменной по глобальному номеру
-char* get_var_name(parser_t *p, int global_id)
+// получить имя переменной по номеру регистра
+char* get_var_name(parser_t *p, int reg)
 {
 	int i = 0;
-	
+
 	while(builtin_identifiers[i].global_id != 0) {
-		if(builtin_identifiers[i].global_id == global_id && builtin_identifiers[i].type == VARIABLE) {
+		if(builtin_identifiers[i].type == VARIABLE && builtin_var_register(builtin_identifiers[i].global_id) == reg) {
 			return builtin_identifiers[i].name;
 		}
 		i++;
 	}
 
 	for(i = 0; i < p->num_user_ids; i++) {
-		if(p->user_identifiers[i].global_id == global_id && p->user_identifiers[i].type == VARIABLE) {
+		if(p->user_identifiers[i].global_id == reg && p->user_identifiers[i].type == VARIABLE) {
 			return p->user_identifiers[i].name;
 		}
 	}
@@ -550,1033 +646,3718 @@ char* get_var_name(parser_t *p, int global_id)
 INLINE static void set_error(parser_t *p, const char *error_text, int error_num)
 {
 	DMSG("syntax error %i: \"%s\" in token \"%s\"\n", error_num, error_text, p->tokens[p->index].data);
-	
+
 	if(p->error == 0)
 		p->error = error_num;
 }
 
-// создать пользовательскую переменную
-static int create_user_var(parser_t *p, const char *name)
+// создать пользовательскую переменную из текущего токена
+static int create_user_var(parser_t *p)
 {
-	DMSG("create user var %s\n", name);
-	
-	// проверить на превышение кол-ва пользовательских переменных
-	if(p->num_user_ids >= MAX_NUM_USER_VARS-1) {
-		set_error(p, "max count user vars encountered", 12);
-		return -1;
-	}
+	identifier_t *var = &p->user_identifiers[-p->tokens[p->index].id - 1];
 
-	int id = p->num_user_ids++;
-	DMSG("--- user_identifiers index = %i\n", id);
-	
-	int len = strlen(name);
-	
-	p->user_identifiers[id].name = (char*) malloc(sizeof(char)*(len+1));
-	memcpy(p->user_identifiers[id].name, name, len+1);
-	
-	p->user_identifiers[id].global_id = p->last_var_global_id++;
-	p->user_identifiers[id].type = VARIABLE;
+	DMSG("create user var %s, register = %i\n", var->name, var->global_id);
 
-	DMSG("--- var name %s, global_id = %i\n", p->user_identifiers[id].name, p->user_identifiers[id].global_id);
+	var->type = VARIABLE;
 
-	int var_i = p->num_user_vars++;
-	DMSG("--- float_user_vars index = %i\n", var_i);
-	
-	p->float_user_vars[var_i].global_id = p->user_identifiers[id].global_id;
-	p->float_user_vars[var_i].value = 0.0f;
-	
-	return p->user_identifiers[id].global_id;
+	return var->global_id;
 }
 
-// присвоить значение переменной
-static void assign_variable(parser_t *p, int global_id, float value)
+// получить количество аргументов функции
+static int get_func_n_args(int func_id)
 {
 	int i = 0;
-	
-	DMSG("assign %s(%i) = %f\n", get_var_name(p, global_id), global_id, value);
-
-	for(i = 0; i < p->num_user_ids; i++) {
-		if(p->float_user_vars[i].global_id == global_id) {
-			p->float_user_vars[i].value = value;
-			return;
-		}
-	}
-	
-	i = 0;
-	while(p->float_extra_vars[i].global_id != 0) {
-		if(p->float_extra_vars[i].global_id == global_id) {
-			p->float_extra_vars[i].value = value;
-			return;
-		}
-		i++;
-	}
-	
-	i = 0;
-	while(p->float_builtin_vars[i].global_id != 0) {
-		if(p->float_builtin_vars[i].global_id == global_id) {
-			p->float_builtin_vars[i].value = value;
-			return;
-		}
+	while(builtin_functions_params[i].global_id != 0) {
+		if(builtin_functions_params[i].global_id == func_id)
+			return builtin_functions_params[i].n_args;
 		i++;
 	}
-	
-	set_error(p, "unknown variable", 6);
+
+	return 0;
 }
 
-// вызвать функцию и вернуть результат её вызова
-static float call_func(parser_t *p, int func_id)
+// найти указатель на функцию с n_args аргументами
+static void* get_func_ptr(int func_id, int n_args)
 {
-	float args[MAX_NUM_FUNC_ARGS];
-	int n_args = 0;
-	
-	func1_t func1_ptr = NULL;
-	func2_t func2_ptr = NULL;
-	func3_t func3_ptr = NULL;
-	func4_t func4_ptr = NULL;
-	func5_t func5_ptr = NULL;
-	func6_t func6_ptr = NULL;
-
-	if(p->tokens[p->index].type == IDENTIFIER) {
-		p->index++;
-	} else {
-		set_error(p, "expected function name", 11);
-		return 0.0f;
-	}
-	
-	if(p->tokens[p->index].type == PARENTH_LEFT) {
-
-		p->index++;
+	int i = 0;
 
-		int i = 0, flag_found = 0;
-		while(builtin_functions_params[i].global_id != 0) {
-			if(builtin_functions_params[i].global_id == func_id) {
-				n_args = builtin_functions_params[i].n_args;
-				break;
-			}
-			i++;
-		}
-		
-		if(n_args == 0) {
-			set_error(p, "wrong function", 10);
-			return 0.0f;
-		}
-		
 #define func_ptrs(n) \
 	case n: {\
 		while(builtin_functions##n[i].global_id != 0) {\
-			if(builtin_functions##n[i].global_id == func_id) {\
-				func##n##_ptr = builtin_functions##n[i].func;\
-				flag_found = 1;\
-				break;\
-			}\
+			if(builtin_functions##n[i].global_id == func_id)\
+				return (void*) builtin_functions##n[i].func;\
 			i++;\
 		}\
 		break; }
-		
-		i = 0;
-		switch(n_args) {
-			func_ptrs(1);
-			func_ptrs(2);
-			func_ptrs(3);
-			func_ptrs(4);
-			func_ptrs(5);
-			func_ptrs(6);
-		};
+
+	switch(n_args) {
+		func_ptrs(1);
+		func_ptrs(2);
+		func_ptrs(3);
+		func_ptrs(4);
+		func_ptrs(5);
+		func_ptrs(6);
+	};
 #undef func_ptrs
-		
-		if(!flag_found) {
-			set_error(p, "wrong number of arguments", 8);
-			return 0.0f;
-		}
-		
-		DMSG("call func id = %i, n_args = %i\n", func_id, n_args);
 
-		if(!func1_ptr && !func2_ptr && !func3_ptr 
-		   && !func4_ptr && !func5_ptr && !func6_ptr) {
-			
-			set_error(p, "null pointer to function", 7);
-			return 0.0f;
-		}
+	return NULL;
+}
 
-		int flag_found_pr = 0, r = 0;
-		for(r = 0; r < n_args; r++) {
-			eval_expr1(p, &args[r]);
-			DMSG("args[%i] = %f\n", r, args[r]);
-			if(p->tokens[p->index].type == COMMA) {
-				p->index++;
-				//continue;
-			} else if(p->tokens[p->index].type == PARENTH_RIGHT) {
-				flag_found_pr = 1;
-				p->index++;
-				break;
-			}
-		}
+/////////////// ----- компиляция
 
-		if(!flag_found_pr) {
-			set_error(p, "expected )", 5);
-			return 0.0f;
-		}
-		
-		if(r+1 != n_args) {
-			set_error(p, "wrong number of arguments", 8);
-			return 0.0f;
-		}
+// добавить инструкцию в программу
+static int emit(parser_t *p, parser_program_t *prog, int opcode)
+{
+	if(prog->num_instructions >= MAX_NUM_INSTRUCTIONS) {
+		set_error(p, "program is too large", 17);
+		return -1;
+	}
+
+	int index = prog->num_instructions++;
+
+	memset(&prog->instructions[index], 0, sizeof(instruction_t));
+	prog->instructions[index].opcode = opcode;
+
+	return index;
+}
+
+// выделить новый регистр
+static int new_register(parser_t *p, parser_program_t *prog)
+{
+	if(prog->num_registers >= MAX_NUM_REGISTERS) {
+		set_error(p, "program is too large", 17);
+		return -1;
+	}
+
+	return prog->num_registers++;
+}
+
+// добавить инструкцию с результатом в новом регистре (n_args операндов a и b)
+static int emit_op(parser_t *p, parser_program_t *prog, int opcode, int n_args, int a, int b)
+{
+	int dst = new_register(p, prog);
+	int index = emit(p, prog, opcode);
+
+	if(dst < 0 || index < 0)
+		return -1;
+
+	instruction_t *ins = &prog->instructions[index];
+	ins->dst = dst;
+	ins->n_args = n_args;
+	ins->args[0] = a;
+	ins->args[1] = b;
+
+	return dst;
+}
+
+// загрузить константу в новый регистр
+static int emit_const(parser_t *p, parser_program_t *prog, float value)
+{
+	int dst = emit_op(p, prog, OP_CONST, 0, 0, 0);
+
+	if(dst >= 0)
+		prog->instructions[prog->num_instructions - 1].value = value;
+
+	return dst;
+}
+
+// скопировать значение переменной (регистр var) в новый регистр
+static int emit_load(parser_t *p, parser_program_t *prog, int var)
+{
+	return emit_op(p, prog, OP_MOV, 1, var, 0);
+}
+
+// сохранить значение регистра src в переменную (регистр var)
+static int emit_store(parser_t *p, parser_program_t *prog, int var, int src)
+{
+	int index = emit(p, prog, OP_MOV);
+
+	if(index < 0)
+		return -1;
+
+	prog->instructions[index].dst = var;
+	prog->instructions[index].n_args = 1;
+	prog->instructions[index].args[0] = src;
+
+	return src;
+}
+
+// вызов функции
+static int compile_call(parser_t *p, parser_program_t *prog, int func_id)
+{
+	int args[MAX_NUM_FUNC_ARGS];
+	int n_args = 0;
 
+	if(TOKEN(p) == IDENTIFIER) {
+		p->index++;
 	} else {
+		set_error(p, "expected function name", 11);
+		return -1;
+	}
+
+	if(TOKEN(p) != PARENTH_LEFT) {
 		set_error(p, "expected (", 9);
-		return 0.0f;
+		return -1;
 	}
-	
-	if(p->skip_expr)
-		return 0.0f;
-	
-	float result = 0.0f;
 
-	switch(n_args) {
-		case 1:
-			result = (*func1_ptr)(args[0]);
-			break;
-		case 2:
-			result = (*func2_ptr)(args[0], args[1]);
-			break;
-		case 3:
-			result = (*func3_ptr)(args[0], args[1], args[2]);
-			break;
-		case 4:
-			result = (*func4_ptr)(args[0], args[1], args[2], args[3]);
-			break;
-		case 5:
-			result = (*func5_ptr)(args[0], args[1], args[2], args[3], args[4]);
-			break;
-		case 6:
-			result = (*func6_ptr)(args[0], args[1], args[2], args[3], args[4], args[5]);
-			break;
-		default:
-			set_error(p, "wrong number of arguments", 8);
+	p->index++;
+
+	if((n_args = get_func_n_args(func_id)) == 0) {
+		set_error(p, "wrong function", 10);
+		return -1;
 	}
 
-	return result;
-}
+	void *func = get_func_ptr(func_id, n_args);
 
-// получить значение переменной
-static float get_var_value(parser_t *p, int global_id)
-{
-	int i = 0;
-	
-	while(p->float_builtin_vars[i].global_id != 0) {
-		if(p->float_builtin_vars[i].global_id == global_id) {
-			return p->float_builtin_vars[i].value;
-		}
-		i++;
+	if(!func) {
+		set_error(p, "wrong number of arguments", 8);
+		return -1;
 	}
-	
-	i = 0;
-	while(p->float_extra_vars[i].global_id != 0) {
-		if(p->float_extra_vars[i].global_id == global_id) {
-			return p->float_extra_vars[i].value;
+
+	DMSG("call func id = %i, n_args = %i\n", func_id, n_args);
+
+	int flag_found_pr = 0, r = 0;
+	for(r = 0; r < n_args; r++) {
+		if((args[r] = compile_expr1(p, prog)) < 0)
+			return -1;
+
+		if(TOKEN(p) == COMMA) {
+			p->index++;
+		} else if(TOKEN(p) == PARENTH_RIGHT) {
+			flag_found_pr = 1;
+			p->index++;
+			break;
 		}
-		i++;
 	}
 
-	for(i = 0; i < p->num_user_ids; i++) {
-		if(p->float_user_vars[i].global_id == global_id) {
-			return p->float_user_vars[i].value;
-		}
+	if(!flag_found_pr) {
+		set_error(p, "expected )", 5);
+		return -1;
 	}
-	
-	set_error(p, "unknown variable", 6);
-	
-	return 0.0f;
+
+	if(r+1 != n_args) {
+		set_error(p, "wrong number of arguments", 8);
+		return -1;
+	}
+
+	int dst = emit_op(p, prog, OP_CALL, n_args, 0, 0);
+
+	if(dst < 0)
+		return -1;
+
+	instruction_t *ins = &prog->instructions[prog->num_instructions - 1];
+	for(r = 0; r < n_args; r++)
+		ins->args[r] = args[r];
+	ins->target = func_id;
+	ins->func = func;
+
+	return dst;
 }
 
-// вычисление переменных, констант и функций
-static void atom(parser_t *p, float *value)
+// переменные, константы и функции
+static int compile_atom(parser_t *p, parser_program_t *prog)
 {
+	int id = 0;
 
-	if(is_stopping)
-		return;
-
-	int id = 0, last = 0;
-	
 	DMSG("atom: %s\n", p->tokens[p->index].data);
-	
-	switch(p->tokens[p->index].type) {
+
+	switch(TOKEN(p)) {
 		case IDENTIFIER:
-			
-			if((id = find_func(p, p->tokens[p->index].data)) != -1) {
-				last = p->index;
-				*value = call_func(p, id);
-				
-				if(!p->skip_expr)
-					DMSG("call func: %s = %f\n", p->tokens[last].data, *value);
-				
-			} else if((id = find_var(p, p->tokens[p->index].data)) != -1) {
-				
-				if(p->skip_expr) {
-					p->index++;
-					return;
-				}
-				
-				last = p->index;
-				*value = get_var_value(p, id);
-				DMSG("get var: %s = %f\n", p->tokens[last].data, *value);
+
+			if((id = find_func(p)) != -1) {
+				return compile_call(p, prog, id);
+			} else if((id = find_var(p)) != -1) {
 				p->index++;
-			} else {
-				if(p->tokens[p->index+1].type == PARENTH_LEFT)
-					set_error(p, "unknown function", 14);
-				else
-					set_error(p, "unknown variable", 6);
-				//index++;
+				return emit_load(p, prog, id);
 			}
-			
-			break;
+
+			if(NEXT_TOKEN(p) == PARENTH_LEFT)
+				set_error(p, "unknown function", 14);
+			else
+				set_error(p, "unknown variable", 6);
+
+			return -1;
 		case FLOAT_NUMBER:
-			
-			if(p->skip_expr) {
-				p->index++;
-				return;
-			}
-			
-			*value = (float) atof((const char*) p->tokens[p->index].data);
-			DMSG("found float num: %f\n", *value);
 			p->index++;
-			break;
+			return emit_const(p, prog, p->tokens[p->index-1].value);
 		case INT_NUMBER:
-			
-			if(p->skip_expr) {
-				p->index++;
-				return;
-			}
-			
-			*value = (float) atoi((const char*) p->tokens[p->index].data);
-			DMSG("found int num: %f\n", *value);
 			p->index++;
-			break;
+			return emit_const(p, prog, p->tokens[p->index-1].value);
 		case UNKNOWN:
 			set_error(p, "encounter unknown token", 16);
-			return;
+			return -1;
 		case PARENTH_RIGHT:
-			return;
+			// пустое выражение "()"
+			return emit_const(p, prog, 0.0f);
 		default:
 			set_error(p, "unknown error", -1);
 	};
+
+	return -1;
 }
 
-// вычисление скобок
-static void eval_expr11(parser_t *p, float *value)
+// скобки
+static int compile_expr11(parser_t *p, parser_program_t *prog)
 {
+	if(TOKEN(p) == PARENTH_LEFT) {
+		p->index++;
 
-	if(is_stopping)
-		return;
+		// компилируем выражение после открывающей скобки
+		int result = compile_expr(p, prog);
 
-	if(p->tokens[p->index].type == PARENTH_LEFT) {
-		p->index++;
-		
-		// вычисляем выражение после открывающей скобки
-		eval_expr(p, value);
-		
-		// псоле вычисления должна идти закрывающая скобка...
-		if(p->tokens[p->index].type != PARENTH_RIGHT) {
-			//error = -8;
+		if(result < 0)
+			return -1;
+
+		// после выражения должна идти закрывающая скобка...
+		if(TOKEN(p) != PARENTH_RIGHT) {
 			set_error(p, "expected )", 5);
+			return -1;
 		}
 		p->index++;
-	} else {
-		
-		// вычисляем идентификатор или число
-		atom(p, value);
+
+		return result;
 	}
+
+	// идентификатор или число
+	return compile_atom(p, prog);
 }
 
-// вычисление унарного ! (факториал)
-static void eval_expr10(parser_t *p, float *value)
-{	
+// унарный ! (факториал)
+static int compile_expr10(parser_t *p, parser_program_t *prog)
+{
+	int result = compile_expr11(p, prog);
 
-	if(is_stopping)
-		return;
+	if(result >= 0 && TOKEN(p) == NOT) {
+		p->index++;
+		result = emit_op(p, prog, OP_FACT, 1, result, 0);
+	}
 
-	eval_expr11(p, value);
-	
-	if(p->skip_expr)
-		return;
-	
-	if(p->tokens[p->index].type == NOT) {
-		DMSG("found unary: %s (i = %i)\n", p->tokens[p->index].data, p->index);
-		
-		if(*value == 0.0f) {
-			*value = 1.0f;
-			p->index++;
+	return result;
+}
+
+// унарный + и -
+static int compile_expr9(parser_t *p, parser_program_t *prog)
+{
+	int last = 0;
+
+	if(TOKEN(p) == PLUS || TOKEN(p) == MINUS) {
+		// если токен + или -, то смещаемся к след. токену..
+		last = TOKEN(p);
+		p->index++;
+	}
+
+	// ...и компилируем выражение (после + или -)
+	int result = compile_expr10(p, prog);
+
+	// если был обнаружен унарный -, то меняем знак
+	if(result >= 0 && last == MINUS)
+		result = emit_op(p, prog, OP_NEG, 1, result, 0);
+
+	return result;
+}
+
+// возведение в степень
+static int compile_expr8(parser_t *p, parser_program_t *prog)
+{
+	int result = compile_expr9(p, prog);
+
+	if(result >= 0 && TOKEN(p) == MULT_MULT) {
+		p->index++;
+
+		// степень
+		int part = compile_expr8(p, prog);
+
+		if(part < 0)
+			return -1;
+
+		result = emit_op(p, prog, OP_POW, 2, result, part);
+	}
+
+	return result;
+}
+
+// * и /
+static int compile_expr7(parser_t *p, parser_program_t *prog)
+{
+	int result = compile_expr8(p, prog);
+
+	while(result >= 0 && (TOKEN(p) == MULT || TOKEN(p) == DIV)) {
+		int last = TOKEN(p);
+		p->index++;
+
+		// компилируем выражение после арифм. операции
+		int part = compile_expr8(p, prog);
+
+		if(part < 0)
+			return -1;
+
+		result = emit_op(p, prog, (last == MULT) ? OP_MUL : OP_DIV, 2, result, part);
+	}
+
+	return result;
+}
+
+// + и -
+static int compile_expr6(parser_t *p, parser_program_t *prog)
+{
+	int result = compile_expr7(p, prog);
+
+	while(result >= 0 && (TOKEN(p) == PLUS || TOKEN(p) == MINUS)) {
+		int last = TOKEN(p);
+		p->index++;
+
+		// компилируем выражение после арифм. операции
+		int part = compile_expr7(p, prog);
+
+		if(part < 0)
+			return -1;
+
+		result = emit_op(p, prog, (last == PLUS) ? OP_ADD : OP_SUB, 2, result, part);
+	}
+
+	return result;
+}
+
+// операции сравнения > < >= <=
+static int compile_expr5(parser_t *p, parser_program_t *prog)
+{
+	int result = compile_expr6(p, prog);
+
+	if(result < 0)
+		return -1;
+
+	int opcode = 0;
+	switch(TOKEN(p)) {
+		case GREATER:
+			opcode = OP_GT;
+			break;
+		case LESS:
+			opcode = OP_LT;
+			break;
+		case GRT_EQL:
+			opcode = OP_GE;
+			break;
+		case LESS_EQL:
+			opcode = OP_LE;
+			break;
+		default:
+			return result;
+	};
+
+	p->index++;
+
+	int part = compile_expr6(p, prog);
+
+	if(part < 0)
+		return -1;
+
+	return emit_op(p, prog, opcode, 2, result, part);
+}
+
+// операции сравнения != ==
+static int compile_expr4(parser_t *p, parser_program_t *prog)
+{
+	int result = compile_expr5(p, prog);
+
+	if(result >= 0 && (TOKEN(p) == EQL_EQL || TOKEN(p) == NOT_EQL)) {
+		int last = TOKEN(p);
+		p->index++;
+
+		int part = compile_expr5(p, prog);
+
+		if(part < 0)
+			return -1;
+
+		result = emit_op(p, prog, (last == EQL_EQL) ? OP_EQ : OP_NE, 2, result, part);
+	}
+
+	return result;
+}
+
+// цикл k..n: expr
+static int compile_expr3(parser_t *p, parser_program_t *prog)
+{
+	int begin = compile_expr4(p, prog);
+
+	if(begin < 0 || TOKEN(p) != DOT_DOT)
+		return begin;
+
+	DMSG("found loop: %s (i = %i)\n", p->tokens[p->index].data, p->index);
+
+	p->index++;
+
+	int end = compile_expr2(p, prog);
+
+	if(end < 0)
+		return -1;
+
+	if(TOKEN(p) != COLON) {
+		set_error(p, "expected :", 4);
+		return -1;
+	}
+
+	p->index++;
+
+	if(prog->num_loops >= MAX_NUM_LOOPS) {
+		set_error(p, "program is too large", 17);
+		return -1;
+	}
+
+	int loop = prog->num_loops++;
+
+	// начало цикла: обнуляем сумму и присваиваем i номер первой итерации
+	int sum = emit_op(p, prog, OP_LOOP_BEGIN, 2, begin, end);
+
+	if(sum < 0)
+		return -1;
+
+	prog->instructions[prog->num_instructions - 1].args[2] = loop;
+
+	int body_begin = prog->num_instructions;
+
+	// тело цикла
+	int part = compile_expr0(p, prog);
+
+	if(part < 0)
+		return -1;
+
+	// конец цикла: суммируем и переходим к след. итерации
+	int index = emit(p, prog, OP_LOOP_NEXT);
+
+	if(index < 0)
+		return -1;
+
+	instruction_t *ins = &prog->instructions[index];
+	ins->dst = sum;
+	ins->n_args = 1;
+	ins->args[0] = part;
+	ins->args[2] = loop;
+	ins->target = body_begin;
+
+	return sum;
+}
+
+// тернарный оператор ? :
+static int compile_expr2(parser_t *p, parser_program_t *prog)
+{
+	int cond = compile_expr3(p, prog);
+
+	if(cond < 0 || TOKEN(p) != QUEST_MARK)
+		return cond;
+
+	DMSG("found ternary: %s (i = %i)\n", p->tokens[p->index].data, p->index);
+
+	p->index++;
+
+	int result = new_register(p, prog);
+
+	// если условие ложно, то переходим к выражению после :
+	int jump_false = emit(p, prog, OP_JZ);
+
+	if(result < 0 || jump_false < 0)
+		return -1;
+
+	prog->instructions[jump_false].n_args = 1;
+	prog->instructions[jump_false].args[0] = cond;
+
+	int value = compile_expr(p, prog);
+
+	if(value < 0 || emit(p, prog, OP_MOV) < 0)
+		return -1;
+
+	prog->instructions[prog->num_instructions - 1].dst = result;
+	prog->instructions[prog->num_instructions - 1].n_args = 1;
+	prog->instructions[prog->num_instructions - 1].args[0] = value;
+
+	int jump_end = emit(p, prog, OP_JMP);
+
+	if(jump_end < 0)
+		return -1;
+
+	if(TOKEN(p) != COLON) {
+		set_error(p, "expected :", 4);
+		return -1;
+	}
+
+	p->index++;
+
+	prog->instructions[jump_false].target = prog->num_instructions;
+
+	value = compile_expr(p, prog);
+
+	if(value < 0 || emit(p, prog, OP_MOV) < 0)
+		return -1;
+
+	prog->instructions[prog->num_instructions - 1].dst = result;
+	prog->instructions[prog->num_instructions - 1].n_args = 1;
+	prog->instructions[prog->num_instructions - 1].args[0] = value;
+
+	prog->instructions[jump_end].target = prog->num_instructions;
+
+	return result;
+}
+
+// присваивание
+static int compile_expr1(parser_t *p, parser_program_t *prog)
+{
+	if(TOKEN(p) != IDENTIFIER)
+		return compile_expr2(p, prog);
+
+	DMSG("found identifier: %s\n", p->tokens[p->index].data);
+
+	int var = 0;
+
+	// это переменная?
+	if((var = find_var(p)) == -1) {
+		if(NEXT_TOKEN(p) == PARENTH_LEFT) {
+			// скорее всего это функция (т.к. есть открывающая скобка)
+			return compile_expr2(p, prog);
+		}
+
+		if(NEXT_TOKEN(p) == EQUAL) {
+			// если это неизвестная переменная и стоит знак присваивания, то создаем её
+			var = create_user_var(p);
+		} else {
+			set_error(p, "unknown variable", 6);
+		}
+	}
+
+	if(var < 0)
+		return -1;
+
+	int opcode = 0;
+	switch(NEXT_TOKEN(p)) {
+		case EQUAL:
+			break;
+		case PLUS_EQL:
+			opcode = OP_ADD;
+			break;
+		case MINUS_EQL:
+			opcode = OP_SUB;
+			break;
+		case MULT_EQL:
+			opcode = OP_MUL;
+			break;
+		case DIV_EQL:
+			opcode = OP_FDIV;
+			break;
+		default:
+			// это не присваивание
+			return compile_expr2(p, prog);
+	}
+
+	DMSG("found assigment: %s\n", p->tokens[p->index+1].data);
+
+	p->index += 2;
+
+	// значение после =
+	int value = compile_expr(p, prog);
+
+	if(value < 0)
+		return -1;
+
+	// для случаев += -= *= /= вычисляем новое значение переменной
+	if(opcode != 0) {
+		value = emit_op(p, prog, opcode, 2, var, value);
+
+		if(value < 0)
+			return -1;
+	}
+
+	// присваиваем значение
+	return emit_store(p, prog, var, value);
+}
+
+// ,
+static int compile_expr0(parser_t *p, parser_program_t *prog)
+{
+	int result = compile_expr1(p, prog);
+
+	if(result >= 0 && TOKEN(p) == COMMA) {
+		p->index++;
+
+		// значением будет выражение после запятой
+		result = compile_expr(p, prog);
+	}
+
+	return result;
+}
+
+// проверка на последний индекс и точку-с-запятой
+static int compile_expr(parser_t *p, parser_program_t *prog)
+{
+	// есть ли ещё токены...
+	if(p->index >= p->num_tokens) {
+		p->error = -1;
+		return -1;
+	}
+
+	// если текущий токен ; то значение выражения 0
+	if(TOKEN(p) == SEMICOLON)
+		return emit_const(p, prog, 0.0f);
+
+	return compile_expr0(p, prog);
+}
+
+// синтаксический анализ
+static void syntax_parser(parser_t *p, parser_program_t *prog)
+{
+	do {
+
+		if(is_stopping)
+			return;
+
+		// выражение должно начинаться с идентификатора
+		if(TOKEN(p) != IDENTIFIER) {
+			set_error(p, "encounter unknown token", 16);
+			return;
+		}
+
+		if(compile_expr(p, prog) < 0)
+			return;
+
+		if(TOKEN(p) != SEMICOLON) {
+			set_error(p, "expected ;", 1);
+			return;
+		}
+
+		p->index++;
+	} while(p->index + 1 < p->num_tokens);
+}
+
+static void destroy_tokens(parser_t *p)
+{
+	// очищаем данные токенов (текст токенов хранится в арене)
+	for(int i = 0; i < p->num_tokens; i++) {
+		p->tokens[i].data = NULL;
+		p->tokens[i].type = 0;
+	}
+
+	if(p->token_arena)
+		free(p->token_arena);
+
+	p->token_arena = NULL;
+	p->token_arena_used = 0;
+
+	// удаляем все пользовательские идентификаторы (имена хранятся в токенах)
+	for(int i = 0; i < p->num_user_ids; i++) {
+		p->user_identifiers[i].type = 0;
+		p->user_identifiers[i].name = NULL;
+		p->user_identifiers[i].global_id = 0;
+	}
+
+	p->num_user_ids = 0;
+	p->num_tokens = 0;
+	p->index = 0;
+}
+
+// компиляция токенов в программу
+static int compile_program(parser_t *p, parser_program_t *prog)
+{
+	memset(prog, 0, sizeof(parser_program_t));
+
+	prog->instructions = (instruction_t*) malloc(sizeof(instruction_t) * MAX_NUM_INSTRUCTIONS);
+	IF_FAILED_RET(prog->instructions, -1);
+
+	p->index = 0;
+	p->error = 0;
+
+	if(resolve_identifiers(p) != 0) {
+		parser_program_destroy(prog);
+		return p->error;
+	}
+
+	// регистры встроенных и пользовательских переменных
+	prog->num_user_vars = p->num_user_ids;
+	prog->num_registers = PARSER_NUM_BUILTIN_REGS + prog->num_user_vars;
+
+	syntax_parser(p, prog);
+
+	if(is_stopping && p->error == 0)
+		p->error = 1;
+
+	if(p->error != 0) {
+		parser_program_destroy(prog);
+		return p->error;
+	}
+
+	// уменьшаем буфер до реального размера программы
+	if(prog->num_instructions > 0)
+		prog->instructions = (instruction_t*) realloc(prog->instructions,
+													  sizeof(instruction_t) * prog->num_instructions);
+
+	return 0;
+}
+
+/////////////// ----- выполнение
+
+typedef struct {
+	int counter;
+	int end;
+	int step;
+} loop_state_t;
+
+/*
+ * Начало цикла a..b: дробная часть границ отбрасывается, i проходит все целые
+ * от a до b с шагом 1 или -1. Границы вне [-MAX_LOOP_BOUND, MAX_LOOP_BOUND],
+ * NaN и циклы длиннее MAX_LOOP_ITERATIONS итераций - ошибка выполнения
+ */
+static int loop_start(loop_state_t *loop, float begin, float end)
+{
+	if(!(begin >= -MAX_LOOP_BOUND && begin <= MAX_LOOP_BOUND &&
+		 end >= -MAX_LOOP_BOUND && end <= MAX_LOOP_BOUND))
+		return 18; // loop is too long
+
+	loop->counter = (int) begin;
+	loop->end = (int) end;
+	loop->step = (loop->counter <= loop->end) ? 1 : -1;
+
+	if((loop->end - loop->counter) * loop->step >= MAX_LOOP_ITERATIONS)
+		return 18;
+
+	return 0;
+}
+
+// вызвать функцию и вернуть результат её вызова
+INLINE static float call_func(const instruction_t *ins, const float *registers)
+{
+	const unsigned short *args = ins->args;
+
+	switch(ins->n_args) {
+		case 1:
+			return (*(func1_t) ins->func)(registers[args[0]]);
+		case 2:
+			return (*(func2_t) ins->func)(registers[args[0]], registers[args[1]]);
+		case 3:
+			return (*(func3_t) ins->func)(registers[args[0]], registers[args[1]], registers[args[2]]);
+		case 4:
+			return (*(func4_t) ins->func)(registers[args[0]], registers[args[1]], registers[args[2]],
+										  registers[args[3]]);
+		case 5:
+			return (*(func5_t) ins->func)(registers[args[0]], registers[args[1]], registers[args[2]],
+										  registers[args[3]], registers[args[4]]);
+		case 6:
+			return (*(func6_t) ins->func)(registers[args[0]], registers[args[1]], registers[args[2]],
+										  registers[args[3]], registers[args[4]], registers[args[5]]);
+	}
+
+	return 0.0f;
+}
+
+// наибольший целый показатель степени, которая вычисляется умножениями
+#define MAX_INT_POWER 64
+
+// целый показатель от 1 до MAX_INT_POWER или 0, если степень вычисляется powf
+INLINE static unsigned int_power(float part)
+{
+	return (part >= 1.0f && part <= MAX_INT_POWER && part == (float) (int) part) ? (unsigned) part : 0;
+}
+
+/*
+ * Возведение в целую степень n умножениями: по битам n от старшего к младшему
+ * result = result * result и, если бит равен 1, result = result * value.
+ * Для постоянного показателя оптимизатор создаёт те же умножения (opt_lower_power)
+ */
+INLINE static float eval_int_power(float value, unsigned n)
+{
+	unsigned bit = MAX_INT_POWER;
+	float result = value;
+
+	while(!(n & bit))
+		bit >>= 1;
+
+	for(bit >>= 1; bit; bit >>= 1) {
+		result *= result;
+		if(n & bit)
+			result *= value;
+	}
+
+	return result;
+}
+
+// возведение в степень
+INLINE static float eval_power(float value, float part)
+{
+	if(part == 0.0f)
+		return 1.0f;
+
+	unsigned n = int_power(part);
+
+	if(n)
+		return eval_int_power(value, n);
+
+	if(value == 0.0f)
+		return 0.0f;
+
+	return powf(value, part);
+}
+
+// факториал
+INLINE static float eval_factorial(float value)
+{
+	if(value == 0.0f)
+		return 1.0f;
+
+	// пропускаем отрицательный факториал
+	if(value < 0.0f)
+		return value;
+
+	float s = 1.0f;
+	for(unsigned i = 1; i <= (unsigned) value; i += 1) {
+		s *= i;
+	}
+
+	return s;
+}
+
+// обнулить d, i и пользовательские переменные
+static void eval_reset(const parser_program_t *program, float *registers)
+{
+	registers[PARSER_REG_D] = 0.0f;
+	registers[PARSER_REG_I] = 0.0f;
+	for(unsigned i = 0; i < program->num_user_vars; i++)
+		registers[PARSER_NUM_BUILTIN_REGS + i] = 0.0f;
+}
+
+// выполнить инструкции first..last-1 (ветвления и циклы не выходят за эти границы)
+static int eval_range(const parser_program_t *program, unsigned first, unsigned last, float *registers)
+{
+	loop_state_t loops[MAX_NUM_LOOPS];
+
+	const instruction_t *begin = program->instructions;
+	const instruction_t *end = begin + last;
+	const instruction_t *ins = begin + first;
+
+#define A registers[ins->args[0]]
+#define B registers[ins->args[1]]
+#define DST registers[ins->dst]
+
+	while(ins < end) {
+
+		switch(ins->opcode) {
+			case OP_CONST:
+				DST = ins->value;
+				break;
+			case OP_MOV:
+				DST = A;
+				break;
+			case OP_NEG:
+				DST = -A;
+				break;
+			case OP_FACT:
+				DST = eval_factorial(A);
+				break;
+			case OP_ADD:
+				DST = A + B;
+				break;
+			case OP_SUB:
+				DST = A - B;
+				break;
+			case OP_MUL:
+				DST = A * B;
+				break;
+			case OP_DIV:
+				if(B == 0.0f)
+					return 15; // dividing by zero
+				DST = A / B;
+				break;
+			case OP_FDIV:
+				DST = A / B;
+				break;
+			case OP_POW:
+				DST = eval_power(A, B);
+				break;
+			case OP_GT:
+				DST = A > B;
+				break;
+			case OP_LT:
+				DST = A < B;
+				break;
+			case OP_GE:
+				DST = A >= B;
+				break;
+			case OP_LE:
+				DST = A <= B;
+				break;
+			case OP_EQ:
+				DST = A == B;
+				break;
+			case OP_NE:
+				DST = A != B;
+				break;
+			case OP_CALL:
+				DST = call_func(ins, registers);
+				break;
+			case OP_JZ:
+				if(A == 0.0f) {
+					ins = begin + ins->target;
+					continue;
+				}
+				break;
+			case OP_JMP:
+				ins = begin + ins->target;
+				continue;
+			case OP_LOOP_BEGIN: {
+				loop_state_t *loop = &loops[ins->args[2]];
+				int error = loop_start(loop, A, B);
+
+				if(error)
+					return error;
+
+				DST = 0.0f;
+
+				// присваиваем i номер текущей итерации
+				registers[PARSER_REG_I] = (float) loop->counter;
+				break; }
+			case OP_LOOP_NEXT: {
+				loop_state_t *loop = &loops[ins->args[2]];
+
+				// вычисляем сумму
+				DST += A;
+
+				if(is_stopping)
+					return 0;
+
+				if(loop->counter != loop->end) {
+					loop->counter += loop->step;
+
+					registers[PARSER_REG_I] = (float) loop->counter;
+
+					ins = begin + ins->target;
+					continue;
+				}
+
+				// обнуляем переменную i
+				registers[PARSER_REG_I] = 0.0f;
+				break; }
+		}
+
+		ins++;
+	}
+
+#undef A
+#undef B
+#undef DST
+
+	return 0;
+}
+
+int parser_program_eval(const parser_program_t *program, float *registers)
+{
+	IF_FAILED_RET(program && registers, -100);
+
+	if(program->native_eval)
+		return ((native_eval_t) program->native_eval)(program->native_funcs, &is_stopping, registers);
+
+	if(program->jit_code && use_jit)
+		return ((jit_func_t) program->jit_code)(registers);
+
+	eval_reset(program, registers);
+
+	return eval_range(program, 0, program->num_instructions, registers);
+}
+
+/////////////// ----- оптимизация
+
+// удалённая инструкция (появляется только во время оптимизации)
+#define OP_NOP 0
+
+// функции шума зависят от глобальных данных, поэтому не вычисляются при компиляции
+#define IS_NOISE_FUNC(id) ((id) >= 132 && (id) <= 138)
+
+/*
+ * Известные факты о регистрах в текущей точке программы:
+ * константы, копии (copy_of[r] - регистр, значение которого совпадает с r)
+ * и уже вычисленные выражения (dst - регистр с результатом)
+ */
+typedef struct {
+	unsigned num_registers;
+	unsigned max_exprs;
+
+	instruction_t *exprs;
+	unsigned num_exprs;
+
+	float *const_value;
+	unsigned short *copy_of;
+	unsigned char *is_const;
+
+	// постоянные аргументы LOOP_BEGIN и OP_POW по номеру инструкции: биты const_args[i] -
+	// какие из args[0], args[1] известны, arg_values[2 * i + k] - их значения (общие для копий состояния)
+	unsigned char *const_args;
+	float *arg_values;
+} opt_state_t;
+
+static opt_state_t* opt_state_create(unsigned num_registers, unsigned max_exprs)
+{
+	opt_state_t *s = (opt_state_t*) malloc(sizeof(opt_state_t) + sizeof(instruction_t) * max_exprs +
+										   (sizeof(float) + sizeof(unsigned short) + 1) * num_registers);
+
+	if(!s)
+		return NULL;
+
+	s->num_registers = num_registers;
+	s->max_exprs = max_exprs;
+	s->num_exprs = 0;
+
+	s->exprs = (instruction_t*) (s + 1);
+	s->const_value = (float*) (s->exprs + max_exprs);
+	s->copy_of = (unsigned short*) (s->const_value + num_registers);
+	s->is_const = (unsigned char*) (s->copy_of + num_registers);
+	s->const_args = NULL;
+	s->arg_values = NULL;
+
+	for(unsigned r = 0; r < num_registers; r++) {
+		s->copy_of[r] = r;
+		s->is_const[r] = 0;
+		s->const_value[r] = 0.0f;
+	}
+
+	return s;
+}
+
+static opt_state_t* opt_state_copy(const opt_state_t *src)
+{
+	opt_state_t *s = opt_state_create(src->num_registers, src->max_exprs);
+
+	if(!s)
+		return NULL;
+
+	s->num_exprs = src->num_exprs;
+	memcpy(s->exprs, src->exprs, sizeof(instruction_t) * src->num_exprs);
+	memcpy(s->const_value, src->const_value, sizeof(float) * src->num_registers);
+	memcpy(s->copy_of, src->copy_of, sizeof(unsigned short) * src->num_registers);
+	memcpy(s->is_const, src->is_const, src->num_registers);
+	s->const_args = src->const_args;
+	s->arg_values = src->arg_values;
+
+	return s;
+}
+
+// одинаковые ли выражения (без учёта регистра-результата)
+static int opt_same_expr(const instruction_t *a, const instruction_t *b)
+{
+	if(a->opcode != b->opcode || a->n_args != b->n_args || a->target != b->target)
+		return 0;
+
+	if(memcmp(&a->value, &b->value, sizeof(float)) != 0)
+		return 0;
+
+	for(int k = 0; k < a->n_args; k++) {
+		if(a->args[k] != b->args[k])
+			return 0;
+	}
+
+	return 1;
+}
+
+// регистр r перезаписан: забываем всё, что с ним связано
+static void opt_state_invalidate(opt_state_t *s, unsigned r)
+{
+	s->is_const[r] = 0;
+	s->copy_of[r] = r;
+
+	for(unsigned k = 0; k < s->num_registers; k++) {
+		if(s->copy_of[k] == r)
+			s->copy_of[k] = k;
+	}
+
+	unsigned n = 0;
+	for(unsigned e = 0; e < s->num_exprs; e++) {
+		const instruction_t *expr = &s->exprs[e];
+		int used = (expr->dst == r);
+
+		for(int k = 0; k < expr->n_args && !used; k++)
+			used = (expr->args[k] == r);
+
+		if(!used)
+			s->exprs[n++] = *expr;
+	}
+	s->num_exprs = n;
+}
+
+// оставить только факты, верные в обоих состояниях (слияние ветвей)
+static void opt_state_intersect(opt_state_t *s, const opt_state_t *other)
+{
+	for(unsigned r = 0; r < s->num_registers; r++) {
+		if(s->is_const[r] && (!other->is_const[r] ||
+							  memcmp(&s->const_value[r], &other->const_value[r], sizeof(float)) != 0))
+			s->is_const[r] = 0;
+
+		if(s->copy_of[r] != other->copy_of[r])
+			s->copy_of[r] = r;
+	}
+
+	unsigned n = 0;
+	for(unsigned e = 0; e < s->num_exprs; e++) {
+		for(unsigned k = 0; k < other->num_exprs; k++) {
+			if(s->exprs[e].dst == other->exprs[k].dst && opt_same_expr(&s->exprs[e], &other->exprs[k])) {
+				s->exprs[n++] = s->exprs[e];
+				break;
+			}
+		}
+	}
+	s->num_exprs = n;
+}
+
+static void opt_make_const(instruction_t *ins, float value)
+{
+	int dst = ins->dst;
+
+	memset(ins, 0, sizeof(instruction_t));
+	ins->opcode = OP_CONST;
+	ins->dst = dst;
+	ins->value = value;
+}
+
+static void opt_make_mov(instruction_t *ins, int src)
+{
+	int dst = ins->dst;
+
+	memset(ins, 0, sizeof(instruction_t));
+	ins->opcode = OP_MOV;
+	ins->dst = dst;
+	ins->n_args = 1;
+	ins->args[0] = src;
+}
+
+// вычислить инструкцию с константными операндами (values - значения регистров)
+// возвращает 0, если инструкцию нельзя вычислить при компиляции
+static int opt_fold(const instruction_t *ins, const float *values, float *result)
+{
+	float a = values[ins->args[0]], b = values[ins->args[1]];
+
+	switch(ins->opcode) {
+		case OP_NEG:
+			*result = -a;
+			break;
+		case OP_FACT:
+			// большие факториалы оставляем на время выполнения
+			if(!(a <= 1000.0f))
+				return 0;
+			*result = eval_factorial(a);
+			break;
+		case OP_ADD:
+			*result = a + b;
+			break;
+		case OP_SUB:
+			*result = a - b;
+			break;
+		case OP_MUL:
+			*result = a * b;
+			break;
+		case OP_DIV:
+			// деление на ноль должно вернуть ошибку при выполнении
+			if(b == 0.0f)
+				return 0;
+			*result = a / b;
+			break;
+		case OP_FDIV:
+			*result = a / b;
+			break;
+		case OP_POW:
+			*result = eval_power(a, b);
+			break;
+		case OP_GT:
+			*result = a > b;
+			break;
+		case OP_LT:
+			*result = a < b;
+			break;
+		case OP_GE:
+			*result = a >= b;
+			break;
+		case OP_LE:
+			*result = a <= b;
+			break;
+		case OP_EQ:
+			*result = a == b;
+			break;
+		case OP_NE:
+			*result = a != b;
+			break;
+		case OP_CALL:
+			if(IS_NOISE_FUNC(ins->target))
+				return 0;
+			*result = call_func(ins, values);
+			break;
+		default:
+			return 0;
+	}
+
+	return 1;
+}
+
+// оптимизация инструкции, вычисляющей значение в регистр dst
+static void opt_value(opt_state_t *s, instruction_t *ins)
+{
+	int k = 0, all_const = 1;
+	float value = 0.0f;
+
+	for(k = 0; k < ins->n_args; k++)
+		all_const = all_const && s->is_const[ins->args[k]];
+
+	// вычисляем константные выражения
+	if(ins->opcode != OP_CONST && ins->opcode != OP_MOV && all_const && opt_fold(ins, s->const_value, &value))
+		opt_make_const(ins, value);
+
+	// деление на известное ненулевое число не требует проверки
+	if(ins->opcode == OP_DIV && s->is_const[ins->args[1]] && s->const_value[ins->args[1]] != 0.0f)
+		ins->opcode = OP_FDIV;
+
+	// для коммутативных операций упорядочиваем операнды
+	if((ins->opcode == OP_ADD || ins->opcode == OP_MUL || ins->opcode == OP_EQ || ins->opcode == OP_NE) &&
+	   ins->args[0] > ins->args[1]) {
+		int tmp = ins->args[0];
+		ins->args[0] = ins->args[1];
+		ins->args[1] = tmp;
+	}
+
+	// ищем ранее вычисленное такое же выражение
+	if(ins->opcode != OP_MOV) {
+		for(unsigned e = 0; e < s->num_exprs; e++) {
+			if(opt_same_expr(ins, &s->exprs[e])) {
+				opt_make_mov(ins, s->exprs[e].dst);
+				break;
+			}
+		}
+	}
+
+	if(ins->opcode == OP_MOV) {
+		int src = ins->args[0];
+
+		if(src == ins->dst) {
+			ins->opcode = OP_NOP;
+			ins->n_args = 0;
+			return;
+		}
+
+		opt_state_invalidate(s, ins->dst);
+
+		s->copy_of[ins->dst] = src;
+		s->is_const[ins->dst] = s->is_const[src];
+		s->const_value[ins->dst] = s->const_value[src];
+		return;
+	}
+
+	opt_state_invalidate(s, ins->dst);
+
+	if(ins->opcode == OP_CONST) {
+		s->is_const[ins->dst] = 1;
+		s->const_value[ins->dst] = ins->value;
+	}
+
+	// выражение от собственного результата (sum = sum + part) после записи уже другое
+	for(k = 0; k < ins->n_args; k++) {
+		if(ins->args[k] == ins->dst)
+			return;
+	}
+
+	if(s->num_exprs < s->max_exprs)
+		s->exprs[s->num_exprs++] = *ins;
+}
+
+/*
+ * Прямой проход по инструкциям [begin, end): распространение констант и копий,
+ * вычисление константных выражений и удаление повторных вычислений.
+ * Ветвления и циклы обрабатываются по структуре, которую создаёт компилятор
+ */
+static int opt_forward(instruction_t *code, unsigned begin, unsigned end, opt_state_t *s)
+{
+	unsigned i = begin;
+
+	while(i < end) {
+		instruction_t *ins = &code[i];
+
+		// заменяем операнды регистрами, откуда они были скопированы
+		for(int k = 0; k < ins->n_args; k++)
+			ins->args[k] = s->copy_of[ins->args[k]];
+
+		// циклы и степени с постоянными аргументами разворачивает opt_expand
+		if(s->const_args && (ins->opcode == OP_LOOP_BEGIN || ins->opcode == OP_POW)) {
+			s->const_args[i] = 0;
+
+			for(int k = 0; k < 2; k++) {
+				if(s->is_const[ins->args[k]])
+					s->const_args[i] |= 1 << k;
+				s->arg_values[2 * i + k] = s->const_value[ins->args[k]];
+			}
+		}
+
+		switch(ins->opcode) {
+			case OP_JZ: {
+				// JZ cond, else; <истина>; JMP end; else: <ложь>; end:
+				unsigned else_begin = ins->target;
+				unsigned else_end = code[else_begin - 1].target;
+				int cond = ins->args[0];
+
+				if(s->is_const[cond]) {
+					if(s->const_value[cond] != 0.0f) {
+						ins->opcode = OP_NOP;
+						ins->n_args = 0;
+						if(opt_forward(code, i + 1, else_begin - 1, s) != 0)
+							return -1;
+					} else {
+						ins->opcode = OP_JMP;
+						ins->n_args = 0;
+						if(opt_forward(code, else_begin, else_end, s) != 0)
+							return -1;
+					}
+				} else {
+					opt_state_t *s_else = opt_state_copy(s);
+
+					if(!s_else)
+						return -1;
+
+					if(opt_forward(code, i + 1, else_begin - 1, s) != 0 ||
+					   opt_forward(code, else_begin, else_end, s_else) != 0) {
+						free(s_else);
+						return -1;
+					}
+
+					opt_state_intersect(s, s_else);
+					free(s_else);
+				}
+
+				i = else_end;
+				continue; }
+			case OP_LOOP_BEGIN: {
+				// ищем конец цикла
+				unsigned loop_end = i + 1;
+				while(code[loop_end].opcode != OP_LOOP_NEXT || code[loop_end].args[2] != ins->args[2])
+					loop_end++;
+
+				// всё, что изменяется в цикле, неизвестно в начале каждой итерации
+				opt_state_invalidate(s, PARSER_REG_I);
+				for(unsigned j = i; j <= loop_end; j++) {
+					if(code[j].opcode != OP_NOP && code[j].opcode != OP_JZ && code[j].opcode != OP_JMP)
+						opt_state_invalidate(s, code[j].dst);
+				}
+
+				if(opt_forward(code, i + 1, loop_end, s) != 0)
+					return -1;
+
+				instruction_t *next = &code[loop_end];
+				next->args[0] = s->copy_of[next->args[0]];
+
+				opt_state_invalidate(s, next->dst);
+				opt_state_invalidate(s, PARSER_REG_I);
+
+				// после цикла i = 0
+				s->is_const[PARSER_REG_I] = 1;
+				s->const_value[PARSER_REG_I] = 0.0f;
+
+				i = loop_end + 1;
+				continue; }
+			case OP_JMP:
+				// остался от ?: с постоянным условием, до цели переход не выполняется
+				i = ins->target;
+				continue;
+			case OP_NOP:
+				break;
+			default:
+				opt_value(s, ins);
+				break;
+		}
+
+		i++;
+	}
+
+	return 0;
+}
+
+// инструкция без побочных эффектов, которую можно удалить, если результат не нужен
+static int opt_is_removable(int opcode)
+{
+	switch(opcode) {
+		case OP_CONST: case OP_MOV: case OP_NEG: case OP_FACT:
+		case OP_ADD: case OP_SUB: case OP_MUL: case OP_FDIV: case OP_POW:
+		case OP_GT: case OP_LT: case OP_GE: case OP_LE: case OP_EQ: case OP_NE:
+		case OP_CALL:
+			return 1;
+	}
+
+	return 0;
+}
+
+#define BIT_SET(set, r) ((set)[(r) >> 5] |= (1u << ((r) & 31)))
+#define BIT_CLEAR(set, r) ((set)[(r) >> 5] &= ~(1u << ((r) & 31)))
+#define BIT_TEST(set, r) (((set)[(r) >> 5] >> ((r) & 31)) & 1u)
+
+/*
+ * Удаление инструкций, результат которых не используется (в том числе присваиваний
+ * переменным, значения которых не доходят до d). Возвращает кол-во удалённых
+ * инструкций или -1 при ошибке выделения памяти
+ */
+static int opt_remove_dead(instruction_t *code, unsigned n, unsigned num_registers)
+{
+	unsigned words = (num_registers + 31) / 32;
+	unsigned *live_in = (unsigned*) calloc((size_t) (n + 1) * words * 2, sizeof(unsigned));
+
+	if(!live_in)
+		return -1;
+
+	// live_in[n] - живые регистры после конца программы (только d)
+	unsigned *live_out = live_in + (size_t) (n + 1) * words;
+	BIT_SET(live_in + (size_t) n * words, PARSER_REG_D);
+
+	int changed = 1;
+	while(changed) {
+		changed = 0;
+
+		for(unsigned i = n; i-- > 0; ) {
+			const instruction_t *ins = &code[i];
+			unsigned *in = live_in + (size_t) i * words;
+			unsigned *out = live_out + (size_t) i * words;
+			unsigned w = 0;
+			int k = 0;
+
+			// живые после инструкции - объединение живых в начале следующих
+			const unsigned *next = live_in + (size_t) (i + 1) * words;
+			const unsigned *jump = NULL;
+
+			if(ins->opcode == OP_JMP)
+				next = NULL;
+			if(ins->opcode == OP_JMP || ins->opcode == OP_JZ || ins->opcode == OP_LOOP_NEXT)
+				jump = live_in + (size_t) ins->target * words;
+
+			for(w = 0; w < words; w++)
+				out[w] = (next ? next[w] : 0) | (jump ? jump[w] : 0);
+
+			unsigned new_in[words];
+			memcpy(new_in, out, sizeof(unsigned) * words);
+
+			if(ins->opcode != OP_NOP && ins->opcode != OP_JZ && ins->opcode != OP_JMP)
+				BIT_CLEAR(new_in, ins->dst);
+			if(ins->opcode == OP_LOOP_BEGIN || ins->opcode == OP_LOOP_NEXT)
+				BIT_CLEAR(new_in, PARSER_REG_I);
+
+			for(k = 0; k < ins->n_args; k++)
+				BIT_SET(new_in, ins->args[k]);
+			if(ins->opcode == OP_LOOP_NEXT)
+				BIT_SET(new_in, ins->dst);
+
+			if(memcmp(new_in, in, sizeof(unsigned) * words) != 0) {
+				memcpy(in, new_in, sizeof(unsigned) * words);
+				changed = 1;
+			}
+		}
+	}
+
+	int removed = 0;
+	for(unsigned i = 0; i < n; i++) {
+		instruction_t *ins = &code[i];
+
+		if(opt_is_removable(ins->opcode) && !BIT_TEST(live_out + (size_t) i * words, ins->dst)) {
+			ins->opcode = OP_NOP;
+			ins->n_args = 0;
+			removed++;
+		}
+	}
+
+	free(live_in);
+
+	return removed;
+}
+
+#undef BIT_SET
+#undef BIT_CLEAR
+#undef BIT_TEST
+
+// развернуть циклы не более чем из стольких итераций и инструкций
+#define OPT_UNROLL_MAX_ITERATIONS 32
+#define OPT_UNROLL_MAX_SIZE 384
+
+// сколько раз повторять оптимизацию после разворачивания (вложенные циклы)
+#define OPT_UNROLL_MAX_ROUNDS 4
+
+// заменить инструкции [begin, end) на size новых, сдвинув следующие за ними и переходы на них
+static void opt_replace(instruction_t *code, unsigned *n, unsigned begin, unsigned end, unsigned size)
+{
+	int shift = (int) size - (int) (end - begin);
+
+	memmove(&code[begin + size], &code[end], sizeof(instruction_t) * (*n - end));
+	*n += shift;
+
+	for(unsigned j = 0; j < *n; j++) {
+		if((j < begin || j >= begin + size) && code[j].target >= (int) end &&
+		   (code[j].opcode == OP_JMP || code[j].opcode == OP_JZ || code[j].opcode == OP_LOOP_NEXT))
+			code[j].target += shift;
+	}
+}
+
+/*
+ * Развернуть цикл с началом в code[i] и границами a..b: тело повторяется для каждого i.
+ * Копии, кроме последней, получают свои временные регистры, и все - регистр с i, поэтому
+ * не зависящие от x части копий выносятся из цикла по точкам. Порядок сложения суммы
+ * не меняется, копии вложенных циклов используют одно состояние по очереди.
+ * Возвращает номер последней инструкции развёрнутого цикла или -1
+ */
+static int opt_unroll_loop(parser_program_t *prog, instruction_t *code, unsigned *n, unsigned i,
+						   float a, float b)
+{
+	const unsigned first_temp = PARSER_NUM_BUILTIN_REGS + prog->num_user_vars;
+	unsigned short rename[MAX_NUM_REGISTERS];
+	unsigned char defined[MAX_NUM_REGISTERS];
+	loop_state_t state;
+
+	// ошибку в границах оставляем на время выполнения
+	if(loop_start(&state, a, b) != 0)
+		return -1;
+
+	unsigned count = (state.end - state.counter) * state.step + 1;
+
+	unsigned loop_end = i + 1;
+	while(code[loop_end].opcode != OP_LOOP_NEXT || code[loop_end].args[2] != code[i].args[2])
+		loop_end++;
+
+	// тело без удалённых инструкций (new_index - номер инструкции в копии)
+	unsigned length = loop_end - i - 1, body = 0;
+	unsigned new_index[length + 1];
+
+	for(unsigned j = 0; j <= length; j++) {
+		new_index[j] = body;
+		if(j < length && code[i + 1 + j].opcode != OP_NOP)
+			body++;
+	}
+
+	unsigned size = count * (body + 3) + 2;
+
+	if(count > OPT_UNROLL_MAX_ITERATIONS || size > OPT_UNROLL_MAX_SIZE ||
+	   *n - (length + 2) + size > MAX_NUM_INSTRUCTIONS)
+		return -1;
+
+	// временные регистры тела; значение из предыдущей итерации не должно читаться
+	unsigned num_temps = 0;
+	int carried = 0;
+
+	memset(defined, 0, prog->num_registers);
+	for(unsigned j = i + 1; j < loop_end; j++) {
+		if(code[j].opcode != OP_NOP && code[j].opcode != OP_JZ && code[j].opcode != OP_JMP &&
+		   code[j].dst >= first_temp && !defined[code[j].dst]) {
+			defined[code[j].dst] = 1;
+			num_temps++;
+		}
+	}
+
+	memset(rename, 0, sizeof(unsigned short) * prog->num_registers);
+	for(unsigned j = i + 1; j <= loop_end && !carried; j++) {
+		for(int k = 0; k < code[j].n_args; k++)
+			carried = carried || (defined[code[j].args[k]] && !rename[code[j].args[k]]);
+
+		if(code[j].opcode != OP_NOP && code[j].opcode != OP_JZ && code[j].opcode != OP_JMP)
+			rename[code[j].dst] = 1;
+	}
+
+	if(carried || prog->num_registers + count * (num_temps + 1) > MAX_NUM_REGISTERS)
+		return -1;
+
+	// sum = 0; { ik = k; i = k; <тело>; sum = sum + part; } ...; i = 0
+	const instruction_t begin = code[i], next = code[loop_end];
+	instruction_t copy[body > 0 ? body : 1];
+
+	for(unsigned j = 0; j < length; j++) {
+		if(code[i + 1 + j].opcode == OP_NOP)
+			continue;
+
+		copy[new_index[j]] = code[i + 1 + j];
+		if(copy[new_index[j]].opcode == OP_JMP || copy[new_index[j]].opcode == OP_JZ ||
+		   copy[new_index[j]].opcode == OP_LOOP_NEXT)
+			copy[new_index[j]].target = new_index[copy[new_index[j]].target - (i + 1)];
+	}
+
+	opt_replace(code, n, i, loop_end + 1, size);
+
+	const unsigned num_registers = prog->num_registers;
+	unsigned pos = i;
+	opt_make_const(&code[pos], 0.0f);
+	code[pos++].dst = begin.dst;
+
+	for(unsigned k = 0; k < count; k++, state.counter += state.step) {
+		for(unsigned r = 0; r < num_registers; r++)
+			rename[r] = r;
+
+		// до первой записи в i (вложенный цикл) тело читает регистр копии;
+		// значения последней итерации после цикла остаются в прежних регистрах
+		unsigned index = prog->num_registers++;
+		rename[PARSER_REG_I] = index;
+		for(unsigned r = first_temp; r < num_registers && k + 1 < count; r++) {
+			if(defined[r])
+				rename[r] = prog->num_registers++;
+		}
+
+		opt_make_const(&code[pos], (float) state.counter);
+		code[pos++].dst = index;
+		opt_make_const(&code[pos], (float) state.counter);
+		code[pos++].dst = PARSER_REG_I;
+
+		for(unsigned j = 0; j < body; j++) {
+			instruction_t *ins = &code[pos + j];
+
+			*ins = copy[j];
+			if(ins->opcode == OP_JMP || ins->opcode == OP_JZ || ins->opcode == OP_LOOP_NEXT)
+				ins->target += pos;
+
+			for(int a = 0; a < ins->n_args; a++)
+				ins->args[a] = rename[ins->args[a]];
+
+			if(ins->opcode == OP_NOP || ins->opcode == OP_JZ || ins->opcode == OP_JMP)
+				continue;
+
+			if(ins->opcode == OP_LOOP_BEGIN || ins->dst == PARSER_REG_I)
+				rename[PARSER_REG_I] = PARSER_REG_I;
+			ins->dst = rename[ins->dst];
+		}
+		pos += body;
+
+		memset(&code[pos], 0, sizeof(instruction_t));
+		code[pos].opcode = OP_ADD;
+		code[pos].dst = next.dst;
+		code[pos].n_args = 2;
+		code[pos].args[0] = next.dst;
+		code[pos++].args[1] = rename[next.args[0]];
+	}
+
+	opt_make_const(&code[pos], 0.0f);
+	code[pos].dst = PARSER_REG_I;
+
+	return pos;
+}
+
+/*
+ * Заменить value ** n с постоянным целым n умножениями в том же порядке, что и
+ * в eval_int_power. Показатели 0 и 1 не требуют вычислений.
+ * Возвращает номер последней инструкции или -1, если показатель не целый
+ */
+static int opt_lower_power(parser_program_t *prog, instruction_t *code, unsigned *n, unsigned i,
+						   float part)
+{
+	const instruction_t pow = code[i];
+	unsigned power = int_power(part);
+
+	if(part == 0.0f) {
+		opt_make_const(&code[i], 1.0f);
+		return i;
+	}
+
+	if(power == 0)
+		return -1;
+
+	if(power == 1) {
+		opt_make_mov(&code[i], pow.args[0]);
+		return i;
+	}
+
+	// кол-во умножений: возведение в квадрат на каждый бит после старшего и умножение на единичный
+	unsigned bit = MAX_INT_POWER, size = 0;
+
+	while(!(power & bit))
+		bit >>= 1;
+	for(unsigned b = bit >> 1; b; b >>= 1)
+		size += (power & b) ? 2 : 1;
+
+	if(*n - 1 + size > MAX_NUM_INSTRUCTIONS || prog->num_registers + size - 1 > MAX_NUM_REGISTERS)
+		return -1;
+
+	opt_replace(code, n, i, i + 1, size);
+
+	unsigned pos = i, result = pow.args[0];
+	for(bit >>= 1; bit; bit >>= 1) {
+		for(int step = 0; step < ((power & bit) ? 2 : 1); step++) {
+			instruction_t *ins = &code[pos];
+
+			memset(ins, 0, sizeof(instruction_t));
+			ins->opcode = OP_MUL;
+			ins->dst = (pos + 1 < i + size) ? prog->num_registers++ : pow.dst;
+			ins->n_args = 2;
+			ins->args[0] = result;
+			ins->args[1] = step ? pow.args[0] : result;
+
+			result = ins->dst;
+			pos++;
+		}
+	}
+
+	return pos - 1;
+}
+
+/*
+ * Развернуть степени и (если unroll) циклы с постоянными аргументами (const_args и
+ * arg_values заполнены opt_forward для текущего code, который вмещает
+ * MAX_NUM_INSTRUCTIONS инструкций). Возвращает кол-во развёрнутых инструкций
+ */
+static int opt_expand(parser_program_t *prog, instruction_t *code, unsigned *n,
+					  const unsigned char *const_args, const float *arg_values, int unroll)
+{
+	int shifted = 0;	// на сколько сдвинулись ещё не просмотренные инструкции
+	int expanded = 0;
+
+	for(unsigned i = 0; i < *n; i++) {
+		unsigned old = i - shifted, old_n = *n;
+		int last = -1;
+
+		if(code[i].opcode == OP_LOOP_BEGIN && const_args[old] == 3 && unroll)
+			last = opt_unroll_loop(prog, code, n, i, arg_values[2 * old], arg_values[2 * old + 1]);
+		else if(code[i].opcode == OP_POW && (const_args[old] & 2))
+			last = opt_lower_power(prog, code, n, i, arg_values[2 * old + 1]);
+
+		if(last < 0)
+			continue;
+
+		expanded++;
+		shifted += (int) *n - (int) old_n;
+		i = last;
+	}
+
+	return expanded;
+}
+
+/*
+ * Удаление недостижимого кода и переходов на следующую инструкцию.
+ * Возвращает кол-во удалённых инструкций или -1 при ошибке выделения памяти
+ */
+static int opt_remove_jumps(instruction_t *code, unsigned n)
+{
+	unsigned *stack = (unsigned*) malloc(sizeof(unsigned) * (2 * n + 1));
+	unsigned char *reachable = (unsigned char*) calloc(n + 1, 1);
+	int removed = 0;
+
+	if(!stack || !reachable) {
+		free(stack);
+		free(reachable);
+		return -1;
+	}
+
+	// помечаем достижимые инструкции
+	unsigned top = 0;
+	stack[top++] = 0;
+	while(top > 0) {
+		unsigned i = stack[--top];
+
+		if(i >= n || reachable[i])
+			continue;
+
+		reachable[i] = 1;
+
+		if(code[i].opcode == OP_JMP || code[i].opcode == OP_JZ || code[i].opcode == OP_LOOP_NEXT)
+			stack[top++] = code[i].target;
+		if(code[i].opcode != OP_JMP)
+			stack[top++] = i + 1;
+	}
+
+	for(unsigned i = 0; i < n; i++) {
+		if(!reachable[i] && code[i].opcode != OP_NOP) {
+			code[i].opcode = OP_NOP;
+			code[i].n_args = 0;
+			removed++;
+		}
+	}
+
+	// переход на следующую (не удалённую) инструкцию не нужен
+	for(unsigned i = n; i-- > 0; ) {
+		if(code[i].opcode != OP_JMP && code[i].opcode != OP_JZ)
+			continue;
+
+		unsigned next = i + 1;
+		while(next < code[i].target && code[next].opcode == OP_NOP)
+			next++;
+
+		if(next == code[i].target) {
+			code[i].opcode = OP_NOP;
+			code[i].n_args = 0;
+			removed++;
+		}
+	}
+
+	free(stack);
+	free(reachable);
+
+	return removed;
+}
+
+// убрать удалённые инструкции из программы, возвращает новое кол-во инструкций
+static unsigned opt_compact(instruction_t *code, unsigned n)
+{
+	unsigned new_index[n + 1];
+	unsigned count = 0;
+
+	for(unsigned i = 0; i <= n; i++) {
+		new_index[i] = count;
+		if(i < n && code[i].opcode != OP_NOP)
+			count++;
+	}
+
+	for(unsigned i = 0; i < n; i++) {
+		if(code[i].opcode == OP_NOP)
+			continue;
+
+		if(code[i].opcode == OP_JMP || code[i].opcode == OP_JZ || code[i].opcode == OP_LOOP_NEXT)
+			code[i].target = new_index[code[i].target];
+
+		code[new_index[i]] = code[i];
+	}
+
+	return count;
+}
+
+/*
+ * Оптимизация скомпилированной программы: вычисление константных выражений,
+ * удаление повторных вычислений и присваиваний, не влияющих на d.
+ * Результатом программы считается только значение d
+ */
+static int optimize_program(parser_program_t *prog)
+{
+	if(prog->num_instructions == 0)
+		return 0;
+
+	unsigned n = prog->num_instructions;
+	instruction_t *code = (instruction_t*) malloc(sizeof(instruction_t) * MAX_NUM_INSTRUCTIONS);
+	unsigned char const_args[MAX_NUM_INSTRUCTIONS];
+	float arg_values[2 * MAX_NUM_INSTRUCTIONS];
+	int ret = 0;
+
+	if(!code)
+		return -1;
+
+	memcpy(code, prog->instructions, sizeof(instruction_t) * n);
+
+	for(unsigned round = 0; ret == 0; round++) {
+		opt_state_t *s = opt_state_create(prog->num_registers, MAX_NUM_INSTRUCTIONS);
+
+		if(!s) {
+			ret = -1;
+			break;
+		}
+
+		memset(const_args, 0, sizeof(const_args));
+		s->const_args = const_args;
+		s->arg_values = arg_values;
+
+		// в начале выполнения d, i и пользовательские переменные равны 0
+		s->is_const[PARSER_REG_D] = 1;
+		s->is_const[PARSER_REG_I] = 1;
+		for(unsigned r = 0; r < prog->num_user_vars; r++)
+			s->is_const[PARSER_NUM_BUILTIN_REGS + r] = 1;
+
+		ret = opt_forward(code, 0, n, s);
+		free(s);
+
+		// размер тел циклов - без ненужных инструкций
+		if(ret == 0 && opt_remove_dead(code, n, prog->num_registers) < 0)
+			ret = -1;
+
+		if(ret != 0)
+			break;
+
+		// после разворачивания i в телах циклов известно - оптимизируем ещё раз
+		int last_round = (round == OPT_UNROLL_MAX_ROUNDS);
+		if(opt_expand(prog, code, &n, const_args, arg_values, !last_round) == 0 || last_round)
+			break;
+	}
+
+	int removed = 1;
+	while(ret == 0 && removed > 0) {
+		int dead = opt_remove_dead(code, n, prog->num_registers);
+		int jumps = opt_remove_jumps(code, n);
+
+		if(dead < 0 || jumps < 0)
+			ret = -1;
+
+		removed = dead + jumps;
+	}
+
+	// при ошибке оставляем программу без изменений
+	if(ret != 0) {
+		free(code);
+		return -1;
+	}
+
+	n = opt_compact(code, n);
+
+	free(prog->instructions);
+	prog->instructions = (instruction_t*) realloc(code, sizeof(instruction_t) * (n > 0 ? n : 1));
+	if(!prog->instructions)
+		prog->instructions = code;
+	prog->num_instructions = n;
+
+	return 0;
+}
+
+/////////////// ----- этапы вычисления
+
+/*
+ * Инструкции переупорядочиваются в три этапа: не зависящие от x и y 
+ * (выполняются один раз на слой z), не зависящие от x (один раз на строку) 
+ * и остальные (для каждой точки). Ветвления и циклы переносятся целиком.
+ * Инструкция не переносится выше предыдущих инструкций более позднего этапа,
+ * которые читают или пишут её результат, поэтому порядок остаётся верным 
+ * и для parser_program_eval
+ */
+
+enum { STAGE_SLICE = 0, STAGE_ROW, STAGE_VOXEL };
+
+// конец ветвления или цикла, который начинается инструкцией begin
+static unsigned stage_region_end(const instruction_t *code, unsigned n, unsigned begin)
+{
+	unsigned end = begin + 1;
+
+	for(unsigned i = begin; i < end; i++) {
+		const instruction_t *ins = &code[i];
+
+		if(ins->opcode == OP_JZ || ins->opcode == OP_JMP) {
+			if((unsigned) ins->target > end)
+				end = ins->target;
+		} else if(ins->opcode == OP_LOOP_BEGIN) {
+			for(unsigned j = i + 1; j < n; j++) {
+				if(code[j].opcode == OP_LOOP_NEXT && code[j].args[2] == ins->args[2]) {
+					if(j + 1 > end)
+						end = j + 1;
+					break;
+				}
+			}
+		}
+	}
+
+	return end;
+}
+
+#define STAGE_MAX(a, b) ((a) > (b) ? (a) : (b))
+
+static int stage_program(parser_program_t *prog)
+{
+	const unsigned n = prog->num_instructions;
+	instruction_t *code = prog->instructions;
+
+	// level - этап, на котором вычислено текущее значение регистра,
+	// used - последний этап, на котором регистр читался или записывался
+	unsigned char level[MAX_NUM_REGISTERS], used[MAX_NUM_REGISTERS];
+
+	unsigned char *stage = (unsigned char*) malloc(STAGE_MAX(n, prog->num_registers) + 1);
+	unsigned *unit_end = (unsigned*) malloc(sizeof(unsigned) * (n + 1));
+	unsigned *new_index = (unsigned*) malloc(sizeof(unsigned) * (n + 1));
+	instruction_t *staged = (instruction_t*) malloc(sizeof(instruction_t) * (n + 1));
+	unsigned short *voxel_inputs = (unsigned short*) malloc(sizeof(unsigned short) * (prog->num_registers + 1));
+
+	if(!stage || !unit_end || !new_index || !staged || !voxel_inputs) {
+		free(stage);
+		free(unit_end);
+		free(new_index);
+		free(staged);
+		free(voxel_inputs);
+		return -1;
+	}
+
+	memset(level, STAGE_SLICE, sizeof(level));
+	memset(used, STAGE_SLICE, sizeof(used));
+	level[PARSER_REG_Y] = STAGE_ROW;
+	level[PARSER_REG_X] = STAGE_VOXEL;
+
+	// определяем этап каждой инструкции (ветвления и циклы - одним блоком)
+	for(unsigned i = 0, end = 0; i < n; i = end) {
+		int opcode = code[i].opcode;
+		unsigned s = STAGE_SLICE;
+
+		end = (opcode == OP_JZ || opcode == OP_JMP || opcode == OP_LOOP_BEGIN) ?
+			stage_region_end(code, n, i) : i + 1;
+
+		for(unsigned j = i; j < end; j++) {
+			const instruction_t *ins = &code[j];
+
+			for(unsigned k = 0; k < ins->n_args; k++)
+				s = STAGE_MAX(s, level[ins->args[k]]);
+
+			if(ins->opcode == OP_JZ || ins->opcode == OP_JMP)
+				continue;
+
+			s = STAGE_MAX(s, used[ins->dst]);
+
+			// x и y задаются в начале своего этапа, поэтому и записываются не раньше
+			if(ins->dst == PARSER_REG_X)
+				s = STAGE_VOXEL;
+			else if(ins->dst == PARSER_REG_Y)
+				s = STAGE_MAX(s, STAGE_ROW);
+
+			if(ins->opcode == OP_LOOP_BEGIN || ins->opcode == OP_LOOP_NEXT)
+				s = STAGE_MAX(s, used[PARSER_REG_I]);
+		}
+
+		for(unsigned j = i; j < end; j++) {
+			const instruction_t *ins = &code[j];
+
+			stage[j] = s;
+			unit_end[j] = end;
+
+			for(unsigned k = 0; k < ins->n_args; k++)
+				used[ins->args[k]] = STAGE_MAX(used[ins->args[k]], s);
+
+			if(ins->opcode == OP_JZ || ins->opcode == OP_JMP)
+				continue;
+
+			level[ins->dst] = s;
+			used[ins->dst] = STAGE_MAX(used[ins->dst], s);
+
+			if(ins->opcode == OP_LOOP_BEGIN || ins->opcode == OP_LOOP_NEXT) {
+				level[PARSER_REG_I] = s;
+				used[PARSER_REG_I] = STAGE_MAX(used[PARSER_REG_I], s);
+			}
+		}
+	}
+
+	// переставляем инструкции по этапам, не меняя порядок внутри этапа
+	unsigned begin[3] = {0, 0, 0};
+
+	for(unsigned i = 0; i < n; i++) {
+		if(stage[i] < STAGE_VOXEL)
+			begin[STAGE_VOXEL]++;
+		if(stage[i] < STAGE_ROW)
+			begin[STAGE_ROW]++;
+	}
+
+	prog->row_begin = begin[STAGE_ROW];
+	prog->voxel_begin = begin[STAGE_VOXEL];
+
+	for(unsigned i = 0; i < n; i++) {
+		new_index[i] = begin[stage[i]]++;
+		staged[new_index[i]] = code[i];
+	}
+
+	// переходы остаются внутри своего блока (или на инструкцию сразу после него)
+	for(unsigned i = 0; i < n; i++) {
+		int opcode = code[i].opcode;
+
+		if(opcode != OP_JZ && opcode != OP_JMP && opcode != OP_LOOP_NEXT)
+			continue;
+
+		unsigned target = code[i].target;
+
+		staged[new_index[i]].target = (target < unit_end[i]) ?
+			new_index[target] : new_index[unit_end[i] - 1] + 1;
+	}
+
+	memcpy(code, staged, sizeof(instruction_t) * n);
+
+	// регистры, значения которых этап точек берёт из предыдущих этапов, и d
+	unsigned char *input = stage;
+
+	memset(input, 0, prog->num_registers);
+	input[PARSER_REG_D] = 1;
+
+	for(unsigned i = prog->voxel_begin; i < n; i++) {
+		for(unsigned k = 0; k < code[i].n_args; k++)
+			input[code[i].args[k]] = 1;
+	}
+
+	input[PARSER_REG_X] = 0;
+
+	free(prog->voxel_inputs);
+	prog->voxel_inputs = voxel_inputs;
+	prog->num_voxel_inputs = 0;
+
+	for(unsigned r = 0; r < prog->num_registers; r++) {
+		if(input[r])
+			voxel_inputs[prog->num_voxel_inputs++] = r;
+	}
+
+	free(stage);
+	free(unit_end);
+	free(new_index);
+	free(staged);
+
+	return 0;
+}
+
+#undef STAGE_MAX
+
+/////////////// ----- пакетное выполнение
+
+// результат пакета нужно вычислить по одной точке
+#define BATCH_SCALAR_FALLBACK (-1)
+
+// максимальная вложенность ветвлений с разными условиями в пакете
+#define MAX_NUM_BATCH_BRANCHES (MAX_NUM_TOKENS / 4)
+
+/*
+ * Функции пакетного вычисления выполняют этап точек (x0 + k, y, z); 
+ * inputs - регистры после этапов слоя и строки
+ */
+typedef int (*eval_batch_func_t)(const parser_program_t *program, const float *inputs,
+								 float x0, float y, float z, unsigned count, float *result);
+
+// вычислить пакет по одной точке (для неподдерживаемых случаев)
+static int eval_batch_scalar(const parser_program_t *program, const float *inputs,
+							 float x0, float y, float z, unsigned count, float *result)
+{
+	float registers[MAX_NUM_REGISTERS];
+	int error = 0, ret = 0;
+
+	for(unsigned k = 0; k < count; k++) {
+
+		if(program->jit_code && use_jit) {
+			// машинный код вычисляет программу целиком
+			registers[PARSER_REG_X] = x0 + k;
+			registers[PARSER_REG_Y] = y;
+			registers[PARSER_REG_Z] = z;
+
+			ret = ((jit_func_t) program->jit_code)(registers);
+		} else {
+			for(unsigned i = 0; i < program->num_voxel_inputs; i++)
+				registers[program->voxel_inputs[i]] = inputs[program->voxel_inputs[i]];
+
+			registers[PARSER_REG_X] = x0 + k;
+
+			ret = eval_range(program, program->voxel_begin, program->num_instructions, registers);
+		}
+
+		if(ret != 0) {
+			result[k] = 0.0f;
+			error = ret;
+		} else {
+			result[k] = registers[PARSER_REG_D];
+		}
+	}
+
+	return error;
+}
+
+#if defined(__GNUC__)
+
+/*
+ * Регистры пакета - векторы из PARSER_BATCH_SIZE значений (по одному на точку),
+ * маска - по одному int на точку (-1 - точка активна, 0 - нет).
+ * Все вспомогательные функции встраиваются, чтобы компилироваться под набор
+ * инструкций вызывающей функции (SSE2, AVX2 или AVX-512), и принимают векторы
+ * по указателю (передача векторов по значению зависит от набора инструкций)
+ */
+typedef float vfloat_t __attribute__((vector_size(PARSER_BATCH_SIZE * sizeof(float))));
+typedef int vmask_t __attribute__((vector_size(PARSER_BATCH_SIZE * sizeof(int))));
+
+#define BATCH_INLINE static inline __attribute__((always_inline))
+
+// для точек маски m значение a, для остальных b
+#define VSELECT(m, a, b) ((vfloat_t) (((vmask_t) (a) & (m)) | ((vmask_t) (b) & ~(m))))
+
+// вектор из одинаковых значений (вычитание нуля сохраняет -0 и NaN)
+#define vbroadcast(value) ((float) (value) - (vfloat_t) {})
+
+// результат сравнения (маска) в виде 1.0 и 0.0
+#define vmask_to_float(m) ((vfloat_t) ((vmask_t) vbroadcast(1.0f) & (m)))
+
+BATCH_INLINE int vmask_any(const vmask_t *m)
+{
+	int any = 0;
+
+	for(int k = 0; k < PARSER_BATCH_SIZE; k++)
+		any |= (*m)[k];
+
+	return any != 0;
+}
+
+BATCH_INLINE int vmask_all(const vmask_t *m)
+{
+	int all = -1;
+
+	for(int k = 0; k < PARSER_BATCH_SIZE; k++)
+		all &= (*m)[k];
+
+	return all != 0;
+}
+
+// одинаково ли значение v во всех точках маски m (значение возвращается в value)
+BATCH_INLINE int vuniform(const vfloat_t *v, const vmask_t *m, float *value)
+{
+	int k = 0;
+
+	for(k = 0; k < PARSER_BATCH_SIZE && !(*m)[k]; k++);
+
+	// нет активных точек
+	if(k == PARSER_BATCH_SIZE) {
+		*value = 0.0f;
+		return 1;
+	}
+
+	*value = (*v)[k];
+
+	vmask_t differ = *m & (*v != vbroadcast(*value));
+
+	return !vmask_any(&differ);
+}
+
+// вызов встроенной функции для каждой активной точки
+BATCH_INLINE void vcall_func(const instruction_t *ins, const vfloat_t *registers, const vmask_t *mask,
+							 vfloat_t *result)
+{
+	const unsigned short *args = ins->args;
+	vfloat_t a = registers[args[0]], b = registers[args[1]], c = registers[args[2]];
+
+	// функции, которые вычисляются сразу для всех точек
+	switch(ins->target) {
+		case 112: // abs
+			*result = (vfloat_t) ((vmask_t) a & ~(vmask_t) vbroadcast(-0.0f));
+			return;
+		case 105: // min
+			*result = VSELECT(a < b, a, b);
+			return;
+		case 106: // max
+			*result = VSELECT(a > b, a, b);
+			return;
+		case 111: // clamp
+			*result = VSELECT(a < b, b, VSELECT(a > c, c, a));
 			return;
+		case 108: // lerp
+			*result = a + (b - a) * c;
+			return;
+		case 126: // dot2
+			*result = a*c + b*registers[args[3]];
+			return;
+		case 128: // dot3
+			*result = a*registers[args[3]] + b*registers[args[4]] + c*registers[args[5]];
+			return;
+	}
+
+	for(int k = 0; k < PARSER_BATCH_SIZE; k++) {
+		if(!(*mask)[k])
+			continue;
+
+		#define LANE(n) registers[args[n]][k]
+
+		switch(ins->n_args) {
+			case 1:
+				(*result)[k] = (*(func1_t) ins->func)(LANE(0));
+				break;
+			case 2:
+				(*result)[k] = (*(func2_t) ins->func)(LANE(0), LANE(1));
+				break;
+			case 3:
+				(*result)[k] = (*(func3_t) ins->func)(LANE(0), LANE(1), LANE(2));
+				break;
+			case 4:
+				(*result)[k] = (*(func4_t) ins->func)(LANE(0), LANE(1), LANE(2), LANE(3));
+				break;
+			case 5:
+				(*result)[k] = (*(func5_t) ins->func)(LANE(0), LANE(1), LANE(2), LANE(3), LANE(4));
+				break;
+			case 6:
+				(*result)[k] = (*(func6_t) ins->func)(LANE(0), LANE(1), LANE(2), LANE(3), LANE(4), LANE(5));
+				break;
 		}
-		
-		// пропускаем отрицательный факториал
-		if(*value < 0.0f) {
-			DMSG("skip factorial; value < 0\n");
-			p->index++;
+
+		#undef LANE
+	}
+}
+
+// ветвление ?:, в котором условие различается для точек пакета
+typedef struct {
+	vmask_t saved_mask;		// маска до ветвления
+	vmask_t else_mask;		// точки, для которых условие ложно
+	unsigned else_begin;	// начало ветки "ложь"
+	unsigned end;			// конец ветвления
+	int in_else;
+} batch_branch_t;
+
+/*
+ * Выполнить этап точек программы для count <= PARSER_BATCH_SIZE точек (x0 + k, y, z).
+ * Операции выполняются сразу над всеми точками; ?: с разными для точек условиями
+ * выполняет обе ветки с маской. Циклы с разными для точек или ошибочными границами не поддерживаются
+ * (возвращается BATCH_SCALAR_FALLBACK)
+ */
+BATCH_INLINE int eval_batch(const parser_program_t *program, const float *inputs,
+							float x0, unsigned count, float *result)
+{
+	vfloat_t registers[program->num_registers];
+	loop_state_t loops[MAX_NUM_LOOPS];
+	batch_branch_t branches[MAX_NUM_BATCH_BRANCHES];
+	unsigned depth = 0, k = 0;
+	int error = 0;
+
+	// alive - точки без ошибок, mask - точки, выполняющие текущую инструкцию
+	vmask_t alive, mask;
+	int full = 0;
+
+	for(k = 0; k < PARSER_BATCH_SIZE; k++) {
+		alive[k] = (k < count) ? -1 : 0;
+		registers[PARSER_REG_X][k] = x0 + k;
+	}
+
+	mask = alive;
+	full = vmask_all(&mask);
+
+	// значения, вычисленные для всей строки
+	for(k = 0; k < program->num_voxel_inputs; k++) {
+		unsigned r = program->voxel_inputs[k];
+		registers[r] = vbroadcast(inputs[r]);
+	}
+
+	const instruction_t *begin = program->instructions;
+	const instruction_t *end = begin + program->num_instructions;
+	const instruction_t *ins = begin + program->voxel_begin;
+
+#define A registers[ins->args[0]]
+#define B registers[ins->args[1]]
+#define DST registers[ins->dst]
+// запись результата только в активные точки
+#define WRITE(reg, value) do { \
+		vfloat_t value_ = (value); \
+		(reg) = full ? value_ : VSELECT(mask, value_, (reg)); \
+	} while(0)
+
+	while(ins < end) {
+		unsigned index = ins - begin;
+
+		// конец ветвления: восстанавливаем маску
+		while(depth > 0) {
+			batch_branch_t *branch = &branches[depth - 1];
+
+			if(index != (branch->in_else ? branch->end : branch->else_begin))
+				break;
+
+			mask = branch->saved_mask & alive;
+			full = vmask_all(&mask);
+			depth--;
+		}
+
+		switch(ins->opcode) {
+			case OP_CONST:
+				WRITE(DST, vbroadcast(ins->value));
+				break;
+			case OP_MOV:
+				WRITE(DST, A);
+				break;
+			case OP_NEG:
+				WRITE(DST, -A);
+				break;
+			case OP_FACT: {
+				vfloat_t value = A;
+				for(k = 0; k < PARSER_BATCH_SIZE; k++) {
+					if(mask[k])
+						value[k] = eval_factorial(value[k]);
+				}
+				WRITE(DST, value);
+				break; }
+			case OP_ADD:
+				WRITE(DST, A + B);
+				break;
+			case OP_SUB:
+				WRITE(DST, A - B);
+				break;
+			case OP_MUL:
+				WRITE(DST, A * B);
+				break;
+			case OP_DIV: {
+				vmask_t zero = mask & (B == vbroadcast(0.0f));
+
+				// точки с делением на ноль дальше не вычисляются
+				if(vmask_any(&zero)) {
+					error = 15; // dividing by zero
+					alive &= ~zero;
+					mask &= ~zero;
+					full = 0;
+
+					if(!vmask_any(&alive))
+						goto finish;
+				}
+
+				WRITE(DST, A / B);
+				break; }
+			case OP_FDIV:
+				WRITE(DST, A / B);
+				break;
+			case OP_POW: {
+				vfloat_t value = A, part = B;
+				float p = 0.0f;
+				unsigned power = 0;
+
+				// одинаковый целый показатель - умножения как в eval_int_power
+				if(vuniform(&part, &mask, &p) && (power = int_power(p)) != 0) {
+					unsigned bit = MAX_INT_POWER;
+					vfloat_t result = value;
+
+					while(!(power & bit))
+						bit >>= 1;
+
+					for(bit >>= 1; bit; bit >>= 1) {
+						result *= result;
+						if(power & bit)
+							result *= value;
+					}
+
+					WRITE(DST, result);
+					break;
+				}
+
+				for(k = 0; k < PARSER_BATCH_SIZE; k++)
+					value[k] = eval_power(value[k], part[k]);
+				WRITE(DST, value);
+				break; }
+			case OP_GT:
+				WRITE(DST, vmask_to_float(A > B));
+				break;
+			case OP_LT:
+				WRITE(DST, vmask_to_float(A < B));
+				break;
+			case OP_GE:
+				WRITE(DST, vmask_to_float(A >= B));
+				break;
+			case OP_LE:
+				WRITE(DST, vmask_to_float(A <= B));
+				break;
+			case OP_EQ:
+				WRITE(DST, vmask_to_float(A == B));
+				break;
+			case OP_NE:
+				WRITE(DST, vmask_to_float(A != B));
+				break;
+			case OP_CALL: {
+				vfloat_t value = DST;
+				vcall_func(ins, registers, &mask, &value);
+				WRITE(DST, value);
+				break; }
+			case OP_JZ: {
+				vmask_t cond = (A != vbroadcast(0.0f));
+				vmask_t then_mask = mask & cond, else_mask = mask & ~cond;
+
+				// условие одинаково для всех точек - обычный переход
+				if(!vmask_any(&else_mask))
+					break;
+
+				if(!vmask_any(&then_mask)) {
+					ins = begin + ins->target;
+					continue;
+				}
+
+				if(depth >= MAX_NUM_BATCH_BRANCHES)
+					return BATCH_SCALAR_FALLBACK;
+
+				batch_branch_t *branch = &branches[depth++];
+				branch->saved_mask = mask;
+				branch->else_mask = else_mask;
+				branch->else_begin = ins->target;
+				branch->end = 0;
+				branch->in_else = 0;
+
+				mask = then_mask;
+				full = 0;
+				break; }
+			case OP_JMP:
+				// конец ветки "истина": выполняем ветку "ложь" для остальных точек
+				if(depth > 0 && !branches[depth - 1].in_else && index + 1 == branches[depth - 1].else_begin) {
+					batch_branch_t *branch = &branches[depth - 1];
+
+					branch->in_else = 1;
+					branch->end = ins->target;
+
+					mask = branch->else_mask & alive;
+					full = 0;
+					break;
+				}
+
+				ins = begin + ins->target;
+				continue;
+			case OP_LOOP_BEGIN: {
+				loop_state_t *loop = &loops[ins->args[2]];
+				float loop_begin = 0.0f, loop_end = 0.0f;
+
+				if(!vuniform(&A, &mask, &loop_begin) || !vuniform(&B, &mask, &loop_end))
+					return BATCH_SCALAR_FALLBACK;
+
+				// ошибку в границах вычисляем по точкам
+				if(loop_start(loop, loop_begin, loop_end) != 0)
+					return BATCH_SCALAR_FALLBACK;
+
+				WRITE(DST, vbroadcast(0.0f));
+				WRITE(registers[PARSER_REG_I], vbroadcast((float) loop->counter));
+				break; }
+			case OP_LOOP_NEXT: {
+				loop_state_t *loop = &loops[ins->args[2]];
+
+				WRITE(DST, DST + A);
+
+				if(is_stopping)
+					goto finish;
+
+				if(loop->counter != loop->end) {
+					loop->counter += loop->step;
+
+					WRITE(registers[PARSER_REG_I], vbroadcast((float) loop->counter));
+
+					ins = begin + ins->target;
+					continue;
+				}
+
+				WRITE(registers[PARSER_REG_I], vbroadcast(0.0f));
+				break; }
+		}
+
+		ins++;
+	}
+
+#undef A
+#undef B
+#undef DST
+#undef WRITE
+
+finish:
+	for(k = 0; k < count; k++)
+		result[k] = alive[k] ? registers[PARSER_REG_D][k] : 0.0f;
+
+	return error;
+}
+
+static int eval_batch_default(const parser_program_t *program, const float *inputs,
+							  float x0, float y, float z, unsigned count, float *result)
+{
+	return eval_batch(program, inputs, x0, count, result);
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+
+__attribute__((target("avx2")))
+static int eval_batch_avx2(const parser_program_t *program, const float *inputs,
+						   float x0, float y, float z, unsigned count, float *result)
+{
+	return eval_batch(program, inputs, x0, count, result);
+}
+
+__attribute__((target("avx512f")))
+static int eval_batch_avx512(const parser_program_t *program, const float *inputs,
+							 float x0, float y, float z, unsigned count, float *result)
+{
+	return eval_batch(program, inputs, x0, count, result);
+}
+
+#endif
+
+#undef VSELECT
+#undef vbroadcast
+#undef vmask_to_float
+#undef BATCH_INLINE
+
+#else /* __GNUC__ */
+
+// без векторных расширений компилятора вычисляем по одной точке
+#define eval_batch_default eval_batch_scalar
+
+#endif /* __GNUC__ */
+
+// выбрать реализацию пакетного вычисления для текущего процессора
+static eval_batch_func_t select_eval_batch()
+{
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+	__builtin_cpu_init();
+
+	if(__builtin_cpu_supports("avx512f")) {
+		TRACE_MSG("using AVX-512 batch evaluation\n");
+		return eval_batch_avx512;
+	}
+
+	if(__builtin_cpu_supports("avx2")) {
+		TRACE_MSG("using AVX2 batch evaluation\n");
+		return eval_batch_avx2;
+	}
+#endif
+
+	return eval_batch_default;
+}
+
+static eval_batch_func_t eval_batch_func = NULL;
+
+/////////////// ----- JIT (x86-64)
+
+/*
+ * Программа транслируется в машинный код x86-64 (SSE, System V ABI) вида
+ * int func(float *registers) с той же семантикой, что и parser_program_eval.
+ * Регистры программы остаются в памяти (адрес в rbx), состояния циклов - в кадре стека.
+ * Встроенные функции, степень и факториал вызываются те же, что и в интерпретаторе,
+ * поэтому результаты совпадают с ним
+ */
+
+#ifdef PARSER_JIT
+
+// коды SSE-инструкций (F3 0F xx)
+#define SSE_MOVSS 0x10
+#define SSE_STORE 0x11
+#define SSE_SQRT 0x51
+#define SSE_ADD 0x58
+#define SSE_MUL 0x59
+#define SSE_SUB 0x5C
+#define SSE_MIN 0x5D
+#define SSE_DIV 0x5E
+#define SSE_MAX 0x5F
+
+// условные переходы (0F xx)
+#define JCC_B 0x82
+#define JCC_AE 0x83
+#define JCC_E 0x84
+#define JCC_NE 0x85
+#define JCC_BE 0x86
+
+// метки, на которые ссылаются переходы, кроме инструкций программы
+#define JIT_LABEL_END(n) (n)
+#define JIT_LABEL_DIV_ZERO(n) ((n) + 1)
+#define JIT_LABEL_ERROR(n) ((n) + 2)
+
+typedef struct {
+	unsigned char *code;
+	unsigned size;
+	unsigned capacity;
+	int error;
+
+	// регистр программы, значение которого сейчас в xmm0 (-1 - нет такого)
+	int cached;
+} jit_buffer_t;
+
+// переход, смещение которого станет известно после трансляции всей программы
+typedef struct {
+	unsigned pos;
+	unsigned target;
+} jit_fixup_t;
+
+#define JIT_BYTES(b, ...) \
+	jit_emit((b), (const unsigned char[]) {__VA_ARGS__}, sizeof((const unsigned char[]) {__VA_ARGS__}))
+
+static void jit_emit(jit_buffer_t *b, const unsigned char *bytes, unsigned n)
+{
+	if(b->error)
+		return;
+
+	if(b->size + n > b->capacity) {
+		unsigned capacity = b->capacity * 2 + n;
+		unsigned char *code = (unsigned char*) realloc(b->code, capacity);
+
+		if(!code) {
+			b->error = 1;
 			return;
 		}
-		
-		float s = 1.0f;
-		for(unsigned i = 1; i <= (unsigned) *value; i += 1) {
-			s *= i;
-		}
-		*value = s;
-		
-		p->index++;
+
+		b->code = code;
+		b->capacity = capacity;
 	}
+
+	memcpy(b->code + b->size, bytes, n);
+	b->size += n;
 }
 
-// вычисление унарного + и -
-static void eval_expr9(parser_t *p, float *value)
+static void jit_u32(jit_buffer_t *b, unsigned value)
 {
+	jit_emit(b, (const unsigned char*) &value, 4);
+}
 
-	if(is_stopping)
-		return;
+static void jit_u64(jit_buffer_t *b, unsigned long long value)
+{
+	jit_emit(b, (const unsigned char*) &value, 8);
+}
 
-	int last = -1;
-	
-	if(p->tokens[p->index].type == PLUS || p->tokens[p->index].type == MINUS) {
-		// если токен + или -, то смещаемся к след. токену..
-		last = p->index++;
-	}
-	// ...и вычисляем выражение (после + или -) 
-	eval_expr10(p, value);
-	
-	if(p->skip_expr)
-		return;
-	
-	// если был обнаружен унарный -, то меняем знак
-	if(last > -1)
-		if(p->tokens[last].type == MINUS) {
-			DMSG("found unary: %s (i = %i)\n", p->tokens[last].data, last);
-			*value = -(*value);
-			//DMSG("value = %f\n", *value);
-		}
+// ModRM для операнда [rbx + 4 * reg] (регистр программы)
+static void jit_reg_operand(jit_buffer_t *b, int r, unsigned reg)
+{
+	JIT_BYTES(b, 0x83 | (r << 3));
+	jit_u32(b, reg * sizeof(float));
 }
 
-// вычисление возведения в степень
-static void eval_expr8(parser_t *p, float *value)
+// ModRM и SIB для операнда [rsp + offset] (состояние цикла)
+static void jit_stack_operand(jit_buffer_t *b, int r, unsigned offset)
 {
+	JIT_BYTES(b, 0x84 | (r << 3), 0x24);
+	jit_u32(b, offset);
+}
 
-	if(is_stopping)
-		return;
+// op xmm, [reg]
+static void jit_sse(jit_buffer_t *b, int opcode, int xmm, unsigned reg)
+{
+	JIT_BYTES(b, 0xF3, 0x0F, opcode);
+	jit_reg_operand(b, xmm, reg);
 
-	eval_expr9(p, value);
+	if(xmm == 0)
+		b->cached = (opcode == SSE_MOVSS || opcode == SSE_STORE) ? (int) reg : -1;
+}
 
-	if(p->tokens[p->index].type == MULT_MULT) {
-		
-		// степень
-		float part = 0.0f;
-		
-		DMSG("found power: %s (i = %i)\n", p->tokens[p->index].data, p->index);
-		p->index++;
-		eval_expr8(p, &part);
-		
-		if(p->skip_expr)
-			return;
-		
-		
-		// оптимизации возведения
-		
-		if(part == 0.0f) {
-			*value = 1.0f;
-			return;
-		}
-		
-		if(*value == 0.0f) {
-			*value = 0.0f;
-			return;
-		}
-		
-		if(part == 1.0f) {
-			return;
-		}
-		
-		if(part == 2.0f) {
-			*value = *value * *value;
-			return;
-		}
-		
-		if(part == 3.0f) {
-			*value = *value * *value* *value;
-			return;
-		}
-		
+// movss xmm0, [reg], если значения reg ещё нет в xmm0
+static void jit_load(jit_buffer_t *b, unsigned reg)
+{
+	if(b->cached != (int) reg)
+		jit_sse(b, SSE_MOVSS, 0, reg);
+}
 
-		//DMSG("part = %f ** value = %f (i = %i)\n", part, *value, index);
-		*value = powf(*value, part);
-	}
+// movss [reg], xmm0
+static void jit_store(jit_buffer_t *b, unsigned reg)
+{
+	jit_sse(b, SSE_STORE, 0, reg);
+}
+
+// mov dword [reg], value
+static void jit_store_imm(jit_buffer_t *b, unsigned reg, float value)
+{
+	unsigned bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	JIT_BYTES(b, 0xC7);
+	jit_reg_operand(b, 0, reg);
+	jit_u32(b, bits);
+
+	if(b->cached == (int) reg)
+		b->cached = -1;
+}
+
+// вызов функции по абсолютному адресу (mov rax, func; call rax)
+static void jit_call(jit_buffer_t *b, const void *func)
+{
+	JIT_BYTES(b, 0x48, 0xB8);
+	jit_u64(b, (unsigned long long) (size_t) func);
+	JIT_BYTES(b, 0xFF, 0xD0);
+
+	b->cached = -1;
 }
 
-// вычисление * и /
-static void eval_expr7(parser_t *p, float *value)
+// переход (cc - код условного перехода или 0), возвращает позицию смещения
+static unsigned jit_jump(jit_buffer_t *b, int cc)
 {
+	if(cc)
+		JIT_BYTES(b, 0x0F, cc);
+	else
+		JIT_BYTES(b, 0xE9);
+
+	unsigned pos = b->size;
+	jit_u32(b, 0);
+
+	return pos;
+}
 
-	if(is_stopping)
+static void jit_patch(jit_buffer_t *b, unsigned pos, unsigned target)
+{
+	if(b->error)
 		return;
 
-	eval_expr8(p, value);
-	
-	while(p->tokens[p->index].type == MULT || p->tokens[p->index].type == DIV) {
-		float part = 0.0f;
-		int last = 0;
-		DMSG("found arithmetic: %s (i = %i)\n", p->tokens[p->index].data, p->index);
-		last = p->index++;
-		
-		// вычисляем выражение после арифм. операции
-		eval_expr8(p, &part);
-		
-		if(p->skip_expr)
-			return;
-		
-		switch(p->tokens[last].type) {
-			case MULT:
-				*value *= part;
-				break;
-			case DIV:
-				if(part == 0.0f) {
-					set_error(p, "dividing by zero", 15);
-					*value = 0.0f;
-					return;
-				}
-				*value /= part;
-				break;
-		};
-		DMSG("value = %f (i = %i)\n", *value, p->index);
-	}
+	int rel = (int) target - (int) (pos + 4);
+	memcpy(b->code + pos, &rel, 4);
+}
+
+// переход, если регистр reg равен нулю: ucomiss xmm1 (0), [reg]; jp skip; je target
+static unsigned jit_jump_if_zero(jit_buffer_t *b, unsigned reg)
+{
+	JIT_BYTES(b, 0x0F, 0x57, 0xC9);
+	JIT_BYTES(b, 0x0F, 0x2E);
+	jit_reg_operand(b, 1, reg);
+
+	// NaN не равно нулю
+	JIT_BYTES(b, 0x7A, 0x06);
+
+	return jit_jump(b, JCC_E);
 }
 
-// вычисление + и -
-static void eval_expr6(parser_t *p, float *value)
+// сравнение: cmpss xmm0 (reg_a), [reg_b], predicate; результат 1.0f или 0.0f
+static void jit_compare(jit_buffer_t *b, unsigned dst, unsigned reg_a, unsigned reg_b, int predicate)
 {
+	jit_load(b, reg_a);
+	JIT_BYTES(b, 0xF3, 0x0F, 0xC2);
+	jit_reg_operand(b, 0, reg_b);
+	JIT_BYTES(b, predicate);
+	b->cached = -1;
+
+	// andps xmm0, 1.0f
+	JIT_BYTES(b, 0xB8, 0x00, 0x00, 0x80, 0x3F);
+	JIT_BYTES(b, 0x66, 0x0F, 0x6E, 0xC8);
+	JIT_BYTES(b, 0x0F, 0x54, 0xC1);
+
+	jit_store(b, dst);
+}
 
-	if(is_stopping)
+static void jit_call_func(jit_buffer_t *b, const instruction_t *ins)
+{
+	const unsigned short *args = ins->args;
+
+	// простые функции заменяются инструкциями с тем же результатом
+	if(ins->func == (void*) call_sqrtf) {
+		jit_sse(b, SSE_SQRT, 0, args[0]);
+	} else if(ins->func == (void*) call_minf || ins->func == (void*) call_maxf) {
+		// minss/maxss: a < b ? a : b, как и math_min
+		jit_load(b, args[0]);
+		jit_sse(b, (ins->func == (void*) call_minf) ? SSE_MIN : SSE_MAX, 0, args[1]);
+	} else if(ins->func == (void*) call_fabs) {
+		// mov eax, [a]; and eax, 0x7FFFFFFF; mov [dst], eax
+		JIT_BYTES(b, 0x8B);
+		jit_reg_operand(b, 0, args[0]);
+		JIT_BYTES(b, 0x25, 0xFF, 0xFF, 0xFF, 0x7F);
+		JIT_BYTES(b, 0x89);
+		jit_reg_operand(b, 0, ins->dst);
+		b->cached = -1;
 		return;
+	} else {
+		jit_load(b, args[0]);
+		for(unsigned k = 1; k < ins->n_args; k++)
+			jit_sse(b, SSE_MOVSS, k, args[k]);
 
-	eval_expr7(p, value);
-	
-	while(p->tokens[p->index].type == PLUS || p->tokens[p->index].type == MINUS) {
-		float part = 0.0f;
-		int last = 0;
-		DMSG("found arithmetic: %s (i = %i)\n", p->tokens[p->index].data, p->index);
-		last = p->index++;
-		
-		// вычисляем выражение после арифм. операции
-		eval_expr7(p, &part);
-		
-		if(p->skip_expr)
-			return;
-		
-		switch(p->tokens[last].type) {
-			case PLUS:
-				*value += part;
-				break;
-			case MINUS:
-				*value -= part;
-				break;
-		};
+		jit_call(b, ins->func);
 	}
+
+	jit_store(b, ins->dst);
 }
 
-// вычисление операций сравнения > < >= <=
-static void eval_expr5(parser_t *p, float *value)
+static void jit_loop_begin(jit_buffer_t *b, const instruction_t *ins, jit_fixup_t *fixups,
+						   unsigned *num_fixups, unsigned error_label)
 {
+	unsigned state = ins->args[2] * sizeof(loop_state_t);
+
+	// lea rdi, [state]; xmm0 = a; xmm1 = b; eax = loop_start(); test eax, eax; jnz error
+	JIT_BYTES(b, 0x48, 0x8D);
+	jit_stack_operand(b, 7, state);
+	jit_load(b, ins->args[0]);
+	jit_sse(b, SSE_MOVSS, 1, ins->args[1]);
+	jit_call(b, (const void*) loop_start);
+	JIT_BYTES(b, 0x85, 0xC0);
+	fixups[*num_fixups].pos = jit_jump(b, JCC_NE);
+	fixups[(*num_fixups)++].target = error_label;
+
+	jit_store_imm(b, ins->dst, 0.0f);
+
+	// i = (float) counter: cvtsi2ss xmm0, dword [counter]
+	JIT_BYTES(b, 0xF3, 0x0F, 0x2A);
+	jit_stack_operand(b, 0, state + offsetof(loop_state_t, counter));
+	jit_store(b, PARSER_REG_I);
+}
 
-	if(is_stopping)
-		return;
+static void jit_loop_next(jit_buffer_t *b, const instruction_t *ins, jit_fixup_t *fixups,
+						  unsigned *num_fixups, unsigned end_label)
+{
+	unsigned state = ins->args[2] * sizeof(loop_state_t);
+
+	// вычисляем сумму
+	jit_load(b, ins->dst);
+	jit_sse(b, SSE_ADD, 0, ins->args[0]);
+	jit_store(b, ins->dst);
+
+	// mov rax, &is_stopping; cmp dword [rax], 0; jne end
+	JIT_BYTES(b, 0x48, 0xB8);
+	jit_u64(b, (unsigned long long) (size_t) &is_stopping);
+	JIT_BYTES(b, 0x83, 0x38, 0x00);
+	fixups[*num_fixups].pos = jit_jump(b, JCC_NE);
+	fixups[(*num_fixups)++].target = end_label;
+
+	// mov eax, [counter]; cmp eax, [end]; je exit; add eax, [step]; mov [counter], eax
+	JIT_BYTES(b, 0x8B);
+	jit_stack_operand(b, 0, state + offsetof(loop_state_t, counter));
+	JIT_BYTES(b, 0x3B);
+	jit_stack_operand(b, 0, state + offsetof(loop_state_t, end));
+	unsigned exit = jit_jump(b, JCC_E);
+	JIT_BYTES(b, 0x03);
+	jit_stack_operand(b, 0, state + offsetof(loop_state_t, step));
+	JIT_BYTES(b, 0x89);
+	jit_stack_operand(b, 0, state + offsetof(loop_state_t, counter));
+
+	// следующая итерация: cvtsi2ss xmm0, eax; i = xmm0
+	JIT_BYTES(b, 0xF3, 0x0F, 0x2A, 0xC0);
+	b->cached = -1;
+	jit_store(b, PARSER_REG_I);
+	fixups[*num_fixups].pos = jit_jump(b, 0);
+	fixups[(*num_fixups)++].target = ins->target;
+
+	// выход из цикла: обнуляем переменную i
+	jit_patch(b, exit, b->size);
+	jit_store_imm(b, PARSER_REG_I, 0.0f);
+}
 
-	eval_expr6(p, value);
-	
-	if(p->tokens[p->index].type == GREATER || p->tokens[p->index].type == LESS ||
-	   p->tokens[p->index].type == GRT_EQL || p->tokens[p->index].type == LESS_EQL) {
-		
-		float part = 0.0f;
-		int last = 0;
-		
-		DMSG("found relational-operator: %s (i = %i)\n", p->tokens[p->index].data, p->index);
-		
-		last = p->index++;
-		eval_expr6(p, &part);
-		
-		if(p->skip_expr)
-			return;
-		
-		switch(p->tokens[last].type) {
-			case GREATER:
-				*value = *value > part;
+// транслировать программу в буфер b
+static void jit_translate(const parser_program_t *program, jit_buffer_t *b,
+						  unsigned *offsets, jit_fixup_t *fixups)
+{
+	const unsigned n = program->num_instructions;
+	unsigned num_fixups = 0;
+
+	// на инструкциях, куда есть переходы, значение xmm0 неизвестно (offsets[i] = 1)
+	memset(offsets, 0, sizeof(unsigned) * (n + 3));
+	for(unsigned i = 0; i < n; i++) {
+		const instruction_t *ins = &program->instructions[i];
+
+		if(ins->opcode == OP_JZ || ins->opcode == OP_JMP || ins->opcode == OP_LOOP_NEXT)
+			offsets[ins->target] = 1;
+	}
+
+	// кадр стека выровнен по 16 байт (после push rbx), чтобы вызывать функции
+	unsigned frame = (program->num_loops * sizeof(loop_state_t) + 15) & ~15u;
+
+	// push rbx; mov rbx, rdi; sub rsp, frame
+	JIT_BYTES(b, 0x53, 0x48, 0x89, 0xFB);
+	JIT_BYTES(b, 0x48, 0x81, 0xEC);
+	jit_u32(b, frame);
+
+	// обнуляем d, i и пользовательские переменные
+	jit_store_imm(b, PARSER_REG_D, 0.0f);
+	jit_store_imm(b, PARSER_REG_I, 0.0f);
+	for(unsigned i = 0; i < program->num_user_vars; i++)
+		jit_store_imm(b, PARSER_NUM_BUILTIN_REGS + i, 0.0f);
+
+	for(unsigned i = 0; i < n; i++) {
+		const instruction_t *ins = &program->instructions[i];
+		const unsigned short *args = ins->args;
+
+		if(offsets[i])
+			b->cached = -1;
+
+		offsets[i] = b->size;
+
+		switch(ins->opcode) {
+			case OP_CONST:
+				jit_store_imm(b, ins->dst, ins->value);
+				break;
+			case OP_MOV:
+			case OP_NEG:
+				// mov eax, [a]; (xor eax, 0x80000000); mov [dst], eax
+				JIT_BYTES(b, 0x8B);
+				jit_reg_operand(b, 0, args[0]);
+				if(ins->opcode == OP_NEG)
+					JIT_BYTES(b, 0x35, 0x00, 0x00, 0x00, 0x80);
+				JIT_BYTES(b, 0x89);
+				jit_reg_operand(b, 0, ins->dst);
+				b->cached = -1;
 				break;
-			case LESS:
-				*value = *value < part;
+			case OP_FACT:
+				jit_load(b, args[0]);
+				jit_call(b, (const void*) eval_factorial);
+				jit_store(b, ins->dst);
 				break;
-			case GRT_EQL:
-				*value = *value >= part;
+			case OP_ADD:
+			case OP_MUL: {
+				// второй операнд уже в xmm0 - меняем операнды местами
+				int swap = (b->cached == (int) args[1]);
+
+				jit_load(b, args[swap]);
+				jit_sse(b, (ins->opcode == OP_ADD) ? SSE_ADD : SSE_MUL, 0, args[!swap]);
+				jit_store(b, ins->dst);
+				break; }
+			case OP_SUB:
+			case OP_FDIV:
+				jit_load(b, args[0]);
+				jit_sse(b, (ins->opcode == OP_SUB) ? SSE_SUB : SSE_DIV, 0, args[1]);
+				jit_store(b, ins->dst);
 				break;
-			case LESS_EQL:
-				*value = *value <= part;
+			case OP_DIV:
+				fixups[num_fixups].pos = jit_jump_if_zero(b, args[1]);
+				fixups[num_fixups++].target = JIT_LABEL_DIV_ZERO(n);
+				jit_load(b, args[0]);
+				jit_sse(b, SSE_DIV, 0, args[1]);
+				jit_store(b, ins->dst);
 				break;
-		};
+			case OP_POW:
+				// постоянные целые показатели уже заменены умножениями (opt_lower_power)
+				jit_load(b, args[0]);
+				jit_sse(b, SSE_MOVSS, 1, args[1]);
+				jit_call(b, (const void*) eval_power);
+				jit_store(b, ins->dst);
+				break;
+			case OP_GT:
+				jit_compare(b, ins->dst, args[1], args[0], 1);
+				break;
+			case OP_LT:
+				jit_compare(b, ins->dst, args[0], args[1], 1);
+				break;
+			case OP_GE:
+				jit_compare(b, ins->dst, args[1], args[0], 2);
+				break;
+			case OP_LE:
+				jit_compare(b, ins->dst, args[0], args[1], 2);
+				break;
+			case OP_EQ:
+				jit_compare(b, ins->dst, args[0], args[1], 0);
+				break;
+			case OP_NE:
+				jit_compare(b, ins->dst, args[0], args[1], 4);
+				break;
+			case OP_CALL:
+				jit_call_func(b, ins);
+				break;
+			case OP_JZ:
+				fixups[num_fixups].pos = jit_jump_if_zero(b, args[0]);
+				fixups[num_fixups++].target = ins->target;
+				break;
+			case OP_JMP:
+				fixups[num_fixups].pos = jit_jump(b, 0);
+				fixups[num_fixups++].target = ins->target;
+				break;
+			case OP_LOOP_BEGIN:
+				jit_loop_begin(b, ins, fixups, &num_fixups, JIT_LABEL_ERROR(n));
+				break;
+			case OP_LOOP_NEXT:
+				jit_loop_next(b, ins, fixups, &num_fixups, JIT_LABEL_END(n));
+				break;
+		}
+	}
+
+	// xor eax, eax; add rsp, frame; pop rbx; ret
+	offsets[JIT_LABEL_END(n)] = b->size;
+	JIT_BYTES(b, 0x31, 0xC0);
+	unsigned ret = b->size;
+	JIT_BYTES(b, 0x48, 0x81, 0xC4);
+	jit_u32(b, frame);
+	JIT_BYTES(b, 0x5B, 0xC3);
+
+	// mov eax, 15 (dividing by zero); jmp ret
+	offsets[JIT_LABEL_DIV_ZERO(n)] = b->size;
+	JIT_BYTES(b, 0xB8, 15, 0x00, 0x00, 0x00);
+	jit_patch(b, jit_jump(b, 0), ret);
+
+	// номер ошибки уже в eax
+	offsets[JIT_LABEL_ERROR(n)] = ret;
+
+	for(unsigned i = 0; i < num_fixups; i++)
+		jit_patch(b, fixups[i].pos, offsets[fixups[i].target]);
+}
+
+// транслировать программу в машинный код (program->jit_code)
+static int jit_compile(parser_program_t *program)
+{
+	const unsigned n = program->num_instructions;
+	jit_buffer_t b = {NULL, 0, 0, 0, -1};
+
+	// на каждую инструкцию не более двух переходов на метки
+	unsigned *offsets = (unsigned*) malloc(sizeof(unsigned) * (n + 3));
+	jit_fixup_t *fixups = (jit_fixup_t*) malloc(sizeof(jit_fixup_t) * (2 * n + 1));
+
+	if(offsets && fixups)
+		jit_translate(program, &b, offsets, fixups);
+	else
+		b.error = 1;
+
+	free(offsets);
+	free(fixups);
+
+	void *code = MAP_FAILED;
+
+	if(!b.error) {
+		code = mmap(NULL, b.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if(code != MAP_FAILED) {
+			memcpy(code, b.code, b.size);
+
+			if(mprotect(code, b.size, PROT_READ | PROT_EXEC) != 0) {
+				munmap(code, b.size);
+				code = MAP_FAILED;
+			}
+		}
 	}
+
+	free(b.code);
+
+	IF_FAILED_RET(code != MAP_FAILED, -1);
+
+	program->jit_code = code;
+	program->jit_size = b.size;
+
+	return 0;
 }
 
-// вычисление операций сравнения != ==
-static void eval_expr4(parser_t *p, float *value)
+#undef JIT_BYTES
+
+#endif /* PARSER_JIT */
+
+/////////////// ----- генерация кода на C
+
+/*
+ * Программа переводится в исходный код на C, который компилируется системным
+ * компилятором в разделяемую библиотеку в каталоге кэша и загружается через dlopen.
+ * Имя библиотеки - хэш исходного кода и параметров компилятора, поэтому повторная
+ * компиляция той же функции только загружает готовую библиотеку.
+ * Встроенные функции вызываются по указателям из program->native_funcs
+ * (funcs[i] - функция инструкции i), поэтому результаты совпадают с интерпретатором
+ */
+
+#ifdef PARSER_NATIVE
+
+// параметры компилятора (без -ffp-contract=off результат отличался бы из-за FMA)
+#define NATIVE_CFLAGS "-O3 -march=native -ffp-contract=off -fno-math-errno -fPIC -shared"
+
+#define NATIVE_MAX_PATH 1024
+
+typedef struct {
+	char *data;
+	unsigned size;
+	unsigned capacity;
+	int error;
+} native_source_t;
+
+static void native_printf(native_source_t *src, const char *format, ...)
 {
+	va_list args, args_copy;
 
-	if(is_stopping)
+	if(src->error)
 		return;
 
-	eval_expr5(p, value);
-	int last = 0;
-	
-	if(p->tokens[p->index].type == EQL_EQL || p->tokens[p->index].type == NOT_EQL) {
-		
-		float part = 0.0f;
-		
-		DMSG("found equal-operator: %s (i = %i)\n", p->tokens[p->index].data, p->index);
-		
-		last = p->index++;
-		eval_expr5(p, &part);
-		
-		if(p->skip_expr)
-			return;
-		
-		switch(p->tokens[last].type) {
-			case EQL_EQL:
-				*value = *value == part;
+	va_start(args, format);
+
+	for(;;) {
+		va_copy(args_copy, args);
+		int n = vsnprintf(src->data + src->size, src->capacity - src->size, format, args_copy);
+		va_end(args_copy);
+
+		if(n < 0) {
+			src->error = 1;
+			break;
+		}
+
+		if(src->size + n < src->capacity) {
+			src->size += n;
+			break;
+		}
+
+		unsigned capacity = src->capacity * 2 + n + 1;
+		char *data = (char*) realloc(src->data, capacity);
+
+		if(!data) {
+			src->error = 1;
+			break;
+		}
+
+		src->data = data;
+		src->capacity = capacity;
+	}
+
+	va_end(args);
+}
+
+// константа, точно представленная в исходном коде
+static void native_float(native_source_t *src, float value)
+{
+	if(isnan(value))
+		native_printf(src, "__builtin_nanf(\"\")");
+	else if(isinf(value))
+		native_printf(src, (value > 0.0f) ? "__builtin_inff()" : "-__builtin_inff()");
+	else
+		native_printf(src, "%af", value);
+}
+
+static const char native_prelude[] =
+	"#include <math.h>\n"
+	"typedef float (*f1_t)(float);\n"
+	"typedef float (*f2_t)(float, float);\n"
+	"typedef float (*f3_t)(float, float, float);\n"
+	"typedef float (*f4_t)(float, float, float, float);\n"
+	"typedef float (*f5_t)(float, float, float, float, float);\n"
+	"typedef float (*f6_t)(float, float, float, float, float, float);\n"
+	"\n"
+	"static inline __attribute__((always_inline))\n"
+	"int body(void *const *funcs, const volatile int *stop, float x, float y, float z, float *d)\n"
+	"{\n";
+
+static const char native_epilogue[] =
+	"\n"
+	"int vrender_eval(void *const *funcs, const int *stop, float *r)\n"
+	"{\n"
+	"\treturn body(funcs, stop, r[1], r[2], r[3], &r[0]);\n"
+	"}\n"
+	"\n"
+	"int vrender_eval_row(void *const *funcs, const int *stop, float x0, float y, float z,\n"
+	"\t\t\t\t\t unsigned count, float *result)\n"
+	"{\n"
+	"\tint error = 0;\n"
+	"\tfor(unsigned k = 0; k < count; k++) {\n"
+	"\t\tfloat d = 0.0f;\n"
+	"\t\tint e = body(funcs, stop, x0 + k, y, z, &d);\n"
+	"\t\tresult[k] = e ? 0.0f : d;\n"
+	"\t\terror = e ? e : error;\n"
+	"\t}\n"
+	"\treturn error;\n"
+	"}\n";
+
+// перевести программу в исходный код на C (семантика parser_program_eval)
+static void native_generate(const parser_program_t *program, native_source_t *src)
+{
+	const unsigned n = program->num_instructions;
+	static const char *compare_ops[] = {">", "<", ">=", "<=", "==", "!="};
+	static const char *arith_ops[] = {"+", "-", "*"};
+
+	char *labels = (char*) calloc(n + 1, 1);
+	IF_FAILED(labels);
+
+	for(unsigned i = 0; i < n; i++) {
+		const instruction_t *ins = &program->instructions[i];
+
+		if(ins->opcode == OP_JZ || ins->opcode == OP_JMP || ins->opcode == OP_LOOP_NEXT)
+			labels[ins->target] = 1;
+	}
+
+	native_printf(src, "%s", native_prelude);
+
+	// регистры - локальные переменные (x, y, z - параметры), состояния циклов
+	native_printf(src, "\tfloat r0 = 0.0f, r1 = x, r2 = y, r3 = z");
+	for(unsigned r = PARSER_REG_I; r < program->num_registers; r++)
+		native_printf(src, ", r%u = 0.0f", r);
+	native_printf(src, ";\n");
+
+	for(unsigned l = 0; l < program->num_loops; l++)
+		native_printf(src, "\tint c%u = 0, e%u = 0, s%u = 0;\n", l, l, l);
+
+	for(unsigned i = 0; i <= n; i++) {
+
+		if(labels[i])
+			native_printf(src, "L%u:;\n", i);
+
+		if(i == n)
+			break;
+
+		const instruction_t *ins = &program->instructions[i];
+		const unsigned short *args = ins->args;
+		const unsigned l = args[2];
+
+		native_printf(src, "\t");
+
+		switch(ins->opcode) {
+			case OP_CONST:
+				native_printf(src, "r%u = ", ins->dst);
+				native_float(src, ins->value);
+				native_printf(src, ";\n");
+				break;
+			case OP_MOV:
+				native_printf(src, "r%u = r%u;\n", ins->dst, args[0]);
+				break;
+			case OP_NEG:
+				native_printf(src, "r%u = -r%u;\n", ins->dst, args[0]);
+				break;
+			case OP_FACT:
+				native_printf(src, "r%u = ((f1_t) funcs[%u])(r%u);\n", ins->dst, i, args[0]);
+				break;
+			case OP_ADD:
+			case OP_SUB:
+			case OP_MUL:
+				native_printf(src, "r%u = r%u %s r%u;\n", ins->dst, args[0],
+							  arith_ops[ins->opcode - OP_ADD], args[1]);
+				break;
+			case OP_DIV:
+				native_printf(src, "if(r%u == 0.0f) return 15;\n\t", args[1]);
+				// далее как OP_FDIV
+			case OP_FDIV:
+				native_printf(src, "r%u = r%u / r%u;\n", ins->dst, args[0], args[1]);
+				break;
+			case OP_POW:
+				native_printf(src, "r%u = ((f2_t) funcs[%u])(r%u, r%u);\n", ins->dst, i, args[0], args[1]);
+				break;
+			case OP_GT:
+			case OP_LT:
+			case OP_GE:
+			case OP_LE:
+			case OP_EQ:
+			case OP_NE:
+				native_printf(src, "r%u = (float) (r%u %s r%u);\n", ins->dst, args[0],
+							  compare_ops[ins->opcode - OP_GT], args[1]);
+				break;
+			case OP_CALL:
+				// простые функции - выражениями с тем же результатом
+				if(ins->func == (void*) call_sqrtf) {
+					native_printf(src, "r%u = sqrtf(r%u);\n", ins->dst, args[0]);
+				} else if(ins->func == (void*) call_fabs) {
+					native_printf(src, "r%u = fabsf(r%u);\n", ins->dst, args[0]);
+				} else if(ins->func == (void*) call_minf || ins->func == (void*) call_maxf) {
+					native_printf(src, "r%u = (r%u %s r%u) ? r%u : r%u;\n", ins->dst, args[0],
+								  (ins->func == (void*) call_minf) ? "<" : ">", args[1], args[0], args[1]);
+				} else {
+					native_printf(src, "r%u = ((f%u_t) funcs[%u])(", ins->dst, ins->n_args, i);
+					for(unsigned k = 0; k < ins->n_args; k++)
+						native_printf(src, (k == 0) ? "r%u" : ", r%u", args[k]);
+					native_printf(src, ");\n");
+				}
+				break;
+			case OP_JZ:
+				native_printf(src, "if(r%u == 0.0f) goto L%u;\n", args[0], ins->target);
+				break;
+			case OP_JMP:
+				native_printf(src, "goto L%u;\n", ins->target);
+				break;
+			case OP_LOOP_BEGIN:
+				// те же проверки границ, что и в loop_start
+				native_printf(src, "if(!(r%u >= %d.0f && r%u <= %d.0f && r%u >= %d.0f && r%u <= %d.0f)) "
+							  "return 18;\n", args[0], -MAX_LOOP_BOUND, args[0], MAX_LOOP_BOUND,
+							  args[1], -MAX_LOOP_BOUND, args[1], MAX_LOOP_BOUND);
+				native_printf(src, "\tc%u = (int) r%u; e%u = (int) r%u; s%u = (c%u <= e%u) ? 1 : -1;\n",
+							  l, args[0], l, args[1], l, l, l);
+				native_printf(src, "\tif((e%u - c%u) * s%u >= %d) return 18;\n",
+							  l, l, l, MAX_LOOP_ITERATIONS);
+				native_printf(src, "\tr%u = 0.0f; r%u = (float) c%u;\n", ins->dst, PARSER_REG_I, l);
 				break;
-			case NOT_EQL:
-				*value = *value != part;
+			case OP_LOOP_NEXT:
+				native_printf(src, "r%u += r%u;\n", ins->dst, args[0]);
+				native_printf(src, "\tif(*stop) return 0;\n");
+				native_printf(src, "\tif(c%u != e%u) { c%u += s%u; r%u = (float) c%u; goto L%u; }\n",
+							  l, l, l, l, PARSER_REG_I, l, ins->target);
+				native_printf(src, "\tr%u = 0.0f;\n", PARSER_REG_I);
 				break;
-		};
+		}
 	}
+
+	native_printf(src, "\t*d = r0;\n\treturn 0;\n}\n%s", native_epilogue);
+
+	free(labels);
 }
 
-// вычисление цикла k..n: expr
-static void eval_expr3(parser_t *p, float *value)
+// 64-битный хэш FNV-1a
+static unsigned long long native_hash(unsigned long long hash, const char *data, unsigned size)
 {
+	for(unsigned i = 0; i < size; i++) {
+		hash ^= (unsigned char) data[i];
+		hash *= 1099511628211ULL;
+	}
 
-	if(is_stopping)
-		return;
+	return hash;
+}
 
-	float begin = 0.0f, end = 0.0f;
-	
-	eval_expr4(p, value);
-	
-	if(p->tokens[p->index].type == DOT_DOT) {
-		DMSG("found loop: %s (i = %i)\n", p->tokens[p->index].data, p->index);
-		
-		begin = *value;
-		
-		p->index++;
-		eval_expr2(p, &end);
-		
-		if(p->tokens[p->index].type == COLON) {
-			float part = 0.0f, sum = 0.0f;
-			int last = 0;
-			
-			DMSG("begin = %f end = %f\n", begin, end);
-			
-			last = ++p->index;
-			
-			// в зависимости от соотношения начала и конца цикла 
-			//  запускаем цикл либо +1, либо -1
-			if(begin <= end) {
-				for(unsigned b = (unsigned) begin; b <= (unsigned) end; b++) {
-
-					if(is_stopping)
-						return;
-
-					p->index = last;
-					
-					// присваиваем i номер текущей итерации
-					assign_variable(p, find_var(p, "i"), (float) b);
-
-					eval_expr0(p, &part);
-					
-					
-					// вычисляем сумму
-					sum += part;
-				}
-			} else {
-				for(unsigned b = (unsigned) begin; b >= (unsigned) end; b--) {
+static int native_write_file(const char *path, const char *data, unsigned size)
+{
+	FILE *file = fopen(path, "wb");
+	IF_FAILED0(file);
+
+	int ok = (fwrite(data, 1, size, file) == size);
+
+	return (fclose(file) == 0) && ok;
+}
+
+int parser_program_compile_native(parser_program_t *program, const char *cache_dir)
+{
+	IF_FAILED_RET(program && program->instructions && cache_dir, -100);
+
+	// путь подставляется в командную строку в кавычках
+	IF_FAILED_RET(strlen(cache_dir) + 64 < NATIVE_MAX_PATH && strchr(cache_dir, '\'') == NULL, -1);
+
+	char path[NATIVE_MAX_PATH], source_path[NATIVE_MAX_PATH], temp_path[NATIVE_MAX_PATH];
+	char command[NATIVE_MAX_PATH * 4];
+
+	native_source_t src = {NULL, 0, 0, 0};
+	native_generate(program, &src);
+
+	if(src.error || !src.data) {
+		free(src.data);
+		ERROR_MSG("can't generate source code\n");
+		return -1;
+	}
 
-					if(is_stopping)
-						return;
+	const char *cc = getenv("CC") ? getenv("CC") : "cc";
 
-					p->index = last;
+	unsigned long long hash = native_hash(14695981039346656037ULL, src.data, src.size);
+	hash = native_hash(hash, cc, strlen(cc));
+	hash = native_hash(hash, NATIVE_CFLAGS, strlen(NATIVE_CFLAGS));
 
-					assign_variable(p, find_var(p, "i"), (float) b);
+	snprintf(path, NATIVE_MAX_PATH, "%s/vrender-%016llx.so", cache_dir, hash);
 
-					eval_expr0(p, &part);
+	void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
 
-					sum += part;
-				}
-			}
-			
-			// обнуляем переменную i
-			assign_variable(p, find_var(p, "i"), 0.0f);
-			
-			*value = sum;
-			//p->index++;
-		} else {
-			set_error(p, "expected :", 4);
+	if(handle) {
+		TRACE_MSG("loaded native code %s from cache\n", path);
+	} else {
+		double time = utils_get_time();
+
+		mkdir(cache_dir, 0755);
+
+		// компилируем во временный файл, чтобы в кэше не оказалось недописанной библиотеки
+		snprintf(source_path, NATIVE_MAX_PATH, "%s/vrender-%016llx.c", cache_dir, hash);
+		snprintf(temp_path, NATIVE_MAX_PATH, "%s/vrender-%016llx.so.%d", cache_dir, hash, (int) getpid());
+		int length = snprintf(command, sizeof(command), "%s " NATIVE_CFLAGS " -o '%s' '%s' -lm",
+							  cc, temp_path, source_path);
+
+		if(length < (int) sizeof(command) && native_write_file(source_path, src.data, src.size) &&
+		   system(command) == 0) {
+			if(rename(temp_path, path) == 0)
+				handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+			else
+				remove(temp_path);
 		}
+
+		if(handle)
+			TRACE_MSG("compiled native code %s in %.2f s\n", path, utils_get_time() - time);
+		else
+			ERROR_MSG("can't compile native code (%s)\n", command);
 	}
-}
 
-// вычисление тернарного : ?
-static void eval_expr2(parser_t *p, float *value)
-{
+	free(src.data);
 
-	if(is_stopping)
-		return;
+	IF_FAILED_RET(handle, -1);
 
-	eval_expr3(p, value);
-	
-	//if(p->skip_expr)
-	//	return;
+	void *eval = dlsym(handle, "vrender_eval");
+	void *eval_row = dlsym(handle, "vrender_eval_row");
+	void **funcs = (void**) calloc(program->num_instructions + 1, sizeof(void*));
 
-	if(p->tokens[p->index].type == QUEST_MARK) {
-		DMSG("found ternary: %s (i = %i)\n", p->tokens[p->index].data, p->index);
-		if(*value != 0.0f) {
-			p->index++;
-			eval_expr(p, value);
+	if(!eval || !eval_row || !funcs) {
+		ERROR_MSG("can't load native code\n");
+		free(funcs);
+		dlclose(handle);
+		return -1;
+	}
 
-			p->index++;
-			
-			// парсим выражение после :, но не вычисляем его
-			float s = 0.0f;
-			p->skip_expr = 1;
-			eval_expr(p, &s);
-			p->skip_expr = 0;
-			
-		} else {
-			
-			int flag_end = 0;
-			// ищем :
-			while(p->tokens[p->index].type != COLON) {
-				if(p->tokens[p->index].type == SEMICOLON || p->index > (p->num_tokens - 1)) {
-					flag_end = 1;
-					break;
-				}
-				p->index++;
-			}
+	// функции инструкций, вызываемые из библиотеки
+	for(unsigned i = 0; i < program->num_instructions; i++) {
+		const instruction_t *ins = &program->instructions[i];
 
-			if(!flag_end) {
-				// если нашли :, то вычисляем выражение после него
-				p->index++;
-				DMSG("found \":\" (i = %i)\n", p->index);
-				eval_expr(p, value);
-			} else {
-				set_error(p, "expected :", 4);
-			}
-		}
+		if(ins->opcode == OP_CALL)
+			funcs[i] = ins->func;
+		else if(ins->opcode == OP_POW)
+			funcs[i] = (void*) eval_power;
+		else if(ins->opcode == OP_FACT)
+			funcs[i] = (void*) eval_factorial;
 	}
+
+	parser_program_destroy_native(program);
+
+	program->native_handle = handle;
+	program->native_eval = eval;
+	program->native_eval_row = eval_row;
+	program->native_funcs = funcs;
+
+	return 0;
 }
 
-// вычисление выражений в присваивании (и само присваивание)
-static void eval_expr1(parser_t *p, float *value)
+void parser_program_destroy_native(parser_program_t *program)
 {
-	
-	if(is_stopping)
-		return;
-
-	if(p->tokens[p->index].type == IDENTIFIER) {
-		
-		DMSG("found identifier: %s\n", p->tokens[p->index].data);
-		
-		int var_id = 0;
-		
-		// это переменная?
-		if((var_id = find_var(p, p->tokens[p->index].data)) == -1) {
-			if(p->tokens[p->index+1].type == PARENTH_LEFT) {
-				// скорее всего это функция (т.к. есть открывающая скобка)
-				eval_expr2(p, value);
-				return;
-			}
-			
-			if(p->tokens[p->index+1].type == EQUAL) {
-				// если это неизвестная переменная и стоит знак присваивания, то создаем её
-				var_id = create_user_var(p, p->tokens[p->index].data);
-			} else {
-				set_error(p, "unknown variable", 6);
-			}
-		}
-		
-		if(var_id <= 0)
-			return;
+	IF_FAILED(program);
 
-		DMSG("found var: %s\n", p->tokens[p->index].data);
-		
-		// переходим к след. токену
-		p->index++;
-		
-		// это присваивание?
-		if(p->tokens[p->index].type == EQUAL || p->tokens[p->index].type == PLUS_EQL ||
-		   p->tokens[p->index].type == MINUS_EQL || p->tokens[p->index].type == MULT_EQL ||
-		   p->tokens[p->index].type == DIV_EQL) {
-			
-			int last = 0;
-			DMSG("found assigment: %s\n", p->tokens[p->index].data);
+	if(program->native_handle)
+		dlclose(program->native_handle);
 
-			last = p->index++;
-			
-			// вычисляем значение переменной после =
-			eval_expr(p, value);
-			
-			if(p->skip_expr)
-				return;
-			
-			// получаем значение переменной к котрой будет присваиваться значение
-			// (для случаев += -= *= /=)
-			float var_value = get_var_value(p, var_id);
-			
-			switch(p->tokens[last].type) {
-				case EQUAL:
-					var_value =  *value;
-					break;
-				case PLUS_EQL:
-					var_value +=  *value;
-					break;
-				case MINUS_EQL:
-					var_value -=  *value;
-					break;
-				case MULT_EQL:
-					var_value *=  *value;
-					break;
-				case DIV_EQL:
-					var_value /=  *value;
-					break;
-			}
-			
-			// присваиваем значение
-			assign_variable(p, var_id, var_value);
-			*value = var_value;
+	free(program->native_funcs);
 
-			return;
-		} else {
-			p->index--;
-		}
-	}
-	
-	eval_expr2(p, value);
+	program->native_handle = NULL;
+	program->native_eval = NULL;
+	program->native_eval_row = NULL;
+	program->native_funcs = NULL;
 }
 
-// вычисление ,
-static void eval_expr0(parser_t *p, float *value)
-{
-	if(is_stopping)
-		return;
+#undef NATIVE_CFLAGS
+#undef NATIVE_MAX_PATH
 
-	eval_expr1(p, value);
-	
-	if(p->tokens[p->index].type == COMMA) {
-		DMSG("found comma: %s\n", p->tokens[p->index].data);
-		
-		p->index++;
-		
-		// вычисляем выражение после запятой
-		eval_expr(p, value);
-	}
+#else /* PARSER_NATIVE */
+
+int parser_program_compile_native(parser_program_t *program, const char *cache_dir)
+{
+	ERROR_MSG("native code generation isn't supported on this platform\n");
+	return -1;
 }
 
-// проверка на последний индекс и точку-с-запятой
-static void eval_expr(parser_t *p, float *value)
+void parser_program_destroy_native(parser_program_t *program)
 {
-	if(is_stopping)
-		return;
-	//DMSG("eval0: %s, i = %i\n", p->tokens[p->current_index].data, p->current_index);
-	
-	// есть ли ещё токены...
-	if(p->index > (p->num_tokens - 1)) {
-		set_error(p, "no expression", 0);
-		p->error = -1;
-		return;
-	}
-	
-	// если текущий токен ; то выходим
-	if(p->tokens[p->index].type == SEMICOLON) {
-		*value = 0;
-		return;
-	}
-	
-	// переходим к первому этапу парсинга
-	eval_expr0(p, value);
-	//p->current_index--;
 }
 
-// синтаксический анализ
-void syntax_parser(parser_t *p)
+#endif /* PARSER_NATIVE */
+
+int parser_program_eval_slice(const parser_program_t *program, float x0, float y0, float z,
+							  unsigned count_x, unsigned count_y, unsigned stride, float *result)
 {
-	do {
+	IF_FAILED_RET(program && result && stride >= count_x, -100);
 
-		if(is_stopping)
-			return;
+	int error = 0, ret = 0;
 
-		float value = 0.0f;
-		if(p->tokens[p->index].type == IDENTIFIER) {
-			// если первый токен идентификатор, то парсим всё сначало
-			eval_expr(p, &value);
-			if(p->tokens[p->index].type != SEMICOLON) {
-				if(!p->error)
-					set_error(p, "expected ;", 1);
-				break;
-			}
-		} else {
+	if(program->native_eval_row) {
+		for(unsigned j = 0; j < count_y && !is_stopping; j++) {
+			ret = ((native_eval_row_t) program->native_eval_row)(program->native_funcs, &is_stopping,
+																 x0, y0 + j, z, count_x, result + j * stride);
+			if(ret != 0)
+				error = ret;
+		}
 
-			if(p->tokens[p->index].type != UNKNOWN) {
-				if(!p->error)
-					set_error(p, "encounter unknown token", 16);
-				break;
-			}
+		return error;
+	}
+
+	if(!eval_batch_func)
+		eval_batch_func = select_eval_batch();
+
+	float slice[MAX_NUM_REGISTERS], row[MAX_NUM_REGISTERS];
+
+	// этап слоя
+	slice[PARSER_REG_X] = x0;
+	slice[PARSER_REG_Y] = y0;
+	slice[PARSER_REG_Z] = z;
+
+	eval_reset(program, slice);
+	int slice_error = eval_range(program, 0, program->row_begin, slice);
+
+	for(unsigned j = 0; j < count_y && !is_stopping; j++) {
+		float y = y0 + j;
+		float *row_result = result + j * stride;
+
+		// этап строки
+		ret = slice_error;
+
+		if(ret == 0) {
+			memcpy(row, slice, sizeof(float) * program->num_registers);
+			row[PARSER_REG_Y] = y;
+
+			ret = eval_range(program, program->row_begin, program->voxel_begin, row);
+		}
+
+		if(ret != 0) {
+			memset(row_result, 0, sizeof(float) * count_x);
+			error = ret;
+			continue;
+		}
+
+		// этап точек
+		for(unsigned k = 0; k < count_x; k += PARSER_BATCH_SIZE) {
+			unsigned n = (count_x - k < PARSER_BATCH_SIZE) ? (count_x - k) : PARSER_BATCH_SIZE;
 
-			// если первый токен неидентификатор, то парсим исключая присваивание
-			eval_expr2(p, &value);
-			if(p->tokens[p->index].type != SEMICOLON) {
-				if(!p->error)
-					set_error(p, "expected ;", 1);
+			ret = eval_batch_func(program, row, x0 + k, y, z, n, row_result + k);
+
+			if(ret == BATCH_SCALAR_FALLBACK)
+				ret = eval_batch_scalar(program, row, x0 + k, y, z, n, row_result + k);
+
+			if(ret != 0)
+				error = ret;
+
+			if(is_stopping)
 				break;
-			}
 		}
-		p->index++;
-	} while(p->index < (p->num_tokens - 1));
+	}
+
+	return error;
 }
 
-static void destroy_vars(parser_t *p)
+int parser_program_eval_row(const parser_program_t *program, float x0, float y, float z,
+							unsigned count, float *result)
 {
-	IF_FAILED(p && p->init == 1);
-	
-	// удаляем все созданные переменные
-	for(int i = 0; i < p->num_user_ids; i++) {
-		p->user_identifiers[i].type = 0;
+	return parser_program_eval_slice(program, x0, y, z, count, 1, count, result);
+}
 
-		if(p->user_identifiers[i].name)
-			free(p->user_identifiers[i].name);
-		
-		p->user_identifiers[i].name = NULL;
+void parser_program_destroy(parser_program_t *program)
+{
+	IF_FAILED(program);
 
-		p->user_identifiers[i].global_id = 0;
+	if(program->instructions)
+		free(program->instructions);
 
-		p->float_user_vars[i].global_id = 0;
-		p->float_user_vars[i].value = 0.0f;
-	}
-	
-	p->num_user_ids = 0;
-	p->num_user_vars = 0;
+#ifdef PARSER_JIT
+	if(program->jit_code)
+		munmap(program->jit_code, program->jit_size);
+#endif
+
+	parser_program_destroy_native(program);
+
+	if(program->voxel_inputs)
+		free(program->voxel_inputs);
+
+	memset(program, 0, sizeof(parser_program_t));
 }
 
 int parser_create(parser_t *parser)
 {
 	IF_FAILED0(parser);
-	
-	parser->float_builtin_vars = NULL;
-	
+
 	parser->num_user_ids = 0;
-	parser->num_user_vars = 0;
-	parser->last_var_global_id = last_var_global_id;
-	
+
 	parser->num_tokens = 0;
 	parser->index = 0;
 	parser->error = 0;
-	parser->skip_expr = 0;
-	
+
+	parser->token_arena = NULL;
+	parser->token_arena_used = 0;
+
 	parser->init = 0;
-	
-	// устанавливаем локаль, чтобы atof преобразовывало числа с точкой (иначе может только с запятой)
-	setlocale(LC_NUMERIC, "C");
-	
+
+	memset(&parser->program, 0, sizeof(parser_program_t));
+
+	// выбираем реализацию parser_program_eval_row заранее, до запуска потоков
+	if(!eval_batch_func)
+		eval_batch_func = select_eval_batch();
+
 	return 1;
 }
 
+int parser_compile(parser_t *parser, const char *text, parser_program_t *program)
+{
+	IF_FAILED_RET(parser && text && program, -100);
+
+	parser_clean(parser);
+
+	int ret = lexer_parser(parser, text);
+
+	if(ret != 0) {
+		destroy_tokens(parser);
+		return (ret == 11) ? 1 : (ret == 17) ? 17 : -20;
+	}
+
+	ret = compile_program(parser, program);
+
+	destroy_tokens(parser);
+
+	if(ret == 0) {
+		unsigned num_instructions = program->num_instructions;
+
+		if(optimize_program(program) == 0)
+			TRACE_MSG("%u instructions, %u after optimization\n", num_instructions, program->num_instructions);
+
+		if(stage_program(program) != 0) {
+			parser_program_destroy(program);
+			return -1;
+		}
+
+		TRACE_MSG("%u instructions per slice, %u per row, %u per voxel\n", program->row_begin,
+				  program->voxel_begin - program->row_begin, program->num_instructions - program->voxel_begin);
+
+#ifdef PARSER_JIT
+		// без машинного кода программа выполняется интерпретатором
+		if(jit_compile(program) == 0)
+			TRACE_MSG("%u bytes of machine code\n", program->jit_size);
+#endif
+	}
+
+	return ret;
+}
+
 int parser_parse_text(parser_t *parser, const char *text, float_var_value_t *var_table)
 {
 	IF_FAILED0(parser && text && var_table);
-	
-#if 0
-	char *text1 = "d += snoise3(x, y, z) * 2;";
-	float_var_value_t test_vars[] =
-		{
-			{1, 0.0f}, // d
-			{2, 0.0f}, // x
-			{3, 0.0f}, // y
-			{4, 0.0f}, // z
-			{5, 0.0f}, // t
-			{0, 0.0f}
-		};
-#endif
-	
+
 	if(!parser->init) {
-		
-		// если парсер неинициализированн, то устанавливаем основные параметры
-		
+
+		// если парсер неинициализированн, то компилируем функцию
+
 		parser->index = 0;
 		parser->error = 0;
 		parser->num_tokens = 0;
-		
+
 		int ret = lexer_parser(parser, text);
 
-		if(ret == 11)
-			return 1;
-		else if(ret == 1)
-			return -20;
-		
-		// выделяем память под доп. переменные и устанавливаем значение переменной "i" в 0.0f
-		parser->float_extra_vars = (float_var_value_t*) malloc(sizeof(float_var_value_t) * 2);
-		parser->float_extra_vars[0].global_id = 6; parser->float_extra_vars[0].value = 0.0f;
-		parser->float_extra_vars[1].global_id = 0; parser->float_extra_vars[1].value = 0.0f;
-		
+		if(ret != 0) {
+			destroy_tokens(parser);
+			return (ret == 11) ? 1 : (ret == 17) ? 17 : -20;
+		}
+
+		parser->error = compile_program(parser, &parser->program);
+
+		if(parser->error == 0 && stage_program(&parser->program) != 0)
+			parser->error = -1;
+
+		destroy_tokens(parser);
+
 		parser->init = 1;
 	}
-	
-	parser->float_builtin_vars = var_table;
-	//parser->float_builtin_vars = test_vars;
-	
-	// уничтожаем (если есть) созданные пользовательские переменные
-	destroy_vars(parser);
-	
-	// парсим строку
-	syntax_parser(parser);
-	
-	parser->index = 0;
-	
-	if(parser->error != 0) {
-		int ret = parser->error;
-		parser->error = 0;
-		
-		return ret;
+
+	// функция скомпилирована с ошибкой
+	if(parser->error != 0)
+		return parser->error;
+
+	float registers[MAX_NUM_REGISTERS];
+	int i = 0, reg = 0;
+
+	// копируем значения встроенных переменных из таблицы в регистры...
+	for(i = 0; var_table[i].global_id != 0; i++) {
+		if((reg = builtin_var_register(var_table[i].global_id)) >= 0)
+			registers[reg] = var_table[i].value;
 	}
-	
-	return 0;
+
+	int ret = parser_program_eval(&parser->program, registers);
+
+	// ...и обратно
+	for(i = 0; var_table[i].global_id != 0; i++) {
+		if((reg = builtin_var_register(var_table[i].global_id)) >= 0)
+			var_table[i].value = registers[reg];
+	}
+
+	return ret;
 }
 
-void parser_clean(parser_t *parser) 
+void parser_clean(parser_t *parser)
 {
 	IF_FAILED(parser);
-	
+
 	// проводим очистку только в инициализированном парсере
 	if(parser->init == 1) {
-		
-		// очищаем данные токенов
-		for(int i = 0; i < parser->num_tokens; i++) {
-			if(parser->tokens[i].data)
-				free(parser->tokens[i].data);
-			parser->tokens[i].data = NULL;
-			
-			parser->tokens[i].type = 0;
-		}
-		
-		// очищаем дополнительные встроенные переменные
-		if(parser->float_extra_vars)
-			free(parser->float_extra_vars);
-		
-		parser->float_extra_vars = NULL;
-		
-		
-		// сбрасываем текущий индекс, ошибку и кол-во токенов
-		parser->index = 0;
+
+		destroy_tokens(parser);
+
+		parser_program_destroy(&parser->program);
+
+		// сбрасываем ошибку
 		parser->error = 0;
-		parser->num_tokens = 0;
-		
+
 		// сбрасываем инициализацию
 		parser->init = 0;
 	}
@@ -1585,6 +4366,78 @@ void parser_clean(parser_t *parser)
 #define skip_ws(p) while(*p == ' ') p++;
 #define copy_text(text_ptr, to_ptr, n) for(int i = 0; i < n; i++) to_ptr[i] = text_ptr[i]; to_ptr[n] = '\0';
 
+// степени 10, которые точно представимы в double
+static const double exact_powers_of_10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// преобразовать число вида 123 или 123.456 (от begin до end) в float
+// не зависит от локали; если мантисса помещается в 53 бита, а дробная часть
+// не длиннее 22 цифр, результат совпадает с (float) atof()
+static float lex_number(const char *begin, const char *end)
+{
+	unsigned long long mantissa = 0;
+	int n_digits = 0, frac_digits = 0, fraction = 0;
+	double value = 0.0;
+
+	for(const char *ptr = begin; ptr < end; ptr++) {
+		if(*ptr == '.') {
+			fraction = 1;
+			continue;
+		}
+
+		// пропускаем незначащие нули
+		if(mantissa == 0 && *ptr == '0') {
+			if(fraction)
+				frac_digits++;
+			continue;
+		}
+
+		// лишние цифры дробной части уже не влияют на результат
+		if(n_digits >= 19) {
+			if(!fraction)
+				frac_digits--;
+			continue;
+		}
+
+		mantissa = mantissa*10 + (*ptr - '0');
+		n_digits++;
+
+		if(fraction)
+			frac_digits++;
+	}
+
+	value = (double) mantissa;
+
+	if(frac_digits > 0) {
+		while(frac_digits > 22) {
+			value /= 1e22;
+			frac_digits -= 22;
+		}
+		value /= exact_powers_of_10[frac_digits];
+	} else {
+		while(frac_digits < -22) {
+			value *= 1e22;
+			frac_digits += 22;
+		}
+		value *= exact_powers_of_10[-frac_digits];
+	}
+
+	return (float) value;
+}
+
+// выделить память под текст токена из арены
+// (размер арены рассчитан в lexer_parser, поэтому проверка не нужна)
+static char* arena_alloc(parser_t *p, unsigned size)
+{
+	char *data = p->token_arena + p->token_arena_used;
+
+	p->token_arena_used += size;
+
+	return data;
+}
+
 // лексический анализ
 int lexer_parser(parser_t *p, const char *text)
 {
@@ -1592,6 +4445,14 @@ int lexer_parser(parser_t *p, const char *text)
 	
 	char *ptr = (char*) text;
 	
+	// текст всех токенов хранится в одном блоке памяти: каждый токен занимает
+	// не больше прочитанных символов + 2 (двухсимвольный оператор и '\0')
+	p->token_arena = (char*) malloc(sizeof(char) * (strlen(text) + 2*MAX_NUM_TOKENS));
+	p->token_arena_used = 0;
+	
+	if(!p->token_arena)
+		return 1;
+	
 	while(*ptr != '\0') {
 
 		if(is_stopping)
@@ -1626,6 +4487,10 @@ int lexer_parser(parser_t *p, const char *text)
 			continue;
 		}
 		
+		// проверяем на превышение кол-ва токенов (слишком большая программа)
+		if(p->num_tokens >= MAX_NUM_TOKENS)
+			return 17;
+		
 		if( isalpha(*ptr) ) {
 			// найден идентификатор
 			
@@ -1635,7 +4500,7 @@ int lexer_parser(parser_t *p, const char *text)
 			while( (isalpha(*ptr) || isdigit(*ptr)) && ( (ptr - begin) < 63 ) ) ptr++;
 			
 			p->tokens[p->num_tokens].type = IDENTIFIER;
-			p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * (ptr - begin ));
+			p->tokens[p->num_tokens].data = arena_alloc(p, (ptr - begin) + 1);
 			copy_text(begin, p->tokens[p->num_tokens].data, (ptr - begin));
 			
 			//printf("found identifier: %s\n", p->tokens[p->num_tokens].data);
@@ -1657,7 +4522,10 @@ int lexer_parser(parser_t *p, const char *text)
 				p->tokens[p->num_tokens].type = INT_NUMBER;
 			}
 			
-			p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * (ptr - begin ));
+			// значение числа вычисляем сразу, чтобы не разбирать текст при компиляции
+			p->tokens[p->num_tokens].value = lex_number(begin, ptr);
+			
+			p->tokens[p->num_tokens].data = arena_alloc(p, (ptr - begin) + 1);
 			copy_text(begin, p->tokens[p->num_tokens].data, (ptr - begin));
 			
 			//printf("found number: %s\n", p->tokens[p->num_tokens].data);
@@ -1670,146 +4538,146 @@ int lexer_parser(parser_t *p, const char *text)
 				case '=':
 					if(*(ptr+1) == '=') {
 						p->tokens[p->num_tokens].type = EQL_EQL;
-						p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 2);
+						p->tokens[p->num_tokens].data = arena_alloc(p, 3);
 						copy_text(ptr, p->tokens[p->num_tokens].data, 2);
 						ptr++;
 					} else {
 						p->tokens[p->num_tokens].type = EQUAL;
-						p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 1);
+						p->tokens[p->num_tokens].data = arena_alloc(p, 2);
 						copy_text(ptr, p->tokens[p->num_tokens].data, 1);
 					}
 					break;
 				case '+':
 					if(*(ptr+1) == '=') {
 						p->tokens[p->num_tokens].type = PLUS_EQL;
-						p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 2);
+						p->tokens[p->num_tokens].data = arena_alloc(p, 3);
 						copy_text(ptr, p->tokens[p->num_tokens].data, 2);
 						ptr++;
 					} else {
 						p->tokens[p->num_tokens].type = PLUS;
-						p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 1);
+						p->tokens[p->num_tokens].data = arena_alloc(p, 2);
 						copy_text(ptr, p->tokens[p->num_tokens].data, 1);
 					}
 					break;
 				case '-':
 					if(*(ptr+1) == '=') {
 						p->tokens[p->num_tokens].type = MINUS_EQL;
-						p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 2);
+						p->tokens[p->num_tokens].data = arena_alloc(p, 3);
 						copy_text(ptr, p->tokens[p->num_tokens].data, 2);
 						ptr++;
 					} else {
 						p->tokens[p->num_tokens].type = MINUS;
-						p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 1);
+						p->tokens[p->num_tokens].data = arena_alloc(p, 2);
 						copy_text(ptr, p->tokens[p->num_tokens].data, 1);
 					}
 					break;
 				case '*':
 					if(*(ptr+1) == '=') {
 						p->tokens[p->num_tokens].type = MULT_EQL;
-						p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 2);
+						p->tokens[p->num_tokens].data = arena_alloc(p, 3);
 						copy_text(ptr, p->tokens[p->num_tokens].data, 2);
 						ptr++;
 					} else if(*(ptr+1) == '*') {
 						p->tokens[p->num_tokens].type = MULT_MULT;
-						p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 2);
+						p->tokens[p->num_tokens].data = arena_alloc(p, 3);
 						copy_text(ptr, p->tokens[p->num_tokens].data, 2);
 						ptr++;
 					} else {
 						p->tokens[p->num_tokens].type = MULT;
-						p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 1);
+						p->tokens[p->num_tokens].data = arena_alloc(p, 2);
 						copy_text(ptr, p->tokens[p->num_tokens].data, 1);
 					}
 					break;
 				case '/':
 					if(*(ptr+1) == '=') {
 						p->tokens[p->num_tokens].type = DIV_EQL;
-						p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 2);
+						p->tokens[p->num_tokens].data = arena_alloc(p, 3);
 						copy_text(ptr, p->tokens[p->num_tokens].data, 2);
 						ptr++;
 					} else {
 						p->tokens[p->num_tokens].type = DIV;
-						p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 1);
+						p->tokens[p->num_tokens].data = arena_alloc(p, 2);
 						copy_text(ptr, p->tokens[p->num_tokens].data, 1);
 					}
 					break;
 				case ';':
 					p->tokens[p->num_tokens].type = SEMICOLON;
-					p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 1);
+					p->tokens[p->num_tokens].data = arena_alloc(p, 2);
 					copy_text(ptr, p->tokens[p->num_tokens].data, 1);
 					break;
 				case ':':
 					p->tokens[p->num_tokens].type = COLON;
-					p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 1);
+					p->tokens[p->num_tokens].data = arena_alloc(p, 2);
 					copy_text(ptr, p->tokens[p->num_tokens].data, 1);
 					break;
 				case '?':
 					p->tokens[p->num_tokens].type = QUEST_MARK;
-					p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 1);
+					p->tokens[p->num_tokens].data = arena_alloc(p, 2);
 					copy_text(ptr, p->tokens[p->num_tokens].data, 1);
 					break;
 				case '(':
 					p->tokens[p->num_tokens].type = PARENTH_LEFT;
-					p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 1);
+					p->tokens[p->num_tokens].data = arena_alloc(p, 2);
 					copy_text(ptr, p->tokens[p->num_tokens].data, 1);
 					break;
 				case ')':
 					p->tokens[p->num_tokens].type = PARENTH_RIGHT;
-					p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 1);
+					p->tokens[p->num_tokens].data = arena_alloc(p, 2);
 					copy_text(ptr, p->tokens[p->num_tokens].data, 1);
 					break;
 				case '.':
 					if(*(ptr+1) == '.') {
 						p->tokens[p->num_tokens].type = DOT_DOT;
-						p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 2);
+						p->tokens[p->num_tokens].data = arena_alloc(p, 3);
 						copy_text(ptr, p->tokens[p->num_tokens].data, 2);
 						ptr++;
 					} else {
 						p->tokens[p->num_tokens].type = DOT;
-						p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 1);
+						p->tokens[p->num_tokens].data = arena_alloc(p, 2);
 						copy_text(ptr, p->tokens[p->num_tokens].data, 1);
 					}
 					break;
 				case ',':
 					p->tokens[p->num_tokens].type = COMMA;
-					p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 1);
+					p->tokens[p->num_tokens].data = arena_alloc(p, 2);
 					copy_text(ptr, p->tokens[p->num_tokens].data, 1);
 					break;
 				case '>':
 					if(*(ptr+1) == '=') {
 						p->tokens[p->num_tokens].type = GRT_EQL;
-						p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 2);
+						p->tokens[p->num_tokens].data = arena_alloc(p, 3);
 						copy_text(ptr, p->tokens[p->num_tokens].data, 2);
 					} else {
 						p->tokens[p->num_tokens].type = GREATER;
-						p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 1);
+						p->tokens[p->num_tokens].data = arena_alloc(p, 2);
 						copy_text(ptr, p->tokens[p->num_tokens].data, 1);
 					}
 					break;
 				case '<':
 					if(*(ptr+1) == '=') {
 						p->tokens[p->num_tokens].type = LESS_EQL;
-						p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 2);
+						p->tokens[p->num_tokens].data = arena_alloc(p, 3);
 						copy_text(ptr, p->tokens[p->num_tokens].data, 2);
 					} else {
 						p->tokens[p->num_tokens].type = LESS;
-						p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 1);
+						p->tokens[p->num_tokens].data = arena_alloc(p, 2);
 						copy_text(ptr, p->tokens[p->num_tokens].data, 1);
 					}
 					break;
 				case '!':
 					if(*(ptr+1) == '!') {
 						p->tokens[p->num_tokens].type = NOT_EQL;
-						p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 2);
+						p->tokens[p->num_tokens].data = arena_alloc(p, 3);
 						copy_text(ptr, p->tokens[p->num_tokens].data, 2);
 					} else {
 						p->tokens[p->num_tokens].type = NOT;
-						p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 1);
+						p->tokens[p->num_tokens].data = arena_alloc(p, 2);
 						copy_text(ptr, p->tokens[p->num_tokens].data, 1);
 					}
 					break;
 				default:
 					p->tokens[p->num_tokens].type = UNKNOWN;
-					p->tokens[p->num_tokens].data = (char*) malloc(sizeof(char) * 1);
+					p->tokens[p->num_tokens].data = arena_alloc(p, 2);
 					copy_text(ptr, p->tokens[p->num_tokens].data, 1);
 					break;		
 			};
@@ -1848,3 +4716,14 @@ int parser_is_stopped()
 {
 	return is_stopping;
 }
+
+int parser_set_jit(int enable)
+{
+	use_jit = enable;
+
+#ifdef PARSER_JIT
+	return 1;
+#else
+	return 0;
+#endif
+}
@@ -0,0 +1,1238 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lod_mesh.h"
+#include "marching_cubes.h"
+#include "utils.h"
+
+// узлов чанка по всем осям
+#define LOD_MESH_CHUNK_NODES ((LOD_MESH_CHUNK_CELLS + 1) * (LOD_MESH_CHUNK_CELLS + 1) * (LOD_MESH_CHUNK_CELLS + 1))
+
+// отрезков границы изоповерхности на гранях ячейки: 6 граней по 4 четверти по 2 отрезка
+#define LOD_MESH_MAX_SEGMENTS 48
+
+// нет вершины / чанк не построен
+#define LOD_MESH_NONE 0xFFFFFFFFu
+#define LOD_MESH_NO_LEVEL 0xFF
+
+// узел поля (в ячейках исходного поля) и значение в нём
+typedef struct {
+	vector3ui pos;
+	float value;
+} lod_sample_t;
+
+// отрезок границы изоповерхности на грани ячейки (номера вершин)
+typedef struct {
+	unsigned from, to;
+} lod_segment_t;
+
+// сетка чанка, построенная в задаче пула
+typedef struct {
+	vector3f *vertices;
+	unsigned num_vertices, max_vertices;
+
+	triangle_t *triangles;
+	unsigned num_triangles, max_triangles;
+
+	// границы значений всех узлов чанка (в т.ч. переходных)
+	float min_value, max_value;
+
+	int failed;
+} lod_mesh_result_t;
+
+// буферы потока пула
+typedef struct {
+	// значения узлов чанка
+	float *values;
+
+	// номер вершины + 1 на отрезке от узла чанка по оси (3 * узел + ось)
+	unsigned *weld;
+
+	// заполненные элементы weld
+	unsigned *keys;
+	unsigned max_keys;
+} lod_mesh_scratch_t;
+
+// перестройка чанков в пуле потоков: задача - чанк
+typedef struct lod_mesh_build_s {
+	volume_pyramid_t pyramid;
+	vector3ui cells, num_chunks;
+	vector3f pos_step;
+	float isolevel;
+
+	// уровни всех чанков (new_lods сетки)
+	const unsigned char *lods;
+
+	// перестраиваемые чанки и их сетки
+	unsigned *chunks;
+	lod_mesh_result_t *results;
+	unsigned num_tasks, max_tasks;
+
+	// кол-во завершённых задач
+	unsigned done;
+	double start_time;
+
+	lod_mesh_scratch_t scratch[SCHEDULER_MAX_THREADS];
+} lod_mesh_build_t;
+
+// построение одного чанка
+typedef struct {
+	const lod_mesh_build_t *build;
+	lod_mesh_scratch_t *scratch;
+	lod_mesh_result_t *result;
+
+	// узлы чанка [origin, end] в ячейках поля, шаг 2^lod, nodes - кол-во узлов по осям
+	vector3ui origin, end, nodes;
+	unsigned lod, step;
+
+	// есть соседи детальнее чанка (на границе с ними ячейки переходные)
+	int has_transitions;
+	unsigned num_keys;
+} lod_chunk_t;
+
+/*
+ * Вершины граней ячейки (вершина c - (c & 1, (c >> 1) & 1, (c >> 2) & 1)) против часовой
+ * стрелки, если смотреть снаружи ячейки; противоположные вершины - 0 и 2
+ */
+static const unsigned char lod_mesh_faces[6][4] = {
+	{0, 4, 6, 2}, {1, 3, 7, 5},
+	{0, 1, 5, 4}, {2, 6, 7, 3},
+	{0, 2, 3, 1}, {4, 5, 7, 6}
+};
+
+/* Увеличить буфер *ptr до count элементов element_size. Возвращает 0 при ошибке */
+static int lod_mesh_reserve(void **ptr, unsigned *size, unsigned count, size_t element_size)
+{
+	if(count <= *size && *ptr)
+		return 1;
+
+	unsigned new_size = count + count / 2 + 64;
+	void *new_ptr = realloc(*ptr, element_size * new_size);
+
+	IF_FAILED0(new_ptr);
+
+	*ptr = new_ptr;
+	*size = new_size;
+
+	return 1;
+}
+
+INLINE static vector3ui lod_mesh_min(vector3ui a, vector3ui b)
+{
+	return vec3ui((a.x < b.x) ? a.x : b.x, (a.y < b.y) ? a.y : b.y, (a.z < b.z) ? a.z : b.z);
+}
+
+INLINE static vector3ui lod_mesh_max(vector3ui a, vector3ui b)
+{
+	return vec3ui((a.x > b.x) ? a.x : b.x, (a.y > b.y) ? a.y : b.y, (a.z > b.z) ? a.z : b.z);
+}
+
+/* Чанки first..last по оси, содержащие отрезок [lo, hi] (на границе чанков точка принадлежит обоим) */
+INLINE static void lod_mesh_axis_chunks(unsigned lo, unsigned hi, unsigned num, unsigned *first, unsigned *last)
+{
+	*first = lo / LOD_MESH_CHUNK_CELLS;
+
+	if(lo == hi && lo % LOD_MESH_CHUNK_CELLS == 0 && *first > 0)
+		*last = (*first)--;
+	else
+		*last = *first;
+
+	if(*last >= num)
+		*last = num - 1;
+	if(*first >= num)
+		*first = num - 1;
+}
+
+/* Самый детальный уровень чанков, содержащих узлы [lo, hi] (узел, ребро или грань ячейки) */
+static unsigned lod_mesh_min_lod(const lod_mesh_build_t *build, vector3ui lo, vector3ui hi)
+{
+	unsigned first_x, last_x, first_y, last_y, first_z, last_z;
+	unsigned lod = LOD_MESH_MAX_LEVEL;
+
+	lod_mesh_axis_chunks(lo.x, hi.x, build->num_chunks.x, &first_x, &last_x);
+	lod_mesh_axis_chunks(lo.y, hi.y, build->num_chunks.y, &first_y, &last_y);
+	lod_mesh_axis_chunks(lo.z, hi.z, build->num_chunks.z, &first_z, &last_z);
+
+	for(unsigned k = first_z; k <= last_z; k++)
+		for(unsigned j = first_y; j <= last_y; j++)
+			for(unsigned i = first_x; i <= last_x; i++) {
+				unsigned level = build->lods[i + (j + k*build->num_chunks.y)*build->num_chunks.x];
+
+				if(level < lod)
+					lod = level;
+			}
+
+	return lod;
+}
+
+/* Самый детальный уровень соседей чанка coords по граням, рёбрам и вершинам */
+static unsigned lod_mesh_neighbors_lod(const unsigned char *lods, vector3ui num_chunks, vector3ui coords)
+{
+	unsigned lod = LOD_MESH_NO_LEVEL;
+
+	for(unsigned k = (coords.z > 0) ? coords.z - 1 : 0; k <= coords.z + 1 && k < num_chunks.z; k++)
+		for(unsigned j = (coords.y > 0) ? coords.y - 1 : 0; j <= coords.y + 1 && j < num_chunks.y; j++)
+			for(unsigned i = (coords.x > 0) ? coords.x - 1 : 0; i <= coords.x + 1 && i < num_chunks.x; i++) {
+				unsigned level = lods[i + (j + k*num_chunks.y)*num_chunks.x];
+
+				if(level < lod && (i != coords.x || j != coords.y || k != coords.z))
+					lod = level;
+			}
+
+	return lod;
+}
+
+/* Значение узла p (кратного 2^level) по уровню level пирамиды */
+INLINE static float lod_mesh_value(const lod_mesh_build_t *build, vector3ui p, unsigned level)
+{
+	vector3ui size = build->pyramid.sizes[level];
+	float value = build->pyramid.average[level][(p.x >> level) + ((p.y >> level) + (p.z >> level)*size.y)*size.x];
+
+	// NaN - снаружи, как в marching cubes; конечное значение не даёт NaN при интерполяции
+	return isnan(value) ? FLT_MAX : value;
+}
+
+/*
+ * Узел p: значение берётся по уровню самого детального чанка, содержащего узел,
+ * поэтому у соседних чанков разных уровней оно одно и то же
+ */
+static lod_sample_t lod_mesh_sample(lod_chunk_t *chunk, vector3ui p)
+{
+	lod_mesh_result_t *result = chunk->result;
+	lod_sample_t sample;
+
+	sample.pos = p;
+	sample.value = lod_mesh_value(chunk->build, p, lod_mesh_min_lod(chunk->build, p, p));
+
+	if(sample.value < result->min_value)
+		result->min_value = sample.value;
+	if(sample.value > result->max_value)
+		result->max_value = sample.value;
+
+	return sample;
+}
+
+INLINE static lod_sample_t lod_mesh_midpoint(lod_chunk_t *chunk, vector3ui a, vector3ui b)
+{
+	return lod_mesh_sample(chunk, vec3ui((a.x + b.x) / 2, (a.y + b.y) / 2, (a.z + b.z) / 2));
+}
+
+/*
+ * Вершина изоповерхности на отрезке ab по оси. Интерполяция ведётся от меньшего узла,
+ * поэтому вершина совпадает у всех ячеек и чанков, содержащих отрезок
+ */
+static unsigned lod_mesh_vertex(lod_chunk_t *chunk, lod_sample_t a, lod_sample_t b)
+{
+	lod_mesh_result_t *result = chunk->result;
+	lod_mesh_scratch_t *scratch = chunk->scratch;
+
+	if(a.pos.x > b.pos.x || a.pos.y > b.pos.y || a.pos.z > b.pos.z) {
+		lod_sample_t temp = a;
+
+		a = b;
+		b = temp;
+	}
+
+	unsigned axis = (a.pos.x != b.pos.x) ? 0 : ((a.pos.y != b.pos.y) ? 1 : 2);
+	vector3ui local = vec3ui_sub(a.pos, chunk->origin);
+	unsigned key = ((local.x + (local.y + local.z*(LOD_MESH_CHUNK_CELLS + 1))*(LOD_MESH_CHUNK_CELLS + 1)))*3 + axis;
+
+	if(scratch->weld[key])
+		return scratch->weld[key] - 1;
+
+	if(!lod_mesh_reserve((void**) &result->vertices, &result->max_vertices, result->num_vertices + 1, sizeof(vector3f)) ||
+	   !lod_mesh_reserve((void**) &scratch->keys, &scratch->max_keys, chunk->num_keys + 1, sizeof(unsigned))) {
+		result->failed = 1;
+		return 0;
+	}
+
+	float t = (chunk->build->isolevel - a.value) / (b.value - a.value);
+
+	result->vertices[result->num_vertices] = vec3f_mult(vec3f_lerp(vec3ui_to_vec3f(a.pos), vec3ui_to_vec3f(b.pos), t),
+														chunk->build->pos_step);
+
+	scratch->keys[chunk->num_keys++] = key;
+	scratch->weld[key] = ++result->num_vertices;
+
+	return result->num_vertices - 1;
+}
+
+static void lod_mesh_triangle(lod_chunk_t *chunk, unsigned v1, unsigned v2, unsigned v3)
+{
+	lod_mesh_result_t *result = chunk->result;
+
+	if(!lod_mesh_reserve((void**) &result->triangles, &result->max_triangles, result->num_triangles + 1, sizeof(triangle_t))) {
+		result->failed = 1;
+		return;
+	}
+
+	triangle_t *triangle = &result->triangles[result->num_triangles++];
+
+	triangle->indices[0] = v1;
+	triangle->indices[1] = v2;
+	triangle->indices[2] = v3;
+}
+
+/*
+ * Отрезки границы изоповерхности на многоугольнике грани (узлы против часовой стрелки снаружи
+ * ячейки): каждая последовательность внутренних узлов отделяется своим отрезком от входа
+ * в объём до выхода. Соседняя ячейка обходит ту же грань в обратную сторону и получает те же
+ * отрезки в обратном направлении
+ */
+static void lod_mesh_polygon(lod_chunk_t *chunk, const lod_sample_t *polygon, unsigned count,
+							 lod_segment_t *segments, unsigned *num_segments)
+{
+	float isolevel = chunk->build->isolevel;
+	unsigned first = 0, enter = 0;
+
+	while(first < count && !(polygon[first].value >= isolevel && polygon[(first + 1) % count].value < isolevel))
+		first++;
+
+	if(first == count)
+		return;
+
+	for(unsigned n = 0; n < count; n++) {
+		unsigned i = (first + n) % count, j = (i + 1) % count;
+		int inside_i = (polygon[i].value < isolevel), inside_j = (polygon[j].value < isolevel);
+
+		if(inside_i == inside_j)
+			continue;
+
+		unsigned vertex = lod_mesh_vertex(chunk, polygon[i], polygon[j]);
+
+		if(inside_j) {
+			enter = vertex;
+		} else if(*num_segments < LOD_MESH_MAX_SEGMENTS) {
+			segments[*num_segments].from = enter;
+			segments[*num_segments].to = vertex;
+			(*num_segments)++;
+		}
+	}
+}
+
+/*
+ * Отрезки на грани face ячейки. На границе с более детальным соседом рёбра грани делятся
+ * пополам, а грань, общая с ним, - на четверти
+ */
+static void lod_mesh_face(lod_chunk_t *chunk, const lod_sample_t *corners, unsigned face, int transition,
+						  lod_segment_t *segments, unsigned *num_segments)
+{
+	const unsigned char *vertices = lod_mesh_faces[face];
+	lod_sample_t polygon[8];
+	unsigned count = 0;
+
+	if(!transition) {
+		for(unsigned i = 0; i < 4; i++)
+			polygon[i] = corners[vertices[i]];
+
+		lod_mesh_polygon(chunk, polygon, 4, segments, num_segments);
+		return;
+	}
+
+	vector3ui lo = lod_mesh_min(corners[vertices[0]].pos, corners[vertices[2]].pos);
+	vector3ui hi = lod_mesh_max(corners[vertices[0]].pos, corners[vertices[2]].pos);
+
+	if(lod_mesh_min_lod(chunk->build, lo, hi) < chunk->lod) {
+		lod_sample_t center = lod_mesh_midpoint(chunk, lo, hi), midpoints[4];
+
+		for(unsigned i = 0; i < 4; i++)
+			midpoints[i] = lod_mesh_midpoint(chunk, corners[vertices[i]].pos, corners[vertices[(i + 1) % 4]].pos);
+
+		for(unsigned i = 0; i < 4; i++) {
+			polygon[0] = corners[vertices[i]];
+			polygon[1] = midpoints[i];
+			polygon[2] = center;
+			polygon[3] = midpoints[(i + 3) % 4];
+
+			lod_mesh_polygon(chunk, polygon, 4, segments, num_segments);
+		}
+
+		return;
+	}
+
+	for(unsigned i = 0; i < 4; i++) {
+		vector3ui a = corners[vertices[i]].pos, b = corners[vertices[(i + 1) % 4]].pos;
+
+		polygon[count++] = corners[vertices[i]];
+
+		if(lod_mesh_min_lod(chunk->build, lod_mesh_min(a, b), lod_mesh_max(a, b)) < chunk->lod)
+			polygon[count++] = lod_mesh_midpoint(chunk, a, b);
+	}
+
+	lod_mesh_polygon(chunk, polygon, count, segments, num_segments);
+}
+
+/*
+ * Треугольники контура: 3 вершины - треугольник, 4 - два по короткой диагонали,
+ * больше - веер из центра контура
+ */
+static void lod_mesh_triangulate(lod_chunk_t *chunk, const unsigned *loop, unsigned count)
+{
+	lod_mesh_result_t *result = chunk->result;
+
+	if(count < 3 || result->failed)
+		return;
+
+	if(count == 3) {
+		lod_mesh_triangle(chunk, loop[0], loop[1], loop[2]);
+	}
+	else if(count == 4) {
+		const vector3f *v = result->vertices;
+
+		if(vec3f_length(vec3f_sub(v[loop[0]], v[loop[2]])) <= vec3f_length(vec3f_sub(v[loop[1]], v[loop[3]]))) {
+			lod_mesh_triangle(chunk, loop[0], loop[1], loop[2]);
+			lod_mesh_triangle(chunk, loop[0], loop[2], loop[3]);
+		} else {
+			lod_mesh_triangle(chunk, loop[1], loop[2], loop[3]);
+			lod_mesh_triangle(chunk, loop[1], loop[3], loop[0]);
+		}
+	}
+	else {
+		if(!lod_mesh_reserve((void**) &result->vertices, &result->max_vertices, result->num_vertices + 1, sizeof(vector3f))) {
+			result->failed = 1;
+			return;
+		}
+
+		vector3f center = vec3f(0.0f, 0.0f, 0.0f);
+		unsigned center_index = result->num_vertices++;
+
+		for(unsigned i = 0; i < count; i++)
+			center = vec3f_add(center, result->vertices[loop[i]]);
+
+		result->vertices[center_index] = vec3f_div_c(center, (float) count);
+
+		for(unsigned i = 0; i < count; i++)
+			lod_mesh_triangle(chunk, center_index, loop[i], loop[(i + 1) % count]);
+	}
+}
+
+/* Собрать отрезки граней в замкнутые контуры и триангулировать их */
+static void lod_mesh_loops(lod_chunk_t *chunk, lod_segment_t *segments, unsigned num_segments)
+{
+	unsigned loop[LOD_MESH_MAX_SEGMENTS];
+
+	for(unsigned s = 0; s < num_segments; s++) {
+		if(segments[s].from == LOD_MESH_NONE)
+			continue;
+
+		unsigned count = 0, start = segments[s].from, next = segments[s].to;
+
+		loop[count++] = start;
+		segments[s].from = LOD_MESH_NONE;
+
+		while(next != start && count < LOD_MESH_MAX_SEGMENTS) {
+			unsigned t = s + 1;
+
+			while(t < num_segments && segments[t].from != next)
+				t++;
+
+			if(t == num_segments)
+				break;
+
+			loop[count++] = next;
+			next = segments[t].to;
+			segments[t].from = LOD_MESH_NONE;
+		}
+
+		if(next == start)
+			lod_mesh_triangulate(chunk, loop, count);
+	}
+}
+
+/*
+ * Ячейка (i, j, k) чанка. Изоповерхность строится по контурам на гранях ячейки
+ * (как в marching cubes, неоднозначные грани - с разделёнными внутренними узлами),
+ * поэтому переходные ячейки с поделёнными гранями не требуют отдельных таблиц
+ */
+static void lod_mesh_cell(lod_chunk_t *chunk, unsigned i, unsigned j, unsigned k)
+{
+	const float *values = chunk->scratch->values;
+	float isolevel = chunk->build->isolevel;
+	lod_sample_t corners[8];
+	unsigned mask = 0;
+
+	for(unsigned c = 0; c < 8; c++) {
+		unsigned ci = i + (c & 1), cj = j + ((c >> 1) & 1), ck = k + ((c >> 2) & 1);
+
+		corners[c].pos = vec3ui_add(chunk->origin, vec3ui_mult_c(vec3ui(ci, cj, ck), chunk->step));
+		corners[c].value = values[ci + (cj + ck*chunk->nodes.y)*chunk->nodes.x];
+
+		if(corners[c].value < isolevel)
+			mask |= 1 << c;
+	}
+
+	// переходные ячейки касаются границы чанка, у которого есть более детальные соседи
+	int transition = chunk->has_transitions &&
+		(i == 0 || j == 0 || k == 0 || i + 2 == chunk->nodes.x || j + 2 == chunk->nodes.y || k + 2 == chunk->nodes.z);
+
+	if(!transition && (mask == 0 || mask == 0xFF))
+		return;
+
+	lod_segment_t segments[LOD_MESH_MAX_SEGMENTS];
+	unsigned num_segments = 0;
+
+	for(unsigned face = 0; face < 6; face++)
+		lod_mesh_face(chunk, corners, face, transition, segments, &num_segments);
+
+	lod_mesh_loops(chunk, segments, num_segments);
+}
+
+/* Построить сетку чанка номер task */
+static void lod_mesh_build_task(void *data, unsigned thread, unsigned task)
+{
+	lod_mesh_build_t *build = (lod_mesh_build_t*) data;
+	lod_mesh_scratch_t *scratch = &build->scratch[thread];
+	lod_mesh_result_t *result = &build->results[task];
+	unsigned index = build->chunks[task];
+	lod_chunk_t chunk;
+
+	result->num_vertices = result->num_triangles = 0;
+	result->min_value = -FLT_MAX;
+	result->max_value = FLT_MAX;
+	result->failed = 0;
+
+	if(!scratch->values) {
+		scratch->values = (float*) malloc(sizeof(float) * LOD_MESH_CHUNK_NODES);
+		scratch->weld = (unsigned*) calloc(3 * LOD_MESH_CHUNK_NODES, sizeof(unsigned));
+
+		if(!scratch->values || !scratch->weld) {
+			free(scratch->values);
+			free(scratch->weld);
+			scratch->values = NULL;
+			scratch->weld = NULL;
+
+			result->failed = 1;
+			__atomic_add_fetch(&build->done, 1, __ATOMIC_RELEASE);
+			return;
+		}
+	}
+
+	vector3ui coords = vec3ui(index % build->num_chunks.x, (index / build->num_chunks.x) % build->num_chunks.y,
+							  index / (build->num_chunks.x * build->num_chunks.y));
+
+	chunk.build = build;
+	chunk.scratch = scratch;
+	chunk.result = result;
+	chunk.origin = vec3ui_mult_c(coords, LOD_MESH_CHUNK_CELLS);
+	chunk.end = lod_mesh_min(vec3ui_add_c(chunk.origin, LOD_MESH_CHUNK_CELLS), build->cells);
+	chunk.lod = build->lods[index];
+	chunk.step = 1u << chunk.lod;
+	chunk.nodes = vec3ui_add_c(vec3ui_div_c(vec3ui_sub(chunk.end, chunk.origin), chunk.step), 1);
+	chunk.num_keys = 0;
+
+	chunk.has_transitions = lod_mesh_neighbors_lod(build->lods, build->num_chunks, coords) < chunk.lod;
+
+	result->min_value = FLT_MAX;
+	result->max_value = -FLT_MAX;
+
+	// значения узлов; на границе с детальным соседом - по его уровню
+	for(unsigned k = 0; k < chunk.nodes.z; k++)
+		for(unsigned j = 0; j < chunk.nodes.y; j++)
+			for(unsigned i = 0; i < chunk.nodes.x; i++) {
+				vector3ui p = vec3ui_add(chunk.origin, vec3ui_mult_c(vec3ui(i, j, k), chunk.step));
+				int border = (i == 0 || j == 0 || k == 0 || i + 1 == chunk.nodes.x || j + 1 == chunk.nodes.y || k + 1 == chunk.nodes.z);
+				unsigned level = (chunk.has_transitions && border) ? lod_mesh_min_lod(build, p, p) : chunk.lod;
+
+				float value = lod_mesh_value(build, p, level);
+
+				scratch->values[i + (j + k*chunk.nodes.y)*chunk.nodes.x] = value;
+
+				if(value < result->min_value)
+					result->min_value = value;
+				if(value > result->max_value)
+					result->max_value = value;
+			}
+
+	for(unsigned k = 0; k + 1 < chunk.nodes.z; k++)
+		for(unsigned j = 0; j + 1 < chunk.nodes.y; j++)
+			for(unsigned i = 0; i + 1 < chunk.nodes.x; i++)
+				lod_mesh_cell(&chunk, i, j, k);
+
+	for(unsigned i = 0; i < chunk.num_keys; i++)
+		scratch->weld[scratch->keys[i]] = 0;
+
+	// неполная сетка перестраивается при любом изо-уровне
+	if(result->failed) {
+		result->num_vertices = result->num_triangles = 0;
+		result->min_value = -FLT_MAX;
+		result->max_value = FLT_MAX;
+	}
+
+	__atomic_add_fetch(&build->done, 1, __ATOMIC_RELEASE);
+}
+
+void lod_mesh_init(lod_mesh_t *mesh)
+{
+	IF_FAILED(mesh);
+
+	memset(mesh, 0, sizeof(lod_mesh_t));
+
+	mesh->vertices.element_size = sizeof(vector3f);
+	mesh->indices.element_size = sizeof(unsigned);
+	mesh->is_stale = 1;
+}
+
+/* Вернуть диапазон [first, first + count) в свободные. Возвращает 0 при ошибке */
+static int lod_mesh_pool_free(lod_mesh_pool_t *pool, unsigned first, unsigned count)
+{
+	lod_mesh_range_t *ranges = pool->free;
+	unsigned i = 0;
+
+	if(!count)
+		return 1;
+
+	while(i < pool->num_free && ranges[i].first < first)
+		i++;
+
+	int join_prev = (i > 0 && ranges[i - 1].first + ranges[i - 1].count == first);
+	int join_next = (i < pool->num_free && first + count == ranges[i].first);
+
+	if(join_prev && join_next) {
+		ranges[i - 1].count += count + ranges[i].count;
+		memmove(&ranges[i], &ranges[i + 1], sizeof(lod_mesh_range_t) * (pool->num_free - i - 1));
+		pool->num_free--;
+	}
+	else if(join_prev) {
+		ranges[i - 1].count += count;
+	}
+	else if(join_next) {
+		ranges[i].first = first;
+		ranges[i].count += count;
+	}
+	else {
+		if(!lod_mesh_reserve((void**) &pool->free, &pool->max_free, pool->num_free + 1, sizeof(lod_mesh_range_t)))
+			return 0;
+
+		ranges = pool->free;
+		memmove(&ranges[i + 1], &ranges[i], sizeof(lod_mesh_range_t) * (pool->num_free - i));
+		ranges[i].first = first;
+		ranges[i].count = count;
+		pool->num_free++;
+	}
+
+	return 1;
+}
+
+/*
+ * Выделить count элементов (первый подходящий свободный диапазон). Если места нет,
+ * буфер увеличивается вдвое с копированием содержимого: диапазоны чанков сохраняются,
+ * но буфер меняется (grown = 1). Возвращает 0 при ошибке
+ */
+static int lod_mesh_pool_alloc(lod_mesh_pool_t *pool, unsigned count, unsigned *first, int *grown)
+{
+	for(unsigned i = 0; i < pool->num_free; i++) {
+		lod_mesh_range_t *range = &pool->free[i];
+
+		if(range->count < count)
+			continue;
+
+		*first = range->first;
+		range->first += count;
+		range->count -= count;
+
+		if(!range->count) {
+			memmove(range, range + 1, sizeof(lod_mesh_range_t) * (pool->num_free - i - 1));
+			pool->num_free--;
+		}
+
+		return 1;
+	}
+
+	unsigned size = pool->size + ((pool->size > count) ? pool->size : count);
+	GLuint buffer;
+
+	// свободный хвост учитывается до копирования, чтобы при ошибке буфер остался прежним
+	if(!lod_mesh_reserve((void**) &pool->free, &pool->max_free, pool->num_free + 1, sizeof(lod_mesh_range_t)))
+		return 0;
+
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr) pool->element_size * size, NULL, GL_DYNAMIC_DRAW);
+
+	if(pool->buffer) {
+		glBindBuffer(GL_COPY_READ_BUFFER, pool->buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (GLsizeiptr) pool->element_size * pool->size);
+		glDeleteBuffers(1, &pool->buffer);
+	}
+
+	lod_mesh_pool_free(pool, pool->size, size - pool->size);
+
+	pool->buffer = buffer;
+	pool->size = size;
+	*grown = 1;
+
+	return lod_mesh_pool_alloc(pool, count, first, grown);
+}
+
+/* Удалить буфер пула */
+static void lod_mesh_pool_release(lod_mesh_pool_t *pool)
+{
+	if(pool->buffer)
+		glDeleteBuffers(1, &pool->buffer);
+
+	pool->buffer = 0;
+	pool->size = 0;
+	pool->num_free = 0;
+}
+
+/* Подключить общие буферы к VAO */
+static void lod_mesh_setup_vao(lod_mesh_t *mesh, GLint attr_position)
+{
+	if(!mesh->vao)
+		glGenVertexArrays(1, &mesh->vao);
+
+	glBindVertexArray(mesh->vao);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh->vertices.buffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->indices.buffer);
+
+	if(attr_position != -1) {
+		glVertexAttribPointer(attr_position, 3, GL_FLOAT, GL_FALSE, sizeof(vector3f), (const GLvoid*) 0);
+		glEnableVertexAttribArray(attr_position);
+	}
+
+	glBindVertexArray(0);
+}
+
+/* Удалить буферы и массивы чанков */
+static void lod_mesh_release_chunks(lod_mesh_t *mesh)
+{
+	if(mesh->vao)
+		glDeleteVertexArrays(1, &mesh->vao);
+
+	mesh->vao = 0;
+	lod_mesh_pool_release(&mesh->vertices);
+	lod_mesh_pool_release(&mesh->indices);
+
+	free(mesh->chunks);
+	free(mesh->draw_counts);
+	free(mesh->draw_offsets);
+	free(mesh->dirty);
+	free(mesh->lods);
+	free(mesh->new_lods);
+
+	mesh->chunks = NULL;
+	mesh->draw_counts = NULL;
+	mesh->draw_offsets = NULL;
+	mesh->dirty = mesh->lods = mesh->new_lods = NULL;
+	mesh->num_draws = 0;
+	mesh->num_chunks = vec3ui(0, 0, 0);
+}
+
+/* Разбить поле из cells ячеек на чанки. Возвращает 0 при ошибке */
+static int lod_mesh_layout(lod_mesh_t *mesh, vector3ui cells)
+{
+	lod_mesh_release_chunks(mesh);
+
+	mesh->cells = cells;
+	mesh->is_stale = 1;
+
+	vector3ui num_chunks = vec3ui_div_c(vec3ui_add_c(cells, LOD_MESH_CHUNK_CELLS - 1), LOD_MESH_CHUNK_CELLS);
+	unsigned count = num_chunks.x * num_chunks.y * num_chunks.z;
+
+	if(!count)
+		return 0;
+
+	mesh->chunks = (lod_mesh_chunk_t*) calloc(count, sizeof(lod_mesh_chunk_t));
+	mesh->draw_counts = (GLsizei*) malloc(sizeof(GLsizei) * count);
+	mesh->draw_offsets = (const GLvoid**) malloc(sizeof(GLvoid*) * count);
+	mesh->dirty = (unsigned char*) calloc(count, 1);
+	mesh->lods = (unsigned char*) malloc(count);
+	mesh->new_lods = (unsigned char*) malloc(count);
+
+	if(!mesh->chunks || !mesh->draw_counts || !mesh->draw_offsets || !mesh->dirty || !mesh->lods || !mesh->new_lods) {
+		ERROR_MSG("LOD: cannot allocate %u chunks\n", count);
+		lod_mesh_release_chunks(mesh);
+		return 0;
+	}
+
+	memset(mesh->lods, LOD_MESH_NO_LEVEL, count);
+	mesh->num_chunks = num_chunks;
+
+	return 1;
+}
+
+/*
+ * Уровни чанков в new_lods: по расстоянию от viewer до чанка, не грубее узлов пирамиды,
+ * покрывающих чанк; затем уровни огрубляются не больше чем на 1 от соседей
+ */
+static void lod_mesh_select(lod_mesh_t *mesh, const volume_pyramid_t *pyramid, vector3f viewer, float distance)
+{
+	vector3ui num_chunks = mesh->num_chunks;
+	vector3f step = vec3f_div(vec3f(1.0f, 1.0f, 1.0f), vec3ui_to_vec3f(mesh->cells));
+	unsigned max_level = (pyramid->num_levels - 1 < LOD_MESH_MAX_LEVEL) ? pyramid->num_levels - 1 : LOD_MESH_MAX_LEVEL;
+	int changed;
+
+	for(unsigned k = 0; k < num_chunks.z; k++)
+		for(unsigned j = 0; j < num_chunks.y; j++)
+			for(unsigned i = 0; i < num_chunks.x; i++) {
+				vector3ui origin = vec3ui_mult_c(vec3ui(i, j, k), LOD_MESH_CHUNK_CELLS);
+				vector3ui end = lod_mesh_min(vec3ui_add_c(origin, LOD_MESH_CHUNK_CELLS), mesh->cells);
+				vector3ui extent = vec3ui_sub(end, origin);
+				unsigned max = max_level;
+
+				while(max > 0 && ((extent.x | extent.y | extent.z) & ((1u << max) - 1)))
+					max--;
+
+				vector3f lo = vec3f_mult(vec3ui_to_vec3f(origin), step), hi = vec3f_mult(vec3ui_to_vec3f(end), step);
+				vector3f d = vec3f(fmaxf(fmaxf(lo.x - viewer.x, viewer.x - hi.x), 0.0f),
+								   fmaxf(fmaxf(lo.y - viewer.y, viewer.y - hi.y), 0.0f),
+								   fmaxf(fmaxf(lo.z - viewer.z, viewer.z - hi.z), 0.0f));
+				float dist = vec3f_length(d);
+				unsigned lod = (dist < distance) ? 0 : (unsigned) log2f(dist / distance) + 1;
+
+				mesh->new_lods[i + (j + k*num_chunks.y)*num_chunks.x] = (lod < max) ? lod : max;
+			}
+
+	do {
+		changed = 0;
+
+		for(unsigned k = 0; k < num_chunks.z; k++)
+			for(unsigned j = 0; j < num_chunks.y; j++)
+				for(unsigned i = 0; i < num_chunks.x; i++) {
+					unsigned char *lod = &mesh->new_lods[i + (j + k*num_chunks.y)*num_chunks.x];
+					unsigned neighbors = lod_mesh_neighbors_lod(mesh->new_lods, num_chunks, vec3ui(i, j, k));
+
+					if(*lod > neighbors + 1) {
+						*lod = neighbors + 1;
+						changed = 1;
+					}
+				}
+	} while(changed);
+}
+
+/*
+ * Загрузить сетку чанка в общие буферы. Диапазоны выделяются с запасом, чтобы при небольших
+ * изменениях сетка оставалась на месте. Возвращает 0 при ошибке
+ */
+static int lod_mesh_upload_chunk(lod_mesh_t *mesh, lod_mesh_chunk_t *chunk, lod_mesh_result_t *result, int *grown)
+{
+	unsigned num_elements = 3 * result->num_triangles;
+
+	chunk->num_vertices = chunk->num_elements = 0;
+
+	if(result->num_vertices > chunk->max_vertices) {
+		unsigned max = result->num_vertices + result->num_vertices / 4;
+
+		lod_mesh_pool_free(&mesh->vertices, chunk->first_vertex, chunk->max_vertices);
+		chunk->max_vertices = 0;
+
+		if(!lod_mesh_pool_alloc(&mesh->vertices, max, &chunk->first_vertex, grown))
+			return 0;
+
+		chunk->max_vertices = max;
+	}
+
+	if(num_elements > chunk->max_elements) {
+		unsigned max = num_elements + num_elements / 4;
+
+		lod_mesh_pool_free(&mesh->indices, chunk->first_index, chunk->max_elements);
+		chunk->max_elements = 0;
+
+		if(!lod_mesh_pool_alloc(&mesh->indices, max, &chunk->first_index, grown))
+			return 0;
+
+		chunk->max_elements = max;
+	}
+
+	// индексы сетки чанка - от начала его диапазона вершин
+	unsigned *indices = (unsigned*) result->triangles;
+
+	for(unsigned i = 0; i < num_elements; i++)
+		indices[i] += chunk->first_vertex;
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, mesh->vertices.buffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(vector3f) * chunk->first_vertex,
+					sizeof(vector3f) * result->num_vertices, (const GLvoid*) result->vertices);
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, mesh->indices.buffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(unsigned) * chunk->first_index,
+					sizeof(unsigned) * num_elements, (const GLvoid*) indices);
+
+	chunk->num_vertices = result->num_vertices;
+	chunk->num_elements = num_elements;
+
+	return 1;
+}
+
+/* Поток перестройки: выполняет задачи работы вместо потока отрисовки и дожидается потоков пула */
+static void *lod_mesh_build_thread(void *arg)
+{
+	lod_mesh_t *mesh = (lod_mesh_t*) arg;
+
+	thread_pool_wait(&mesh->job);
+
+	return NULL;
+}
+
+/* Дождаться завершения работы пула */
+static void lod_mesh_join(lod_mesh_t *mesh)
+{
+	if(mesh->has_thread)
+		pthread_join(mesh->thread, NULL);
+	else
+		thread_pool_wait(&mesh->job);
+
+	thread_pool_release(&mesh->job);
+	mesh->is_building = 0;
+	mesh->has_thread = 0;
+}
+
+/* Дождаться работы пула и загрузить сетки перестроенных чанков */
+static void lod_mesh_finish(lod_mesh_t *mesh, GLint attr_position)
+{
+	lod_mesh_build_t *build = mesh->build;
+	unsigned num_chunks = mesh->num_chunks.x * mesh->num_chunks.y * mesh->num_chunks.z;
+	unsigned num_triangles = 0;
+	int grown = 0;
+
+	lod_mesh_join(mesh);
+
+	glBindVertexArray(0);
+
+	for(unsigned task = 0; task < build->num_tasks; task++) {
+		lod_mesh_result_t *result = &build->results[task];
+		lod_mesh_chunk_t *chunk = &mesh->chunks[build->chunks[task]];
+
+		if(result->failed)
+			ERROR_MSG("LOD: cannot build chunk %u\n", build->chunks[task]);
+
+		chunk->min_value = result->min_value;
+		chunk->max_value = result->max_value;
+
+		// чанк без буферов остаётся пустым до следующей перестройки
+		if(!lod_mesh_upload_chunk(mesh, chunk, result, &grown)) {
+			ERROR_MSG("LOD: cannot allocate buffers for chunk %u\n", build->chunks[task]);
+
+			chunk->min_value = -FLT_MAX;
+			chunk->max_value = FLT_MAX;
+		}
+
+		mesh->dirty[build->chunks[task]] = 0;
+		num_triangles += result->num_triangles;
+	}
+
+	if(grown || !mesh->vao)
+		lod_mesh_setup_vao(mesh, attr_position);
+
+	mesh->num_draws = 0;
+
+	for(unsigned i = 0; i < num_chunks; i++) {
+		if(!mesh->chunks[i].num_elements)
+			continue;
+
+		mesh->draw_counts[mesh->num_draws] = mesh->chunks[i].num_elements;
+		mesh->draw_offsets[mesh->num_draws] = (const GLvoid*) (sizeof(unsigned) * mesh->chunks[i].first_index);
+		mesh->num_draws++;
+	}
+
+	memcpy(mesh->lods, mesh->new_lods, num_chunks);
+
+	TRACE_MSG("LOD: %u chunks (%u triangles) rebuilt in %.3f s\n", build->num_tasks, num_triangles,
+			  utils_get_time() - build->start_time);
+}
+
+/*
+ * Выбрать для перестройки чанки, у которых изменился уровень или уровень соседа,
+ * изо-уровень прошёл через значения узлов или изменилось поле. Возвращает 0, если
+ * перестраивать нечего или при ошибке
+ */
+static int lod_mesh_prepare(lod_mesh_t *mesh, const volume_pyramid_t *pyramid, float isolevel)
+{
+	vector3ui num_chunks = mesh->num_chunks;
+	unsigned count = num_chunks.x * num_chunks.y * num_chunks.z;
+
+	// сетка чанка, все узлы которого по одну сторону от обоих изо-уровней, не меняется
+	float low = (isolevel < mesh->isolevel) ? isolevel : mesh->isolevel;
+	float high = (isolevel < mesh->isolevel) ? mesh->isolevel : isolevel;
+
+	if(!mesh->build) {
+		mesh->build = (lod_mesh_build_t*) calloc(1, sizeof(lod_mesh_build_t));
+		IF_FAILED0(mesh->build);
+	}
+
+	lod_mesh_build_t *build = mesh->build;
+
+	// буферы сеток сохраняются между перестройками, новые - пустые
+	if(count > build->max_tasks) {
+		unsigned *chunks = (unsigned*) realloc(build->chunks, sizeof(unsigned) * count);
+		lod_mesh_result_t *results = (lod_mesh_result_t*) realloc(build->results, sizeof(lod_mesh_result_t) * count);
+
+		if(chunks)
+			build->chunks = chunks;
+		if(results)
+			build->results = results;
+
+		IF_FAILED0(chunks && results);
+
+		memset(build->results + build->max_tasks, 0, sizeof(lod_mesh_result_t) * (count - build->max_tasks));
+		build->max_tasks = count;
+	}
+
+	build->num_tasks = 0;
+
+	for(unsigned k = 0; k < num_chunks.z; k++)
+		for(unsigned j = 0; j < num_chunks.y; j++)
+			for(unsigned i = 0; i < num_chunks.x; i++) {
+				unsigned index = i + (j + k*num_chunks.y)*num_chunks.x;
+				const lod_mesh_chunk_t *chunk = &mesh->chunks[index];
+				int dirty = mesh->is_stale || mesh->dirty[index] ||
+					(isolevel != mesh->isolevel && chunk->min_value < high && chunk->max_value >= low);
+
+				for(unsigned z = (k > 0) ? k - 1 : 0; !dirty && z <= k + 1 && z < num_chunks.z; z++)
+					for(unsigned y = (j > 0) ? j - 1 : 0; !dirty && y <= j + 1 && y < num_chunks.y; y++)
+						for(unsigned x = (i > 0) ? i - 1 : 0; !dirty && x <= i + 1 && x < num_chunks.x; x++) {
+							unsigned neighbor = x + (y + z*num_chunks.y)*num_chunks.x;
+
+							dirty = (mesh->lods[neighbor] != mesh->new_lods[neighbor]);
+						}
+
+				if(dirty)
+					build->chunks[build->num_tasks++] = index;
+			}
+
+	mesh->isolevel = isolevel;
+	mesh->is_stale = 0;
+
+	if(!build->num_tasks)
+		return 0;
+
+	build->pyramid = *pyramid;
+	build->cells = mesh->cells;
+	build->num_chunks = num_chunks;
+	build->pos_step = vec3f_div(vec3f(1.0f, 1.0f, 1.0f), vec3ui_to_vec3f(mesh->cells));
+	build->isolevel = isolevel;
+	build->lods = mesh->new_lods;
+	build->done = 0;
+	build->start_time = utils_get_time();
+
+	return 1;
+}
+
+/* Отправить в пул перестройку изменившихся чанков */
+static void lod_mesh_submit(lod_mesh_t *mesh, const volume_pyramid_t *pyramid, float isolevel, GLint attr_position)
+{
+	if(!lod_mesh_prepare(mesh, pyramid, isolevel))
+		return;
+
+	lod_mesh_build_t *build = mesh->build;
+
+	if(!thread_pool_submit(&mesh->job, lod_mesh_build_task, build, build->num_tasks)) {
+		ERROR_MSG("LOD: cannot submit %u chunks\n", build->num_tasks);
+
+		// повторить на следующем обновлении
+		for(unsigned task = 0; task < build->num_tasks; task++)
+			mesh->dirty[build->chunks[task]] = 1;
+
+		return;
+	}
+
+	mesh->is_building = 1;
+
+	// поток отрисовки только проверяет завершение (в т.ч. когда в пуле нет других потоков)
+	mesh->has_thread = (pthread_create(&mesh->thread, NULL, lod_mesh_build_thread, mesh) == 0);
+
+	if(!mesh->has_thread) {
+		ERROR_MSG("LOD: cannot create build thread\n");
+		lod_mesh_finish(mesh, attr_position);
+	}
+}
+
+void lod_mesh_update(lod_mesh_t *mesh, const volume_pyramid_t *pyramid, float isolevel,
+					 vector3f viewer, float distance, GLint attr_position)
+{
+	IF_FAILED(mesh && pyramid && distance > 0.0f);
+
+	if(mesh->is_building) {
+		// чанки загружаются все вместе, чтобы швы между ними менялись одновременно
+		if(__atomic_load_n(&mesh->build->done, __ATOMIC_ACQUIRE) < mesh->build->num_tasks)
+			return;
+
+		lod_mesh_finish(mesh, attr_position);
+	}
+
+	if(!pyramid->num_levels || !pyramid->average[0])
+		return;
+
+	vector3ui cells = vec3ui_sub_c(pyramid->sizes[0], 1);
+
+	if(!mesh->chunks || cells.x != mesh->cells.x || cells.y != mesh->cells.y || cells.z != mesh->cells.z)
+		if(!lod_mesh_layout(mesh, cells))
+			return;
+
+	lod_mesh_select(mesh, pyramid, viewer, distance);
+	lod_mesh_submit(mesh, pyramid, isolevel, attr_position);
+}
+
+int lod_mesh_extract(const volume_pyramid_t *pyramid, float isolevel, vector3f viewer, float distance,
+					 vector3f **vertices, unsigned *num_vertices, triangle_t **triangles, unsigned *num_triangles)
+{
+	IF_FAILED0(pyramid && distance > 0.0f && vertices && num_vertices && triangles && num_triangles);
+	IF_FAILED0(pyramid->num_levels && pyramid->average[0]);
+
+	lod_mesh_t mesh;
+	int is_built = 0;
+
+	*vertices = NULL;
+	*triangles = NULL;
+	*num_vertices = *num_triangles = 0;
+
+	// чанки без буферов OpenGL: все перестраиваются после разбиения
+	lod_mesh_init(&mesh);
+
+	if(lod_mesh_layout(&mesh, vec3ui_sub_c(pyramid->sizes[0], 1))) {
+		lod_mesh_select(&mesh, pyramid, viewer, distance);
+
+		is_built = lod_mesh_prepare(&mesh, pyramid, isolevel) &&
+				   thread_pool_run(lod_mesh_build_task, mesh.build, mesh.build->num_tasks);
+	}
+
+	for(unsigned task = 0; is_built && task < mesh.build->num_tasks; task++) {
+		is_built = !mesh.build->results[task].failed;
+		*num_vertices += mesh.build->results[task].num_vertices;
+		*num_triangles += mesh.build->results[task].num_triangles;
+	}
+
+	if(is_built) {
+		*vertices = (vector3f*) malloc(sizeof(vector3f) * (*num_vertices + 1));
+		*triangles = (triangle_t*) malloc(sizeof(triangle_t) * (*num_triangles + 1));
+		is_built = (*vertices && *triangles);
+	}
+
+	// индексы сетки чанка - от начала его вершин в общем массиве
+	for(unsigned task = 0, first_vertex = 0, first_triangle = 0; is_built && task < mesh.build->num_tasks; task++) {
+		const lod_mesh_result_t *result = &mesh.build->results[task];
+
+		memcpy(*vertices + first_vertex, result->vertices, sizeof(vector3f) * result->num_vertices);
+
+		for(unsigned t = 0; t < result->num_triangles; t++)
+			for(unsigned i = 0; i < 3; i++)
+				(*triangles)[first_triangle + t].indices[i] = result->triangles[t].indices[i] + first_vertex;
+
+		first_vertex += result->num_vertices;
+		first_triangle += result->num_triangles;
+	}
+
+	if(!is_built) {
+		ERROR_MSG("LOD: cannot extract chunk meshes\n");
+
+		free(*vertices);
+		free(*triangles);
+		*vertices = NULL;
+		*triangles = NULL;
+		*num_vertices = *num_triangles = 0;
+	}
+
+	lod_mesh_destroy(&mesh);
+
+	return is_built;
+}
+
+void lod_mesh_draw(const lod_mesh_t *mesh)
+{
+	IF_FAILED(mesh);
+
+	if(!mesh->num_draws)
+		return;
+
+	glBindVertexArray(mesh->vao);
+	glMultiDrawElements(GL_TRIANGLES, mesh->draw_counts, GL_UNSIGNED_INT, mesh->draw_offsets, mesh->num_draws);
+	glBindVertexArray(0);
+}
+
+/* Дождаться работы пула и отбросить её результат, её чанки перестраиваются заново */
+static void lod_mesh_discard(lod_mesh_t *mesh)
+{
+	if(!mesh->is_building)
+		return;
+
+	lod_mesh_join(mesh);
+
+	for(unsigned task = 0; task < mesh->build->num_tasks; task++)
+		mesh->dirty[mesh->build->chunks[task]] = 1;
+}
+
+void lod_mesh_invalidate(lod_mesh_t *mesh)
+{
+	IF_FAILED(mesh);
+
+	lod_mesh_discard(mesh);
+	mesh->is_stale = 1;
+}
+
+void lod_mesh_invalidate_region(lod_mesh_t *mesh, vector3ui begin, vector3ui end)
+{
+	IF_FAILED(mesh);
+
+	lod_mesh_discard(mesh);
+
+	if(!mesh->chunks)
+		return;
+
+	// узел уровня l пирамиды усредняет исходные узлы на расстоянии до 2^l - 1
+	unsigned margin = (1u << LOD_MESH_MAX_LEVEL) - 1;
+	vector3ui lo = vec3ui_sub(begin, lod_mesh_min(begin, vec3ui(margin, margin, margin)));
+	vector3ui hi = vec3ui_add_c(end, margin);
+	vector3ui first, last;
+
+	// чанк c содержит узлы [c * LOD_MESH_CHUNK_CELLS, (c + 1) * LOD_MESH_CHUNK_CELLS]
+	first = vec3ui((lo.x > 0) ? (lo.x - 1) / LOD_MESH_CHUNK_CELLS : 0, (lo.y > 0) ? (lo.y - 1) / LOD_MESH_CHUNK_CELLS : 0,
+				   (lo.z > 0) ? (lo.z - 1) / LOD_MESH_CHUNK_CELLS : 0);
+	last = lod_mesh_min(vec3ui_div_c(hi, LOD_MESH_CHUNK_CELLS), vec3ui_sub_c(mesh->num_chunks, 1));
+
+	for(unsigned k = first.z; k <= last.z; k++)
+		for(unsigned j = first.y; j <= last.y; j++)
+			for(unsigned i = first.x; i <= last.x; i++)
+				mesh->dirty[i + (j + k*mesh->num_chunks.y)*mesh->num_chunks.x] = 1;
+}
+
+void lod_mesh_destroy(lod_mesh_t *mesh)
+{
+	IF_FAILED(mesh);
+
+	lod_mesh_discard(mesh);
+	lod_mesh_release_chunks(mesh);
+
+	free(mesh->vertices.free);
+	free(mesh->indices.free);
+
+	if(mesh->build) {
+		lod_mesh_build_t *build = mesh->build;
+
+		for(unsigned i = 0; i < build->max_tasks && build->results; i++) {
+			free(build->results[i].vertices);
+			free(build->results[i].triangles);
+		}
+
+		for(unsigned i = 0; i < SCHEDULER_MAX_THREADS; i++) {
+			free(build->scratch[i].values);
+			free(build->scratch[i].weld);
+			free(build->scratch[i].keys);
+		}
+
+		free(build->chunks);
+		free(build->results);
+		free(build);
+	}
+
+	lod_mesh_init(mesh);
+}
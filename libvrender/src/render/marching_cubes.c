@@ -18,10 +18,31 @@
 
 #include "common.h"
 #include "marching_cubes.h"
+#include "mesh_decimate.h"
 #include "math/dmath.h"
 #include "render.h"
+#include "thread_pool.h"
+#include <stdint.h>
 #include <string.h>
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+// кол-во вершин в одной задаче вычисления нормалей
+#define NORMALS_TASK_SIZE 1024
+// запас места слоя в буферах обновляемой сетки: MESH_SLACK_DIV-я часть и ещё MESH_SLACK_MIN элементов
+#define MESH_SLACK_DIV 4
+#define MESH_SLACK_MIN 16
+// через сколько обновлений сетки выводить статистику
+#define MESH_REPORT_UPDATES 100
+
+// общие вершины у соседних ячеек (marching_cubes_set_welded)
+static int is_welded = 1;
+
+// упрощение сетки перед загрузкой (marching_cubes_set_decimation)
+static float decimation_ratio = 1.0f, decimation_error = 0.0f;
+
 // таблица граней
 int mc_edge_table[256] = {
 	0x0  , 0x109, 0x203, 0x30a, 0x406, 0x50f, 0x605, 0x70c,
@@ -408,7 +429,8 @@ int marching_cubes_polygonise(cell_t cell, float isolevel, vector3f *out_vertice
 		indices[i] = -1;
 	
 	// заполняем массив indices номерами вершин внутри массива out_vertices
-	for(int i = 0; i < 12; i++) {
+	// (до 5 треугольников, как и при полигонизации всего поля)
+	for(int i = 0; i < 15; i++) {
 		if(mc_tri_table[cube][i] != -1) {
 			if(indices[(unsigned) mc_tri_table[cube][i]] == -1) {
 				indices[(unsigned) mc_tri_table[cube][i]] = vertices_count;
@@ -438,175 +460,1378 @@ int marching_cubes_polygonise(cell_t cell, float isolevel, vector3f *out_vertice
 }
 
 
-int marching_cubes_create(const float *volume, vector3ui volume_size, vector3ui grid_size, 
-						  float isolevel, vector3f *out_vertices, unsigned *number_of_vertices, 
-						  triangle_t *out_triangles, unsigned *number_of_triangles)
-{	
-	IF_FAILED_RET(volume && out_vertices && out_triangles, -1);
-	
-	unsigned short i = 0, j = 0, k = 0;
-	vector3ui value_step = vec3ui_div(volume_size, grid_size);
-	vector3f  pos_step = vec3f_div(vec3f(1.0f, 1.0f, 1.0f), vec3f(grid_size.x, grid_size.y, grid_size.z));
-	unsigned int vertices_count = 0, triangles_count = 0;
-	unsigned index_offset = 0;
-	
-	
-	cell_t cell;
-	vector3f vertices[15];
-	triangle_t triangles[5];
-	unsigned short nv = 0, nt = 0;
-	
-	// проходим по всему массиву volume
-	for(k = 0; k < grid_size.z - 1; k++) {
-		for(j = 0; j < grid_size.y - 1; j++) {
-			for(i = 0; i < grid_size.x - 1; i++) {
-				
-				// вычисялем смещения для вершин и для изо-значений
-				vector3f  pos_offset   = vec3f_mult(vec3f(i, j, k), pos_step);
-				vector3ui value_offset = vec3ui_mult(vec3ui(i, j, k), value_step);
-				
-				#define VOLUME(v) volume[(v).x + (v).y*volume_size.x + (v).z*volume_size.x*volume_size.y]
-				
-				// создаем ячейку с соотвествующими вершинами и изо-значениями
-				cell.vertices_positions[0] = pos_offset;
-				cell.vertices_values[0]	= VOLUME(value_offset);
-				
-				cell.vertices_positions[1] = vec3f_add(pos_offset, vec3f(pos_step.x, 0.0f, 0.0f));
-				cell.vertices_values[1]	= VOLUME(vec3ui_add(value_offset, vec3ui(value_step.x, 0, 0)));
-				
-				cell.vertices_positions[2] = vec3f_add(pos_offset, vec3f(pos_step.x, pos_step.y, 0.0f));
-				cell.vertices_values[2]	= VOLUME(vec3ui_add(value_offset, vec3ui(value_step.x, value_step.y, 0)));
-				
-				cell.vertices_positions[3] = vec3f_add(pos_offset, vec3f(0.0f, pos_step.y, 0.0f));
-				cell.vertices_values[3]	= VOLUME(vec3ui_add(value_offset, vec3ui(0, value_step.y, 0)));
-				
-				
-				cell.vertices_positions[4] = vec3f_add(pos_offset, vec3f(0.0f, 0.0f, pos_step.z));;
-				cell.vertices_values[4]	= VOLUME(vec3ui_add(value_offset, vec3ui(0, 0, value_step.z)));
-				
-				cell.vertices_positions[5] = vec3f_add(pos_offset, vec3f(pos_step.x, 0.0f, pos_step.z));
-				cell.vertices_values[5]	= VOLUME(vec3ui_add(value_offset, vec3ui(value_step.x, 0, value_step.z)));
-				
-				cell.vertices_positions[6] = vec3f_add(pos_offset, vec3f(pos_step.x, pos_step.y, pos_step.z));
-				cell.vertices_values[6]	= VOLUME(vec3ui_add(value_offset, vec3ui(value_step.x, value_step.y, value_step.z)));
-				
-				cell.vertices_positions[7] = vec3f_add(pos_offset, vec3f(0.0f, pos_step.y, pos_step.z));
-				cell.vertices_values[7]	= VOLUME(vec3ui_add(value_offset, vec3ui(0, value_step.y, value_step.z)));
-				
-				#undef VOLUME
-				
-				// полигонизируем ячейку и получаем набор из вершин и индексов
-				int result = marching_cubes_polygonise(cell, isolevel, vertices, &nv, triangles, &nt);
-				
-				if(result == 0)
-					continue;
-				else if(result == -1)
-					return -1;
-
-				// заполняем массив out_vertices новыми вершинами
-				int v = 0;
-				for(v = 0; v < nv-1; v++) {
-					out_vertices[vertices_count] = vertices[v];
-					vertices_count++;
-				}
-				
-				// заполняем out_triangles новыми индексами треугольников
-				int t = 0;
-				triangle_t triangle;
-				int max_temp = 0, max_temp_2 = 0;
-				for(t = 0; t < nt-1; t++) {
-					triangle = triangles[t];
-
-					// смещаем индексы
-					triangle.indices[0] += index_offset;
-					triangle.indices[1] += index_offset;
-					triangle.indices[2] += index_offset;
-
-					// ищем максимальный индекс
-					max_temp = math_max(math_max(triangle.indices[0], triangle.indices[1]), triangle.indices[2]);
-					max_temp_2 = math_max(max_temp_2, max_temp);
-
-					out_triangles[triangles_count] = triangle;
-					triangles_count++;
-					}
+// полигонизация в пуле потоков: задачи - плоскости узлов сетки и слои ячеек
+typedef struct {
+	const float *volume;
+	vector3ui volume_size, grid_size;
+	float isolevel;
+
+	// шаг узлов сетки в скалярном поле и в координатах вершин
+	vector3ui value_step;
+	vector3f pos_step;
+
+	// кол-во слоёв: ячеек, а с общими вершинами ещё один слой с вершинами последней плоскости
+	unsigned num_layers;
+
+	// min/max значений узлов блоков ячеек (mc_bricks)
+	const float *bricks;
+	vector3ui num_bricks;
+
+	// состояния блоков для изо-уровня (MC_BRICK_*) и полос блоков по x (band_states[by + bz * num_bricks.y])
+	unsigned char *brick_states, *band_states;
+
+	// принадлежность узлов сетки объёму (значение < isolevel): строки битов по row_words
+	// 64-битных слов на каждую строку узлов по x, плоскости идут подряд
+	uint64_t *inside;
+	unsigned row_words;
+
+	// обновление сетки, построенной при flip_isolevel: plane_flips - есть ли на плоскости узлы,
+	// сменившие принадлежность, dirty - слои, треугольники которых нужно построить заново
+	// (NULL - полигонизация всех слоёв)
+	float flip_isolevel;
+	unsigned char *plane_flips, *dirty;
+
+	// плоскости [edit_begin, edit_end), значения узлов которых изменились после построения
+	// (marching_cubes_invalidate_region): их слои тоже строятся заново
+	unsigned edit_begin, edit_end;
+
+	// кол-во вершин и треугольников слоёв после прохода подсчёта,
+	// смещения слоёв в выходных массивах после префиксной суммы
+	unsigned *vertex_offsets, *triangle_offsets;
+
+	vector3f *out_vertices;
+	triangle_t *out_triangles;
+
+	int error;
+} mc_job_t;
+
+// буферы, сохраняемые между вызовами и увеличиваемые только при необходимости
+// (полигонизация выполняется из одного потока рендера, поэтому буферы общие)
+static struct {
+	uint64_t *inside;
+	unsigned max_inside;
+
+	unsigned char *brick_states;
+	unsigned max_brick_states;
+
+	unsigned *offsets;
+	unsigned max_offsets;
+
+	// номера вершин на рёбрах двух плоскостей для каждого потока пула
+	unsigned *edge_ids[SCHEDULER_MAX_THREADS];
+	unsigned max_edge_ids[SCHEDULER_MAX_THREADS];
+
+	vector3f *vertices;
+	unsigned max_vertices;
 
-				// смещение = максимальный индекс + 1
-				index_offset = max_temp_2 + 1;
-				
+	triangle_t *triangles;
+	unsigned max_triangles;
+} mc_buffers;
+
+// размер блока в ячейках по каждой оси (узлы строки блока занимают байт строки битов узлов)
+#define MC_BRICK_SIZE 8
+
+// состояние блока для изо-уровня: все узлы снаружи, внутри или по обе стороны поверхности
+#define MC_BRICK_OUTSIDE 0
+#define MC_BRICK_INSIDE 1
+#define MC_BRICK_MIXED 2
+
+// min/max значений узлов по блокам MC_BRICK_SIZE^3 ячеек: строятся один раз для скалярного поля
+// и размера сетки, затем при любом изо-уровне значения узлов читаются только в блоках,
+// через которые проходит изоповерхность
+static struct {
+	const float *volume;
+	vector3ui volume_size, grid_size;
+	vector3ui num_bricks;
+
+	float *min_max;
+	unsigned max_min_max;
+
+	int is_valid;
+} mc_bricks;
+
+// сетка marching_cubes_update_mesh: у каждого слоя своё место в буферах с запасом,
+// поэтому слой можно перестроить, не сдвигая остальные
+static struct {
+	const float *volume;
+	vector3ui volume_size, grid_size;
+	int is_welded;
+	float isolevel;
+
+	unsigned num_layers;
+	// кол-во вершин и треугольников слоёв, начала мест слоёв (num_layers+1, последнее - размер буфера)
+	unsigned *vertex_counts, *triangle_counts, *vertex_bases, *triangle_bases;
+	unsigned *layers;
+	unsigned max_layers;
+
+	// номер размещения слоёв, номер обновления и номера обновлений, перестроивших слои
+	unsigned layout, version;
+	unsigned *versions;
+
+	// буферы marching_cubes_update_vbos и загруженная в них сетка
+	GLuint vertex_vbo, index_vbo;
+	mc_layers_upload_t upload;
+
+	// изменившиеся слои и плоскости при обновлении
+	unsigned char *flags;
+	unsigned max_flags;
+
+	// плоскости с изменёнными значениями узлов [edit_begin, edit_end)
+	unsigned edit_begin, edit_end;
+
+	// вершины и треугольники по местам слоёв
+	vector3f *vertices;
+	unsigned max_vertices;
+	triangle_t *triangles;
+	unsigned max_triangles;
+
+	// статистика обновлений с последнего отчёта
+	unsigned num_updates, num_relayouts;
+	double touched_triangles, total_triangles;
+
+	int is_valid;
+} mc_mesh;
+
+// кол-во вершин и треугольников в конфигурации ячейки (как в marching_cubes_polygonise,
+// с общими вершинами треугольники те же)
+static unsigned char mc_case_vertices[256], mc_case_triangles[256];
+// рёбра вершин в порядке создания marching_cubes_polygonise и номера вершин индексов mc_tri_table
+static unsigned char mc_case_edges[256][12], mc_case_indices[256][15];
+static int mc_case_init = 0;
+
+// смещения узлов ячейки и узлы рёбер (нумерация marching_cubes_polygonise)
+static const unsigned char mc_corners[8][3] = {
+	{0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0}, {0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1}
+};
+static const unsigned char mc_edge_corners[12][2] = {
+	{0, 1}, {1, 2}, {2, 3}, {3, 0}, {4, 5}, {5, 6}, {6, 7}, {7, 4}, {0, 4}, {1, 5}, {2, 6}, {3, 7}
+};
+
+/* Заполнить таблицы вершин и треугольников по конфигурациям */
+static void marching_cubes_init_cases(void)
+{
+	if(mc_case_init)
+		return;
+
+	for(unsigned cube = 0; cube < 256; cube++) {
+		unsigned edges = 0, count = 0, vertices = 0;
+
+		while(count < 15 && mc_tri_table[cube][count] != -1)
+			count++;
+
+		for(unsigned i = 0; i < count; i++) {
+			unsigned edge = (unsigned) mc_tri_table[cube][i];
+
+			if(!(edges & (1 << edge))) {
+				mc_case_edges[cube][vertices] = edge;
+				vertices++;
+			}
+			edges |= 1 << edge;
+
+			for(unsigned v = 0; v < vertices; v++) {
+				if(mc_case_edges[cube][v] == edge)
+					mc_case_indices[cube][i] = v;
 			}
 		}
+
+		mc_case_vertices[cube] = (mc_edge_table[cube] != 0) ? vertices : 0;
+		mc_case_triangles[cube] = (mc_edge_table[cube] != 0) ? count / 3 : 0;
 	}
-	
-	if(number_of_vertices)
-		*number_of_vertices = vertices_count+1;
-	if(number_of_triangles)
-		*number_of_triangles = triangles_count+1;
-	
+
+	mc_case_init = 1;
+}
+
+/* Увеличить буфер *ptr из *size элементов до count элементов (с запасом) */
+static int marching_cubes_reserve(void **ptr, unsigned *size, unsigned count, size_t element_size)
+{
+	if(count <= *size && *ptr)
+		return 1;
+
+	// запас на случай плавного роста (анимация изо-уровня)
+	unsigned new_size = count + count / 4 + 1;
+	void *new_ptr = realloc(*ptr, element_size * new_size);
+
+	IF_FAILED0(new_ptr);
+
+	*ptr = new_ptr;
+	*size = new_size;
+
 	return 1;
 }
 
-int marching_cubes_create_vbos(const float *volume, vector3ui volume_size, 
-							  vector3ui grid_size, float isolevel,
-							   GLuint vertex_vbo, GLuint index_vbo, GLuint normal_vbo,
-							   float (*function)(vector3f pos), unsigned *num_elements)
+/* Значение скалярного поля в узле v сетки */
+INLINE static float marching_cubes_grid_value(const mc_job_t *job, vector3ui v)
 {
-	int result = 0;
-	unsigned n_vertices = 0, n_triangles = 0;
-	vector3f *vertices = NULL;
-	triangle_t *triangles = NULL;
-	GLint last_array_buffer, last_element_array_buffer;
-	
-	IF_FAILED_RET(volume && (vertex_vbo > 0) && (index_vbo > 0), -1);
+	vector3ui value = vec3ui_mult(v, job->value_step);
+
+	return job->volume[value.x + value.y*job->volume_size.x + value.z*job->volume_size.x*job->volume_size.y];
+}
 
-	// выделяем память под вершины и индексы
-	vertices = (vector3f*) malloc(sizeof(vector3f) * volume_size.x*volume_size.y*volume_size.z * 15);
-	triangles = (triangle_t*) malloc(sizeof(triangle_t) * volume_size.x*volume_size.y*volume_size.z * 5);
+/* Вершина изоповерхности на ребре между узлами v1 и v2 сетки */
+static vector3f marching_cubes_edge_vertex(const mc_job_t *job, vector3ui v1, vector3ui v2)
+{
+	return vertices_lerp(job->isolevel, vec3f_mult(vec3ui_to_vec3f(v1), job->pos_step), marching_cubes_grid_value(job, v1),
+						 vec3f_mult(vec3ui_to_vec3f(v2), job->pos_step), marching_cubes_grid_value(job, v2));
+}
 
-	// полигонизируем
-	result = marching_cubes_create(volume, volume_size, grid_size, isolevel, vertices, &n_vertices, triangles, &n_triangles);
+/* Строка битов принадлежности объёму узлов (0..grid_size.x-1, j, k) */
+INLINE static uint64_t *marching_cubes_inside_row(const mc_job_t *job, unsigned j, unsigned k)
+{
+	return job->inside + (j + k * job->grid_size.y) * job->row_words;
+}
 
-	if(result == -1) {
-		free(triangles);
-		free(vertices);
-		
-		return -1;
+INLINE static unsigned marching_cubes_row_bit(const uint64_t *row, unsigned i)
+{
+	return (unsigned) (row[i / 64] >> (i % 64)) & 1;
+}
+
+/* Слово w строки, сдвинутой на один узел (бит i - узел i+1) */
+INLINE static uint64_t marching_cubes_row_next(const mc_job_t *job, const uint64_t *row, unsigned w)
+{
+	return (row[w] >> 1) | ((w + 1 < job->row_words) ? row[w + 1] << 63 : 0);
+}
+
+/* Биты слова w для узлов (ячеек) с номерами меньше n */
+INLINE static uint64_t marching_cubes_row_limit(unsigned w, unsigned n)
+{
+	if(n >= (w + 1) * 64)
+		return ~(uint64_t) 0;
+
+	return (n > w * 64) ? ((uint64_t) 1 << (n - w * 64)) - 1 : 0;
+}
+
+/* Конфигурация ячейки (i, j) слоя k по принадлежности её узлов объёму */
+INLINE static unsigned marching_cubes_cube_index(const mc_job_t *job, unsigned i, unsigned j, unsigned k)
+{
+	const uint64_t *row0 = marching_cubes_inside_row(job, j, k), *row1 = marching_cubes_inside_row(job, j + 1, k);
+	const uint64_t *row2 = marching_cubes_inside_row(job, j, k + 1), *row3 = marching_cubes_inside_row(job, j + 1, k + 1);
+
+	// узлы в том же порядке, что и в marching_cubes_polygonise
+	return marching_cubes_row_bit(row0, i) | (marching_cubes_row_bit(row0, i + 1) << 1) |
+		   (marching_cubes_row_bit(row1, i + 1) << 2) | (marching_cubes_row_bit(row1, i) << 3) |
+		   (marching_cubes_row_bit(row2, i) << 4) | (marching_cubes_row_bit(row2, i + 1) << 5) |
+		   (marching_cubes_row_bit(row3, i + 1) << 6) | (marching_cubes_row_bit(row3, i) << 7);
+}
+
+/* Слово w маски ячеек строки j слоя k, через которые проходит изоповерхность (узлы не по одну сторону) */
+INLINE static uint64_t marching_cubes_active_cells(const mc_job_t *job, unsigned j, unsigned k, unsigned w)
+{
+	const uint64_t *row0 = marching_cubes_inside_row(job, j, k), *row1 = marching_cubes_inside_row(job, j + 1, k);
+	const uint64_t *row2 = marching_cubes_inside_row(job, j, k + 1), *row3 = marching_cubes_inside_row(job, j + 1, k + 1);
+
+	uint64_t any = row0[w] | row1[w] | row2[w] | row3[w], all = row0[w] & row1[w] & row2[w] & row3[w];
+	uint64_t any_next = marching_cubes_row_next(job, row0, w) | marching_cubes_row_next(job, row1, w) |
+						marching_cubes_row_next(job, row2, w) | marching_cubes_row_next(job, row3, w);
+	uint64_t all_next = marching_cubes_row_next(job, row0, w) & marching_cubes_row_next(job, row1, w) &
+						marching_cubes_row_next(job, row2, w) & marching_cubes_row_next(job, row3, w);
+
+	return (any | any_next) & ~(all & all_next) & marching_cubes_row_limit(w, job->grid_size.x - 1);
+}
+
+/* Узлы (ячейки) [begin, end) по оси из size узлов (ячеек), принадлежащие блоку b из num */
+INLINE static void marching_cubes_brick_range(unsigned b, unsigned num, unsigned size, unsigned *begin, unsigned *end)
+{
+	*begin = b * MC_BRICK_SIZE;
+	*end = (b + 1 == num) ? size : *begin + MC_BRICK_SIZE;
+}
+
+/* Задача пула: min/max узлов блоков слоя блоков bz */
+static void marching_cubes_bricks_task(void *data, unsigned thread, unsigned bz)
+{
+	const mc_job_t *job = (const mc_job_t*) data;
+	vector3ui grid_size = job->grid_size, num_bricks = job->num_bricks;
+
+	for(unsigned by = 0; by < num_bricks.y; by++) {
+		for(unsigned bx = 0; bx < num_bricks.x; bx++) {
+			unsigned begin_x, end_x, begin_y, end_y, begin_z, end_z;
+			float min = HUGE_VALF, max = -HUGE_VALF;
+
+			// узлы блока - узлы его ячеек, включая дальние грани
+			marching_cubes_brick_range(bx, num_bricks.x, grid_size.x - 1, &begin_x, &end_x);
+			marching_cubes_brick_range(by, num_bricks.y, grid_size.y - 1, &begin_y, &end_y);
+			marching_cubes_brick_range(bz, num_bricks.z, grid_size.z - 1, &begin_z, &end_z);
+
+			for(unsigned k = begin_z; k <= end_z; k++) {
+				for(unsigned j = begin_y; j <= end_y; j++) {
+					for(unsigned i = begin_x; i <= end_x; i++) {
+						float value = marching_cubes_grid_value(job, vec3ui(i, j, k));
+
+						if(value != value)
+							value = HUGE_VALF;
+
+						if(value < min) min = value;
+						if(value > max) max = value;
+					}
+				}
+			}
+
+			mc_bricks.min_max[2 * (bx + (by + bz * num_bricks.y) * num_bricks.x) + 0] = min;
+			mc_bricks.min_max[2 * (bx + (by + bz * num_bricks.y) * num_bricks.x) + 1] = max;
+		}
 	}
-	
-	glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &last_array_buffer);
-	glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &last_element_array_buffer);
-	
-	// загружаем вершины
-	glBindBuffer(GL_ARRAY_BUFFER, vertex_vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vector3f) * n_vertices, (const GLvoid*) vertices, GL_DYNAMIC_DRAW);
+}
 
-	// загружаем индексы
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_vbo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(triangle_t) * n_triangles, (const GLvoid*) triangles, GL_DYNAMIC_DRAW);
+/* Построить блоки для скалярного поля и сетки задачи, если они ещё не построены. Возвращает 0 при ошибке */
+static int marching_cubes_update_bricks(mc_job_t *job)
+{
+	vector3ui grid_size = job->grid_size;
+	vector3ui num_bricks = vec3ui((grid_size.x + MC_BRICK_SIZE - 2) / MC_BRICK_SIZE,
+								  (grid_size.y + MC_BRICK_SIZE - 2) / MC_BRICK_SIZE,
+								  (grid_size.z + MC_BRICK_SIZE - 2) / MC_BRICK_SIZE);
 
-	if(num_elements)
-	*num_elements = n_triangles * 3;
-	
-	// если требуется, то вычисляем нормали для каждой вершины и записываем их в normal_vbo
-	if(normal_vbo != 0) {
-		vector3f *normals = (vector3f*) malloc(sizeof(vector3f) * n_vertices);
-		vector3f delta = vec3f_div(vec3f(1.0f, 1.0f, 1.0f), vec3ui_to_vec3f(grid_size));
-		
-		glBindBuffer(GL_ARRAY_BUFFER, normal_vbo);
-		
-		for(unsigned i = 0; i < n_vertices; i++) {
-			normals[i] = marching_cubes_calculate_normal(volume, volume_size, delta, vertices[i], function);
+	job->num_bricks = num_bricks;
+
+	if(!mc_bricks.is_valid || mc_bricks.volume != job->volume ||
+	   memcmp(&mc_bricks.volume_size, &job->volume_size, sizeof(vector3ui)) != 0 ||
+	   memcmp(&mc_bricks.grid_size, &grid_size, sizeof(vector3ui)) != 0) {
+
+		mc_bricks.is_valid = 0;
+
+		if(!marching_cubes_reserve((void**) &mc_bricks.min_max, &mc_bricks.max_min_max,
+								   num_bricks.x * num_bricks.y * num_bricks.z * 2, sizeof(float)) ||
+		   !thread_pool_run(marching_cubes_bricks_task, job, num_bricks.z))
+			return 0;
+
+		mc_bricks.volume = job->volume;
+		mc_bricks.volume_size = job->volume_size;
+		mc_bricks.grid_size = grid_size;
+		mc_bricks.num_bricks = num_bricks;
+		mc_bricks.is_valid = 1;
 	}
-		
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vector3f) * n_vertices, (const GLvoid*) normals, GL_STATIC_DRAW);
-		
-		free(normals);
+
+	job->bricks = mc_bricks.min_max;
+
+	return 1;
+}
+
+/*
+ * Состояния блоков для изо-уровня: блок, не содержащий поверхности, целиком снаружи или внутри,
+ * и его узлы классифицируются без чтения значений. При обновлении сетки значения читаются
+ * и в блоках, содержавших поверхность flip_isolevel
+ */
+static void marching_cubes_brick_states(mc_job_t *job)
+{
+	unsigned num_bricks = job->num_bricks.x * job->num_bricks.y * job->num_bricks.z;
+	float low = job->isolevel, high = job->isolevel;
+
+	if(job->plane_flips) {
+		low = (job->flip_isolevel < job->isolevel) ? job->flip_isolevel : job->isolevel;
+		high = (job->flip_isolevel < job->isolevel) ? job->isolevel : job->flip_isolevel;
 	}
-	
-	free(triangles);
-	free(vertices);
-	
-	glBindBuffer(GL_ARRAY_BUFFER, last_array_buffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, last_element_array_buffer);
-	
+
+	// NaN в min/max блоков учтён как +HUGE_VALF, т.е. снаружи
+	for(unsigned n = 0; n < num_bricks; n++) {
+		const float *min_max = job->bricks + 2 * n;
+
+		job->brick_states[n] = (min_max[0] >= high) ? MC_BRICK_OUTSIDE :
+							   ((min_max[1] < low) ? MC_BRICK_INSIDE : MC_BRICK_MIXED);
+	}
+
+	// соседние блоки имеют общие узлы, поэтому полоса без MC_BRICK_MIXED целиком снаружи или внутри
+	for(unsigned band = 0; band < job->num_bricks.y * job->num_bricks.z; band++) {
+		const unsigned char *states = job->brick_states + band * job->num_bricks.x;
+
+		job->band_states[band] = states[0];
+
+		for(unsigned bx = 1; bx < job->num_bricks.x; bx++) {
+			if(states[bx] == MC_BRICK_MIXED)
+				job->band_states[band] = MC_BRICK_MIXED;
+		}
+	}
+}
+
+/*
+ * Состояние полосы блоков со строкой узлов j плоскости k (или строкой ячеек j слоя k).
+ * Пересечённые изоповерхностью рёбра и ячейки лежат только в полосах MC_BRICK_MIXED
+ */
+INLINE static unsigned marching_cubes_band_state(const mc_job_t *job, unsigned j, unsigned k)
+{
+	unsigned by = (j / MC_BRICK_SIZE < job->num_bricks.y) ? j / MC_BRICK_SIZE : job->num_bricks.y - 1;
+	unsigned bz = (k / MC_BRICK_SIZE < job->num_bricks.z) ? k / MC_BRICK_SIZE : job->num_bricks.z - 1;
+
+	return job->band_states[by + bz * job->num_bricks.y];
+}
+
+/* Биты count (не более 8) подряд идущих значений, меньших level */
+INLINE static unsigned marching_cubes_chunk_bits(const float *values, unsigned count, float level)
+{
+	unsigned bits = 0;
+
+#ifdef __SSE__
+	if(count == 8) {
+		__m128 levels = _mm_set1_ps(level);
+
+		return (unsigned) _mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(values), levels)) |
+			   ((unsigned) _mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(values + 4), levels)) << 4);
+	}
+#endif
+
+	for(unsigned n = 0; n < count; n++)
+		bits |= (unsigned) (values[n] < level) << n;
+
+	return bits;
+}
+
+/*
+ * Задача пула: биты принадлежности объёму узлов плоскости k. Строка обрабатывается
+ * по MC_BRICK_SIZE узлов (байт строки битов): в блоках без поверхности биты известны заранее,
+ * в остальных значения сравниваются с изо-уровнем векторно (при value_step.x == 1
+ * значения узлов идут в volume подряд). При обновлении сетки отмечается,
+ * сменил ли принадлежность какой-либо узел плоскости
+ */
+static void marching_cubes_classify_task(void *data, unsigned thread, unsigned k)
+{
+	const mc_job_t *job = (const mc_job_t*) data;
+	vector3ui grid_size = job->grid_size, num_bricks = job->num_bricks, value_step = job->value_step;
+	unsigned bz = (k / MC_BRICK_SIZE < num_bricks.z) ? k / MC_BRICK_SIZE : num_bricks.z - 1;
+	unsigned char flips = 0;
+
+	for(unsigned j = 0; j < grid_size.y; j++) {
+		unsigned by = (j / MC_BRICK_SIZE < num_bricks.y) ? j / MC_BRICK_SIZE : num_bricks.y - 1;
+		const unsigned char *states = job->brick_states + (by + bz * num_bricks.y) * num_bricks.x;
+		const float *values = job->volume + (j * value_step.y + k * value_step.z * job->volume_size.y) * job->volume_size.x;
+		uint64_t *row = marching_cubes_inside_row(job, j, k);
+
+		memset(row, 0, sizeof(uint64_t) * job->row_words);
+
+		if(marching_cubes_band_state(job, j, k) == MC_BRICK_OUTSIDE)
+			continue;
+
+		if(marching_cubes_band_state(job, j, k) == MC_BRICK_INSIDE) {
+			for(unsigned w = 0; w < job->row_words; w++)
+				row[w] = marching_cubes_row_limit(w, grid_size.x);
+
+			continue;
+		}
+
+		for(unsigned i = 0; i < grid_size.x; i += MC_BRICK_SIZE) {
+			unsigned bx = (i / MC_BRICK_SIZE < num_bricks.x) ? i / MC_BRICK_SIZE : num_bricks.x - 1;
+			unsigned count = (grid_size.x - i < MC_BRICK_SIZE) ? grid_size.x - i : MC_BRICK_SIZE;
+			unsigned bits = (states[bx] == MC_BRICK_INSIDE) ? (1u << count) - 1 : 0;
+
+			if(states[bx] == MC_BRICK_MIXED) {
+				const float *chunk = values + i;
+				float gathered[MC_BRICK_SIZE];
+
+				if(value_step.x != 1) {
+					for(unsigned n = 0; n < count; n++)
+						gathered[n] = values[(i + n) * value_step.x];
+
+					chunk = gathered;
+				}
+
+				bits = marching_cubes_chunk_bits(chunk, count, job->isolevel);
+
+				if(job->plane_flips)
+					flips |= (bits != marching_cubes_chunk_bits(chunk, count, job->flip_isolevel));
+			}
+
+			row[i / 64] |= (uint64_t) bits << (i % 64);
+		}
+	}
+
+	if(job->plane_flips)
+		job->plane_flips[k] = flips;
+}
+
+/* 
+ * Пронумеровать пересечённые изоповерхностью рёбра плоскости z узлов сетки
+ * (по x, затем по y в каждом узле) в порядке обхода, начиная с first;
+ * edge_ids[2 * (i + j * grid.x) + 0/1] - номер вершины на ребре по x/y.
+ * Если vertices задан, то вершины записываются в него. Возвращает кол-во рёбер
+ */
+static unsigned marching_cubes_plane_edges(const mc_job_t *job, unsigned z, unsigned first,
+										   unsigned *edge_ids, vector3f *vertices)
+{
+	vector3ui grid_size = job->grid_size;
+	unsigned count = 0;
+
+	for(unsigned j = 0; j < grid_size.y; j++) {
+		if(marching_cubes_band_state(job, j, z) != MC_BRICK_MIXED)
+			continue;
+
+		const uint64_t *row = marching_cubes_inside_row(job, j, z);
+		const uint64_t *next_row = (j + 1 < grid_size.y) ? marching_cubes_inside_row(job, j + 1, z) : NULL;
+
+		// пересечённые рёбра - различающиеся биты соседних узлов строки и соседних строк
+		for(unsigned w = 0; w < job->row_words; w++) {
+			uint64_t x_edges = (row[w] ^ marching_cubes_row_next(job, row, w)) & marching_cubes_row_limit(w, grid_size.x - 1);
+			uint64_t y_edges = next_row ? row[w] ^ next_row[w] : 0;
+
+			if(!edge_ids && !vertices) {
+				count += __builtin_popcountll(x_edges) + __builtin_popcountll(y_edges);
+				continue;
+			}
+
+			for(uint64_t edges = x_edges | y_edges; edges; edges &= edges - 1) {
+				unsigned bit = __builtin_ctzll(edges), i = w * 64 + bit, n = i + j * grid_size.x;
+
+				for(unsigned axis = 0; axis < 2; axis++) {
+					unsigned i2 = i + (axis == 0), j2 = j + (axis == 1);
+
+					if(!((((axis == 0) ? x_edges : y_edges) >> bit) & 1))
+						continue;
+
+					if(vertices)
+						vertices[count] = marching_cubes_edge_vertex(job, vec3ui(i, j, z), vec3ui(i2, j2, z));
+
+					if(edge_ids)
+						edge_ids[2 * n + axis] = first + count;
+
+					count++;
+				}
+			}
+		}
+	}
+
+	return count;
+}
+
+/* Пронумеровать пересечённые рёбра между плоскостями k и k+1 (как marching_cubes_plane_edges) */
+static unsigned marching_cubes_z_edges(const mc_job_t *job, unsigned k, unsigned first, unsigned *z_ids, vector3f *vertices)
+{
+	vector3ui grid_size = job->grid_size;
+	unsigned count = 0;
+
+	for(unsigned j = 0; j < grid_size.y; j++) {
+		if(marching_cubes_band_state(job, j, k) != MC_BRICK_MIXED)
+			continue;
+
+		const uint64_t *row = marching_cubes_inside_row(job, j, k), *top_row = marching_cubes_inside_row(job, j, k + 1);
+
+		for(unsigned w = 0; w < job->row_words; w++) {
+			uint64_t edges = row[w] ^ top_row[w];
+
+			if(!z_ids && !vertices) {
+				count += __builtin_popcountll(edges);
+				continue;
+			}
+
+			for(; edges; edges &= edges - 1) {
+				unsigned i = w * 64 + __builtin_ctzll(edges);
+
+				if(vertices)
+					vertices[count] = marching_cubes_edge_vertex(job, vec3ui(i, j, k), vec3ui(i, j, k + 1));
+
+				if(z_ids)
+					z_ids[i + j * grid_size.x] = first + count;
+
+				count++;
+			}
+		}
+	}
+
+	return count;
+}
+
+/* Задача пула: посчитать вершины и треугольники слоя k (без их создания) */
+static void marching_cubes_count_task(void *data, unsigned thread, unsigned k)
+{
+	const mc_job_t *job = (const mc_job_t*) data;
+	vector3ui grid_size = job->grid_size;
+	unsigned num_vertices = 0, num_triangles = 0;
+
+	// кол-во в слое без изменений известно с прошлого построения
+	if(job->dirty && !job->dirty[k])
+		return;
+
+	if(is_welded) {
+		// вершины рёбер плоскости k и рёбер между плоскостями k и k+1
+		num_vertices = marching_cubes_plane_edges(job, k, 0, NULL, NULL);
+
+		if(k + 1 < grid_size.z)
+			num_vertices += marching_cubes_z_edges(job, k, 0, NULL, NULL);
+	}
+
+	for(unsigned j = 0; k + 1 < grid_size.z && j + 1 < grid_size.y; j++) {
+		if(marching_cubes_band_state(job, j, k) != MC_BRICK_MIXED)
+			continue;
+
+		for(unsigned w = 0; w < job->row_words; w++) {
+			for(uint64_t cells = marching_cubes_active_cells(job, j, k, w); cells; cells &= cells - 1) {
+				unsigned cube = marching_cubes_cube_index(job, w * 64 + __builtin_ctzll(cells), j, k);
+
+				if(!is_welded)
+					num_vertices += mc_case_vertices[cube];
+
+				num_triangles += mc_case_triangles[cube];
+			}
+		}
+	}
+
+	job->vertex_offsets[k] = num_vertices;
+	job->triangle_offsets[k] = num_triangles;
+}
+
+/*
+ * Задача пула: полигонизировать слой ячеек k (у каждой ячейки свои вершины). Результат
+ * как у marching_cubes_polygonise, но конфигурация ячейки уже известна по битам узлов,
+ * а вершины и номера берутся из таблиц конфигураций
+ */
+static void marching_cubes_fill_task(void *data, unsigned thread, unsigned k)
+{
+	mc_job_t *job = (mc_job_t*) data;
+
+	const float *volume = job->volume;
+	vector3ui volume_size = job->volume_size, grid_size = job->grid_size, value_step = job->value_step;
+	vector3f pos_step = job->pos_step;
+	vector3f *out_vertices = job->out_vertices + job->vertex_offsets[k];
+	triangle_t *out_triangles = job->out_triangles + job->triangle_offsets[k];
+	unsigned vertices_count = job->vertex_offsets[k];
+
+	// смещения узлов ячейки в скалярном поле и в координатах вершин
+	unsigned corner_values[8];
+	vector3f corner_positions[8];
+
+	for(unsigned c = 0; c < 8; c++) {
+		vector3ui corner = vec3ui_mult(vec3ui(mc_corners[c][0], mc_corners[c][1], mc_corners[c][2]), value_step);
+
+		corner_values[c] = corner.x + corner.y*volume_size.x + corner.z*volume_size.x*volume_size.y;
+		corner_positions[c] = vec3f(mc_corners[c][0] ? pos_step.x : 0.0f, mc_corners[c][1] ? pos_step.y : 0.0f,
+									mc_corners[c][2] ? pos_step.z : 0.0f);
+	}
+
+	for(unsigned j = 0; j + 1 < grid_size.y; j++) {
+		if(marching_cubes_band_state(job, j, k) != MC_BRICK_MIXED)
+			continue;
+
+		for(unsigned w = 0; w < job->row_words; w++) {
+			for(uint64_t cells = marching_cubes_active_cells(job, j, k, w); cells; cells &= cells - 1) {
+				unsigned i = w * 64 + __builtin_ctzll(cells);
+				unsigned cube = marching_cubes_cube_index(job, i, j, k);
+
+				if(mc_case_triangles[cube] == 0)
+					continue;
+
+				vector3f pos_offset = vec3f_mult(vec3f(i, j, k), pos_step);
+				vector3ui value_offset = vec3ui_mult(vec3ui(i, j, k), value_step);
+				const float *values = volume + value_offset.x + value_offset.y*volume_size.x + value_offset.z*volume_size.x*volume_size.y;
+
+				// вершины на рёбрах в порядке первого появления в mc_tri_table
+				for(unsigned v = 0; v < mc_case_vertices[cube]; v++) {
+					unsigned c1 = mc_edge_corners[mc_case_edges[cube][v]][0], c2 = mc_edge_corners[mc_case_edges[cube][v]][1];
+
+					*out_vertices++ = vertices_lerp(job->isolevel, vec3f_add(pos_offset, corner_positions[c1]), values[corner_values[c1]],
+													vec3f_add(pos_offset, corner_positions[c2]), values[corner_values[c2]]);
+				}
+
+				// порядок обхода треугольника как в marching_cubes_polygonise
+				for(unsigned t = 0; t < mc_case_triangles[cube]; t++, out_triangles++) {
+					out_triangles->indices[2] = vertices_count + mc_case_indices[cube][3 * t + 0];
+					out_triangles->indices[1] = vertices_count + mc_case_indices[cube][3 * t + 1];
+					out_triangles->indices[0] = vertices_count + mc_case_indices[cube][3 * t + 2];
+				}
+
+				vertices_count += mc_case_vertices[cube];
+			}
+		}
+	}
+}
+
+/*
+ * Задача пула: полигонизировать слой k с общими вершинами. Слой создаёт вершины рёбер
+ * плоскости k и рёбер между плоскостями k и k+1, вершины плоскости k+1 создаёт слой k+1
+ * (их номера известны заранее, так как нумерация плоскости зависит только от неё).
+ * Слой grid_size.z-1 содержит только вершины последней плоскости
+ */
+static void marching_cubes_welded_fill_task(void *data, unsigned thread, unsigned k)
+{
+	mc_job_t *job = (mc_job_t*) data;
+	vector3ui grid_size = job->grid_size;
+	unsigned plane_size = grid_size.x * grid_size.y;
+	unsigned first = job->vertex_offsets[k];
+	triangle_t *triangle = job->out_triangles + job->triangle_offsets[k];
+
+	// номера вершин на рёбрах по x и y плоскостей k и k+1 и на рёбрах между ними
+	if(!marching_cubes_reserve((void**) &mc_buffers.edge_ids[thread], &mc_buffers.max_edge_ids[thread],
+							   plane_size * 5, sizeof(unsigned))) {
+		job->error = 1;
+		return;
+	}
+
+	unsigned *bottom_ids = mc_buffers.edge_ids[thread], *top_ids = bottom_ids + plane_size * 2;
+	unsigned *z_ids = bottom_ids + plane_size * 4;
+
+	// треугольники слоя без изменений остаются прежними, сдвигаются только вершины
+	if(job->dirty && !job->dirty[k]) {
+		first += marching_cubes_plane_edges(job, k, first, NULL, job->out_vertices + first);
+
+		if(k + 1 < grid_size.z)
+			marching_cubes_z_edges(job, k, first, NULL, job->out_vertices + first);
+
+		return;
+	}
+
+	first += marching_cubes_plane_edges(job, k, first, bottom_ids, job->out_vertices + first);
+
+	if(k + 1 == grid_size.z)
+		return;
+
+	// рёбра между плоскостями
+	marching_cubes_z_edges(job, k, first, z_ids, job->out_vertices + first);
+
+	marching_cubes_plane_edges(job, k + 1, job->vertex_offsets[k + 1], top_ids, NULL);
+
+	for(unsigned j = 0; j + 1 < grid_size.y; j++) {
+		if(marching_cubes_band_state(job, j, k) != MC_BRICK_MIXED)
+			continue;
+
+		for(unsigned w = 0; w < job->row_words; w++) {
+			for(uint64_t cells = marching_cubes_active_cells(job, j, k, w); cells; cells &= cells - 1) {
+				unsigned i = w * 64 + __builtin_ctzll(cells);
+				unsigned cube = marching_cubes_cube_index(job, i, j, k);
+
+				unsigned n = i + j * grid_size.x;
+				unsigned corners[4] = {n, n + 1, n + 1 + grid_size.x, n + grid_size.x};
+
+				unsigned ids[12] = {
+					bottom_ids[2 * corners[0] + 0], bottom_ids[2 * corners[1] + 1],
+					bottom_ids[2 * corners[3] + 0], bottom_ids[2 * corners[0] + 1],
+					top_ids[2 * corners[0] + 0], top_ids[2 * corners[1] + 1],
+					top_ids[2 * corners[3] + 0], top_ids[2 * corners[0] + 1],
+					z_ids[corners[0]], z_ids[corners[1]], z_ids[corners[2]], z_ids[corners[3]]
+				};
+
+				// порядок обхода треугольника как в marching_cubes_polygonise
+				for(unsigned t = 0; mc_tri_table[cube][t] != -1; t += 3, triangle++) {
+					triangle->indices[2] = ids[(unsigned) mc_tri_table[cube][t + 0]];
+					triangle->indices[1] = ids[(unsigned) mc_tri_table[cube][t + 1]];
+					triangle->indices[0] = ids[(unsigned) mc_tri_table[cube][t + 2]];
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Классификация узлов и подсчёт вершин и треугольников слоёв (для job->dirty - только
+ * изменившихся) в job->vertex_offsets, job->triangle_offsets. Возвращает 0 при ошибке
+ */
+static int marching_cubes_count_layers(mc_job_t *job)
+{
+	vector3ui grid_size = job->grid_size;
+
+	marching_cubes_init_cases();
+
+	job->value_step = vec3ui_div(job->volume_size, grid_size);
+	job->pos_step = vec3f_div(vec3f(1.0f, 1.0f, 1.0f), vec3f(grid_size.x, grid_size.y, grid_size.z));
+	job->num_layers = (grid_size.x > 1 && grid_size.y > 1 && grid_size.z > 1) ? grid_size.z - 1 : 0;
+
+	if(is_welded && job->num_layers > 0)
+		job->num_layers++;
+
+	job->row_words = (grid_size.x + 63) / 64;
+
+	if(!marching_cubes_reserve((void**) &mc_buffers.inside, &mc_buffers.max_inside,
+							   job->row_words * grid_size.y * grid_size.z, sizeof(uint64_t)) ||
+	   !marching_cubes_reserve((void**) &mc_buffers.offsets, &mc_buffers.max_offsets,
+							   (job->num_layers + 1) * 2, sizeof(unsigned)))
+		return 0;
+
+	job->inside = mc_buffers.inside;
+	job->vertex_offsets = mc_buffers.offsets;
+	job->triangle_offsets = mc_buffers.offsets + job->num_layers + 1;
+	job->error = 0;
+
+	if(job->num_layers == 0)
+		return 1;
+
+	if(!marching_cubes_update_bricks(job) ||
+	   !marching_cubes_reserve((void**) &mc_buffers.brick_states, &mc_buffers.max_brick_states,
+							   (job->num_bricks.x + 1) * job->num_bricks.y * job->num_bricks.z, sizeof(unsigned char)))
+		return 0;
+
+	job->brick_states = mc_buffers.brick_states;
+	job->band_states = mc_buffers.brick_states + job->num_bricks.x * job->num_bricks.y * job->num_bricks.z;
+	marching_cubes_brick_states(job);
+
+	if(!thread_pool_run(marching_cubes_classify_task, job, grid_size.z))
+		return 0;
+
+	// треугольники слоя зависят от узлов двух его плоскостей (последний слой вершин - от одной)
+	if(job->dirty) {
+		for(unsigned k = job->edit_begin; k < job->edit_end && k < grid_size.z; k++)
+			job->plane_flips[k] = 1;
+
+		for(unsigned k = 0; k < job->num_layers; k++)
+			job->dirty[k] = job->plane_flips[k] || (k + 1 < grid_size.z && job->plane_flips[k + 1]);
+	}
+
+	return thread_pool_run(marching_cubes_count_task, job, job->num_layers);
+}
+
+/*
+ * Первый проход: классификация узлов и подсчёт вершин и треугольников слоёв,
+ * префиксная сумма даёт смещения слоёв. Возвращает 0 при ошибке
+ */
+static int marching_cubes_count(mc_job_t *job, unsigned *num_vertices, unsigned *num_triangles)
+{
+	unsigned vertices_count = 0, triangles_count = 0;
+
+	if(!marching_cubes_count_layers(job))
+		return 0;
+
+	// исключающая префиксная сумма, поэтому результат совпадает с последовательным обходом слоёв
+	for(unsigned k = 0; k < job->num_layers; k++) {
+		unsigned layer_vertices = job->vertex_offsets[k], layer_triangles = job->triangle_offsets[k];
+
+		job->vertex_offsets[k] = vertices_count;
+		job->triangle_offsets[k] = triangles_count;
+
+		vertices_count += layer_vertices;
+		triangles_count += layer_triangles;
+	}
+
+	job->vertex_offsets[job->num_layers] = vertices_count;
+	job->triangle_offsets[job->num_layers] = triangles_count;
+
+	*num_vertices = vertices_count;
+	*num_triangles = triangles_count;
+
+	return 1;
+}
+
+/* Второй проход: создать вершины и треугольники слоёв в job->out_* по смещениям. Возвращает 0 при ошибке */
+static int marching_cubes_fill(mc_job_t *job)
+{
+	if(job->num_layers == 0)
+		return 1;
+
+	if(!thread_pool_run(is_welded ? marching_cubes_welded_fill_task : marching_cubes_fill_task, job, job->num_layers))
+		return 0;
+
+	return !job->error;
+}
+
+void marching_cubes_set_welded(int welded)
+{
+	is_welded = welded;
+}
+
+void marching_cubes_set_decimation(float ratio, float max_error)
+{
+	IF_FAILED(ratio >= 0.0f && max_error >= 0.0f);
+
+	decimation_ratio = ratio;
+	decimation_error = max_error;
+}
+
+void marching_cubes_invalidate(void)
+{
+	mc_bricks.is_valid = 0;
+	mc_mesh.is_valid = 0;
+}
+
+/*
+ * Узлы сетки [first, last] размера grid_size, которые берутся из узлов поля [begin, end]
+ * (узел сетки i - узел поля i * step). Возвращает 0, если таких нет
+ */
+static int marching_cubes_region_nodes(vector3ui volume_size, vector3ui grid_size, vector3ui begin, vector3ui end,
+									   vector3ui *first, vector3ui *last)
+{
+	vector3ui step = vec3ui_div(volume_size, grid_size);
+
+	*first = vec3ui((begin.x + step.x - 1) / step.x, (begin.y + step.y - 1) / step.y, (begin.z + step.z - 1) / step.z);
+	*last = vec3ui(math_min(end.x / step.x, grid_size.x - 1), math_min(end.y / step.y, grid_size.y - 1),
+				   math_min(end.z / step.z, grid_size.z - 1));
+
+	return first->x <= last->x && first->y <= last->y && first->z <= last->z;
+}
+
+void marching_cubes_invalidate_region(const float *volume, vector3ui volume_size, vector3ui begin, vector3ui end)
+{
+	vector3ui first, last;
+
+	IF_FAILED(volume && begin.x <= end.x && begin.y <= end.y && begin.z <= end.z);
+
+	// min/max пересчитываются в слоях блоков с изменёнными узлами (узел на границе - в обоих)
+	if(mc_bricks.is_valid && mc_bricks.volume == volume &&
+	   memcmp(&mc_bricks.volume_size, &volume_size, sizeof(vector3ui)) == 0 &&
+	   marching_cubes_region_nodes(volume_size, mc_bricks.grid_size, begin, end, &first, &last)) {
+		mc_job_t job = {volume, volume_size, mc_bricks.grid_size};
+		unsigned last_bz = math_min(last.z / MC_BRICK_SIZE, mc_bricks.num_bricks.z - 1);
+
+		job.value_step = vec3ui_div(volume_size, mc_bricks.grid_size);
+		job.num_bricks = mc_bricks.num_bricks;
+
+		for(unsigned bz = (first.z > 0) ? (first.z - 1) / MC_BRICK_SIZE : 0; bz <= last_bz; bz++)
+			marching_cubes_bricks_task(&job, 0, bz);
+	}
+
+	// слои с изменёнными узлами перестраиваются при следующем marching_cubes_update_mesh
+	if(mc_mesh.is_valid && mc_mesh.volume == volume &&
+	   memcmp(&mc_mesh.volume_size, &volume_size, sizeof(vector3ui)) == 0 &&
+	   marching_cubes_region_nodes(volume_size, mc_mesh.grid_size, begin, end, &first, &last)) {
+		if(mc_mesh.edit_begin == mc_mesh.edit_end) {
+			mc_mesh.edit_begin = first.z;
+			mc_mesh.edit_end = last.z + 1;
+		} else {
+			mc_mesh.edit_begin = math_min(mc_mesh.edit_begin, first.z);
+			mc_mesh.edit_end = math_max(mc_mesh.edit_end, last.z + 1);
+		}
+	}
+}
+
+int marching_cubes_create(const float *volume, vector3ui volume_size, vector3ui grid_size, 
+						  float isolevel, vector3f *out_vertices, unsigned *number_of_vertices, 
+						  triangle_t *out_triangles, unsigned *number_of_triangles)
+{	
+	IF_FAILED_RET(volume && out_vertices && out_triangles, -1);
+	
+	mc_job_t job = {volume, volume_size, grid_size, isolevel};
+	unsigned vertices_count = 0, triangles_count = 0;
+
+	job.out_vertices = out_vertices;
+	job.out_triangles = out_triangles;
+
+	if(!marching_cubes_count(&job, &vertices_count, &triangles_count) || !marching_cubes_fill(&job))
+		return -1;
+	
+	if(number_of_vertices)
+		*number_of_vertices = vertices_count+1;
+	if(number_of_triangles)
+		*number_of_triangles = triangles_count+1;
+	
+	return 1;
+}
+
+// вычисление нормалей в пуле потоков
+typedef struct {
+	const float *volume;
+	vector3ui volume_size;
+	vector3f delta;
+	const vector3f *vertices;
+	vector3f *normals;
+	unsigned num_vertices;
+	float (*function)(vector3f pos);
+} normals_job_t;
+
+/* Задача пула: нормали вершин task*NORMALS_TASK_SIZE.. */
+static void marching_cubes_normals_task(void *data, unsigned thread, unsigned task)
+{
+	const normals_job_t *job = (const normals_job_t*) data;
+	unsigned begin = task * NORMALS_TASK_SIZE;
+	unsigned end = (begin + NORMALS_TASK_SIZE < job->num_vertices) ? begin + NORMALS_TASK_SIZE : job->num_vertices;
+
+	for(unsigned i = begin; i < end; i++)
+		job->normals[i] = marching_cubes_calculate_normal(job->volume, job->volume_size, job->delta,
+														  job->vertices[i], job->function);
+}
+
+void marching_cubes_decimate_mesh(vector3ui grid_size, const vector3f **vertices, unsigned *n_vertices,
+								  const triangle_t **triangles, unsigned *n_triangles)
+{
+	IF_FAILED(vertices && n_vertices && triangles && n_triangles);
+
+	// упрощаем сетку: ошибка задаётся в шагах сетки, координаты вершин - в [0, 1]
+	if(decimation_ratio < 1.0f && *n_triangles > 0) {
+		unsigned max_size = math_max(grid_size.x, math_max(grid_size.y, grid_size.z));
+
+		if(!mesh_decimate(*vertices, *n_vertices, *triangles, *n_triangles, (unsigned) (decimation_ratio * *n_triangles),
+						  decimation_error / max_size, vertices, n_vertices, triangles, n_triangles))
+			ERROR_MSG("Mesh decimation failed, using the full mesh\n");
+	}
+}
+
+int marching_cubes_upload_vbos(const float *volume, vector3ui volume_size, vector3ui grid_size,
+							   const vector3f *vertices, unsigned n_vertices,
+							   const triangle_t *triangles, unsigned n_triangles,
+							   GLuint vertex_vbo, GLuint index_vbo, GLuint normal_vbo,
+							   float (*function)(vector3f pos), unsigned *num_elements)
+{
+	GLint last_array_buffer, last_element_array_buffer;
+
+	IF_FAILED0((vertices || n_vertices == 0) && (triangles || n_triangles == 0) && (vertex_vbo > 0) && (index_vbo > 0));
+	
+	marching_cubes_decimate_mesh(grid_size, &vertices, &n_vertices, &triangles, &n_triangles);
+
+	glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &last_array_buffer);
+	glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &last_element_array_buffer);
+	
+	// загружаем вершины
+	glBindBuffer(GL_ARRAY_BUFFER, vertex_vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vector3f) * n_vertices, (const GLvoid*) vertices, GL_DYNAMIC_DRAW);
+
+	// загружаем индексы
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_vbo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(triangle_t) * n_triangles, (const GLvoid*) triangles, GL_DYNAMIC_DRAW);
+
+	if(num_elements)
+	*num_elements = n_triangles * 3;
+	
+	// если требуется, то вычисляем нормали для каждой вершины и записываем их в normal_vbo
+	if(normal_vbo != 0) {
+		vector3f *normals = (vector3f*) malloc(sizeof(vector3f) * n_vertices);
+		vector3f delta = vec3f_div(vec3f(1.0f, 1.0f, 1.0f), vec3ui_to_vec3f(grid_size));
+		
+		normals_job_t job = {volume, volume_size, delta, vertices, normals, n_vertices, function};
+		
+		glBindBuffer(GL_ARRAY_BUFFER, normal_vbo);
+		
+		// каждая нормаль - 6 вычислений функции, считаем их во всех потоках пула
+		if(!thread_pool_run(marching_cubes_normals_task, &job, (n_vertices + NORMALS_TASK_SIZE - 1) / NORMALS_TASK_SIZE)) {
+			for(unsigned i = 0; i < n_vertices; i++)
+				normals[i] = marching_cubes_calculate_normal(volume, volume_size, delta, vertices[i], function);
+		}
+		
+		glBufferData(GL_ARRAY_BUFFER, sizeof(vector3f) * n_vertices, (const GLvoid*) normals, GL_STATIC_DRAW);
+		
+		free(normals);
+	}
+	
+	glBindBuffer(GL_ARRAY_BUFFER, last_array_buffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, last_element_array_buffer);
+	
+	return 1;
+}
+
+int marching_cubes_create_mesh(const float *volume, vector3ui volume_size, vector3ui grid_size, float isolevel,
+							   const vector3f **vertices, unsigned *n_vertices,
+							   const triangle_t **triangles, unsigned *n_triangles)
+{
+	unsigned num_vertices = 0, num_triangles = 0;
+	mc_job_t mc_job = {volume, volume_size, grid_size, isolevel};
+
+	IF_FAILED0(volume && vertices && n_vertices && triangles && n_triangles);
+
+	// считаем вершины и треугольники, затем полигонизируем в буферы точного размера
+	if(!marching_cubes_count(&mc_job, &num_vertices, &num_triangles) ||
+	   !marching_cubes_reserve((void**) &mc_buffers.vertices, &mc_buffers.max_vertices, num_vertices, sizeof(vector3f)) ||
+	   !marching_cubes_reserve((void**) &mc_buffers.triangles, &mc_buffers.max_triangles, num_triangles, sizeof(triangle_t)))
+		return 0;
+
+	mc_job.out_vertices = mc_buffers.vertices;
+	mc_job.out_triangles = mc_buffers.triangles;
+
+	if(!marching_cubes_fill(&mc_job))
+		return 0;
+
+	*vertices = mc_buffers.vertices;
+	*n_vertices = num_vertices;
+	*triangles = mc_buffers.triangles;
+	*n_triangles = num_triangles;
+
+	return 1;
+}
+
+int marching_cubes_create_vbos(const float *volume, vector3ui volume_size, 
+							  vector3ui grid_size, float isolevel,
+							   GLuint vertex_vbo, GLuint index_vbo, GLuint normal_vbo,
+							   float (*function)(vector3f pos), unsigned *num_elements)
+{
+	const vector3f *vertices;
+	const triangle_t *triangles;
+	unsigned n_vertices, n_triangles;
+	
+	IF_FAILED_RET(volume && (vertex_vbo > 0) && (index_vbo > 0), -1);
+
+	if(!marching_cubes_create_mesh(volume, volume_size, grid_size, isolevel, &vertices, &n_vertices, &triangles, &n_triangles) ||
+	   !marching_cubes_upload_vbos(volume, volume_size, grid_size, vertices, n_vertices,
+								   triangles, n_triangles, vertex_vbo, index_vbo, normal_vbo,
+								   function, num_elements))
+		return -1;
+	
+	return 1;
+}
+
+/* Построить сетку заново, разместив слои с запасом. Возвращает 0 при ошибке */
+static int marching_cubes_layout_mesh(mc_job_t *job)
+{
+	unsigned num_layers, vertices_count = 0, triangles_count = 0;
+
+	mc_mesh.is_valid = 0;
+
+	job->plane_flips = job->dirty = NULL;
+
+	if(!marching_cubes_count_layers(job))
+		return 0;
+
+	num_layers = job->num_layers;
+
+	if(!marching_cubes_reserve((void**) &mc_mesh.layers, &mc_mesh.max_layers, num_layers * 5 + 2, sizeof(unsigned)) ||
+	   !marching_cubes_reserve((void**) &mc_mesh.flags, &mc_mesh.max_flags, num_layers + job->grid_size.z, 1))
+		return 0;
+
+	mc_mesh.vertex_counts = mc_mesh.layers;
+	mc_mesh.triangle_counts = mc_mesh.vertex_counts + num_layers;
+	mc_mesh.vertex_bases = mc_mesh.triangle_counts + num_layers;
+	mc_mesh.triangle_bases = mc_mesh.vertex_bases + num_layers + 1;
+	mc_mesh.versions = mc_mesh.triangle_bases + num_layers + 1;
+
+	memset(mc_mesh.versions, 0, sizeof(unsigned) * num_layers);
+
+	for(unsigned k = 0; k < num_layers; k++) {
+		mc_mesh.vertex_counts[k] = job->vertex_offsets[k];
+		mc_mesh.triangle_counts[k] = job->triangle_offsets[k];
+
+		mc_mesh.vertex_bases[k] = vertices_count;
+		mc_mesh.triangle_bases[k] = triangles_count;
+
+		vertices_count += job->vertex_offsets[k] + job->vertex_offsets[k] / MESH_SLACK_DIV + MESH_SLACK_MIN;
+		triangles_count += job->triangle_offsets[k] + job->triangle_offsets[k] / MESH_SLACK_DIV + MESH_SLACK_MIN;
+	}
+
+	mc_mesh.vertex_bases[num_layers] = vertices_count;
+	mc_mesh.triangle_bases[num_layers] = triangles_count;
+
+	if(!marching_cubes_reserve((void**) &mc_mesh.vertices, &mc_mesh.max_vertices, vertices_count, sizeof(vector3f)) ||
+	   !marching_cubes_reserve((void**) &mc_mesh.triangles, &mc_mesh.max_triangles, triangles_count, sizeof(triangle_t)))
+		return 0;
+
+	// незанятые треугольники вырождены и не рисуются
+	memset(mc_mesh.vertices, 0, sizeof(vector3f) * vertices_count);
+	memset(mc_mesh.triangles, 0, sizeof(triangle_t) * triangles_count);
+
+	job->vertex_offsets = mc_mesh.vertex_bases;
+	job->triangle_offsets = mc_mesh.triangle_bases;
+	job->out_vertices = mc_mesh.vertices;
+	job->out_triangles = mc_mesh.triangles;
+
+	if(!marching_cubes_fill(job))
+		return 0;
+
+	// новое размещение загружается в буферы целиком
+	mc_mesh.layout++;
+	mc_mesh.version = 0;
+
+	mc_mesh.volume = job->volume;
+	mc_mesh.volume_size = job->volume_size;
+	mc_mesh.grid_size = job->grid_size;
+	mc_mesh.is_welded = is_welded;
+	mc_mesh.isolevel = job->isolevel;
+	mc_mesh.num_layers = num_layers;
+	mc_mesh.edit_begin = mc_mesh.edit_end = 0;
+	mc_mesh.is_valid = 1;
+
+	return 1;
+}
+
+/*
+ * Обновить сетку для нового изо-уровня: заново строятся только слои, в узлах которых
+ * сменилась принадлежность объёму, в остальных пересчитываются вершины.
+ * Возвращает кол-во перестроенных треугольников + 1, -1 - слои не помещаются на свои места, 0 - ошибка
+ */
+static int marching_cubes_patch_mesh(mc_job_t *job)
+{
+	unsigned num_layers = mc_mesh.num_layers;
+	int touched = 0;
+
+	job->flip_isolevel = mc_mesh.isolevel;
+	job->edit_begin = mc_mesh.edit_begin;
+	job->edit_end = mc_mesh.edit_end;
+	job->dirty = mc_mesh.flags;
+	job->plane_flips = mc_mesh.flags + num_layers;
+
+	if(!marching_cubes_count_layers(job))
+		return 0;
+
+	for(unsigned k = 0; k < num_layers; k++) {
+		if(job->dirty[k] &&
+		   (job->vertex_offsets[k] > mc_mesh.vertex_bases[k + 1] - mc_mesh.vertex_bases[k] ||
+			job->triangle_offsets[k] > mc_mesh.triangle_bases[k + 1] - mc_mesh.triangle_bases[k]))
+			return -1;
+	}
+
+	// треугольники изменившихся слоёв строятся заново, хвосты их мест вырождаются
+	mc_mesh.version++;
+
+	for(unsigned k = 0; k < num_layers; k++) {
+		if(!job->dirty[k])
+			continue;
+
+		mc_mesh.versions[k] = mc_mesh.version;
+		mc_mesh.vertex_counts[k] = job->vertex_offsets[k];
+
+		if(job->triangle_offsets[k] < mc_mesh.triangle_counts[k])
+			memset(mc_mesh.triangles + mc_mesh.triangle_bases[k] + job->triangle_offsets[k], 0,
+				   sizeof(triangle_t) * (mc_mesh.triangle_counts[k] - job->triangle_offsets[k]));
+
+		mc_mesh.triangle_counts[k] = job->triangle_offsets[k];
+		touched += job->triangle_offsets[k];
+	}
+
+	job->vertex_offsets = mc_mesh.vertex_bases;
+	job->triangle_offsets = mc_mesh.triangle_bases;
+	job->out_vertices = mc_mesh.vertices;
+	job->out_triangles = mc_mesh.triangles;
+
+	if(!marching_cubes_fill(job))
+		return 0;
+
+	mc_mesh.isolevel = job->isolevel;
+	mc_mesh.edit_begin = mc_mesh.edit_end = 0;
+
+	return touched + 1;
+}
+
+/*
+ * Обновить сохранённую сетку: по слоям, если изменились только изо-уровень или узлы
+ * marching_cubes_invalidate_region, иначе построить заново. Возвращает 0 при ошибке
+ */
+static int marching_cubes_update_layers(const float *volume, vector3ui volume_size, vector3ui grid_size, float isolevel)
+{
+	mc_job_t job = {volume, volume_size, grid_size, isolevel};
+
+	int is_same_mesh = mc_mesh.is_valid && mc_mesh.volume == volume && mc_mesh.is_welded == is_welded &&
+					   memcmp(&mc_mesh.volume_size, &volume_size, sizeof(vector3ui)) == 0 &&
+					   memcmp(&mc_mesh.grid_size, &grid_size, sizeof(vector3ui)) == 0;
+	int is_update = is_same_mesh && (isolevel != mc_mesh.isolevel || mc_mesh.edit_begin < mc_mesh.edit_end);
+	int touched = is_same_mesh ? 1 : -1, is_relayout = 0;
+
+	if(is_update)
+		touched = marching_cubes_patch_mesh(&job);
+
+	// сетка строится впервые или слои не помещаются на свои места
+	if(touched < 0) {
+		mc_job_t layout_job = {volume, volume_size, grid_size, isolevel};
+
+		touched = marching_cubes_layout_mesh(&layout_job) ? 1 : 0;
+		is_relayout = is_update;
+	}
+
+	if(touched == 0) {
+		mc_mesh.is_valid = 0;
+		return 0;
+	}
+
+	if(is_update) {
+		unsigned total = 0;
+
+		for(unsigned k = 0; k < mc_mesh.num_layers; k++)
+			total += mc_mesh.triangle_counts[k];
+
+		// при перестройке всей сетки затронуты все треугольники
+		mc_mesh.touched_triangles += is_relayout ? total : (unsigned) (touched - 1);
+		mc_mesh.total_triangles += total;
+		mc_mesh.num_relayouts += is_relayout;
+		mc_mesh.num_updates++;
+	}
+
+	if(mc_mesh.num_updates >= MESH_REPORT_UPDATES) {
+		TRACE_MSG("%u updates: %.0f of %.0f triangles rebuilt per update (%.1f%%), %u relayouts\n",
+				  mc_mesh.num_updates, mc_mesh.touched_triangles / mc_mesh.num_updates,
+				  mc_mesh.total_triangles / mc_mesh.num_updates,
+				  (mc_mesh.total_triangles > 0.0) ? 100.0 * mc_mesh.touched_triangles / mc_mesh.total_triangles : 0.0,
+				  mc_mesh.num_relayouts);
+
+		mc_mesh.num_updates = mc_mesh.num_relayouts = 0;
+		mc_mesh.touched_triangles = mc_mesh.total_triangles = 0.0;
+	}
+
+	return 1;
+}
+
+int marching_cubes_update_mesh(const float *volume, vector3ui volume_size, vector3ui grid_size, float isolevel,
+							   mc_layers_t *mesh)
+{
+	IF_FAILED0(volume && mesh);
+
+	if(!marching_cubes_update_layers(volume, volume_size, grid_size, isolevel))
+		return 0;
+
+	unsigned num_layers = mc_mesh.num_layers;
+
+	mesh->vertices = mc_mesh.vertices;
+	mesh->triangles = mc_mesh.triangles;
+	mesh->num_vertices = mc_mesh.vertex_bases[num_layers];
+	mesh->num_triangles = mc_mesh.triangle_bases[num_layers];
+	mesh->num_layers = num_layers;
+	mesh->triangle_bases = mc_mesh.triangle_bases;
+	mesh->versions = mc_mesh.versions;
+	mesh->layout = mc_mesh.layout;
+
+	// вершины сдвигаются с изо-уровнем во всех слоях, поэтому загружаются одним интервалом
+	mesh->first_vertex = mesh->num_vertices;
+	mesh->last_vertex = 0;
+
+	for(unsigned k = 0; k < num_layers; k++) {
+		if(mc_mesh.vertex_counts[k] == 0)
+			continue;
+
+		if(mc_mesh.vertex_bases[k] < mesh->first_vertex)
+			mesh->first_vertex = mc_mesh.vertex_bases[k];
+
+		mesh->last_vertex = mc_mesh.vertex_bases[k] + mc_mesh.vertex_counts[k];
+	}
+
+	if(mesh->first_vertex > mesh->last_vertex)
+		mesh->first_vertex = mesh->last_vertex;
+
+	return 1;
+}
+
+int marching_cubes_upload_layers(const mc_layers_t *mesh, mc_layers_upload_t *upload, GLuint vertex_vbo, GLuint index_vbo)
+{
+	GLint last_array_buffer, last_element_array_buffer;
+
+	IF_FAILED0(mesh && upload && mesh->layout && (vertex_vbo > 0) && (index_vbo > 0));
+
+	if(!marching_cubes_reserve((void**) &upload->versions, &upload->max_versions, mesh->num_layers, sizeof(unsigned)))
+		return 0;
+
+	glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &last_array_buffer);
+	glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &last_element_array_buffer);
+
+	glBindBuffer(GL_ARRAY_BUFFER, vertex_vbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_vbo);
+
+	if(mesh->layout != upload->layout) {
+		// новое размещение слоёв - буферы целиком
+		glBufferData(GL_ARRAY_BUFFER, sizeof(vector3f) * mesh->num_vertices, (const GLvoid*) mesh->vertices, GL_DYNAMIC_DRAW);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(triangle_t) * mesh->num_triangles, (const GLvoid*) mesh->triangles,
+					 GL_DYNAMIC_DRAW);
+	} else {
+		if(mesh->first_vertex < mesh->last_vertex)
+			glBufferSubData(GL_ARRAY_BUFFER, sizeof(vector3f) * mesh->first_vertex,
+							sizeof(vector3f) * (mesh->last_vertex - mesh->first_vertex),
+							(const GLvoid*) (mesh->vertices + mesh->first_vertex));
+
+		// треугольники - интервалами подряд идущих слоёв, перестроенных после прошлой загрузки
+		for(unsigned k = 0; k < mesh->num_layers; k++) {
+			unsigned end = k;
+
+			if(mesh->versions[k] == upload->versions[k])
+				continue;
+
+			while(end < mesh->num_layers && mesh->versions[end] != upload->versions[end])
+				end++;
+
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, sizeof(triangle_t) * mesh->triangle_bases[k],
+							sizeof(triangle_t) * (mesh->triangle_bases[end] - mesh->triangle_bases[k]),
+							(const GLvoid*) (mesh->triangles + mesh->triangle_bases[k]));
+			k = end;
+		}
+	}
+
+	memcpy(upload->versions, mesh->versions, sizeof(unsigned) * mesh->num_layers);
+	upload->layout = mesh->layout;
+
+	glBindBuffer(GL_ARRAY_BUFFER, last_array_buffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, last_element_array_buffer);
+
+	return 1;
+}
+
+int marching_cubes_update_vbos(const float *volume, vector3ui volume_size, vector3ui grid_size, float isolevel,
+							   GLuint vertex_vbo, GLuint index_vbo, unsigned *num_elements)
+{
+	mc_layers_t mesh;
+
+	IF_FAILED0(volume && (vertex_vbo > 0) && (index_vbo > 0));
+
+	// в другие буферы сетка загружается целиком
+	if(mc_mesh.vertex_vbo != vertex_vbo || mc_mesh.index_vbo != index_vbo) {
+		mc_mesh.vertex_vbo = vertex_vbo;
+		mc_mesh.index_vbo = index_vbo;
+		mc_mesh.upload.layout = 0;
+	}
+
+	if(!marching_cubes_update_mesh(volume, volume_size, grid_size, isolevel, &mesh) ||
+	   !marching_cubes_upload_layers(&mesh, &mc_mesh.upload, vertex_vbo, index_vbo))
+		return 0;
+
+	if(num_elements)
+		*num_elements = mesh.num_triangles * 3;
+
 	return 1;
 }
@@ -0,0 +1,636 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "mesh_decimate.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+// вершин в задаче пула
+#define DECIMATE_TASK_SIZE 4096
+
+// максимальное кол-во соседей вершины (у вершин с большим числом соседей стягивания не ищутся)
+#define DECIMATE_MAX_VALENCE 32
+
+// максимальное кол-во проходов стягивания
+#define DECIMATE_MAX_PASSES 64
+
+// кандидаты сортируются подсчётом по старшим битам стоимости (знак всегда 0)
+#define DECIMATE_SORT_BITS 11
+
+/*
+ * Квадрика ошибки: сумма по треугольникам area * (n*p + d)^2, где n*p + d = 0 - плоскость
+ * треугольника. a - симметричная матрица n*n^T (xx, xy, xz, yy, yz, zz), b = d*n, c = d^2,
+ * weight - сумма площадей
+ */
+typedef struct {
+	float a[6], b[3], c;
+	float weight;
+} quadric_t;
+
+// упрощение в пуле потоков: задачи - группы по DECIMATE_TASK_SIZE вершин
+typedef struct {
+	const vector3f *vertices;
+	unsigned n_vertices;
+
+	triangle_t *triangles;
+	unsigned n_triangles;
+
+	// треугольники вершины v - adjacency[offsets[v] .. offsets[v + 1])
+	unsigned *offsets, *adjacency;
+
+	// соседи вершины v на текущем проходе - neighbors[2 * offsets[v]] .. (num_neighbors[v] штук,
+	// их не больше удвоенного числа треугольников вершины; 0 - больше DECIMATE_MAX_VALENCE)
+	unsigned *neighbors, *num_neighbors;
+
+	quadric_t *quadrics;
+
+	// вершина не перемещается (граничные и неманифолдные рёбра)
+	unsigned char *locked;
+
+	// лучшее стягивание вершины (cost = HUGE_VALF - нет допустимых), пересчитывается
+	// только у вершин, рядом с которыми на прошлом проходе изменилась сетка
+	unsigned *targets;
+	float *costs;
+
+	// номер прохода и пометки вершин (mesh_decimate_pass)
+	unsigned pass;
+	const unsigned *marks;
+
+	// предел стоимости (квадрат ошибки)
+	float max_cost;
+} decimate_job_t;
+
+// буферы, сохраняемые между вызовами и увеличиваемые только при необходимости
+static struct {
+	vector3f *vertices;
+	unsigned max_vertices;
+
+	triangle_t *triangles;
+	unsigned max_triangles;
+
+	unsigned *adjacency;
+	unsigned max_adjacency;
+
+	unsigned *neighbors;
+	unsigned max_neighbors;
+
+	// массивы по вершинам
+	unsigned *offsets, *num_neighbors, *targets, *remap, *marks;
+	float *costs;
+	quadric_t *quadrics;
+	unsigned char *locked;
+	unsigned *collapses;
+	unsigned max_vertex_data;
+} dec_buffers;
+
+/* Увеличить буфер *ptr до count элементов element_size. Возвращает 0 при ошибке */
+static int mesh_decimate_reserve(void **ptr, unsigned *size, unsigned count, size_t element_size)
+{
+	if(count <= *size && *ptr)
+		return 1;
+
+	unsigned new_size = count + count / 4 + 1;
+	void *new_ptr = realloc(*ptr, element_size * new_size);
+
+	IF_FAILED0(new_ptr);
+
+	*ptr = new_ptr;
+	*size = new_size;
+
+	return 1;
+}
+
+/* Все массивы по вершинам на count вершин. Возвращает 0 при ошибке */
+static int mesh_decimate_reserve_vertex_data(unsigned count)
+{
+	if(count + 1 <= dec_buffers.max_vertex_data && dec_buffers.offsets)
+		return 1;
+
+	unsigned size = count + count / 4 + 2;
+
+#define _reserve(ptr) \
+	if(!((ptr) = realloc((ptr), sizeof(*(ptr)) * size))) { \
+		mesh_decimate_release(); \
+		return 0; \
+	}
+
+	_reserve(dec_buffers.offsets);
+	_reserve(dec_buffers.num_neighbors);
+	_reserve(dec_buffers.targets);
+	_reserve(dec_buffers.remap);
+	_reserve(dec_buffers.marks);
+	_reserve(dec_buffers.costs);
+	_reserve(dec_buffers.quadrics);
+	_reserve(dec_buffers.locked);
+	_reserve(dec_buffers.collapses);
+
+#undef _reserve
+
+	dec_buffers.max_vertex_data = size;
+
+	return 1;
+}
+
+void mesh_decimate_release(void)
+{
+	free(dec_buffers.vertices);
+	free(dec_buffers.triangles);
+	free(dec_buffers.adjacency);
+	free(dec_buffers.neighbors);
+	free(dec_buffers.offsets);
+	free(dec_buffers.num_neighbors);
+	free(dec_buffers.targets);
+	free(dec_buffers.remap);
+	free(dec_buffers.marks);
+	free(dec_buffers.costs);
+	free(dec_buffers.quadrics);
+	free(dec_buffers.locked);
+	free(dec_buffers.collapses);
+
+	memset(&dec_buffers, 0, sizeof(dec_buffers));
+}
+
+/* Заполнить смежность вершин и треугольников job (подсчёт, префиксная сумма, запись) */
+static void mesh_decimate_adjacency(decimate_job_t *job)
+{
+	unsigned *offsets = job->offsets;
+
+	memset(offsets, 0, sizeof(unsigned) * (job->n_vertices + 1));
+
+	for(unsigned t = 0; t < job->n_triangles; t++) {
+		for(unsigned c = 0; c < 3; c++)
+			offsets[job->triangles[t].indices[c] + 1]++;
+	}
+
+	for(unsigned v = 0; v < job->n_vertices; v++)
+		offsets[v + 1] += offsets[v];
+
+	// offsets[v] сдвигается при записи и после неё равен началу вершины v + 1
+	for(unsigned t = 0; t < job->n_triangles; t++) {
+		for(unsigned c = 0; c < 3; c++)
+			job->adjacency[offsets[job->triangles[t].indices[c]]++] = t;
+	}
+
+	for(unsigned v = job->n_vertices; v > 0; v--)
+		offsets[v] = offsets[v - 1];
+
+	offsets[0] = 0;
+}
+
+/*
+ * Соседи вершины v и кол-во треугольников на ребре к каждому. Возвращает кол-во соседей,
+ * 0 - если соседей больше DECIMATE_MAX_VALENCE
+ */
+static unsigned mesh_decimate_neighbors(const decimate_job_t *job, unsigned v, unsigned *neighbors, unsigned *counts)
+{
+	unsigned num = 0;
+
+	for(unsigned n = job->offsets[v]; n < job->offsets[v + 1]; n++) {
+		const unsigned *indices = job->triangles[job->adjacency[n]].indices;
+
+		for(unsigned c = 0; c < 3; c++) {
+			unsigned w = indices[c], i = 0;
+
+			if(w == v)
+				continue;
+
+			while(i < num && neighbors[i] != w)
+				i++;
+
+			if(i == num) {
+				if(num == DECIMATE_MAX_VALENCE)
+					return 0;
+
+				neighbors[num] = w;
+				counts[num++] = 0;
+			}
+
+			counts[i]++;
+		}
+	}
+
+	return num;
+}
+
+/* Добавить к q квадрику плоскости треугольника p0, p1, p2 с весом его площади */
+static void mesh_decimate_add_plane(quadric_t *q, vector3f p0, vector3f p1, vector3f p2)
+{
+	vector3f normal = vec3f_cross(vec3f_sub(p1, p0), vec3f_sub(p2, p0));
+	float length = vec3f_length(normal);
+
+	if(length <= 0.0f)
+		return;
+
+	// площадь - половина длины нормали
+	float area = 0.5f * length;
+
+	normal = vec3f_div_c(normal, length);
+
+	float d = -vec3f_dot(normal, p0);
+
+	q->a[0] += area * normal.x * normal.x;
+	q->a[1] += area * normal.x * normal.y;
+	q->a[2] += area * normal.x * normal.z;
+	q->a[3] += area * normal.y * normal.y;
+	q->a[4] += area * normal.y * normal.z;
+	q->a[5] += area * normal.z * normal.z;
+	q->b[0] += area * d * normal.x;
+	q->b[1] += area * d * normal.y;
+	q->b[2] += area * d * normal.z;
+	q->c += area * d * d;
+	q->weight += area;
+}
+
+/* Сумма квадрик q1 и q2 в точке p, делённая на их вес (средний квадрат расстояния) */
+INLINE static float mesh_decimate_cost(const quadric_t *q1, const quadric_t *q2, vector3f p)
+{
+	float a[6], b[3];
+
+	for(unsigned i = 0; i < 6; i++)
+		a[i] = q1->a[i] + q2->a[i];
+	for(unsigned i = 0; i < 3; i++)
+		b[i] = q1->b[i] + q2->b[i];
+
+	float weight = q1->weight + q2->weight;
+	float error = p.x * (a[0] * p.x + 2.0f * (a[1] * p.y + a[2] * p.z + b[0])) +
+				  p.y * (a[3] * p.y + 2.0f * (a[4] * p.z + b[1])) +
+				  p.z * (a[5] * p.z + 2.0f * b[2]) + q1->c + q2->c;
+
+	// ошибка округления может дать небольшое отрицательное значение
+	return (weight > 0.0f) ? fabsf(error) / weight : 0.0f;
+}
+
+/* Задача пула: квадрики вершин по исходным треугольникам и признаки границы */
+static void mesh_decimate_init_task(void *data, unsigned thread, unsigned task)
+{
+	decimate_job_t *job = (decimate_job_t*) data;
+	unsigned begin = task * DECIMATE_TASK_SIZE;
+	unsigned end = (begin + DECIMATE_TASK_SIZE < job->n_vertices) ? begin + DECIMATE_TASK_SIZE : job->n_vertices;
+	unsigned neighbors[DECIMATE_MAX_VALENCE], counts[DECIMATE_MAX_VALENCE];
+
+	for(unsigned v = begin; v < end; v++) {
+		quadric_t *q = &job->quadrics[v];
+		unsigned num = mesh_decimate_neighbors(job, v, neighbors, counts);
+
+		memset(q, 0, sizeof(quadric_t));
+
+		for(unsigned n = job->offsets[v]; n < job->offsets[v + 1]; n++) {
+			const unsigned *indices = job->triangles[job->adjacency[n]].indices;
+
+			mesh_decimate_add_plane(q, job->vertices[indices[0]], job->vertices[indices[1]], job->vertices[indices[2]]);
+		}
+
+		// у внутренней вершины каждое ребро разделяют ровно два треугольника
+		job->locked[v] = (num == 0);
+
+		for(unsigned i = 0; i < num; i++)
+			job->locked[v] |= (counts[i] != 2);
+	}
+}
+
+/*
+ * Стягивание v в w допустимо: у v и w ровно два общих соседа (вершины напротив ребра),
+ * иначе сетка станет неманифолдной, и ни один треугольник v не меняет ориентацию
+ */
+static int mesh_decimate_valid(const decimate_job_t *job, unsigned v, unsigned w,
+							   const unsigned *neighbors, unsigned num)
+{
+	const unsigned *w_neighbors = job->neighbors + 2 * job->offsets[w];
+	unsigned w_num = job->num_neighbors[w], common = 0;
+
+	if(w_num == 0)
+		return 0;
+
+	for(unsigned i = 0; i < num; i++) {
+		for(unsigned j = 0; j < w_num; j++)
+			common += (neighbors[i] == w_neighbors[j]);
+	}
+
+	if(common != 2)
+		return 0;
+
+	vector3f target = job->vertices[w];
+
+	for(unsigned n = job->offsets[v]; n < job->offsets[v + 1]; n++) {
+		const unsigned *indices = job->triangles[job->adjacency[n]].indices;
+		vector3f p[3], q[3];
+
+		// треугольники с ребром v-w исчезают
+		if(indices[0] == w || indices[1] == w || indices[2] == w)
+			continue;
+
+		for(unsigned c = 0; c < 3; c++) {
+			p[c] = job->vertices[indices[c]];
+			q[c] = (indices[c] == v) ? target : p[c];
+		}
+
+		vector3f old_normal = vec3f_cross(vec3f_sub(p[1], p[0]), vec3f_sub(p[2], p[0]));
+		vector3f new_normal = vec3f_cross(vec3f_sub(q[1], q[0]), vec3f_sub(q[2], q[0]));
+
+		if(vec3f_dot(old_normal, new_normal) <= 0.0f)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Задача пула: списки соседей вершин на текущем проходе */
+static void mesh_decimate_neighbors_task(void *data, unsigned thread, unsigned task)
+{
+	decimate_job_t *job = (decimate_job_t*) data;
+	unsigned begin = task * DECIMATE_TASK_SIZE;
+	unsigned end = (begin + DECIMATE_TASK_SIZE < job->n_vertices) ? begin + DECIMATE_TASK_SIZE : job->n_vertices;
+	unsigned counts[DECIMATE_MAX_VALENCE];
+
+	for(unsigned v = begin; v < end; v++)
+		job->num_neighbors[v] = mesh_decimate_neighbors(job, v, job->neighbors + 2 * job->offsets[v], counts);
+}
+
+/*
+ * Стягивание v->w меняет треугольники вершин N[v] (v и её соседей) и квадрику w, поэтому
+ * стоимость и допустимость стягиваний меняются только в 2-окрестности v: у вершин, сама
+ * вершина или сосед которых помечены на прошлом проходе
+ */
+INLINE static int mesh_decimate_changed(const decimate_job_t *job, unsigned v)
+{
+	unsigned last = 2 * (job->pass - 1);
+
+	for(unsigned n = job->offsets[v]; n < job->offsets[v + 1]; n++) {
+		const unsigned *indices = job->triangles[job->adjacency[n]].indices;
+
+		if(job->marks[indices[0]] >= last || job->marks[indices[1]] >= last || job->marks[indices[2]] >= last)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Задача пула: самое дешёвое допустимое стягивание каждой вершины в пределах ошибки */
+static void mesh_decimate_cost_task(void *data, unsigned thread, unsigned task)
+{
+	decimate_job_t *job = (decimate_job_t*) data;
+	unsigned begin = task * DECIMATE_TASK_SIZE;
+	unsigned end = (begin + DECIMATE_TASK_SIZE < job->n_vertices) ? begin + DECIMATE_TASK_SIZE : job->n_vertices;
+	float costs[DECIMATE_MAX_VALENCE];
+
+	for(unsigned v = begin; v < end; v++) {
+		const unsigned *neighbors = job->neighbors + 2 * job->offsets[v];
+		unsigned num = job->num_neighbors[v];
+
+		// у стянутых вершин нет треугольников
+		if(job->offsets[v] == job->offsets[v + 1]) {
+			job->costs[v] = HUGE_VALF;
+			continue;
+		}
+
+		if(job->pass > 1 && !mesh_decimate_changed(job, v))
+			continue;
+
+		job->costs[v] = HUGE_VALF;
+
+		if(job->locked[v] || num == 0)
+			continue;
+
+		for(unsigned i = 0; i < num; i++)
+			costs[i] = mesh_decimate_cost(&job->quadrics[v], &job->quadrics[neighbors[i]], job->vertices[neighbors[i]]);
+
+		// проверяем кандидатов по возрастанию стоимости до первого допустимого
+		for(;;) {
+			unsigned best = num;
+
+			for(unsigned i = 0; i < num; i++) {
+				if(costs[i] <= job->max_cost && (best == num || costs[i] < costs[best]))
+					best = i;
+			}
+
+			if(best == num)
+				break;
+
+			if(mesh_decimate_valid(job, v, neighbors[best], neighbors, num)) {
+				job->costs[v] = costs[best];
+				job->targets[v] = neighbors[best];
+				break;
+			}
+
+			costs[best] = HUGE_VALF;
+		}
+	}
+}
+
+/* Ключ сортировки стоимости: для неотрицательных float порядок битов совпадает с порядком чисел */
+INLINE static unsigned mesh_decimate_sort_key(float cost)
+{
+	uint32_t bits;
+
+	memcpy(&bits, &cost, sizeof(uint32_t));
+
+	return bits >> (31 - DECIMATE_SORT_BITS);
+}
+
+/*
+ * Один проход: выбрать по возрастанию стоимости стягивания, не затрагивающие друг друга,
+ * и применить их к треугольникам. Стягивания v->w и v'->w' независимы (проверки допустимости
+ * обоих остаются верными), если v', w' не входят в N[v], а v, w - в N[v']. Вершины N[v]
+ * помечаются 2 * pass, цель w - 2 * pass + 1. Возвращает кол-во стягиваний
+ */
+static unsigned mesh_decimate_pass(decimate_job_t *job, unsigned pass, unsigned target_triangles)
+{
+	unsigned num_collapses = 0, num_applied = 0, removed = 0, ring = 2 * pass;
+	unsigned *remap = dec_buffers.remap, *marks = dec_buffers.marks;
+
+	unsigned num_tasks = (job->n_vertices + DECIMATE_TASK_SIZE - 1) / DECIMATE_TASK_SIZE;
+
+	mesh_decimate_adjacency(job);
+
+	job->pass = pass;
+	job->marks = marks;
+
+	if(!thread_pool_run(mesh_decimate_neighbors_task, job, num_tasks) ||
+	   !thread_pool_run(mesh_decimate_cost_task, job, num_tasks))
+		return 0;
+
+	// вершины со стягиваниями по возрастанию стоимости (с точностью до младших битов)
+	unsigned histogram[(1 << DECIMATE_SORT_BITS) + 1];
+
+	memset(histogram, 0, sizeof(histogram));
+
+	for(unsigned v = 0; v < job->n_vertices; v++) {
+		if(job->costs[v] <= job->max_cost) {
+			histogram[mesh_decimate_sort_key(job->costs[v]) + 1]++;
+			num_collapses++;
+		}
+	}
+
+	for(unsigned i = 0; i < (1 << DECIMATE_SORT_BITS); i++)
+		histogram[i + 1] += histogram[i];
+
+	for(unsigned v = 0; v < job->n_vertices; v++) {
+		if(job->costs[v] <= job->max_cost)
+			dec_buffers.collapses[histogram[mesh_decimate_sort_key(job->costs[v])]++] = v;
+	}
+
+	for(unsigned i = 0; i < num_collapses && job->n_triangles - removed > target_triangles; i++) {
+		unsigned v = dec_buffers.collapses[i], w = job->targets[v];
+
+		int is_free = (marks[v] < ring && marks[w] < ring);
+
+		// в N[v] нет целей других стягиваний
+		for(unsigned n = job->offsets[v]; is_free && n < job->offsets[v + 1]; n++) {
+			const unsigned *indices = job->triangles[job->adjacency[n]].indices;
+
+			is_free = (marks[indices[0]] != ring + 1 && marks[indices[1]] != ring + 1 && marks[indices[2]] != ring + 1);
+		}
+
+		if(!is_free)
+			continue;
+
+		for(unsigned n = job->offsets[v]; n < job->offsets[v + 1]; n++) {
+			const unsigned *indices = job->triangles[job->adjacency[n]].indices;
+
+			marks[indices[0]] = marks[indices[1]] = marks[indices[2]] = ring;
+		}
+
+		marks[w] = ring + 1;
+		remap[v] = w;
+
+		// квадрика w теперь отвечает и за треугольники v
+		quadric_t *q = &job->quadrics[w];
+		const quadric_t *qv = &job->quadrics[v];
+
+		for(unsigned c = 0; c < 6; c++)
+			q->a[c] += qv->a[c];
+		for(unsigned c = 0; c < 3; c++)
+			q->b[c] += qv->b[c];
+
+		q->c += qv->c;
+		q->weight += qv->weight;
+
+		// на внутреннем ребре исчезают два треугольника
+		removed += 2;
+		num_applied++;
+	}
+
+	if(num_applied == 0)
+		return 0;
+
+	unsigned n_triangles = 0;
+
+	for(unsigned t = 0; t < job->n_triangles; t++) {
+		unsigned a = remap[job->triangles[t].indices[0]], b = remap[job->triangles[t].indices[1]],
+				 c = remap[job->triangles[t].indices[2]];
+
+		if(a == b || b == c || a == c)
+			continue;
+
+		job->triangles[n_triangles].indices[0] = a;
+		job->triangles[n_triangles].indices[1] = b;
+		job->triangles[n_triangles++].indices[2] = c;
+	}
+
+	job->n_triangles = n_triangles;
+
+	return num_applied;
+}
+
+int mesh_decimate(const vector3f *vertices, unsigned n_vertices,
+				  const triangle_t *triangles, unsigned n_triangles,
+				  unsigned target_triangles, float max_error,
+				  const vector3f **out_vertices, unsigned *out_n_vertices,
+				  const triangle_t **out_triangles, unsigned *out_n_triangles)
+{
+	IF_FAILED0((vertices || n_vertices == 0) && (triangles || n_triangles == 0) && max_error >= 0.0f &&
+			   out_vertices && out_n_vertices && out_triangles && out_n_triangles);
+
+	double time = utils_get_time();
+	decimate_job_t job;
+
+	if(!mesh_decimate_reserve((void**) &dec_buffers.triangles, &dec_buffers.max_triangles, n_triangles, sizeof(triangle_t)) ||
+	   !mesh_decimate_reserve((void**) &dec_buffers.adjacency, &dec_buffers.max_adjacency, n_triangles * 3, sizeof(unsigned)) ||
+	   !mesh_decimate_reserve((void**) &dec_buffers.neighbors, &dec_buffers.max_neighbors, n_triangles * 6, sizeof(unsigned)) ||
+	   !mesh_decimate_reserve((void**) &dec_buffers.vertices, &dec_buffers.max_vertices, n_vertices, sizeof(vector3f)) ||
+	   !mesh_decimate_reserve_vertex_data(n_vertices))
+		return 0;
+
+	memcpy(dec_buffers.triangles, triangles, sizeof(triangle_t) * n_triangles);
+
+	job.vertices = vertices;
+	job.n_vertices = n_vertices;
+	job.triangles = dec_buffers.triangles;
+	job.n_triangles = n_triangles;
+	job.offsets = dec_buffers.offsets;
+	job.adjacency = dec_buffers.adjacency;
+	job.neighbors = dec_buffers.neighbors;
+	job.num_neighbors = dec_buffers.num_neighbors;
+	job.quadrics = dec_buffers.quadrics;
+	job.locked = dec_buffers.locked;
+	job.targets = dec_buffers.targets;
+	job.costs = dec_buffers.costs;
+	job.max_cost = max_error * max_error;
+
+	for(unsigned v = 0; v < n_vertices; v++) {
+		dec_buffers.remap[v] = v;
+		dec_buffers.marks[v] = 0;
+	}
+
+	mesh_decimate_adjacency(&job);
+
+	unsigned num_tasks = (n_vertices + DECIMATE_TASK_SIZE - 1) / DECIMATE_TASK_SIZE;
+
+	if(num_tasks > 0 && !thread_pool_run(mesh_decimate_init_task, &job, num_tasks))
+		return 0;
+
+	for(unsigned pass = 1; pass <= DECIMATE_MAX_PASSES && job.n_triangles > target_triangles; pass++) {
+		if(!mesh_decimate_pass(&job, pass, target_triangles))
+			break;
+	}
+
+	// оставляем только вершины оставшихся треугольников, remap - их новые номера
+	unsigned *remap = dec_buffers.remap, num_vertices = 0;
+
+	for(unsigned v = 0; v < n_vertices; v++)
+		remap[v] = ~0u;
+
+	for(unsigned t = 0; t < job.n_triangles; t++) {
+		for(unsigned c = 0; c < 3; c++) {
+			unsigned *index = &job.triangles[t].indices[c];
+
+			if(remap[*index] == ~0u) {
+				dec_buffers.vertices[num_vertices] = vertices[*index];
+				remap[*index] = num_vertices++;
+			}
+
+			*index = remap[*index];
+		}
+	}
+
+	time = utils_get_time() - time;
+
+	TRACE_MSG("decimated %u to %u triangles in %.3f s (%.1f Mtri/s)\n", n_triangles, job.n_triangles,
+			  time, (time > 0.0) ? n_triangles / time * 1e-6 : 0.0);
+
+	*out_vertices = dec_buffers.vertices;
+	*out_n_vertices = num_vertices;
+	*out_triangles = dec_buffers.triangles;
+	*out_n_triangles = job.n_triangles;
+
+	return 1;
+}
@@ -0,0 +1,243 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "mesh_worker.h"
+
+// флаг middle: сетка построена и ещё не забрана потоком рендера
+#define MESH_WORKER_FRESH 4u
+#define MESH_WORKER_INDEX 3u
+
+/* Увеличить буфер *ptr из *size элементов до count элементов (с запасом) */
+static int mesh_buffer_reserve(void **ptr, unsigned *size, unsigned count, size_t element_size)
+{
+	if(count <= *size && *ptr)
+		return 1;
+
+	// запас на случай плавного роста (анимация изо-уровня)
+	unsigned new_size = count + count / 4 + 1;
+	void *new_ptr = realloc(*ptr, element_size * new_size);
+
+	IF_FAILED0(new_ptr);
+
+	*ptr = new_ptr;
+	*size = new_size;
+
+	return 1;
+}
+
+int mesh_buffer_store(mesh_buffer_t *mesh, const vector3f *vertices, unsigned n_vertices,
+					  const triangle_t *triangles, unsigned n_triangles)
+{
+	IF_FAILED0(mesh && (vertices || n_vertices == 0) && (triangles || n_triangles == 0));
+
+	if(!mesh_buffer_reserve((void**) &mesh->vertices, &mesh->max_vertices, n_vertices, sizeof(vector3f)) ||
+	   !mesh_buffer_reserve((void**) &mesh->triangles, &mesh->max_triangles, n_triangles, sizeof(triangle_t)))
+		return 0;
+
+	memcpy(mesh->vertices, vertices, sizeof(vector3f) * n_vertices);
+	memcpy(mesh->triangles, triangles, sizeof(triangle_t) * n_triangles);
+
+	mesh->num_vertices = n_vertices;
+	mesh->num_triangles = n_triangles;
+	mesh->layers.layout = 0;
+
+	return 1;
+}
+
+int mesh_buffer_store_layers(mesh_buffer_t *mesh, const mc_layers_t *layers)
+{
+	IF_FAILED0(mesh && layers && layers->layout);
+
+	unsigned num_layers = layers->num_layers;
+
+	if(!mesh_buffer_store(mesh, layers->vertices, layers->num_vertices, layers->triangles, layers->num_triangles) ||
+	   !mesh_buffer_reserve((void**) &mesh->layer_data, &mesh->max_layer_data, num_layers * 2 + 1, sizeof(unsigned)))
+		return 0;
+
+	memcpy(mesh->layer_data, layers->triangle_bases, sizeof(unsigned) * (num_layers + 1));
+	memcpy(mesh->layer_data + num_layers + 1, layers->versions, sizeof(unsigned) * num_layers);
+
+	mesh->layers = *layers;
+	mesh->layers.vertices = mesh->vertices;
+	mesh->layers.triangles = mesh->triangles;
+	mesh->layers.triangle_bases = mesh->layer_data;
+	mesh->layers.versions = mesh->layer_data + num_layers + 1;
+
+	return 1;
+}
+
+static void *mesh_worker_thread(void *arg)
+{
+	mesh_worker_t *worker = (mesh_worker_t*) arg;
+
+	pthread_mutex_lock(&worker->mutex);
+
+	while(!worker->is_quit) {
+		if(!worker->has_request) {
+			pthread_cond_wait(&worker->cond, &worker->mutex);
+			continue;
+		}
+
+		// берём последний запрос, следующие заменят его в worker->request
+		mesh_request_t request = worker->request;
+		mesh_buffer_t *mesh = &worker->buffers[worker->back];
+
+		worker->has_request = 0;
+		worker->is_busy = 1;
+		pthread_mutex_unlock(&worker->mutex);
+
+		pthread_mutex_lock(&worker->build_mutex);
+		mesh->request = request;
+		mesh->is_valid = worker->build(&request, mesh);
+		pthread_mutex_unlock(&worker->build_mutex);
+
+		if(!mesh->is_valid)
+			ERROR_MSG("cannot build mesh for isolevel %f\n", request.isolevel);
+
+		// публикуем сетку и забираем буфер, который рендер уже не использует
+		worker->back = __atomic_exchange_n(&worker->middle, worker->back | MESH_WORKER_FRESH, __ATOMIC_ACQ_REL) &
+			MESH_WORKER_INDEX;
+
+		pthread_mutex_lock(&worker->mutex);
+		worker->is_busy = 0;
+		pthread_cond_broadcast(&worker->cond);
+	}
+
+	pthread_mutex_unlock(&worker->mutex);
+
+	return NULL;
+}
+
+int mesh_worker_start(mesh_worker_t *worker, mesh_build_func_t build)
+{
+	IF_FAILED0(worker && build);
+
+	memset(worker, 0, sizeof(mesh_worker_t));
+
+	worker->build = build;
+	worker->back = 0;
+	worker->middle = 1;
+	worker->front = 2;
+
+	pthread_mutex_init(&worker->mutex, NULL);
+	pthread_mutex_init(&worker->build_mutex, NULL);
+	pthread_cond_init(&worker->cond, NULL);
+
+	if(pthread_create(&worker->thread, NULL, mesh_worker_thread, worker) != 0) {
+		ERROR_MSG("cannot create mesh worker thread\n");
+
+		pthread_cond_destroy(&worker->cond);
+		pthread_mutex_destroy(&worker->build_mutex);
+		pthread_mutex_destroy(&worker->mutex);
+		return 0;
+	}
+
+	worker->is_running = 1;
+
+	return 1;
+}
+
+void mesh_worker_request(mesh_worker_t *worker, const mesh_request_t *request)
+{
+	IF_FAILED(worker && worker->is_running && request);
+
+	pthread_mutex_lock(&worker->mutex);
+	worker->request = *request;
+	worker->has_request = 1;
+	pthread_cond_broadcast(&worker->cond);
+	pthread_mutex_unlock(&worker->mutex);
+}
+
+const mesh_buffer_t *mesh_worker_acquire(mesh_worker_t *worker)
+{
+	IF_FAILED_RET(worker && worker->is_running, NULL);
+
+	if(!(__atomic_load_n(&worker->middle, __ATOMIC_ACQUIRE) & MESH_WORKER_FRESH))
+		return NULL;
+
+	// отдаём прочитанный front потоку построения и забираем свежую сетку
+	worker->front = __atomic_exchange_n(&worker->middle, worker->front, __ATOMIC_ACQ_REL) & MESH_WORKER_INDEX;
+
+	return &worker->buffers[worker->front];
+}
+
+void mesh_worker_cancel(mesh_worker_t *worker)
+{
+	IF_FAILED(worker);
+
+	if(!worker->is_running)
+		return;
+
+	pthread_mutex_lock(&worker->mutex);
+
+	worker->has_request = 0;
+
+	while(worker->is_busy)
+		pthread_cond_wait(&worker->cond, &worker->mutex);
+
+	// поток ждёт запроса, middle меняет только рендер
+	__atomic_and_fetch(&worker->middle, MESH_WORKER_INDEX, __ATOMIC_ACQ_REL);
+
+	pthread_mutex_unlock(&worker->mutex);
+}
+
+void mesh_worker_lock(mesh_worker_t *worker)
+{
+	IF_FAILED(worker);
+
+	if(worker->is_running)
+		pthread_mutex_lock(&worker->build_mutex);
+}
+
+void mesh_worker_unlock(mesh_worker_t *worker)
+{
+	IF_FAILED(worker);
+
+	if(worker->is_running)
+		pthread_mutex_unlock(&worker->build_mutex);
+}
+
+void mesh_worker_stop(mesh_worker_t *worker)
+{
+	IF_FAILED(worker);
+
+	if(!worker->is_running)
+		return;
+
+	pthread_mutex_lock(&worker->mutex);
+	worker->has_request = 0;
+	worker->is_quit = 1;
+	pthread_cond_broadcast(&worker->cond);
+	pthread_mutex_unlock(&worker->mutex);
+
+	pthread_join(worker->thread, NULL);
+
+	pthread_cond_destroy(&worker->cond);
+	pthread_mutex_destroy(&worker->build_mutex);
+	pthread_mutex_destroy(&worker->mutex);
+
+	for(unsigned i = 0; i < 3; i++) {
+		free(worker->buffers[i].vertices);
+		free(worker->buffers[i].triangles);
+		free(worker->buffers[i].layer_data);
+	}
+
+	memset(worker, 0, sizeof(mesh_worker_t));
+}
@@ -27,8 +27,14 @@
 #include "input.h"
 #include "marching_cubes.h"
 #include "parser.h"
+#include "thread_pool.h"
+#include "volume_pyramid.h"
+#include "surface_nets.h"
+#include "mesh_decimate.h"
+#include "lod_mesh.h"
+#include "mesh_worker.h"
+#include "utils.h"
 #include "string.h"
-#include "omp.h"
 #include <ctype.h>
 
 static int init = 0, init_opengl = 0;
@@ -39,8 +45,10 @@ static int is_stop_building = 0;
 // необходимо ли в основном потоке обменять местами new_volume и volume
 static int is_swap_volumes = 0;
 
-// количество потоков
-static unsigned num_threads = 1;
+// размер тайла построения скалярного поля (64*16*8 значений = 32 Кб, помещается в L1/L2)
+#define VOLUME_TILE_X 64
+#define VOLUME_TILE_Y 16
+#define VOLUME_TILE_Z 8
 
 // основная камера
 static camera_t camera;
@@ -49,10 +57,37 @@ static double last_time = 0.0f;
 
 static parser_t parser;
 static float *volume = NULL, *new_volume = NULL;
-static char *str_function = NULL;
+
+// пирамиды скалярного поля для сеток меньше поля (new_pyramid строится вместе с new_volume)
+static volume_pyramid_t pyramid, new_pyramid;
+
+// скомпилированная функция скалярного поля
+static parser_program_t function_program;
+
+// каталог кэша для компиляции функции в машинный код системным компилятором (NULL - не компилировать)
+static char *native_cache_dir = NULL;
 
 // размер скалярного поля и размер сетки
 static vector3ui volume_size, grid_size;
+
+// метод построения изоповерхности (RENDER_MESH_*)
+static int mesh_method = RENDER_MESH_MARCHING_CUBES;
+
+// упрощение сетки (render_set_decimation)
+static float decimation_ratio = 1.0f;
+
+// изоповерхность по чанкам с уровнем детализации (render_set_lod)
+static lod_mesh_t lod_mesh;
+static int lod_enable = 0;
+static float lod_distance = 0.25f;
+
+// построение единой сетки в фоновом потоке (render_set_background_meshing)
+static mesh_worker_t mesh_worker;
+static int background_meshing = 1;
+
+// слои сетки marching cubes, загруженные в vbo из сеток потока
+static mc_layers_upload_t uploaded_layers;
+
 // шаг обработки сетки и скалярного поля
 static vector3f grid_step, volume_step;
 
@@ -181,6 +216,10 @@ int init_buffers(void)
 
 void swap_volumes(void)
 {
+	// сетка и чанки в фоне читают текущее поле
+	mesh_worker_cancel(&mesh_worker);
+	lod_mesh_invalidate(&lod_mesh);
+
 	if(volume) {
 		free(volume);
 		volume = NULL;
@@ -188,6 +227,14 @@ void swap_volumes(void)
 
 	volume = new_volume;
 	new_volume = NULL;
+
+	volume_pyramid_t temp = pyramid;
+
+	pyramid = new_pyramid;
+	new_pyramid = temp;
+
+	// новый volume может получить адрес старого
+	marching_cubes_invalidate();
 }
 
 void render_update_volume_tex(void)
@@ -211,6 +258,68 @@ void render_update_volume_tex(void)
 	init = 1;
 }
 
+/* Построить единую сетку в потоке mesh_worker тем же методом, что и render_update_mc */
+static int render_build_mesh(const mesh_request_t *request, mesh_buffer_t *mesh)
+{
+	const vector3f *vertices;
+	const triangle_t *triangles;
+	unsigned n_vertices, n_triangles;
+
+	// marching cubes без упрощения обновляет сохранённую сетку по слоям, как в вызывающем потоке
+	if(request->method == RENDER_MESH_MARCHING_CUBES && decimation_ratio >= 1.0f) {
+		mc_layers_t layers;
+
+		return marching_cubes_update_mesh(request->volume, request->volume_size, request->grid_size, request->isolevel,
+										  &layers) && mesh_buffer_store_layers(mesh, &layers);
+	}
+
+	int (*create_mesh)(const float*, vector3ui, vector3ui, float, const vector3f**, unsigned*,
+					   const triangle_t**, unsigned*) =
+		(request->method == RENDER_MESH_SURFACE_NETS) ? surface_nets_create_mesh : marching_cubes_create_mesh;
+
+	if(!create_mesh(request->volume, request->volume_size, request->grid_size, request->isolevel,
+					&vertices, &n_vertices, &triangles, &n_triangles))
+		return 0;
+
+	marching_cubes_decimate_mesh(request->grid_size, &vertices, &n_vertices, &triangles, &n_triangles);
+
+	return mesh_buffer_store(mesh, vertices, n_vertices, triangles, n_triangles);
+}
+
+/* Загрузить в буферы сетку, построенную в фоне, если готова новая */
+static void render_upload_mesh(void)
+{
+	const mesh_buffer_t *mesh = mesh_worker_acquire(&mesh_worker);
+
+	if(!mesh || !mesh->is_valid)
+		return;
+
+	// сетку по слоям загружаем диапазонами слоёв, изменившихся после прошлой загрузки
+	if(mesh->layers.layout) {
+		glBindVertexArray(0);
+
+		if(!marching_cubes_upload_layers(&mesh->layers, &uploaded_layers, vbo[0], vbo[1])) {
+			ERROR_MSG("cannot upload mesh layers\n");
+			return;
+		}
+
+		num_elements = mesh->layers.num_triangles * 3;
+		return;
+	}
+
+	uploaded_layers.layout = 0;
+
+	// индексный буфер - часть состояния vao
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo[0]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vector3f) * mesh->num_vertices, (const GLvoid*) mesh->vertices, GL_DYNAMIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(triangle_t) * mesh->num_triangles, (const GLvoid*) mesh->triangles,
+				 GL_DYNAMIC_DRAW);
+	glBindVertexArray(0);
+
+	num_elements = mesh->num_triangles * 3;
+}
+
 void render_update_mc(void)
 {
 
@@ -219,13 +328,41 @@ void render_update_mc(void)
 		is_swap_volumes = 0;
 	}
 
+	// чанки перестраиваются в render_update
+	if(lod_enable)
+		return;
+
+	// сетка с шагом 2^l по полю строится по уровню l пирамиды: те же узлы, но значения усреднены
+	unsigned level = volume_pyramid_level(&pyramid, grid_size);
+
+	// в фоне сетка строится (запрос заменяет ещё не взятый) и загружается в render_update
+	if(background_meshing) {
+		mesh_request_t request = {pyramid.average[level], pyramid.sizes[level], grid_size, isolevel, mesh_method};
+
+		mesh_worker_request(&mesh_worker, &request);
+		return;
+	}
+
 	glBindVertexArray(0);
 
-	// полигонизируем скалярное поле
-	if(!marching_cubes_create_vbos(volume,
-								   volume_size, 
-								   grid_size, 
-								   isolevel, vbo[0], vbo[1], 0, NULL, &num_elements)) {
+	// surface nets строит сетку целиком, marching cubes при анимации изо-уровня обновляет её по слоям
+	// (кроме упрощаемой сетки: она строится целиком перед загрузкой)
+	if(mesh_method == RENDER_MESH_SURFACE_NETS) {
+		if(!surface_nets_create_vbos(pyramid.average[level], pyramid.sizes[level], grid_size, isolevel,
+									 vbo[0], vbo[1], 0, NULL, &num_elements)) {
+			
+			ERROR_MSG("Surface Nets: nothing to generate");
+		}
+	}
+	else if(decimation_ratio < 1.0f) {
+		if(!marching_cubes_create_vbos(pyramid.average[level], pyramid.sizes[level], grid_size, isolevel,
+									   vbo[0], vbo[1], 0, NULL, &num_elements)) {
+			
+			ERROR_MSG("Marching Cubes: nothing to generate");
+		}
+	}
+	else if(!marching_cubes_update_vbos(pyramid.average[level], pyramid.sizes[level], grid_size, isolevel,
+										vbo[0], vbo[1], &num_elements)) {
 		
 		ERROR_MSG("Marching Cubes: nothing to generate");
 	}
@@ -286,9 +423,18 @@ int render_init(void)
 	// устанавливаем функцию по-умолчанию
 	parser_create(&parser);
 	const char *default_func = "d = y;";
-	str_function = (char*) malloc(sizeof(char) * (strlen(default_func) + 1));
-	strcpy(str_function, default_func);
+	if(parser_compile(&parser, default_func, &function_program) != 0)
+		return 0;
 	
+	volume_pyramid_init(&pyramid);
+	volume_pyramid_init(&new_pyramid);
+	lod_mesh_init(&lod_mesh);
+
+	if(!mesh_worker_start(&mesh_worker, render_build_mesh)) {
+		ERROR_MSG("cannot start background meshing, building meshes in the render thread\n");
+		background_meshing = 0;
+	}
+
 	// настраиваем и создаем скалярное поле
 	render_set_volume_size(vec3ui(128, 128, 128), 1);
 	render_set_grid_size(vec3ui(64, 64, 64));
@@ -306,7 +452,7 @@ int render_init(void)
 	// устанавливаем параметры по-умолчанию
 	new_light_position = light_position = vec3f(1.0f, 1.0f, 1.0f);
 	rot_axis = vec3f(0.0f, 1.0f, 0.0f);
-	num_threads = 1;
+	thread_pool_set_num_threads(1);
 	rot_angle = 0.0f;
 	light_animate = 0;
 	light_rot_angle = 0.0f;
@@ -332,28 +478,45 @@ int render_init(void)
 
 void render_set_number_of_threads(unsigned num)
 {
-	num_threads = num;
+	thread_pool_set_num_threads(num);
+}
+
+int render_set_jit(int enable)
+{
+	return parser_set_jit(enable);
+}
+
+void render_set_native_cache(const char *cache_dir)
+{
+	if(native_cache_dir) {
+		free(native_cache_dir);
+		native_cache_dir = NULL;
+	}
+
+	if(cache_dir) {
+		native_cache_dir = (char*) malloc(strlen(cache_dir) + 1);
+		IF_FAILED(native_cache_dir);
+
+		strcpy(native_cache_dir, cache_dir);
+	}
 }
 
 static float volume_func(vector3f pos) 
 {
-	// инициализируем таблицу переменных с соотвествующей позицией
-	float_var_value_t float_vars[] = 
-		{
-			{1, 0.0f}, // d
-			{2, pos.x}, // x
-			{3, pos.y}, // y
-			{4, pos.z}, // z
-			{0, 0.0f}
-		};
-
-	// парсим функцию
-	if(parser_parse_text(&parser, str_function, float_vars) != 0) {
+	// инициализируем регистры переменных соотвествующей позицией
+	float registers[MAX_NUM_REGISTERS];
+
+	registers[PARSER_REG_X] = pos.x;
+	registers[PARSER_REG_Y] = pos.y;
+	registers[PARSER_REG_Z] = pos.z;
+
+	// вычисляем функцию
+	if(parser_program_eval(&function_program, registers) != 0) {
 		return 0.0f;
 	}
 	
 	// получаем вычисленное значение d
-	return float_vars[0].value;
+	return registers[PARSER_REG_D];
 }
 
 void render_set_grid_size(vector3ui grid_size_v)
@@ -364,94 +527,164 @@ void render_set_grid_size(vector3ui grid_size_v)
 	render_update_mc();
 }
 
-void render_set_volume_size(vector3ui volume_size_v, int rebuild)
+void render_set_mesh_method(int method)
 {
-	volume_size = vec3ui_add_c(volume_size_v, 1);
-	volume_step = vec3f_div(vec3f(1.0f, 1.0f, 1.0f), vec3ui_to_vec3f(volume_size));
-	
-	if(rebuild) {
+	IF_FAILED(method == RENDER_MESH_MARCHING_CUBES || method == RENDER_MESH_SURFACE_NETS);
 
-		new_volume = (float*) malloc(sizeof(float) * volume_size.x*volume_size.y*volume_size.z);
-		IF_FAILED(new_volume != NULL);
+	// поток сетки использует внутренние буферы marching cubes
+	mesh_worker_cancel(&mesh_worker);
 
-		is_stop_building = 0;
+	mesh_method = method;
 
-		if(parser_is_stopped())
-			parser_resume();
+	// сетка marching cubes, сохранённая для обновления по слоям, больше не соответствует буферам
+	marching_cubes_invalidate();
 
-		// проверяем количество потоков и решаем использовать ли многопоточность
-		if(num_threads >= 2) {
+	if(init)
+		render_update_mc();
+}
 
-			// устанавливаем кол-во потоков
-			omp_set_num_threads(num_threads);
+void render_set_decimation(float ratio, float max_error)
+{
+	IF_FAILED(ratio >= 0.0f && max_error >= 0.0f);
 
-			int *stop_ptr = &is_stop_building;
+	// поток сетки упрощает её с этими параметрами
+	mesh_worker_cancel(&mesh_worker);
 
-			// запускаем паралельно данный участок кода
-			#pragma omp parallel firstprivate(volume_size) shared(new_volume, str_function, stop_ptr)
-			{
-				int i = omp_get_thread_num();
+	decimation_ratio = ratio;
+	marching_cubes_set_decimation(ratio, max_error);
+	marching_cubes_invalidate();
 
-				parser_t tparser;
-				parser_create(&tparser);
-				parser_clean(&tparser);
+	if(init)
+		render_update_mc();
+}
 
-				// вычисляем интервал вычислений для данного потока
-				vector3ui begin = vec3ui(0, 0, volume_size.z * ((float) (i) / (float) omp_get_num_threads()));
-				vector3ui end = vec3ui(volume_size.x, volume_size.y, volume_size.z * ((float) (i+1) / (float) omp_get_num_threads()));
+void render_set_lod(int enable, float distance)
+{
+	IF_FAILED(distance > 0.0f);
 
-				float_var_value_t float_vars[] =
-				{
-					{1, 0.0f}, // d
-					{2, 0.0f}, // x
-					{3, 0.0f}, // y
-					{4, 0.0f}, // z
-					{0, 0.0f}
-				};
+	lod_distance = distance;
 
-				// проходимся по соотвествующему участку массива
-				for(unsigned k = begin.z; k < end.z; k++) {
-					for(unsigned j = begin.y; j < end.y; j++) {
-						for(unsigned i = begin.x; i < end.x; i++) {
+	if(lod_enable == (enable ? 1 : 0))
+		return;
 
-							if(*stop_ptr)
-								goto exit_loop;
+	lod_enable = (enable ? 1 : 0);
 
-							float_vars[0].value = 0.0f; float_vars[1].value = i;
-							float_vars[2].value = j; float_vars[3].value = k;
+	// сетка по чанкам строится заново при включении, единая - при выключении
+	lod_mesh_destroy(&lod_mesh);
 
-							if(parser_parse_text(&tparser, str_function, float_vars) == 0) {
-								new_volume[i + j*volume_size.x + k*volume_size.x*volume_size.y] = float_vars[0].value;
-							}
-						}
-					}
-				}
+	if(init && !lod_enable)
+		render_update_mc();
+}
 
-				exit_loop:
+void render_set_background_meshing(int enable)
+{
+	IF_FAILED(!enable || !init || mesh_worker.is_running);
 
-				parser_clean(&tparser);
-			}
+	if(background_meshing == (enable ? 1 : 0))
+		return;
 
-		} else {
-			// проходимся по всему массиву и устанавливаем соотвествующее функции значение
-			for(unsigned k = 0; k < volume_size.z; k++) {
-				for(unsigned j = 0; j < volume_size.y; j++) {
-					for(unsigned i = 0; i < volume_size.x; i++) {
+	// после загрузки фоновых сеток буферы не соответствуют сетке для обновления по слоям
+	mesh_worker_cancel(&mesh_worker);
+	marching_cubes_invalidate();
 
-						if(is_stop_building)
-							goto exit_loop2;
+	background_meshing = (enable ? 1 : 0);
 
-						new_volume[i + j*volume_size.x + k*volume_size.x*volume_size.y] = volume_func(vec3f(i, j, k));
-					}
-				}
-			}
+	if(init)
+		render_update_mc();
+}
 
-			exit_loop2: ; // ....
+// построение скалярного поля в пуле потоков
+typedef struct {
+	float *volume;
+	vector3ui size;
+} volume_build_t;
 
-		}
+/* Кол-во тайлов построения скалярного поля размера size */
+static unsigned volume_num_tiles(vector3ui size)
+{
+	return ((size.x + VOLUME_TILE_X - 1) / VOLUME_TILE_X) *
+		   ((size.y + VOLUME_TILE_Y - 1) / VOLUME_TILE_Y) *
+		   ((size.z + VOLUME_TILE_Z - 1) / VOLUME_TILE_Z);
+}
+
+/* Границы [begin, end) тайла с номером tile (x меняется быстрее всего, z - медленнее) */
+static void volume_tile_bounds(vector3ui size, unsigned tile, vector3ui *begin, vector3ui *end)
+{
+	unsigned tiles_x = (size.x + VOLUME_TILE_X - 1) / VOLUME_TILE_X;
+	unsigned tiles_y = (size.y + VOLUME_TILE_Y - 1) / VOLUME_TILE_Y;
+
+	*begin = vec3ui((tile % tiles_x) * VOLUME_TILE_X, (tile / tiles_x % tiles_y) * VOLUME_TILE_Y,
+					(tile / (tiles_x * tiles_y)) * VOLUME_TILE_Z);
+
+	*end = vec3ui(begin->x + VOLUME_TILE_X, begin->y + VOLUME_TILE_Y, begin->z + VOLUME_TILE_Z);
+
+	// крайние тайлы обрезаются по границе поля
+	if(end->x > size.x) end->x = size.x;
+	if(end->y > size.y) end->y = size.y;
+	if(end->z > size.z) end->z = size.z;
+}
+
+/* Задача пула: вычислить тайл tile скалярного поля */
+static void volume_build_tile(void *data, unsigned thread, unsigned tile)
+{
+	const volume_build_t *build = (const volume_build_t*) data;
+	vector3ui begin, end, size = build->size;
+
+	// остановку проверяем один раз на тайл
+	if(is_stop_building)
+		return;
+
+	volume_tile_bounds(size, tile, &begin, &end);
+
+	for(unsigned k = begin.z; k < end.z; k++)
+		parser_program_eval_slice(&function_program, begin.x, begin.y, k, end.x - begin.x, end.y - begin.y,
+								  size.x, &build->volume[begin.x + begin.y*size.x + k*size.x*size.y]);
+}
 
+void render_set_volume_size(vector3ui volume_size_v, int rebuild)
+{
+	volume_size = vec3ui_add_c(volume_size_v, 1);
+	volume_step = vec3f_div(vec3f(1.0f, 1.0f, 1.0f), vec3ui_to_vec3f(volume_size));
+	
+	if(rebuild) {
+
+		new_volume = (float*) malloc(sizeof(float) * volume_size.x*volume_size.y*volume_size.z);
+		IF_FAILED(new_volume != NULL);
+
+		is_stop_building = 0;
+
+		if(parser_is_stopped())
+			parser_resume();
+
+		double build_time = utils_get_time();
+
+		thread_pool_job_t job;
+		volume_build_t build = {new_volume, volume_size};
+
+		// потоки пула берут тайлы из своих очередей, а закончив - крадут у самых загруженных
+		if(thread_pool_submit(&job, volume_build_tile, &build, volume_num_tiles(volume_size))) {
+			thread_pool_wait(&job);
+
+			if(!is_stop_building)
+				scheduler_report(&job.scheduler);
+
+			thread_pool_release(&job);
+		} else {
+			is_stop_building = 1;
+		}
 
 		if(!is_stop_building) {
+			unsigned num_voxels = volume_size.x * volume_size.y * volume_size.z;
+
+			build_time = utils_get_time() - build_time;
+			TRACE_MSG("%u voxels built in %.3f s (%.0f voxels/s)\n", num_voxels, build_time,
+					  (build_time > 0.0) ? num_voxels / build_time : 0.0);
+
+			// без пирамиды marching cubes читает поле с шагом
+			build_time = utils_get_time();
+
+			if(volume_pyramid_build(&new_pyramid, new_volume, volume_size))
+				TRACE_MSG("%u pyramid levels built in %.3f s\n", new_pyramid.num_levels, utils_get_time() - build_time);
 
 			is_swap_volumes = 1;
 		} else {
@@ -529,8 +762,23 @@ void render_update(double last_frame_time)
 	mat4_submat(model_inv_mat3, 3, 3, model_inv_mat4);
 	
 	// обновляем вершинные буферы
-	if(isolevel_animate)
-		render_update_mc();
+	if(lod_enable) {
+		// положение камеры в координатах сетки (модельная матрица применяется к столбцу)
+		matrix4f model_inv_t;
+		mat4_copy(model_inv_mat4, model_inv_t);
+		mat4_transponse(model_inv_t);
+
+		lod_mesh_update(&lod_mesh, &pyramid, isolevel, mat4_mult_vec3(model_inv_t, camera_pos),
+						lod_distance, attr_position);
+	}
+	else {
+		if(isolevel_animate)
+			render_update_mc();
+
+		// сетку, построенную в фоне, только загружаем, не дожидаясь следующей
+		if(background_meshing)
+			render_upload_mesh();
+	}
 	
 	shader_program_bind(&program);
 	
@@ -663,13 +911,17 @@ void render_draw(void)
 
 	shader_program_bind(&program);
 	
-	glBindVertexArray(vao);
-	glEnableVertexAttribArray(attr_position);
-	
-	glDrawElements(GL_TRIANGLES, num_elements, GL_UNSIGNED_INT, NULL);
+	if(lod_enable) {
+		lod_mesh_draw(&lod_mesh);
+	} else {
+		glBindVertexArray(vao);
+		glEnableVertexAttribArray(attr_position);
 
-	glDisableVertexAttribArray(attr_position);
-	glBindVertexArray(0);
+		glDrawElements(GL_TRIANGLES, num_elements, GL_UNSIGNED_INT, NULL);
+
+		glDisableVertexAttribArray(attr_position);
+		glBindVertexArray(0);
+	}
 
 	shader_program_unbind(&program);
 }
@@ -695,20 +947,30 @@ void render_destroy(void)
 	
 	shader_program_file_destroy(&pfile);
 	
+	// поток сетки использует пул потоков и поле
+	mesh_worker_stop(&mesh_worker);
+
 	glDeleteBuffers(2, vbo);
 	glDeleteVertexArrays(1, &vao);
+	marching_cubes_invalidate();
+	lod_mesh_destroy(&lod_mesh);
+
+	free(uploaded_layers.versions);
+	memset(&uploaded_layers, 0, sizeof(mc_layers_upload_t));
 	
+	parser_program_destroy(&function_program);
 	parser_clean(&parser);
-	
-	if(str_function) {
-		free(str_function);
-		str_function = NULL;
-	}
+	render_set_native_cache(NULL);
+	thread_pool_destroy();
 	
 	if(volume) {
 		free(volume);
 		volume = NULL;
 	}
+
+	mesh_decimate_release();
+	volume_pyramid_destroy(&pyramid);
+	volume_pyramid_destroy(&new_pyramid);
 	
 	init = 0;
 
@@ -719,36 +981,37 @@ int render_set_function_text(const char *function_text)
 {
 	IF_FAILED_RET(init && function_text, -100);
 	
-	float_var_value_t float_vars[] = 
-		{
-			{1, 0.0f}, // d
-			{2, 0.0f}, // x
-			{3, 0.0f}, // y
-			{4, 0.0f}, // z
-			{0, 0.0f}
-		};
+	float registers[MAX_NUM_REGISTERS];
+
+	registers[PARSER_REG_X] = 0.0f;
+	registers[PARSER_REG_Y] = 0.0f;
+	registers[PARSER_REG_Z] = 0.0f;
 
 	if(parser_is_stopped())
 		parser_resume();
 	
 	int error = 0;
+	parser_program_t program;
 	
-	parser_clean(&parser);
-	
-	// выполняем пре-парсинг функции, чтобы сразу определить синтаксические ошибки
-	if((error = parser_parse_text(&parser, function_text, float_vars)) != 0) {
+	// компилируем функцию, чтобы сразу определить синтаксические ошибки
+	if((error = parser_compile(&parser, function_text, &program)) != 0) {
 		ERROR_MSG("error %i in function statement\n", error);
 		return error;
 	}
+
+	// при ошибке компиляции функция вычисляется как обычно
+	if(native_cache_dir)
+		parser_program_compile_native(&program, native_cache_dir);
 	
-	
-	if(str_function) {
-		free(str_function);
-		str_function = NULL;
+	// выполняем пробное вычисление, чтобы определить ошибки времени выполнения
+	if((error = parser_program_eval(&program, registers)) != 0) {
+		ERROR_MSG("error %i in function statement\n", error);
+		parser_program_destroy(&program);
+		return error;
 	}
 	
-	str_function = (char*) malloc(sizeof(char) * (strlen(function_text) + 1));
-	strcpy(str_function, function_text);
+	parser_program_destroy(&function_program);
+	function_program = program;
 	
 	return 0;
 }
@@ -770,13 +1033,24 @@ int render_export_obj(char **buffer)
 	glGenBuffers(1, &index_vbo);
 	glGenBuffers(1, &normal_vbo);
 	
-	if(!marching_cubes_create_vbos(volume, 
-								   volume_size, 
-								   grid_size, 
-								   isolevel, vertex_vbo, index_vbo, normal_vbo,
-								   volume_func, NULL)) {
+	int (*create_vbos)(const float*, vector3ui, vector3ui, float, GLuint, GLuint, GLuint,
+					   float (*)(vector3f), unsigned*) =
+		(mesh_method == RENDER_MESH_SURFACE_NETS) ? surface_nets_create_vbos : marching_cubes_create_vbos;
+	
+	// функции полигонизации заняты, пока поток сетки строит её
+	mesh_worker_lock(&mesh_worker);
+
+	int is_created = create_vbos(volume, 
+								 volume_size, 
+								 grid_size, 
+								 isolevel, vertex_vbo, index_vbo, normal_vbo,
+								 volume_func, NULL);
+
+	mesh_worker_unlock(&mesh_worker);
+
+	if(!is_created) {
 		
-		ERROR_MSG("Marching Cubes: nothing to generate");
+		ERROR_MSG("Polygonization: nothing to generate");
 		
 		glBindBuffer(GL_ARRAY_BUFFER, last_array_buffer);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, last_element_array_buffer);
@@ -855,7 +1129,7 @@ int render_export_obj(char **buffer)
 	strcat(ptr, temp);
 	ptr += num_chars;
 	
-	for(unsigned i = 0; i < (element_buffer_size / sizeof(unsigned int)) - 3; i += 3) {		
+	for(unsigned i = 0; i + 2 < (element_buffer_size / sizeof(unsigned int)); i += 3) {		
 		num_chars = sprintf(temp, "f %i//%i %i//%i %i//%i\n", 
 				element_data[i]+1, element_data[i]+1, 
 				element_data[i+1]+1, element_data[i+1]+1, 
@@ -1049,12 +1323,60 @@ void render_get_current_volume(float **volume_ptr, vector3ui *size)
 	*size = volume_size;
 }
 
+void render_update_volume_region(vector3ui begin, vector3ui end)
+{
+	IF_FAILED(init && volume);
+	IF_FAILED(begin.x <= end.x && begin.y <= end.y && begin.z <= end.z);
+	IF_FAILED(end.x < volume_size.x && end.y < volume_size.y && end.z < volume_size.z);
+
+	// сетка и чанки в фоне читают пирамиду
+	mesh_worker_cancel(&mesh_worker);
+	lod_mesh_invalidate_region(&lod_mesh, begin, end);
+
+	// узел уровня l пирамиды зависит от исходных узлов на расстоянии до 2^l - 1
+	if(volume_pyramid_update_region(&pyramid, begin, end)) {
+		unsigned level = volume_pyramid_level(&pyramid, grid_size), scale = 1u << level;
+		vector3ui size = pyramid.sizes[level];
+
+		marching_cubes_invalidate_region(pyramid.average[level], size,
+										 vec3ui(begin.x >> level, begin.y >> level, begin.z >> level),
+										 vec3ui(math_min((end.x + scale - 1) >> level, size.x - 1),
+												math_min((end.y + scale - 1) >> level, size.y - 1),
+												math_min((end.z + scale - 1) >> level, size.z - 1)));
+	} else {
+		ERROR_MSG("cannot update volume pyramid region, rebuilding it\n");
+		marching_cubes_invalidate();
+
+		if(!volume_pyramid_build(&pyramid, volume, volume_size))
+			ERROR_MSG("cannot build volume pyramid\n");
+	}
+
+	// область поля - подмассив с шагом строк и слоёв всего поля
+	texture_bind(&volume_texture);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, volume_size.x);
+	glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, volume_size.y);
+	glTexSubImage3D(GL_TEXTURE_3D, 0, begin.x, begin.y, begin.z,
+					end.x - begin.x + 1, end.y - begin.y + 1, end.z - begin.z + 1, GL_RED, GL_FLOAT,
+					(const GLvoid*) &volume[begin.x + (begin.y + begin.z*volume_size.y)*volume_size.x]);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, 0);
+
+	render_update_mc();
+}
+
 void render_set_external_volume(float *volume_ptr, vector3ui size)
 {
 	IF_FAILED(init && volume_ptr);
 
+	mesh_worker_cancel(&mesh_worker);
+	lod_mesh_invalidate(&lod_mesh);
+
 	render_set_volume_size(size, 0);
 	memcpy(volume, volume_ptr, sizeof(float) * volume_size.x*volume_size.y*volume_size.z);
+	marching_cubes_invalidate();
+
+	if(!volume_pyramid_build(&pyramid, volume, volume_size))
+		ERROR_MSG("cannot build volume pyramid\n");
 
 	render_update_volume_tex();
 	render_update_mc();
@@ -0,0 +1,496 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "surface_nets.h"
+#include "render.h"
+#include "thread_pool.h"
+#include <stdint.h>
+#include <string.h>
+
+// 8 узлов строки принадлежат объёму (байты inside по 1)
+#define SN_ALL_INSIDE 0x0101010101010101ull
+
+// смещения узлов ячейки и узлы рёбер (нумерация как в marching_cubes_polygonise)
+static const unsigned char sn_corners[8][3] = {
+	{0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0}, {0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1}
+};
+static const unsigned char sn_edge_corners[12][2] = {
+	{0, 1}, {1, 2}, {2, 3}, {3, 0}, {4, 5}, {5, 6}, {6, 7}, {7, 4}, {0, 4}, {1, 5}, {2, 6}, {3, 7}
+};
+
+// полигонизация в пуле потоков: задачи - плоскости узлов сетки и слои ячеек
+typedef struct {
+	const float *volume;
+	vector3ui volume_size, grid_size;
+	float isolevel;
+
+	// шаг узлов сетки в скалярном поле и в координатах вершин
+	vector3ui value_step;
+	vector3f pos_step;
+
+	unsigned num_layers;
+
+	// принадлежность узлов сетки объёму (значение < isolevel)
+	unsigned char *inside;
+
+	// кол-во вершин и треугольников слоёв после прохода подсчёта,
+	// смещения слоёв в выходных массивах после префиксной суммы
+	unsigned *vertex_offsets, *triangle_offsets;
+
+	vector3f *out_vertices;
+	triangle_t *out_triangles;
+
+	int error;
+} sn_job_t;
+
+// буферы, сохраняемые между вызовами и увеличиваемые только при необходимости
+static struct {
+	unsigned char *inside;
+	unsigned max_inside;
+
+	unsigned *offsets;
+	unsigned max_offsets;
+
+	// номера вершин ячеек двух слоёв для каждого потока пула
+	unsigned *cell_ids[SCHEDULER_MAX_THREADS];
+	unsigned max_cell_ids[SCHEDULER_MAX_THREADS];
+
+	vector3f *vertices;
+	unsigned max_vertices;
+
+	triangle_t *triangles;
+	unsigned max_triangles;
+} sn_buffers;
+
+/* Увеличить буфер *ptr из *size элементов до count элементов (с запасом) */
+static int surface_nets_reserve(void **ptr, unsigned *size, unsigned count, size_t element_size)
+{
+	if(count <= *size && *ptr)
+		return 1;
+
+	unsigned new_size = count + count / 4 + 1;
+	void *new_ptr = realloc(*ptr, element_size * new_size);
+
+	IF_FAILED0(new_ptr);
+
+	*ptr = new_ptr;
+	*size = new_size;
+
+	return 1;
+}
+
+/* Значение скалярного поля в узле (i, j, k) сетки */
+INLINE static float surface_nets_value(const sn_job_t *job, unsigned i, unsigned j, unsigned k)
+{
+	vector3ui value = vec3ui_mult(vec3ui(i, j, k), job->value_step);
+
+	return job->volume[value.x + value.y*job->volume_size.x + value.z*job->volume_size.x*job->volume_size.y];
+}
+
+/* Строки j и j+1 плоскостей k и k+1 (узлы ячеек строки j слоя k) */
+INLINE static void surface_nets_rows(const sn_job_t *job, unsigned j, unsigned k, const unsigned char *rows[4])
+{
+	rows[0] = job->inside + (j + k * job->grid_size.y) * job->grid_size.x;
+	rows[1] = rows[0] + job->grid_size.x;
+	rows[2] = rows[0] + job->grid_size.x * job->grid_size.y;
+	rows[3] = rows[2] + job->grid_size.x;
+}
+
+/* Конфигурация ячейки i по строкам узлов (порядок узлов как в marching_cubes_polygonise) */
+INLINE static unsigned surface_nets_cube(const unsigned char *rows[4], unsigned i)
+{
+	return rows[0][i] | (rows[0][i + 1] << 1) | (rows[1][i + 1] << 2) | (rows[1][i] << 3) |
+		   (rows[2][i] << 4) | (rows[2][i + 1] << 5) | (rows[3][i + 1] << 6) | (rows[3][i] << 7);
+}
+
+/* 8 байтов a и b совпадают */
+INLINE static int surface_nets_same8(const unsigned char *a, const unsigned char *b)
+{
+	uint64_t x, y;
+
+	memcpy(&x, a, sizeof(uint64_t));
+	memcpy(&y, b, sizeof(uint64_t));
+
+	return x == y;
+}
+
+/* Ячейки i..i+6 строки без изоповерхности: все 8 узлов четырёх строк по одну сторону */
+INLINE static int surface_nets_uniform8(const unsigned char *rows[4], unsigned i, unsigned size)
+{
+	uint64_t x;
+
+	if(i + 8 > size)
+		return 0;
+
+	memcpy(&x, rows[0] + i, sizeof(uint64_t));
+
+	return (x == 0 || x == SN_ALL_INSIDE) && surface_nets_same8(rows[0] + i, rows[1] + i) &&
+		   surface_nets_same8(rows[0] + i, rows[2] + i) && surface_nets_same8(rows[0] + i, rows[3] + i);
+}
+
+/* Вершина ячейки (i, j, k): среднее точек пересечения изоповерхностью рёбер ячейки */
+static vector3f surface_nets_vertex(const sn_job_t *job, unsigned i, unsigned j, unsigned k, unsigned cube)
+{
+	vector3f positions[8], sum = vec3f(0.0f, 0.0f, 0.0f);
+	float values[8];
+	unsigned count = 0;
+
+	for(unsigned c = 0; c < 8; c++) {
+		unsigned x = i + sn_corners[c][0], y = j + sn_corners[c][1], z = k + sn_corners[c][2];
+
+		positions[c] = vec3f_mult(vec3f(x, y, z), job->pos_step);
+		values[c] = surface_nets_value(job, x, y, z);
+	}
+
+	for(unsigned e = 0; e < 12; e++) {
+		unsigned c1 = sn_edge_corners[e][0], c2 = sn_edge_corners[e][1];
+
+		if(((cube >> c1) ^ (cube >> c2)) & 1) {
+			sum = vec3f_add(sum, vec3f_lerp(positions[c1], positions[c2],
+											(job->isolevel - values[c1]) / (values[c2] - values[c1])));
+			count++;
+		}
+	}
+
+	return vec3f_div_c(sum, (float) count);
+}
+
+/*
+ * Два треугольника четырёхугольника a, b, c, d (обход против часовой стрелки вокруг оси ребра).
+ * outward - значения растут вдоль оси ребра, т.е. объём с отрицательной стороны
+ */
+INLINE static triangle_t *surface_nets_quad(triangle_t *triangle, unsigned a, unsigned b, unsigned c, unsigned d,
+											int outward)
+{
+	// обход как у треугольников marching cubes: нормаль (по правилу правой руки) направлена наружу
+	if(outward) {
+		triangle[0].indices[0] = a; triangle[0].indices[1] = b; triangle[0].indices[2] = c;
+		triangle[1].indices[0] = a; triangle[1].indices[1] = c; triangle[1].indices[2] = d;
+	} else {
+		triangle[0].indices[0] = a; triangle[0].indices[1] = c; triangle[0].indices[2] = b;
+		triangle[1].indices[0] = a; triangle[1].indices[1] = d; triangle[1].indices[2] = c;
+	}
+
+	return triangle + 2;
+}
+
+/* Задача пула: принадлежность объёму узлов плоскости k */
+static void surface_nets_classify_task(void *data, unsigned thread, unsigned k)
+{
+	const sn_job_t *job = (const sn_job_t*) data;
+	vector3ui grid_size = job->grid_size;
+	unsigned char *inside = job->inside + k * grid_size.x * grid_size.y;
+
+	for(unsigned j = 0; j < grid_size.y; j++) {
+		const float *values = job->volume + (j * job->value_step.y + k * job->value_step.z * job->volume_size.y) *
+							  job->volume_size.x;
+
+		for(unsigned i = 0; i < grid_size.x; i++)
+			inside[i + j * grid_size.x] = (values[i * job->value_step.x] < job->isolevel);
+	}
+}
+
+/*
+ * Пересечённые рёбра, четырёхугольники которых строит слой k: рёбра между плоскостями k и k+1
+ * и (кроме последнего слоя) рёбра по x и y плоскости k+1. У рёбер на границе сетки
+ * нет четырёх ячеек, они пропускаются. Если triangle задан, то четырёхугольники
+ * записываются в него по номерам вершин ячеек слоёв k (ids) и k+1 (top_ids).
+ * Возвращает кол-во четырёхугольников
+ */
+static unsigned surface_nets_quads(const sn_job_t *job, unsigned k, const unsigned *ids, const unsigned *top_ids,
+								   triangle_t *triangle)
+{
+	vector3ui grid_size = job->grid_size;
+	unsigned plane_size = grid_size.x * grid_size.y, cells_x = grid_size.x - 1;
+	const unsigned char *inside = job->inside + k * plane_size, *top = inside + plane_size;
+	unsigned count = 0;
+
+	for(unsigned j = 1; j + 1 < grid_size.y; j++) {
+		for(unsigned i = 1; i + 1 < grid_size.x; i++) {
+			unsigned n = i + j * grid_size.x, c = i + j * cells_x;
+
+			if(i + 8 < grid_size.x && surface_nets_same8(inside + n, top + n)) {
+				i += 7;
+				continue;
+			}
+
+			if(inside[n] == top[n])
+				continue;
+
+			if(triangle)
+				triangle = surface_nets_quad(triangle, ids[c - 1 - cells_x], ids[c - cells_x], ids[c], ids[c - 1], inside[n]);
+
+			count++;
+		}
+	}
+
+	if(k + 2 >= grid_size.z)
+		return count;
+
+	for(unsigned j = 0; j + 1 < grid_size.y; j++) {
+		for(unsigned i = 0; i + 1 < grid_size.x; i++) {
+			unsigned n = i + j * grid_size.x, c = i + j * cells_x;
+
+			// участок без пересечённых рёбер: узлы i..i+8 строки и i..i+7 следующей строки совпадают
+			if(i + 9 < grid_size.x && surface_nets_same8(top + n, top + n + 1) &&
+			   surface_nets_same8(top + n, top + n + grid_size.x)) {
+				i += 7;
+				continue;
+			}
+
+			// ребро по x между узлами (i, j) и (i+1, j) плоскости k+1
+			if(j > 0 && top[n] != top[n + 1]) {
+				if(triangle)
+					triangle = surface_nets_quad(triangle, ids[c - cells_x], ids[c], top_ids[c], top_ids[c - cells_x], top[n]);
+
+				count++;
+			}
+
+			// ребро по y между узлами (i, j) и (i, j+1) плоскости k+1
+			if(i > 0 && top[n] != top[n + grid_size.x]) {
+				if(triangle)
+					triangle = surface_nets_quad(triangle, ids[c - 1], top_ids[c - 1], top_ids[c], ids[c], top[n]);
+
+				count++;
+			}
+		}
+	}
+
+	return count;
+}
+
+/* Задача пула: посчитать вершины и треугольники слоя ячеек k */
+static void surface_nets_count_task(void *data, unsigned thread, unsigned k)
+{
+	const sn_job_t *job = (const sn_job_t*) data;
+	vector3ui grid_size = job->grid_size;
+	unsigned num_vertices = 0;
+
+	for(unsigned j = 0; j + 1 < grid_size.y; j++) {
+		const unsigned char *rows[4];
+
+		surface_nets_rows(job, j, k, rows);
+
+		for(unsigned i = 0; i + 1 < grid_size.x; i++) {
+			if(surface_nets_uniform8(rows, i, grid_size.x)) {
+				i += 6;
+				continue;
+			}
+
+			unsigned cube = surface_nets_cube(rows, i);
+
+			num_vertices += (cube != 0 && cube != 255);
+		}
+	}
+
+	job->vertex_offsets[k] = num_vertices;
+	job->triangle_offsets[k] = surface_nets_quads(job, k, NULL, NULL, NULL) * 2;
+}
+
+/*
+ * Пронумеровать вершины ячеек слоя k, начиная с first (ids[i + j * (grid.x-1)]).
+ * Если vertices задан, то вершины записываются в него
+ */
+static void surface_nets_layer_ids(const sn_job_t *job, unsigned k, unsigned first, unsigned *ids, vector3f *vertices)
+{
+	vector3ui grid_size = job->grid_size;
+
+	for(unsigned j = 0; j + 1 < grid_size.y; j++) {
+		const unsigned char *rows[4];
+
+		surface_nets_rows(job, j, k, rows);
+
+		for(unsigned i = 0; i + 1 < grid_size.x; i++) {
+			if(surface_nets_uniform8(rows, i, grid_size.x)) {
+				i += 6;
+				continue;
+			}
+
+			unsigned cube = surface_nets_cube(rows, i);
+
+			if(cube == 0 || cube == 255)
+				continue;
+
+			if(vertices)
+				*vertices++ = surface_nets_vertex(job, i, j, k, cube);
+
+			ids[i + j * (grid_size.x - 1)] = first++;
+		}
+	}
+}
+
+/*
+ * Задача пула: вершины и четырёхугольники слоя ячеек k. Номера вершин слоя k+1
+ * известны по смещениям слоёв, поэтому слои строятся независимо
+ */
+static void surface_nets_fill_task(void *data, unsigned thread, unsigned k)
+{
+	sn_job_t *job = (sn_job_t*) data;
+	unsigned cells_size = (job->grid_size.x - 1) * (job->grid_size.y - 1);
+
+	if(!surface_nets_reserve((void**) &sn_buffers.cell_ids[thread], &sn_buffers.max_cell_ids[thread],
+							 cells_size * 2, sizeof(unsigned))) {
+		job->error = 1;
+		return;
+	}
+
+	unsigned *ids = sn_buffers.cell_ids[thread], *top_ids = ids + cells_size;
+
+	surface_nets_layer_ids(job, k, job->vertex_offsets[k], ids, job->out_vertices + job->vertex_offsets[k]);
+
+	if(k + 1 < job->num_layers)
+		surface_nets_layer_ids(job, k + 1, job->vertex_offsets[k + 1], top_ids, NULL);
+
+	surface_nets_quads(job, k, ids, top_ids, job->out_triangles + job->triangle_offsets[k]);
+}
+
+/*
+ * Первый проход: классификация узлов и подсчёт вершин и треугольников слоёв,
+ * префиксная сумма даёт смещения слоёв. Возвращает 0 при ошибке
+ */
+static int surface_nets_count(sn_job_t *job, unsigned *num_vertices, unsigned *num_triangles)
+{
+	vector3ui grid_size = job->grid_size;
+	unsigned vertices_count = 0, triangles_count = 0;
+
+	job->value_step = vec3ui_div(job->volume_size, grid_size);
+	job->pos_step = vec3f_div(vec3f(1.0f, 1.0f, 1.0f), vec3f(grid_size.x, grid_size.y, grid_size.z));
+	job->num_layers = (grid_size.x > 1 && grid_size.y > 1 && grid_size.z > 1) ? grid_size.z - 1 : 0;
+	job->error = 0;
+
+	if(!surface_nets_reserve((void**) &sn_buffers.inside, &sn_buffers.max_inside,
+							 grid_size.x * grid_size.y * grid_size.z, sizeof(unsigned char)) ||
+	   !surface_nets_reserve((void**) &sn_buffers.offsets, &sn_buffers.max_offsets,
+							 (job->num_layers + 1) * 2, sizeof(unsigned)))
+		return 0;
+
+	job->inside = sn_buffers.inside;
+	job->vertex_offsets = sn_buffers.offsets;
+	job->triangle_offsets = sn_buffers.offsets + job->num_layers + 1;
+
+	if(job->num_layers > 0 &&
+	   (!thread_pool_run(surface_nets_classify_task, job, grid_size.z) ||
+		!thread_pool_run(surface_nets_count_task, job, job->num_layers)))
+		return 0;
+
+	for(unsigned k = 0; k < job->num_layers; k++) {
+		unsigned layer_vertices = job->vertex_offsets[k], layer_triangles = job->triangle_offsets[k];
+
+		job->vertex_offsets[k] = vertices_count;
+		job->triangle_offsets[k] = triangles_count;
+
+		vertices_count += layer_vertices;
+		triangles_count += layer_triangles;
+	}
+
+	job->vertex_offsets[job->num_layers] = vertices_count;
+	job->triangle_offsets[job->num_layers] = triangles_count;
+
+	*num_vertices = vertices_count;
+	*num_triangles = triangles_count;
+
+	return 1;
+}
+
+/* Второй проход: создать вершины и треугольники слоёв в job->out_* по смещениям. Возвращает 0 при ошибке */
+static int surface_nets_fill(sn_job_t *job)
+{
+	if(job->num_layers == 0)
+		return 1;
+
+	if(!thread_pool_run(surface_nets_fill_task, job, job->num_layers))
+		return 0;
+
+	return !job->error;
+}
+
+int surface_nets_create(const float *volume, vector3ui volume_size, vector3ui grid_size,
+						float isolevel, vector3f *out_vertices, unsigned *number_of_vertices,
+						triangle_t *out_triangles, unsigned *number_of_triangles)
+{
+	IF_FAILED_RET(volume && out_vertices && out_triangles, -1);
+
+	sn_job_t job = {volume, volume_size, grid_size, isolevel};
+	unsigned vertices_count = 0, triangles_count = 0;
+
+	if(!surface_nets_count(&job, &vertices_count, &triangles_count))
+		return -1;
+
+	job.out_vertices = out_vertices;
+	job.out_triangles = out_triangles;
+
+	if(!surface_nets_fill(&job))
+		return -1;
+
+	if(number_of_vertices)
+		*number_of_vertices = vertices_count+1;
+	if(number_of_triangles)
+		*number_of_triangles = triangles_count+1;
+
+	return 1;
+}
+
+int surface_nets_create_mesh(const float *volume, vector3ui volume_size, vector3ui grid_size, float isolevel,
+							 const vector3f **vertices, unsigned *n_vertices,
+							 const triangle_t **triangles, unsigned *n_triangles)
+{
+	unsigned num_vertices = 0, num_triangles = 0;
+	sn_job_t job = {volume, volume_size, grid_size, isolevel};
+
+	IF_FAILED0(volume && vertices && n_vertices && triangles && n_triangles);
+
+	// считаем вершины и треугольники, затем строим сетку в буферах точного размера
+	if(!surface_nets_count(&job, &num_vertices, &num_triangles) ||
+	   !surface_nets_reserve((void**) &sn_buffers.vertices, &sn_buffers.max_vertices, num_vertices, sizeof(vector3f)) ||
+	   !surface_nets_reserve((void**) &sn_buffers.triangles, &sn_buffers.max_triangles, num_triangles, sizeof(triangle_t)))
+		return 0;
+
+	job.out_vertices = sn_buffers.vertices;
+	job.out_triangles = sn_buffers.triangles;
+
+	if(!surface_nets_fill(&job))
+		return 0;
+
+	*vertices = sn_buffers.vertices;
+	*n_vertices = num_vertices;
+	*triangles = sn_buffers.triangles;
+	*n_triangles = num_triangles;
+
+	return 1;
+}
+
+int surface_nets_create_vbos(const float *volume, vector3ui volume_size,
+							 vector3ui grid_size, float isolevel,
+							 GLuint vertex_vbo, GLuint index_vbo, GLuint normal_vbo,
+							 float (*function)(vector3f pos), unsigned *num_elements)
+{
+	const vector3f *vertices;
+	const triangle_t *triangles;
+	unsigned n_vertices, n_triangles;
+
+	IF_FAILED_RET(volume && (vertex_vbo > 0) && (index_vbo > 0), -1);
+
+	if(!surface_nets_create_mesh(volume, volume_size, grid_size, isolevel, &vertices, &n_vertices, &triangles, &n_triangles) ||
+	   !marching_cubes_upload_vbos(volume, volume_size, grid_size, vertices, n_vertices,
+								   triangles, n_triangles, vertex_vbo, index_vbo, normal_vbo,
+								   function, num_elements))
+		return -1;
+
+	return 1;
+}
@@ -0,0 +1,261 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "volume_pyramid.h"
+#include "thread_pool.h"
+
+// построение уровня в пуле потоков: задачи - плоскости узлов уровня
+typedef struct {
+	vector3ui src_size, size;
+
+	// строимые узлы уровня [begin, end]
+	vector3ui begin, end;
+
+	const float *src, *src_min, *src_max;
+	float *average, *min, *max;
+
+	int error;
+} pyramid_job_t;
+
+void volume_pyramid_init(volume_pyramid_t *pyramid)
+{
+	IF_FAILED(pyramid);
+
+	memset(pyramid, 0, sizeof(volume_pyramid_t));
+}
+
+/* Узлы [begin, end] предыдущего уровня вокруг узла i по оси из size узлов */
+INLINE static void volume_pyramid_footprint(unsigned i, unsigned size, unsigned *begin, unsigned *end)
+{
+	*begin = (i > 0) ? 2 * i - 1 : 0;
+	*end = (2 * i + 1 < size) ? 2 * i + 1 : size - 1;
+}
+
+/*
+ * Задача пула: плоскость begin.z + task строимого уровня. Строки узлов предыдущего уровня
+ * сначала сворачиваются по y и z (независимо для каждого x), затем по x
+ */
+static void volume_pyramid_task(void *data, unsigned thread, unsigned task)
+{
+	pyramid_job_t *job = (pyramid_job_t*) data;
+	vector3ui src_size = job->src_size, size = job->size;
+	unsigned begin_x, end_x, begin_y, end_y, begin_z, end_z, first_x, last_x;
+	unsigned k = job->begin.z + task;
+
+	// суммы, веса и границы столбцов строки, свёрнутой по y и z
+	float *sums = (float*) malloc(sizeof(float) * src_size.x * 4);
+
+	if(!sums) {
+		job->error = 1;
+		return;
+	}
+
+	float *weights = sums + src_size.x, *mins = weights + src_size.x, *maxs = mins + src_size.x;
+
+	// столбцы предыдущего уровня под строимыми узлами строки
+	volume_pyramid_footprint(job->begin.x, src_size.x, &first_x, &end_x);
+	volume_pyramid_footprint(job->end.x, src_size.x, &begin_x, &last_x);
+	volume_pyramid_footprint(k, src_size.z, &begin_z, &end_z);
+
+	for(unsigned j = job->begin.y; j <= job->end.y; j++) {
+		volume_pyramid_footprint(j, src_size.y, &begin_y, &end_y);
+
+		for(unsigned x = first_x; x <= last_x; x++) {
+			sums[x] = weights[x] = 0.0f;
+			mins[x] = HUGE_VALF;
+			maxs[x] = -HUGE_VALF;
+		}
+
+		for(unsigned z = begin_z; z <= end_z; z++) {
+			for(unsigned y = begin_y; y <= end_y; y++) {
+				unsigned row = y * src_size.x + z * src_size.x * src_size.y;
+				const float *values = job->src + row, *lows = job->src_min + row, *highs = job->src_max + row;
+
+				// вес 2 у центрального узла по оси, 1 у соседних
+				float w = (float) ((1 + (y == 2 * j)) * (1 + (z == 2 * k)));
+
+				for(unsigned x = first_x; x <= last_x; x++) {
+					float value = values[x], low = lows[x], high = highs[x];
+
+					sums[x] += (value == value) ? w * value : 0.0f;
+					weights[x] += (value == value) ? w : 0.0f;
+
+					// на первом уровне min/max берутся из исходного поля, где возможны NaN
+					low = (low == low) ? low : HUGE_VALF;
+					high = (high == high) ? high : HUGE_VALF;
+
+					mins[x] = (low < mins[x]) ? low : mins[x];
+					maxs[x] = (high > maxs[x]) ? high : maxs[x];
+				}
+			}
+		}
+
+		for(unsigned i = job->begin.x; i <= job->end.x; i++) {
+			float sum = 0.0f, weight = 0.0f, min = HUGE_VALF, max = -HUGE_VALF;
+			unsigned n = i + j * size.x + k * size.x * size.y;
+
+			volume_pyramid_footprint(i, src_size.x, &begin_x, &end_x);
+
+			for(unsigned x = begin_x; x <= end_x; x++) {
+				float w = (x == 2 * i) ? 2.0f : 1.0f;
+
+				sum += w * sums[x];
+				weight += w * weights[x];
+
+				if(mins[x] < min) min = mins[x];
+				if(maxs[x] > max) max = maxs[x];
+			}
+
+			job->average[n] = (weight > 0.0f) ? sum / weight : NAN;
+			job->min[n] = min;
+			job->max[n] = max;
+		}
+	}
+
+	free(sums);
+}
+
+/* Построить узлы [begin, end] уровня level по предыдущему уровню. Возвращает 0 при ошибке */
+static int volume_pyramid_build_level(volume_pyramid_t *pyramid, unsigned level, vector3ui begin, vector3ui end)
+{
+	pyramid_job_t job;
+
+	job.src_size = pyramid->sizes[level - 1];
+	job.size = pyramid->sizes[level];
+	job.begin = begin;
+	job.end = end;
+	job.src = pyramid->average[level - 1];
+	job.src_min = (level > 1) ? pyramid->min[level - 1] : pyramid->average[0];
+	job.src_max = (level > 1) ? pyramid->max[level - 1] : pyramid->average[0];
+	job.average = (float*) pyramid->average[level];
+	job.min = pyramid->min[level];
+	job.max = pyramid->max[level];
+	job.error = 0;
+
+	return thread_pool_run(volume_pyramid_task, &job, end.z - begin.z + 1) && !job.error;
+}
+
+int volume_pyramid_build(volume_pyramid_t *pyramid, const float *volume, vector3ui size)
+{
+	IF_FAILED0(pyramid && volume && size.x > 0 && size.y > 0 && size.z > 0);
+
+	vector3ui sizes[VOLUME_PYRAMID_MAX_LEVELS];
+	unsigned num_levels = 1;
+	size_t memory_size = 0;
+
+	sizes[0] = size;
+
+	while(num_levels < VOLUME_PYRAMID_MAX_LEVELS && sizes[num_levels - 1].x > 2 &&
+		  sizes[num_levels - 1].y > 2 && sizes[num_levels - 1].z > 2) {
+		vector3ui prev = sizes[num_levels - 1];
+
+		sizes[num_levels] = vec3ui((prev.x - 1) / 2 + 1, (prev.y - 1) / 2 + 1, (prev.z - 1) / 2 + 1);
+		memory_size += (size_t) sizes[num_levels].x * sizes[num_levels].y * sizes[num_levels].z * 3;
+		num_levels++;
+	}
+
+	// до окончания построения пирамида содержит только исходное поле
+	pyramid->num_levels = 1;
+	pyramid->sizes[0] = size;
+	pyramid->average[0] = volume;
+
+	if(memory_size > pyramid->memory_size) {
+		float *memory = (float*) realloc(pyramid->memory, sizeof(float) * memory_size);
+
+		IF_FAILED0(memory);
+
+		pyramid->memory = memory;
+		pyramid->memory_size = memory_size;
+	}
+
+	float *ptr = pyramid->memory;
+
+	for(unsigned level = 1; level < num_levels; level++) {
+		size_t count = (size_t) sizes[level].x * sizes[level].y * sizes[level].z;
+
+		pyramid->sizes[level] = sizes[level];
+		pyramid->average[level] = ptr;
+		pyramid->min[level] = ptr + count;
+		pyramid->max[level] = ptr + count * 2;
+
+		if(!volume_pyramid_build_level(pyramid, level, vec3ui(0, 0, 0), vec3ui_sub_c(sizes[level], 1)))
+			return 0;
+
+		ptr += count * 3;
+	}
+
+	pyramid->num_levels = num_levels;
+
+	return 1;
+}
+
+int volume_pyramid_update_region(volume_pyramid_t *pyramid, vector3ui begin, vector3ui end)
+{
+	IF_FAILED0(pyramid && pyramid->num_levels > 0 && pyramid->average[0]);
+	IF_FAILED0(begin.x <= end.x && begin.y <= end.y && begin.z <= end.z);
+	IF_FAILED0(end.x < pyramid->sizes[0].x && end.y < pyramid->sizes[0].y && end.z < pyramid->sizes[0].z);
+
+	// узел i уровня зависит от узлов 2i-1..2i+1 предыдущего
+	for(unsigned level = 1; level < pyramid->num_levels; level++) {
+		vector3ui size = pyramid->sizes[level];
+
+		begin = vec3ui(begin.x / 2, begin.y / 2, begin.z / 2);
+		end = vec3ui((end.x + 1) / 2, (end.y + 1) / 2, (end.z + 1) / 2);
+
+		if(end.x >= size.x) end.x = size.x - 1;
+		if(end.y >= size.y) end.y = size.y - 1;
+		if(end.z >= size.z) end.z = size.z - 1;
+
+		if(!volume_pyramid_build_level(pyramid, level, begin, end))
+			return 0;
+	}
+
+	return 1;
+}
+
+unsigned volume_pyramid_level(const volume_pyramid_t *pyramid, vector3ui grid_size)
+{
+	IF_FAILED0(pyramid && pyramid->num_levels > 0 && grid_size.x > 0 && grid_size.y > 0 && grid_size.z > 0);
+
+	vector3ui step = vec3ui_div(pyramid->sizes[0], grid_size);
+
+	for(unsigned level = pyramid->num_levels - 1; level > 0; level--) {
+		unsigned scale = 1u << level;
+		vector3ui size = pyramid->sizes[level];
+
+		// шаг по уровню - целое, и marching cubes получит его из размера уровня
+		if(step.x >= scale && step.y >= scale && step.z >= scale &&
+		   step.x % scale == 0 && step.y % scale == 0 && step.z % scale == 0 &&
+		   size.x / grid_size.x == step.x / scale && size.y / grid_size.y == step.y / scale &&
+		   size.z / grid_size.z == step.z / scale)
+			return level;
+	}
+
+	return 0;
+}
+
+void volume_pyramid_destroy(volume_pyramid_t *pyramid)
+{
+	IF_FAILED(pyramid);
+
+	free(pyramid->memory);
+	volume_pyramid_init(pyramid);
+}
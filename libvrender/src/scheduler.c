@@ -0,0 +1,170 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "scheduler.h"
+#include "utils.h"
+
+#define RANGE_PACK(next, end) (((uint64_t) (end) << 32) | (uint64_t) (next))
+#define RANGE_NEXT(range) ((unsigned) ((range) & 0xFFFFFFFFu))
+#define RANGE_END(range) ((unsigned) ((range) >> 32))
+
+int scheduler_create(scheduler_t *scheduler, unsigned num_threads, unsigned num_tasks)
+{
+	IF_FAILED0(scheduler && num_threads > 0 && num_threads <= SCHEDULER_MAX_THREADS);
+
+	// лишняя очередь - запас на выравнивание по строке кэша
+	scheduler->memory = malloc(sizeof(scheduler_queue_t) * (num_threads + 1));
+	IF_FAILED0(scheduler->memory != NULL);
+
+	scheduler->queues = (scheduler_queue_t*) (((uintptr_t) scheduler->memory + 63) & ~(uintptr_t) 63);
+	scheduler->num_threads = num_threads;
+	scheduler->num_tasks = num_tasks;
+
+	memset(scheduler->queues, 0, sizeof(scheduler_queue_t) * num_threads);
+
+	// непрерывные блоки: соседние задачи (тайлы) остаются у одного потока
+	for(unsigned i = 0; i < num_threads; i++) {
+		unsigned begin = (unsigned) ((uint64_t) num_tasks * i / num_threads);
+		unsigned end = (unsigned) ((uint64_t) num_tasks * (i + 1) / num_threads);
+
+		scheduler->queues[i].range = RANGE_PACK(begin, end);
+	}
+
+	scheduler->start_time = utils_get_time();
+
+	return 1;
+}
+
+/* Взять первую задачу своей очереди */
+static int scheduler_pop(scheduler_queue_t *queue, unsigned *task)
+{
+	uint64_t range = __atomic_load_n(&queue->range, __ATOMIC_ACQUIRE);
+
+	while(RANGE_NEXT(range) < RANGE_END(range)) {
+		uint64_t new_range = RANGE_PACK(RANGE_NEXT(range) + 1, RANGE_END(range));
+
+		if(__atomic_compare_exchange_n(&queue->range, &range, new_range, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			*task = RANGE_NEXT(range);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Украсть вторую половину самой длинной чужой очереди */
+static int scheduler_steal(scheduler_t *scheduler, unsigned thread, unsigned *task)
+{
+	for(;;) {
+		unsigned victim = thread, max_count = 0;
+		uint64_t victim_range = 0;
+
+		for(unsigned i = 1; i < scheduler->num_threads; i++) {
+			unsigned k = (thread + i) % scheduler->num_threads;
+			uint64_t range = __atomic_load_n(&scheduler->queues[k].range, __ATOMIC_ACQUIRE);
+			unsigned count = RANGE_END(range) - RANGE_NEXT(range);
+
+			if(RANGE_NEXT(range) < RANGE_END(range) && count > max_count) {
+				victim = k;
+				max_count = count;
+				victim_range = range;
+			}
+		}
+
+		if(max_count == 0)
+			return 0;
+
+		// задачи берутся с конца интервала, владелец продолжает с начала
+		unsigned split = RANGE_END(victim_range) - (max_count + 1) / 2;
+		uint64_t new_range = RANGE_PACK(RANGE_NEXT(victim_range), split);
+
+		if(!__atomic_compare_exchange_n(&scheduler->queues[victim].range, &victim_range, new_range, 0,
+										__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			continue;
+
+		// своя очередь пуста, остаток украденного кладём в неё (его можно украсть дальше)
+		__atomic_store_n(&scheduler->queues[thread].range, RANGE_PACK(split + 1, RANGE_END(victim_range)),
+						 __ATOMIC_RELEASE);
+
+		scheduler->queues[thread].num_steals++;
+		*task = split;
+
+		return 1;
+	}
+}
+
+int scheduler_next(scheduler_t *scheduler, unsigned thread, unsigned *task)
+{
+	IF_FAILED0(scheduler && task && thread < scheduler->num_threads);
+
+	scheduler_queue_t *queue = &scheduler->queues[thread];
+	double time = utils_get_time();
+
+	if(queue->has_task) {
+		queue->busy_time += time - queue->task_start;
+		queue->has_task = 0;
+	}
+
+	if(!scheduler_pop(queue, task) && !scheduler_steal(scheduler, thread, task))
+		return 0;
+
+	queue->num_tasks++;
+	queue->task_start = time;
+	queue->has_task = 1;
+
+	return 1;
+}
+
+void scheduler_report(const scheduler_t *scheduler)
+{
+	IF_FAILED(scheduler && scheduler->queues);
+
+	double total_time = utils_get_time() - scheduler->start_time;
+	double min_busy = total_time, max_busy = 0.0, sum_busy = 0.0;
+
+	for(unsigned i = 0; i < scheduler->num_threads; i++) {
+		const scheduler_queue_t *queue = &scheduler->queues[i];
+
+		TRACE_MSG("thread %u: %u tasks (%u steals), busy %.3f s, idle %.3f s\n", i, queue->num_tasks,
+				  queue->num_steals, queue->busy_time, total_time - queue->busy_time);
+
+		sum_busy += queue->busy_time;
+
+		if(queue->busy_time < min_busy)
+			min_busy = queue->busy_time;
+		if(queue->busy_time > max_busy)
+			max_busy = queue->busy_time;
+	}
+
+	// эффективность: доля времени, которую потоки в среднем были заняты
+	TRACE_MSG("%u tasks on %u threads in %.3f s: busy min %.3f avg %.3f max %.3f s, efficiency %.0f%%\n",
+			  scheduler->num_tasks, scheduler->num_threads, total_time, min_busy,
+			  sum_busy / scheduler->num_threads, max_busy,
+			  (total_time > 0.0) ? 100.0 * sum_busy / (total_time * scheduler->num_threads) : 100.0);
+}
+
+void scheduler_destroy(scheduler_t *scheduler)
+{
+	IF_FAILED(scheduler);
+
+	free(scheduler->memory);
+
+	scheduler->memory = NULL;
+	scheduler->queues = NULL;
+}
@@ -0,0 +1,243 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include "thread_pool.h"
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// появилась работа или потокам пора завершаться
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+// поток вышел из работы или перезапуск потоков закончен
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+static pthread_t *workers = NULL;
+static unsigned num_workers = 0;
+
+// кол-во потоков вместе с вызывающим, установленное thread_pool_set_num_threads
+static unsigned requested_threads = 1;
+
+static int is_quit = 0, is_restarting = 0;
+
+// очередь работ, в которых ещё есть невзятые задачи
+static thread_pool_job_t *jobs = NULL;
+// кол-во отправленных и ещё не дождавшихся работ
+static unsigned num_jobs = 0;
+
+/* Выполнять задачи работы, пока они есть в очередях планировщика */
+static void thread_pool_execute(thread_pool_job_t *job, unsigned thread)
+{
+	unsigned task;
+
+	while(scheduler_next(&job->scheduler, thread, &task))
+		job->func(job->data, thread, task);
+}
+
+/* Убрать работу из очереди (вызывается под pool_mutex) */
+static void thread_pool_dequeue(thread_pool_job_t *job)
+{
+	if(!job->is_queued)
+		return;
+
+	thread_pool_job_t **ptr = &jobs;
+
+	while(*ptr != job)
+		ptr = &(*ptr)->next;
+
+	*ptr = job->next;
+	job->is_queued = 0;
+}
+
+static void *thread_pool_worker(void *arg)
+{
+	unsigned thread = (unsigned) (uintptr_t) arg;
+
+	pthread_mutex_lock(&pool_mutex);
+
+	while(!is_quit) {
+		thread_pool_job_t *job = jobs;
+
+		if(!job) {
+			pthread_cond_wait(&work_cond, &pool_mutex);
+			continue;
+		}
+
+		job->num_active++;
+		pthread_mutex_unlock(&pool_mutex);
+
+		thread_pool_execute(job, thread);
+
+		pthread_mutex_lock(&pool_mutex);
+
+		// невзятых задач не осталось, остальные потоки работу не берут
+		thread_pool_dequeue(job);
+
+		if(--job->num_active == 0)
+			pthread_cond_broadcast(&done_cond);
+	}
+
+	pthread_mutex_unlock(&pool_mutex);
+
+	return NULL;
+}
+
+/*
+ * Перезапустить потоки с новым кол-вом (вызывается под pool_mutex, когда работ нет).
+ * На время остановки pool_mutex освобождается, остальные ждут is_restarting
+ */
+static void thread_pool_restart(void)
+{
+	is_restarting = 1;
+	is_quit = 1;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&pool_mutex);
+
+	for(unsigned i = 0; i < num_workers; i++)
+		pthread_join(workers[i], NULL);
+
+	pthread_mutex_lock(&pool_mutex);
+
+	free(workers);
+	workers = NULL;
+	num_workers = 0;
+	is_quit = 0;
+
+	if(requested_threads > 1) {
+		workers = (pthread_t*) malloc(sizeof(pthread_t) * (requested_threads - 1));
+
+		// если потоки создать не удалось, работы выполняются оставшимися
+		for(unsigned i = 0; workers && i < requested_threads - 1; i++) {
+			if(pthread_create(&workers[num_workers], NULL, thread_pool_worker, (void*) (uintptr_t) i) != 0) {
+				ERROR_MSG("cannot create worker thread %u\n", i);
+				break;
+			}
+			num_workers++;
+		}
+	}
+
+	TRACE_MSG("%u worker threads\n", num_workers);
+
+	is_restarting = 0;
+	pthread_cond_broadcast(&done_cond);
+}
+
+void thread_pool_set_num_threads(unsigned num)
+{
+	pthread_mutex_lock(&pool_mutex);
+
+	requested_threads = (num < 1) ? 1 : ((num > SCHEDULER_MAX_THREADS) ? SCHEDULER_MAX_THREADS : num);
+
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+int thread_pool_submit(thread_pool_job_t *job, thread_pool_func_t func, void *data, unsigned num_tasks)
+{
+	IF_FAILED0(job && func);
+
+	pthread_mutex_lock(&pool_mutex);
+
+	while(is_restarting)
+		pthread_cond_wait(&done_cond, &pool_mutex);
+
+	if(num_jobs == 0 && num_workers + 1 != requested_threads)
+		thread_pool_restart();
+
+	// у вызывающего потока последний номер
+	if(!scheduler_create(&job->scheduler, num_workers + 1, num_tasks)) {
+		pthread_mutex_unlock(&pool_mutex);
+		return 0;
+	}
+
+	job->func = func;
+	job->data = data;
+	job->caller = num_workers;
+	job->num_active = 0;
+	job->is_queued = 1;
+	job->next = NULL;
+
+	// в конец очереди, чтобы раньше отправленные работы завершались раньше
+	thread_pool_job_t **ptr = &jobs;
+
+	while(*ptr)
+		ptr = &(*ptr)->next;
+
+	*ptr = job;
+	num_jobs++;
+
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&pool_mutex);
+
+	return 1;
+}
+
+void thread_pool_wait(thread_pool_job_t *job)
+{
+	IF_FAILED(job);
+
+	thread_pool_execute(job, job->caller);
+
+	pthread_mutex_lock(&pool_mutex);
+
+	// новые потоки в работу не войдут, ждём вошедших
+	thread_pool_dequeue(job);
+
+	while(job->num_active > 0)
+		pthread_cond_wait(&done_cond, &pool_mutex);
+
+	// thread_pool_destroy ждёт завершения всех работ
+	if(--num_jobs == 0)
+		pthread_cond_broadcast(&done_cond);
+
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+void thread_pool_release(thread_pool_job_t *job)
+{
+	IF_FAILED(job);
+
+	scheduler_destroy(&job->scheduler);
+}
+
+int thread_pool_run(thread_pool_func_t func, void *data, unsigned num_tasks)
+{
+	thread_pool_job_t job;
+
+	if(!thread_pool_submit(&job, func, data, num_tasks))
+		return 0;
+
+	thread_pool_wait(&job);
+	thread_pool_release(&job);
+
+	return 1;
+}
+
+void thread_pool_destroy(void)
+{
+	pthread_mutex_lock(&pool_mutex);
+
+	while(is_restarting || num_jobs > 0)
+		pthread_cond_wait(&done_cond, &pool_mutex);
+
+	requested_threads = 1;
+
+	if(num_workers > 0)
+		thread_pool_restart();
+
+	pthread_mutex_unlock(&pool_mutex);
+}
@@ -16,6 +16,12 @@
  *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifdef __WIN32
+	#include <windows.h>
+#else
+	#include <time.h>
+#endif
+
 #include "utils.h"
 
 long utils_file_get_size(const char *filename)
@@ -63,3 +69,21 @@ int utils_read_file(const char *filename, char *buffer)
 	
 	return 1;
 }
+
+double utils_get_time(void)
+{
+#ifdef __WIN32
+	LARGE_INTEGER counter, frequency;
+
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+
+	return (double) counter.QuadPart / (double) frequency.QuadPart;
+#else
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return (double) time.tv_sec + (double) time.tv_nsec * 1e-9;
+#endif
+}
@@ -0,0 +1,201 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Замеры полигонизации поля size^3 на сетке (size-1)^3 (size - первый аргумент,
+ * по-умолчанию 129). Память: пиковый RSS процесса при полигонизации нескольких изо-уровней
+ * сверх поля (замер первым, пока буферы полигонизации не выделены) в сравнении с размером
+ * сетки и резервом прежней полигонизации (15 вершин и 5 треугольников на узел поля).
+ * Масштабирование: время marching_cubes_create_mesh с общими вершинами и без
+ * в 1..max_threads потоках пула (второй аргумент, по-умолчанию 8).
+ * Способы: время и кол-во треугольников marching cubes с общими вершинами
+ * и surface nets на одних и тех же полях (в одном потоке)
+ */
+
+#include <math.h>
+#include <sys/resource.h>
+#include "common_test.h"
+#include "marching_cubes.h"
+#include "surface_nets.h"
+#include "thread_pool.h"
+
+#define NUM_RUNS 5
+
+// marching_cubes_create_mesh или surface_nets_create_mesh
+typedef int (*create_mesh_func_t)(const float *volume, vector3ui volume_size, vector3ui grid_size, float isolevel,
+								  const vector3f **vertices, unsigned *n_vertices,
+								  const triangle_t **triangles, unsigned *n_triangles);
+
+/* Сфера с волнами (type = 0) или синусоидальное поле с множеством мелких деталей (type = 1) */
+static float *create_volume(vector3ui size, int type)
+{
+	float *volume = (float*) malloc(sizeof(float) * size.x * size.y * size.z);
+
+	CHECK(volume);
+
+	for(unsigned k = 0; k < size.z; k++)
+		for(unsigned j = 0; j < size.y; j++)
+			for(unsigned i = 0; i < size.x; i++) {
+				float x = i - size.x * 0.5f, y = j - size.y * 0.5f, z = k - size.z * 0.5f;
+
+				volume[i + j*size.x + k*size.x*size.y] = (type == 0) ?
+					sqrtf(x*x + y*y + z*z) - size.x * 0.3f + 1.5f * sinf(x * 0.2f) * cosf(y * 0.15f + z * 0.1f) :
+					sinf(x * 0.3f) + sinf(y * 0.3f) + sinf(z * 0.3f);
+			}
+
+	return volume;
+}
+
+/* Лучшее из NUM_RUNS время create_mesh (в секундах) */
+static double time_create(create_mesh_func_t create_mesh, const float *volume, vector3ui volume_size,
+						  vector3ui grid_size, unsigned *num_vertices, unsigned *num_triangles)
+{
+	double best = 0.0;
+
+	for(unsigned run = 0; run < NUM_RUNS; run++) {
+		const vector3f *vertices;
+		const triangle_t *triangles;
+
+		marching_cubes_invalidate();
+
+		double time = utils_get_time();
+		CHECK(create_mesh(volume, volume_size, grid_size, 0.0f, &vertices, num_vertices, &triangles, num_triangles));
+		time = utils_get_time() - time;
+
+		if(run == 0 || time < best)
+			best = time;
+	}
+
+	return best;
+}
+
+/* Пиковый RSS процесса в МБ */
+static double peak_rss(void)
+{
+	struct rusage usage;
+
+	CHECK(getrusage(RUSAGE_SELF, &usage) == 0);
+
+	// в Linux ru_maxrss - в килобайтах
+	return usage.ru_maxrss / 1024.0;
+}
+
+static void bench_memory(const float *volume, vector3ui volume_size, vector3ui grid_size)
+{
+	static const float isolevels[] = {-4.0f, -2.0f, 0.0f, 2.0f, 4.0f};
+	double base = peak_rss(), mesh_size = 0.0;
+	unsigned num_nodes = volume_size.x * volume_size.y * volume_size.z;
+
+	for(unsigned l = 0; l < sizeof(isolevels) / sizeof(isolevels[0]); l++) {
+		const vector3f *vertices;
+		const triangle_t *triangles;
+		unsigned num_vertices, num_triangles;
+
+		CHECK(marching_cubes_create_mesh(volume, volume_size, grid_size, isolevels[l], &vertices, &num_vertices,
+										 &triangles, &num_triangles));
+
+		double size = (sizeof(vector3f) * (double) num_vertices + sizeof(triangle_t) * (double) num_triangles) / 1048576.0;
+
+		if(size > mesh_size)
+			mesh_size = size;
+	}
+
+	double reserve = (sizeof(vector3f) * 15.0 + sizeof(triangle_t) * 5.0) * num_nodes / 1048576.0;
+
+	printf("memory: %u^3 grid, %u isolevels\n", grid_size.x, (unsigned) (sizeof(isolevels) / sizeof(isolevels[0])));
+	printf("  peak RSS: %.1f MB (volume and program), %.1f MB during extraction (+%.1f MB)\n",
+		   base, peak_rss(), peak_rss() - base);
+	printf("  largest mesh: %.1f MB, previous per-call reserve: %.1f MB\n", mesh_size, reserve);
+}
+
+static void bench_scaling(const float *volume, vector3ui volume_size, vector3ui grid_size, unsigned max_threads)
+{
+	printf("scaling: %u^3 grid, best of %u, ms (speedup)\n", grid_size.x, NUM_RUNS);
+	printf("  threads      welded           soup\n");
+
+	double single[2] = {0.0, 0.0};
+
+	for(unsigned n = 1; n <= max_threads; n++) {
+		double times[2];
+		unsigned num_vertices, num_triangles;
+
+		thread_pool_set_num_threads(n);
+
+		for(int welded = 1; welded >= 0; welded--) {
+			marching_cubes_set_welded(welded);
+			times[welded] = time_create(marching_cubes_create_mesh, volume, volume_size, grid_size,
+										&num_vertices, &num_triangles);
+
+			if(n == 1)
+				single[welded] = times[welded];
+		}
+
+		printf("  %7u  %7.2f (%4.2fx)  %7.2f (%4.2fx)\n", n, times[1] * 1e3, single[1] / times[1],
+			   times[0] * 1e3, single[0] / times[0]);
+	}
+
+	marching_cubes_set_welded(1);
+}
+
+static void bench_methods(vector3ui volume_size, vector3ui grid_size)
+{
+	static const char *field_names[] = {"sphere", "sine"};
+	unsigned num_cells = (grid_size.x - 1) * (grid_size.y - 1) * (grid_size.z - 1);
+
+	thread_pool_set_num_threads(1);
+
+	printf("methods: %u^3 grid, 1 thread, best of %u\n", grid_size.x, NUM_RUNS);
+	printf("  field   method            triangles   vertices        ms   Mcells/s\n");
+
+	for(int type = 0; type < 2; type++) {
+		float *volume = create_volume(volume_size, type);
+		unsigned num_vertices, num_triangles;
+
+		double time = time_create(marching_cubes_create_mesh, volume, volume_size, grid_size,
+								  &num_vertices, &num_triangles);
+		printf("  %-7s marching cubes  %11u %10u %9.2f %10.1f\n", field_names[type], num_triangles, num_vertices,
+			   time * 1e3, num_cells / time * 1e-6);
+
+		time = time_create(surface_nets_create_mesh, volume, volume_size, grid_size, &num_vertices, &num_triangles);
+		printf("  %-7s surface nets    %11u %10u %9.2f %10.1f\n", field_names[type], num_triangles, num_vertices,
+			   time * 1e3, num_cells / time * 1e-6);
+
+		free(volume);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	unsigned size = argc > 1 ? (unsigned) atoi(argv[1]) : 129;
+	unsigned max_threads = argc > 2 ? (unsigned) atoi(argv[2]) : 8;
+	vector3ui volume_size = vec3ui(size, size, size), grid_size = vec3ui(size - 1, size - 1, size - 1);
+
+	TEST_INIT();
+
+	float *volume = create_volume(volume_size, 0);
+
+	bench_memory(volume, volume_size, grid_size);
+	bench_scaling(volume, volume_size, grid_size, max_threads);
+
+	free(volume);
+
+	bench_methods(volume_size, grid_size);
+	thread_pool_destroy();
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Скорость упрощения (треугольников исходной сетки в секунду) сеток marching cubes
+ * поля size^3 (первый аргумент, по-умолчанию 129) в num_threads потоках пула
+ * (второй аргумент, по-умолчанию 1): до 10% треугольников и по ошибке в полшага сетки
+ */
+
+#include <math.h>
+#include "common_test.h"
+#include "marching_cubes.h"
+#include "mesh_decimate.h"
+#include "thread_pool.h"
+
+#define NUM_RUNS 3
+
+/* Сфера с волнами (type = 0) или синусоидальное поле (type = 1) */
+static float *create_volume(vector3ui size, int type)
+{
+	float *volume = (float*) malloc(sizeof(float) * size.x * size.y * size.z);
+
+	CHECK(volume);
+
+	for(unsigned k = 0; k < size.z; k++)
+		for(unsigned j = 0; j < size.y; j++)
+			for(unsigned i = 0; i < size.x; i++) {
+				float x = i - size.x * 0.5f, y = j - size.y * 0.5f, z = k - size.z * 0.5f;
+
+				volume[i + j*size.x + k*size.x*size.y] = (type == 0) ?
+					sqrtf(x*x + y*y + z*z) - size.x * 0.3f + 1.5f * sinf(x * 0.2f) * cosf(y * 0.15f + z * 0.1f) :
+					sinf(x * 0.3f) + sinf(y * 0.3f) + sinf(z * 0.3f);
+			}
+
+	return volume;
+}
+
+static void bench_field(const char *name, const float *volume, vector3ui volume_size, vector3ui grid_size)
+{
+	const vector3f *vertices;
+	const triangle_t *triangles;
+	unsigned num_vertices, num_triangles;
+	float step = 1.0f / grid_size.x;
+
+	marching_cubes_invalidate();
+	CHECK(marching_cubes_create_mesh(volume, volume_size, grid_size, 0.0f, &vertices, &num_vertices,
+									 &triangles, &num_triangles));
+
+	// ratio 0.1 с большой ошибкой и без ограничения кол-ва с ошибкой в полшага
+	const unsigned targets[2] = {num_triangles / 10, 0};
+	const float errors[2] = {10.0f * step, 0.5f * step};
+	const char *modes[2] = {"ratio 0.1", "error 0.5"};
+
+	for(unsigned m = 0; m < 2; m++) {
+		const vector3f *out_vertices;
+		const triangle_t *out_triangles;
+		unsigned out_num_vertices, out_num_triangles;
+		double best = 0.0;
+
+		for(unsigned run = 0; run < NUM_RUNS; run++) {
+			double time = utils_get_time();
+
+			CHECK(mesh_decimate(vertices, num_vertices, triangles, num_triangles, targets[m], errors[m],
+								&out_vertices, &out_num_vertices, &out_triangles, &out_num_triangles));
+
+			time = utils_get_time() - time;
+
+			if(run == 0 || time < best)
+				best = time;
+		}
+
+		printf("  %-7s %-10s %9u -> %8u tris %9.1f ms %7.2f Mtris/s\n", name, modes[m], num_triangles,
+			   out_num_triangles, best * 1e3, num_triangles / best * 1e-6);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	unsigned size = argc > 1 ? (unsigned) atoi(argv[1]) : 129;
+	unsigned num_threads = argc > 2 ? (unsigned) atoi(argv[2]) : 1;
+	vector3ui volume_size = vec3ui(size, size, size), grid_size = vec3ui(size - 1, size - 1, size - 1);
+
+	TEST_INIT();
+
+	thread_pool_set_num_threads(num_threads);
+
+	printf("decimation: %u^3 grid, %u threads, best of %u\n", grid_size.x, num_threads, NUM_RUNS);
+
+	float *volume = create_volume(volume_size, 0);
+	bench_field("sphere", volume, volume_size, grid_size);
+	free(volume);
+
+	volume = create_volume(volume_size, 1);
+	bench_field("sine", volume, volume_size, grid_size);
+	free(volume);
+
+	mesh_decimate_release();
+	thread_pool_destroy();
+
+	return 0;
+}
@@ -0,0 +1,211 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Замеры парсера на поле size^3 (size - первый аргумент, по-умолчанию 64).
+ * Литералы: время вычисления функции на точку и время, которое добавлял бы
+ * перевод текста каждого литерала (atof) при каждом вычислении, как это делал
+ * интерпретатор до хранения значений чисел в токенах.
+ * JIT: точек в секунду при вычислении по точкам и слоями (как строит поле
+ * render_set_volume_size) интерпретатором и машинным кодом
+ */
+
+#include <ctype.h>
+#include <string.h>
+#include "common_test.h"
+#include "parser.h"
+
+// тор и эллипсоид, 27 литералов
+static const char *literal_func =
+	"x -= 63.5; y -= 63.5; z -= 63.5;\n"
+	"R = 30.0; r = 15.0;\n"
+	"t = (R - sqrt(x**2 + y**2))**2 + z**2 - r**2;\n"
+	"e = x**2 / 1.5**2 + y**2 / 2.25**2 + z**2 / 3.125**2 - 400.0;\n"
+	"d = min(t, e * 0.75 + 0.125) + 0.001 * sin(x * 0.1) * cos(y * 0.2) + 0.0025 * z - 1.0;\n";
+
+#define MAX_LITERALS 64
+
+static volatile float sink;
+
+/* Выписать литералы текста функции (числа, не являющиеся частью имени) */
+static unsigned collect_literals(const char *text, char literals[][32])
+{
+	unsigned count = 0;
+
+	for(const char *ptr = text; *ptr; ) {
+		if(isdigit(*ptr) && (ptr == text || !(isalnum(ptr[-1]) || ptr[-1] == '_'))) {
+			char *end;
+			strtod(ptr, &end);
+
+			unsigned length = (unsigned) (end - ptr);
+
+			if(count < MAX_LITERALS && length < 32) {
+				memcpy(literals[count], ptr, length);
+				literals[count][length] = '\0';
+				count++;
+			}
+
+			ptr = end;
+		} else {
+			ptr++;
+		}
+	}
+
+	return count;
+}
+
+static void bench_literals(unsigned size)
+{
+	parser_t parser;
+	parser_program_t program;
+	float registers[MAX_NUM_REGISTERS];
+	char literals[MAX_LITERALS][32];
+	unsigned num_literals = collect_literals(literal_func, literals);
+	unsigned num_voxels = size*size*size;
+
+	parser_create(&parser);
+	CHECK(parser_compile(&parser, literal_func, &program) == 0);
+
+	double time = utils_get_time();
+	float sum = 0.0f;
+
+	for(unsigned k = 0; k < size; k++)
+		for(unsigned j = 0; j < size; j++)
+			for(unsigned i = 0; i < size; i++) {
+				registers[PARSER_REG_X] = i;
+				registers[PARSER_REG_Y] = j;
+				registers[PARSER_REG_Z] = k;
+
+				parser_program_eval(&program, registers);
+				sum += registers[PARSER_REG_D];
+			}
+
+	double eval_time = utils_get_time() - time;
+
+	// перевод текста литералов на каждой точке
+	time = utils_get_time();
+
+	for(unsigned v = 0; v < num_voxels; v++)
+		for(unsigned l = 0; l < num_literals; l++)
+			sum += (float) atof(literals[l]);
+
+	double atof_time = utils_get_time() - time;
+
+	sink = sum;
+
+	printf("literals: %u in function, %u^3 voxels\n", num_literals, size);
+	printf("  after  (values in tokens):  %8.1f ns/voxel\n", eval_time * 1e9 / num_voxels);
+	printf("  before (+atof per literal): %8.1f ns/voxel (%.1f ns/voxel in atof)\n",
+		   (eval_time + atof_time) * 1e9 / num_voxels, atof_time * 1e9 / num_voxels);
+
+	parser_program_destroy(&program);
+	parser_clean(&parser);
+}
+
+// арифметика, шум и циклы с одинаковыми и разными для точек границами
+static const char *jit_funcs[] = {
+	"d = ((x*0.03)**2 + (y*0.03)**2 + (z*0.03)**2)**3 - 1;",
+	"d = vnoise3(x * 0.05, y * 0.05, z * 0.05) + 0.5 * snoise3(x * 0.1, y * 0.1, z * 0.1) - 0.2;",
+	"d = (1..20: sin(z*i*0.1) * cos(y*0.1 + i)) + x*0.01;",
+	"d = (0..x/4: (x*0.02*i)**2 - y*0.01*i) - z*0.1;",
+	"d = (0..x/4: sin(x*0.05*i) * vnoise2(y*0.1, i)) - z*0.1;",
+	NULL
+};
+
+/* Точек в секунду: по точкам (slices = 0) или слоями */
+static double eval_rate(const parser_program_t *program, unsigned size, int slices, float *slice)
+{
+	float registers[MAX_NUM_REGISTERS];
+	float sum = 0.0f;
+	double time = utils_get_time();
+
+	for(unsigned k = 0; k < size; k++) {
+		if(slices) {
+			parser_program_eval_slice(program, 0.0f, 0.0f, k, size, size, size, slice);
+			sum += slice[k];
+			continue;
+		}
+
+		for(unsigned j = 0; j < size; j++)
+			for(unsigned i = 0; i < size; i++) {
+				registers[PARSER_REG_X] = i;
+				registers[PARSER_REG_Y] = j;
+				registers[PARSER_REG_Z] = k;
+
+				parser_program_eval(program, registers);
+				sum += registers[PARSER_REG_D];
+			}
+	}
+
+	sink = sum;
+
+	return size*size*size / (utils_get_time() - time);
+}
+
+static void bench_jit(unsigned size)
+{
+	parser_t parser;
+	parser_program_t program;
+	float *slice = (float*) malloc(sizeof(float) * size * size);
+
+	CHECK(slice);
+
+	if(!parser_set_jit(1)) {
+		printf("jit: not available\n");
+		free(slice);
+		return;
+	}
+
+	parser_create(&parser);
+
+	printf("jit: %u^3 voxels, Mvoxels/s (interpreter -> JIT)\n", size);
+
+	for(unsigned f = 0; jit_funcs[f]; f++) {
+		CHECK(parser_compile(&parser, jit_funcs[f], &program) == 0);
+
+		double rates[2][2];
+
+		for(int jit = 0; jit <= 1; jit++) {
+			parser_set_jit(jit);
+
+			rates[jit][0] = eval_rate(&program, size, 0, slice);
+			rates[jit][1] = eval_rate(&program, size, 1, slice);
+		}
+
+		printf("  %s\n    points %7.2f -> %7.2f   slices %7.2f -> %7.2f\n", jit_funcs[f],
+			   rates[0][0] * 1e-6, rates[1][0] * 1e-6, rates[0][1] * 1e-6, rates[1][1] * 1e-6);
+
+		parser_program_destroy(&program);
+	}
+
+	parser_set_jit(1);
+	parser_clean(&parser);
+	free(slice);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned size = argc > 1 ? (unsigned) atoi(argv[1]) : 64;
+
+	TEST_INIT();
+
+	bench_literals(size);
+	bench_jit(size);
+
+	return 0;
+}
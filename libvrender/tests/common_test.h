@@ -0,0 +1,43 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMMON_TEST_H_INCLUDED
+#define COMMON_TEST_H_INCLUDED
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "common.h"
+#include "utils.h"
+
+/* Проверка теста: при ошибке печатает условие и завершает тест с кодом 1 */
+#define CHECK(expr) if( !(expr) ) { \
+						fprintf(stderr, "%s:%i: check failed: %s\n", __FILE__, __LINE__, #expr); \
+						exit(1); \
+					}
+
+/* Проверка с сообщением (printf-формат) */
+#define CHECK_MSG(expr, msg, ...) if( !(expr) ) { \
+									fprintf(stderr, "%s:%i: check failed: %s: " msg "\n", \
+											__FILE__, __LINE__, #expr, ##__VA_ARGS__); \
+									exit(1); \
+								  }
+
+/* Открыть лог библиотеки (TRACE_MSG/ERROR_MSG пишут в vrender.log каталога сборки) */
+#define TEST_INIT() CHECK(log_init())
+
+#endif /* COMMON_TEST_H_INCLUDED */
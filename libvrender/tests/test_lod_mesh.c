@@ -0,0 +1,250 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Швы между чанками разного уровня детализации (lod_mesh_extract) без щелей: после
+ * слияния вершин с одинаковыми координатами у каждого направленного ребра внутри
+ * объёма есть обратное столько же раз. Проверяется на синусоидальной поверхности,
+ * пересекающей границы объёма, и на сфере, в т.ч. при размере поля не кратном чанку
+ */
+
+#include <math.h>
+#include <string.h>
+#include "common_test.h"
+#include "lod_mesh.h"
+#include "thread_pool.h"
+
+typedef float (*field_func_t)(float x, float y, float z, float size);
+
+static float sine_field(float x, float y, float z, float size)
+{
+	return z - size * 0.15f * sinf(x * 0.13f) * cosf(y * 0.11f);
+}
+
+static float sphere_field(float x, float y, float z, float size)
+{
+	return sqrtf(x*x + y*y + z*z) - size * 0.37f;
+}
+
+static float *create_volume(vector3ui size, field_func_t field)
+{
+	float *volume = (float*) malloc(sizeof(float) * size.x * size.y * size.z);
+
+	CHECK(volume);
+
+	for(unsigned k = 0; k < size.z; k++)
+		for(unsigned j = 0; j < size.y; j++)
+			for(unsigned i = 0; i < size.x; i++)
+				volume[i + (j + k*size.y)*size.x] = field(i - (size.x - 1) * 0.5f, j - (size.y - 1) * 0.5f,
+														  k - (size.z - 1) * 0.5f, size.x);
+
+	return volume;
+}
+
+static const vector3f *sort_vertices;
+
+static int compare_vertices(const void *a, const void *b)
+{
+	const vector3f *u = &sort_vertices[*(const unsigned*) a], *v = &sort_vertices[*(const unsigned*) b];
+
+	if(u->x != v->x)
+		return (u->x > v->x) - (u->x < v->x);
+	if(u->y != v->y)
+		return (u->y > v->y) - (u->y < v->y);
+
+	return (u->z > v->z) - (u->z < v->z);
+}
+
+/* Номера вершин после слияния одинаковых по координатам */
+static unsigned *weld_vertices(const vector3f *vertices, unsigned num_vertices)
+{
+	unsigned *order = (unsigned*) malloc(sizeof(unsigned) * num_vertices);
+	unsigned *ids = (unsigned*) malloc(sizeof(unsigned) * num_vertices);
+
+	CHECK(order && ids);
+
+	for(unsigned v = 0; v < num_vertices; v++)
+		order[v] = v;
+
+	sort_vertices = vertices;
+	qsort(order, num_vertices, sizeof(unsigned), compare_vertices);
+
+	for(unsigned n = 0, id = 0; n < num_vertices; n++) {
+		if(n > 0 && compare_vertices(&order[n - 1], &order[n]) != 0)
+			id++;
+
+		ids[order[n]] = id;
+	}
+
+	free(order);
+
+	return ids;
+}
+
+static int compare_edges(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+
+	return (x > y) - (x < y);
+}
+
+/* Кол-во рёбер edge в упорядоченном массиве */
+static unsigned count_edge(const uint64_t *edges, unsigned count, uint64_t edge)
+{
+	unsigned first = 0, last = count;
+
+	while(first < last) {
+		unsigned middle = (first + last) / 2;
+
+		if(edges[middle] < edge)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+
+	for(last = first; last < count && edges[last] == edge; last++);
+
+	return last - first;
+}
+
+/* Обе вершины лежат на одной грани объёма [0, 1]^3 */
+static int is_boundary_edge(vector3f a, vector3f b)
+{
+	const float eps = 1e-5f;
+	float pa[3] = {a.x, a.y, a.z}, pb[3] = {b.x, b.y, b.z};
+
+	for(unsigned axis = 0; axis < 3; axis++)
+		if((fabsf(pa[axis]) < eps && fabsf(pb[axis]) < eps) ||
+		   (fabsf(pa[axis] - 1.0f) < eps && fabsf(pb[axis] - 1.0f) < eps))
+			return 1;
+
+	return 0;
+}
+
+/* У каждого ребра внутри объёма есть обратное столько же раз, возвращает кол-во рёбер на границе */
+static unsigned check_seams(const vector3f *vertices, unsigned num_vertices,
+							const triangle_t *triangles, unsigned num_triangles)
+{
+	unsigned *ids = weld_vertices(vertices, num_vertices);
+	uint64_t *edges = (uint64_t*) malloc(sizeof(uint64_t) * num_triangles * 3);
+	unsigned num_edges = 0, num_boundary = 0;
+
+	CHECK(edges);
+
+	for(unsigned t = 0; t < num_triangles; t++)
+		for(unsigned e = 0; e < 3; e++) {
+			unsigned a = triangles[t].indices[e], b = triangles[t].indices[(e + 1) % 3];
+
+			CHECK(a < num_vertices && b < num_vertices);
+
+			// ребро, стянутое слиянием вершин, не разделяет треугольники
+			if(ids[a] == ids[b])
+				continue;
+
+			if(is_boundary_edge(vertices[a], vertices[b])) {
+				num_boundary++;
+				continue;
+			}
+
+			edges[num_edges++] = ((uint64_t) ids[a] << 32) | ids[b];
+		}
+
+	qsort(edges, num_edges, sizeof(uint64_t), compare_edges);
+
+	for(unsigned n = 0; n < num_edges; ) {
+		unsigned count = count_edge(edges, num_edges, edges[n]);
+		uint64_t reverse = (edges[n] << 32) | (edges[n] >> 32);
+		unsigned reverse_count = count_edge(edges, num_edges, reverse);
+
+		// вершина ребра для сообщения
+		if(reverse_count != count) {
+			unsigned a = 0;
+
+			while(ids[a] != (unsigned) (edges[n] >> 32))
+				a++;
+
+			CHECK_MSG(reverse_count == count, "crack at (%f, %f, %f): edge used %u times, reverse %u times",
+					  vertices[a].x, vertices[a].y, vertices[a].z, count, reverse_count);
+		}
+
+		n += count;
+	}
+
+	free(edges);
+	free(ids);
+
+	return num_boundary;
+}
+
+/* Чанки смешанных уровней (наблюдатель в углу объёма) смыкаются без щелей */
+static void test_field(const char *name, field_func_t field, vector3ui size, int is_closed)
+{
+	float *volume = create_volume(size, field);
+	volume_pyramid_t pyramid;
+	vector3f *vertices;
+	triangle_t *triangles;
+	unsigned num_vertices, num_triangles, detailed_triangles;
+
+	volume_pyramid_init(&pyramid);
+	CHECK(volume_pyramid_build(&pyramid, volume, size));
+
+	// все чанки по исходному полю
+	CHECK(lod_mesh_extract(&pyramid, 0.013f, vec3f(0.0f, 0.0f, 0.0f), 100.0f, &vertices, &num_vertices,
+						   &triangles, &detailed_triangles));
+	CHECK(detailed_triangles > 0);
+	check_seams(vertices, num_vertices, triangles, detailed_triangles);
+	free(vertices);
+	free(triangles);
+
+	CHECK(lod_mesh_extract(&pyramid, 0.013f, vec3f(0.0f, 0.0f, 0.0f), 0.1f, &vertices, &num_vertices,
+						   &triangles, &num_triangles));
+
+	// дальние чанки огрублены
+	CHECK_MSG(num_triangles > 0 && num_triangles < detailed_triangles, "%u of %u triangles",
+			  num_triangles, detailed_triangles);
+
+	unsigned num_boundary = check_seams(vertices, num_vertices, triangles, num_triangles);
+
+	CHECK(is_closed ? num_boundary == 0 : num_boundary > 0);
+
+	printf("%s: %ux%ux%u field, %u triangles (%u at level 0), %u boundary edges\n", name, size.x, size.y, size.z,
+		   num_triangles, detailed_triangles, num_boundary);
+
+	free(vertices);
+	free(triangles);
+	volume_pyramid_destroy(&pyramid);
+	free(volume);
+}
+
+int main(void)
+{
+	TEST_INIT();
+
+	thread_pool_set_num_threads(3);
+
+	test_field("sine", sine_field, vec3ui(129, 129, 129), 0);
+	test_field("sine", sine_field, vec3ui(101, 90, 77), 0);
+	test_field("sphere", sphere_field, vec3ui(129, 129, 129), 1);
+	test_field("sphere", sphere_field, vec3ui(101, 90, 77), 1);
+
+	thread_pool_destroy();
+
+	printf("LOD mesh: chunk seams are crack-free\n");
+
+	return 0;
+}
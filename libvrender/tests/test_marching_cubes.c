@@ -0,0 +1,239 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Полигонизация поля (marching_cubes_create) совпадает с последовательным обходом ячеек
+ * через marching_cubes_polygonise: без общих вершин - бит в бит, с общими вершинами
+ * треугольники те же (в том же порядке), меняется только нумерация вершин.
+ * Результат не зависит от кол-ва потоков пула
+ */
+
+#include <math.h>
+#include <string.h>
+#include "common_test.h"
+#include "marching_cubes.h"
+#include "thread_pool.h"
+
+// смещения узлов ячейки (нумерация marching_cubes_polygonise)
+static const unsigned corners[8][3] = {
+	{0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0}, {0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1}
+};
+
+typedef struct {
+	vector3f *vertices;
+	unsigned num_vertices;
+	triangle_t *triangles;
+	unsigned num_triangles;
+} mesh_t;
+
+static void mesh_alloc(mesh_t *mesh, vector3ui grid_size)
+{
+	unsigned num_cells = (grid_size.x - 1) * (grid_size.y - 1) * (grid_size.z - 1);
+
+	// не больше 12 вершин и 5 треугольников на ячейку
+	mesh->vertices = (vector3f*) malloc(sizeof(vector3f) * num_cells * 12);
+	mesh->triangles = (triangle_t*) malloc(sizeof(triangle_t) * num_cells * 5);
+	mesh->num_vertices = mesh->num_triangles = 0;
+
+	CHECK(mesh->vertices && mesh->triangles);
+}
+
+static void mesh_free(mesh_t *mesh)
+{
+	free(mesh->vertices);
+	free(mesh->triangles);
+}
+
+/* Шум со значениями в [-1, 1] (все конфигурации ячеек) или сфера с волнами */
+static float *create_volume(vector3ui size, int is_noise)
+{
+	float *volume = (float*) malloc(sizeof(float) * size.x * size.y * size.z);
+	unsigned seed = 12345;
+
+	CHECK(volume);
+
+	for(unsigned k = 0; k < size.z; k++)
+		for(unsigned j = 0; j < size.y; j++)
+			for(unsigned i = 0; i < size.x; i++) {
+				float *value = &volume[i + j*size.x + k*size.x*size.y];
+
+				if(is_noise) {
+					seed = seed * 1103515245 + 12345;
+					*value = ((seed >> 8) & 0xffff) / 32767.5f - 1.0f;
+				} else {
+					float x = i - size.x * 0.5f, y = j - size.y * 0.5f, z = k - size.z * 0.5f;
+					*value = sqrtf(x*x + y*y + z*z) - size.x * 0.3f + 1.5f * sinf(x * 0.7f) * cosf(y * 0.5f + z * 0.3f);
+				}
+			}
+
+	return volume;
+}
+
+/* Последовательный обход ячеек: сетка без общих вершин. Возвращает кол-во ячеек с 5 треугольниками */
+static unsigned serial_soup(const float *volume, vector3ui volume_size, vector3ui grid_size, float isolevel,
+							mesh_t *mesh)
+{
+	vector3ui value_step = vec3ui_div(volume_size, grid_size);
+	vector3f pos_step = vec3f_div(vec3f(1.0f, 1.0f, 1.0f), vec3f(grid_size.x, grid_size.y, grid_size.z));
+	unsigned num_full_cells = 0;
+
+	for(unsigned k = 0; k + 1 < grid_size.z; k++)
+		for(unsigned j = 0; j + 1 < grid_size.y; j++)
+			for(unsigned i = 0; i + 1 < grid_size.x; i++) {
+				vector3f pos_offset = vec3f_mult(vec3f(i, j, k), pos_step);
+				cell_t cell;
+
+				for(unsigned c = 0; c < 8; c++) {
+					vector3ui node = vec3ui_mult(vec3ui(i + corners[c][0], j + corners[c][1], k + corners[c][2]), value_step);
+
+					cell.vertices_values[c] = volume[node.x + node.y*volume_size.x + node.z*volume_size.x*volume_size.y];
+					cell.vertices_positions[c] = vec3f_add(pos_offset, vec3f(corners[c][0] ? pos_step.x : 0.0f,
+																			 corners[c][1] ? pos_step.y : 0.0f,
+																			 corners[c][2] ? pos_step.z : 0.0f));
+				}
+
+				vector3f vertices[12];
+				triangle_t triangles[5];
+				unsigned short num_vertices = 0, num_triangles = 0;
+
+				if(marching_cubes_polygonise(cell, isolevel, vertices, &num_vertices, triangles, &num_triangles) != 1)
+					continue;
+
+				// marching_cubes_polygonise возвращает кол-во + 1
+				num_vertices--;
+				num_triangles--;
+
+				for(unsigned t = 0; t < num_triangles; t++)
+					for(unsigned v = 0; v < 3; v++)
+						triangles[t].indices[v] += mesh->num_vertices;
+
+				memcpy(mesh->vertices + mesh->num_vertices, vertices, sizeof(vector3f) * num_vertices);
+				memcpy(mesh->triangles + mesh->num_triangles, triangles, sizeof(triangle_t) * num_triangles);
+
+				mesh->num_vertices += num_vertices;
+				mesh->num_triangles += num_triangles;
+
+				if(num_triangles == 5)
+					num_full_cells++;
+			}
+
+	return num_full_cells;
+}
+
+static void create(const float *volume, vector3ui volume_size, vector3ui grid_size, float isolevel,
+				   int welded, mesh_t *mesh)
+{
+	marching_cubes_set_welded(welded);
+	marching_cubes_invalidate();
+
+	CHECK(marching_cubes_create(volume, volume_size, grid_size, isolevel, mesh->vertices, &mesh->num_vertices,
+								mesh->triangles, &mesh->num_triangles) == 1);
+
+	// marching_cubes_create возвращает кол-во + 1
+	mesh->num_vertices--;
+	mesh->num_triangles--;
+}
+
+/* Сетки совпадают бит в бит */
+static void check_identical(const mesh_t *a, const mesh_t *b)
+{
+	CHECK_MSG(a->num_vertices == b->num_vertices, "%u vs %u vertices", a->num_vertices, b->num_vertices);
+	CHECK_MSG(a->num_triangles == b->num_triangles, "%u vs %u triangles", a->num_triangles, b->num_triangles);
+	CHECK(memcmp(a->vertices, b->vertices, sizeof(vector3f) * a->num_vertices) == 0);
+	CHECK(memcmp(a->triangles, b->triangles, sizeof(triangle_t) * a->num_triangles) == 0);
+}
+
+/* Треугольники сеток совпадают по положению вершин (нумерация может различаться) */
+static void check_same_triangles(const mesh_t *a, const mesh_t *b, float epsilon)
+{
+	CHECK_MSG(a->num_triangles == b->num_triangles, "%u vs %u triangles", a->num_triangles, b->num_triangles);
+
+	for(unsigned t = 0; t < a->num_triangles; t++)
+		for(unsigned v = 0; v < 3; v++) {
+			vector3f pa = a->vertices[a->triangles[t].indices[v]], pb = b->vertices[b->triangles[t].indices[v]];
+
+			CHECK_MSG(fabsf(pa.x - pb.x) <= epsilon && fabsf(pa.y - pb.y) <= epsilon && fabsf(pa.z - pb.z) <= epsilon,
+					  "triangle %u vertex %u: (%f, %f, %f) vs (%f, %f, %f)", t, v, pa.x, pa.y, pa.z, pb.x, pb.y, pb.z);
+		}
+}
+
+// кол-во потоков пула (в т.ч. больше, чем ядер, и не делящее кол-во слоёв)
+static const unsigned num_threads[] = {1, 2, 4, 7, 0};
+
+static void check_volume(int is_noise, vector3ui volume_size, vector3ui grid_size, float isolevel)
+{
+	float *volume = create_volume(volume_size, is_noise);
+	mesh_t serial, soup, welded, welded_single;
+
+	mesh_alloc(&serial, grid_size);
+	mesh_alloc(&soup, grid_size);
+	mesh_alloc(&welded, grid_size);
+	mesh_alloc(&welded_single, grid_size);
+
+	unsigned num_full_cells = serial_soup(volume, volume_size, grid_size, isolevel, &serial);
+
+	// в шуме встречаются конфигурации из 5 треугольников
+	CHECK(!is_noise || num_full_cells > 0);
+	CHECK(serial.num_triangles > 0);
+
+	for(unsigned n = 0; num_threads[n]; n++) {
+		thread_pool_set_num_threads(num_threads[n]);
+
+		create(volume, volume_size, grid_size, isolevel, 0, &soup);
+		check_identical(&serial, &soup);
+
+		create(volume, volume_size, grid_size, isolevel, 1, &welded);
+
+		// с общими вершинами результат в одном потоке - эталон для остальных
+		if(n == 0) {
+			CHECK(welded.num_vertices < soup.num_vertices);
+			check_same_triangles(&serial, &welded, 1e-6f);
+
+			memcpy(welded_single.vertices, welded.vertices, sizeof(vector3f) * welded.num_vertices);
+			memcpy(welded_single.triangles, welded.triangles, sizeof(triangle_t) * welded.num_triangles);
+			welded_single.num_vertices = welded.num_vertices;
+			welded_single.num_triangles = welded.num_triangles;
+		} else {
+			check_identical(&welded_single, &welded);
+		}
+	}
+
+	mesh_free(&serial);
+	mesh_free(&soup);
+	mesh_free(&welded);
+	mesh_free(&welded_single);
+	free(volume);
+}
+
+int main()
+{
+	TEST_INIT();
+
+	check_volume(1, vec3ui(33, 33, 33), vec3ui(33, 33, 33), 0.0f);
+	check_volume(1, vec3ui(40, 37, 35), vec3ui(20, 18, 17), 0.3f);
+	check_volume(0, vec3ui(65, 65, 65), vec3ui(64, 64, 64), 0.0f);
+	check_volume(0, vec3ui(65, 65, 65), vec3ui(32, 32, 32), 0.5f);
+
+	thread_pool_destroy();
+	marching_cubes_set_welded(1);
+	marching_cubes_invalidate();
+
+	printf("marching cubes meshes match the serial cell-by-cell soup\n");
+
+	return 0;
+}
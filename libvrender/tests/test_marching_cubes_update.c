@@ -0,0 +1,213 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Сетка по слоям (marching_cubes_update_mesh) при анимации изо-уровня и правке поля
+ * совпадает с построенной заново (marching_cubes_create_mesh) без вырожденных треугольников
+ * запаса, а слои, версии которых не изменились с пропущенных обновлений, содержат те же
+ * треугольники - на этом основана загрузка изменившихся слоёв (marching_cubes_upload_layers)
+ */
+
+#include <math.h>
+#include <string.h>
+#include "common_test.h"
+#include "marching_cubes.h"
+#include "thread_pool.h"
+
+// снимок сетки по слоям, загруженной в буферы
+typedef struct {
+	triangle_t *triangles;
+	unsigned *versions;
+	unsigned layout, num_layers, num_triangles;
+} snapshot_t;
+
+static float *create_volume(vector3ui size)
+{
+	float *volume = (float*) malloc(sizeof(float) * size.x * size.y * size.z);
+
+	CHECK(volume);
+
+	for(unsigned k = 0; k < size.z; k++)
+		for(unsigned j = 0; j < size.y; j++)
+			for(unsigned i = 0; i < size.x; i++) {
+				float x = i - size.x * 0.5f, y = j - size.y * 0.5f, z = k - size.z * 0.5f;
+
+				volume[i + (j + k*size.y)*size.x] = sqrtf(x*x + y*y + z*z) - size.x * 0.3f +
+													1.5f * sinf(x * 0.7f) * cosf(y * 0.5f + z * 0.3f);
+			}
+
+	return volume;
+}
+
+INLINE static int is_degenerate(const triangle_t *t)
+{
+	return t->indices[0] == t->indices[1] && t->indices[1] == t->indices[2];
+}
+
+/* Сетка по слоям без вырожденных треугольников совпадает с построенной заново */
+static void check_layers(const float *volume, vector3ui volume_size, vector3ui grid_size, float isolevel,
+						 const mc_layers_t *layers)
+{
+	const vector3f *vertices;
+	const triangle_t *triangles;
+	unsigned n_vertices, n_triangles, t = 0;
+
+	CHECK(marching_cubes_create_mesh(volume, volume_size, grid_size, isolevel, &vertices, &n_vertices,
+									 &triangles, &n_triangles));
+	CHECK(n_triangles > 0);
+	CHECK(layers->triangle_bases[layers->num_layers] == layers->num_triangles);
+
+	for(unsigned n = 0; n < layers->num_triangles; n++) {
+		const triangle_t *triangle = &layers->triangles[n];
+
+		if(is_degenerate(triangle))
+			continue;
+
+		CHECK_MSG(t < n_triangles, "more than %u triangles at isolevel %f", n_triangles, isolevel);
+
+		for(unsigned v = 0; v < 3; v++) {
+			unsigned index = triangle->indices[v];
+			vector3f pa = layers->vertices[index], pb = vertices[triangles[t].indices[v]];
+
+			CHECK(index >= layers->first_vertex && index < layers->last_vertex);
+			CHECK_MSG(fabsf(pa.x - pb.x) <= 1e-6f && fabsf(pa.y - pb.y) <= 1e-6f && fabsf(pa.z - pb.z) <= 1e-6f,
+					  "isolevel %f triangle %u vertex %u", isolevel, t, v);
+		}
+
+		t++;
+	}
+
+	CHECK_MSG(t == n_triangles, "%u vs %u triangles at isolevel %f", t, n_triangles, isolevel);
+}
+
+static void take_snapshot(const mc_layers_t *layers, snapshot_t *snapshot)
+{
+	snapshot->triangles = (triangle_t*) realloc(snapshot->triangles, sizeof(triangle_t) * layers->num_triangles);
+	snapshot->versions = (unsigned*) realloc(snapshot->versions, sizeof(unsigned) * layers->num_layers);
+
+	CHECK(snapshot->triangles && snapshot->versions);
+
+	memcpy(snapshot->triangles, layers->triangles, sizeof(triangle_t) * layers->num_triangles);
+	memcpy(snapshot->versions, layers->versions, sizeof(unsigned) * layers->num_layers);
+	snapshot->layout = layers->layout;
+	snapshot->num_layers = layers->num_layers;
+	snapshot->num_triangles = layers->num_triangles;
+}
+
+/* Слои с прежней версией не изменились с снимка. Возвращает кол-во изменившихся слоёв */
+static unsigned check_versions(const mc_layers_t *layers, const snapshot_t *snapshot)
+{
+	unsigned changed = 0;
+
+	CHECK(layers->layout == snapshot->layout && layers->num_layers == snapshot->num_layers);
+
+	for(unsigned k = 0; k < layers->num_layers; k++) {
+		unsigned first = layers->triangle_bases[k], count = layers->triangle_bases[k + 1] - first;
+
+		if(layers->versions[k] != snapshot->versions[k]) {
+			changed++;
+			continue;
+		}
+
+		CHECK_MSG(memcmp(layers->triangles + first, snapshot->triangles + first, sizeof(triangle_t) * count) == 0,
+				  "layer %u changed without a new version", k);
+	}
+
+	return changed;
+}
+
+static void check_updates(vector3ui volume_size, vector3ui grid_size)
+{
+	float *volume = create_volume(volume_size);
+	snapshot_t snapshot = {NULL, NULL, 0, 0, 0};
+	mc_layers_t layers;
+	unsigned num_patches = 0;
+	float isolevel = 0.0f;
+
+	marching_cubes_invalidate();
+
+	CHECK(marching_cubes_update_mesh(volume, volume_size, grid_size, 0.0f, &layers));
+	check_layers(volume, volume_size, grid_size, 0.0f, &layers);
+	take_snapshot(&layers, &snapshot);
+
+	// каждое третье обновление "загружается", остальные пропускаются, как у потока сетки
+	for(unsigned n = 1; n <= 30; n++) {
+		isolevel = 0.02f * n;
+
+		CHECK(marching_cubes_update_mesh(volume, volume_size, grid_size, isolevel, &layers));
+		check_layers(volume, volume_size, grid_size, isolevel, &layers);
+
+		if(n % 3)
+			continue;
+
+		if(layers.layout == snapshot.layout) {
+			CHECK(check_versions(&layers, &snapshot) < layers.num_layers);
+			num_patches++;
+		}
+
+		take_snapshot(&layers, &snapshot);
+	}
+
+	// малые шаги изо-уровня помещаются в запас слоёв
+	CHECK(num_patches > 0);
+
+	// правка поля при том же изо-уровне перестраивает только слои с изменёнными узлами
+	vector3ui step = vec3ui_div(volume_size, grid_size);
+	vector3ui begin = vec3ui(0, 0, volume_size.z / 2), end = vec3ui(volume_size.x / 2, volume_size.y - 1, volume_size.z / 2 + 1);
+
+	for(unsigned k = begin.z; k <= end.z; k++)
+		for(unsigned j = begin.y; j <= end.y; j++)
+			for(unsigned i = begin.x; i <= end.x; i++)
+				volume[i + (j + k*volume_size.y)*volume_size.x] -= 0.7f;
+
+	marching_cubes_invalidate_region(volume, volume_size, begin, end);
+
+	CHECK(marching_cubes_update_mesh(volume, volume_size, grid_size, isolevel, &layers));
+	check_layers(volume, volume_size, grid_size, isolevel, &layers);
+	CHECK(layers.layout == snapshot.layout);
+
+	unsigned changed = check_versions(&layers, &snapshot), planes = end.z / step.z - (begin.z + step.z - 1) / step.z + 1;
+
+	// слои ячеек под и над плоскостями (и слой вершин последней плоскости с общими вершинами)
+	CHECK_MSG(changed > 0 && changed <= planes + 1, "%u layers changed, %u planes edited", changed, planes);
+
+	free(snapshot.triangles);
+	free(snapshot.versions);
+	free(volume);
+}
+
+int main()
+{
+	TEST_INIT();
+
+	thread_pool_set_num_threads(3);
+
+	check_updates(vec3ui(48, 48, 48), vec3ui(48, 48, 48));
+	check_updates(vec3ui(65, 65, 65), vec3ui(32, 32, 32));
+
+	marching_cubes_set_welded(0);
+	check_updates(vec3ui(40, 40, 40), vec3ui(40, 40, 40));
+	marching_cubes_set_welded(1);
+
+	thread_pool_destroy();
+	marching_cubes_invalidate();
+
+	printf("layered marching cubes updates match full rebuilds\n");
+
+	return 0;
+}
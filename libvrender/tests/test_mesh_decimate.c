@@ -0,0 +1,232 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Упрощение замкнутых сеток marching cubes: результат остаётся замкнутым согласованно
+ * ориентированным многообразием той же топологии (характеристика Эйлера) и соблюдает
+ * max_error. Квадрики ограничивают средний квадрат расстояния, поэтому проверяется
+ * среднеквадратичное расстояние вершин исходной сетки до упрощённой поверхности
+ * (не больше max_error), а наибольшее - только грубо (не больше 3 * max_error);
+ * плоские грани упрощаются без ошибки
+ */
+
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include "common_test.h"
+#include "marching_cubes.h"
+#include "mesh_decimate.h"
+#include "thread_pool.h"
+
+#define SIZE 41
+
+typedef struct {
+	const vector3f *vertices;
+	unsigned num_vertices;
+	const triangle_t *triangles;
+	unsigned num_triangles;
+} mesh_t;
+
+/* Сфера (type = 0), тор (1) или куб с плоскими гранями (2) */
+static float *create_volume(vector3ui size, int type)
+{
+	float *volume = (float*) malloc(sizeof(float) * size.x * size.y * size.z);
+
+	CHECK(volume);
+
+	for(unsigned k = 0; k < size.z; k++)
+		for(unsigned j = 0; j < size.y; j++)
+			for(unsigned i = 0; i < size.x; i++) {
+				float x = i - size.x * 0.5f + 0.25f, y = j - size.y * 0.5f + 0.25f, z = k - size.z * 0.5f + 0.25f;
+				float value = 0.0f;
+
+				if(type == 0) {
+					value = sqrtf(x*x + y*y + z*z) - 14.0f;
+				} else if(type == 1) {
+					float r = sqrtf(x*x + y*y) - 11.0f;
+					value = sqrtf(r*r + z*z) - 5.0f;
+				} else {
+					value = fmaxf(fabsf(x), fmaxf(fabsf(y), fabsf(z))) - 12.3f;
+				}
+
+				volume[i + j*size.x + k*size.x*size.y] = value;
+			}
+
+	return volume;
+}
+
+static int compare_edges(const void *a, const void *b)
+{
+	uint64_t ea = *(const uint64_t*) a, eb = *(const uint64_t*) b;
+
+	return (ea > eb) - (ea < eb);
+}
+
+/*
+ * Проверить, что сетка - замкнутое согласованно ориентированное многообразие
+ * (каждое ребро встречается ровно в двух треугольниках с противоположным обходом).
+ * Возвращает характеристику Эйлера
+ */
+static int check_closed_manifold(const mesh_t *mesh)
+{
+	unsigned num_edges = mesh->num_triangles * 3;
+	uint64_t *edges = (uint64_t*) malloc(sizeof(uint64_t) * num_edges);
+	unsigned char *used = (unsigned char*) calloc(mesh->num_vertices, 1);
+
+	CHECK(edges && used);
+
+	for(unsigned t = 0; t < mesh->num_triangles; t++) {
+		const unsigned *indices = mesh->triangles[t].indices;
+
+		for(unsigned c = 0; c < 3; c++) {
+			CHECK(indices[c] < mesh->num_vertices);
+			CHECK_MSG(indices[c] != indices[(c + 1) % 3], "degenerate triangle %u", t);
+
+			used[indices[c]] = 1;
+			edges[t * 3 + c] = ((uint64_t) indices[c] << 32) | indices[(c + 1) % 3];
+		}
+	}
+
+	qsort(edges, num_edges, sizeof(uint64_t), compare_edges);
+
+	for(unsigned e = 0; e < num_edges; e++) {
+		uint64_t reverse = (edges[e] << 32) | (edges[e] >> 32);
+
+		// ориентированное ребро не повторяется, а обратное ему есть
+		CHECK_MSG(e + 1 == num_edges || edges[e] != edges[e + 1], "edge %u-%u is used twice in one direction",
+				  (unsigned) (edges[e] >> 32), (unsigned) edges[e]);
+		CHECK_MSG(bsearch(&reverse, edges, num_edges, sizeof(uint64_t), compare_edges),
+				  "edge %u-%u is a border", (unsigned) (edges[e] >> 32), (unsigned) edges[e]);
+	}
+
+	for(unsigned v = 0; v < mesh->num_vertices; v++)
+		CHECK_MSG(used[v], "vertex %u is not used", v);
+
+	free(edges);
+	free(used);
+
+	// V - E + F, каждое ребро посчитано дважды
+	return (int) mesh->num_vertices - (int) (num_edges / 2) + (int) mesh->num_triangles;
+}
+
+/* Расстояние от точки p до треугольника abc */
+static float point_triangle_distance(vector3f p, vector3f a, vector3f b, vector3f c)
+{
+	vector3f ab = vec3f_sub(b, a), ac = vec3f_sub(c, a), ap = vec3f_sub(p, a);
+	vector3f normal = vec3f_cross(ab, ac);
+	float area = vec3f_dot(normal, normal);
+
+	// проекция внутри треугольника - расстояние до плоскости
+	if(area > 0.0f) {
+		float u = vec3f_dot(vec3f_cross(ap, ac), normal) / area;
+		float v = vec3f_dot(vec3f_cross(ab, ap), normal) / area;
+
+		if(u >= 0.0f && v >= 0.0f && u + v <= 1.0f)
+			return fabsf(vec3f_dot(ap, normal)) / sqrtf(area);
+	}
+
+	// иначе - до ближайшей стороны
+	vector3f corners[3] = {a, b, c};
+	float distance = INFINITY;
+
+	for(unsigned s = 0; s < 3; s++) {
+		vector3f from = corners[s], edge = vec3f_sub(corners[(s + 1) % 3], from);
+		float length = vec3f_dot(edge, edge);
+		float t = (length > 0.0f) ? vec3f_dot(vec3f_sub(p, from), edge) / length : 0.0f;
+
+		t = fminf(fmaxf(t, 0.0f), 1.0f);
+		distance = fminf(distance, vec3f_length(vec3f_sub(p, vec3f_add(from, vec3f_mult_c(edge, t)))));
+	}
+
+	return distance;
+}
+
+/* Наибольшее и среднеквадратичное расстояние от вершин сетки from до поверхности сетки to */
+static float max_distance(const mesh_t *from, const mesh_t *to, float *rms)
+{
+	float result = 0.0f;
+	double sum = 0.0;
+
+	for(unsigned v = 0; v < from->num_vertices; v++) {
+		float distance = INFINITY;
+
+		for(unsigned t = 0; t < to->num_triangles && distance > 0.0f; t++) {
+			const unsigned *indices = to->triangles[t].indices;
+
+			distance = fminf(distance, point_triangle_distance(from->vertices[v], to->vertices[indices[0]],
+															   to->vertices[indices[1]], to->vertices[indices[2]]));
+		}
+
+		result = fmaxf(result, distance);
+		sum += distance * distance;
+	}
+
+	*rms = sqrtf(sum / from->num_vertices);
+
+	return result;
+}
+
+static void check_field(int type, float max_error, int euler)
+{
+	vector3ui volume_size = vec3ui(SIZE, SIZE, SIZE), grid_size = volume_size;
+	float *volume = create_volume(volume_size, type);
+	mesh_t mesh, decimated;
+
+	marching_cubes_invalidate();
+	CHECK(marching_cubes_create_mesh(volume, volume_size, grid_size, 0.0f, &mesh.vertices, &mesh.num_vertices,
+									 &mesh.triangles, &mesh.num_triangles));
+	CHECK_MSG(check_closed_manifold(&mesh) == euler, "field %i: extracted mesh", type);
+
+	CHECK(mesh_decimate(mesh.vertices, mesh.num_vertices, mesh.triangles, mesh.num_triangles,
+						mesh.num_triangles / 10, max_error, &decimated.vertices, &decimated.num_vertices,
+						&decimated.triangles, &decimated.num_triangles));
+
+	CHECK_MSG(check_closed_manifold(&decimated) == euler, "field %i: decimated mesh", type);
+	CHECK_MSG(decimated.num_triangles < mesh.num_triangles / 2, "field %i: %u -> %u triangles", type,
+			  mesh.num_triangles, decimated.num_triangles);
+
+	float rms, distance = max_distance(&mesh, &decimated, &rms);
+
+	printf("field %i: %u -> %u triangles, distance rms %g, max %g (max_error %g)\n", type, mesh.num_triangles,
+		   decimated.num_triangles, rms, distance, max_error);
+
+	CHECK_MSG(rms <= max_error, "field %i: rms distance %g > max_error %g", type, rms, max_error);
+	CHECK_MSG(distance <= 3.0f * max_error, "field %i: distance %g > 3 * max_error %g", type, distance, max_error);
+
+	free(volume);
+}
+
+int main()
+{
+	TEST_INIT();
+
+	thread_pool_set_num_threads(2);
+
+	// ошибка - в координатах вершин ([0, 1]), шаг сетки - 1/SIZE
+	check_field(0, 0.1f / SIZE, 2);
+	check_field(1, 0.1f / SIZE, 0);
+	check_field(0, 0.5f / SIZE, 2);
+	check_field(1, 0.5f / SIZE, 0);
+	// плоские грани упрощаются и при почти нулевой ошибке
+	check_field(2, 1e-5f, 2);
+
+	mesh_decimate_release();
+	thread_pool_destroy();
+
+	return 0;
+}
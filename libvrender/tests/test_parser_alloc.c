@@ -0,0 +1,192 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Вычисление скомпилированной функции не обращается к куче: malloc и остальные
+ * функции выделения памяти подменяются счётчиками (glibc), функция вычисляется
+ * по точкам слоя (интерпретатором и JIT), строками, слоем и через parser_parse_text
+ */
+
+#include <string.h>
+#include "common_test.h"
+#include "parser.h"
+
+#ifdef __GLIBC__
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+static int is_counting = 0;
+static unsigned num_calls = 0;
+
+#define COUNT_CALL() if(__atomic_load_n(&is_counting, __ATOMIC_RELAXED)) \
+						__atomic_add_fetch(&num_calls, 1, __ATOMIC_RELAXED)
+
+void *malloc(size_t size)
+{
+	COUNT_CALL();
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+	COUNT_CALL();
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	COUNT_CALL();
+	return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+	COUNT_CALL();
+	*ptr = __libc_memalign(alignment, size);
+	return *ptr ? 0 : 12;
+}
+
+void free(void *ptr)
+{
+	COUNT_CALL();
+	__libc_free(ptr);
+}
+
+#define SIZE 64
+
+// пользовательские переменные, цикл, ветвление и функции
+static const char *func =
+	"a = x * 0.5;\n"
+	"b = 1..8: sin(a + i) * y;\n"
+	"d = (x > 20 ? a : b) + sqrt(x*x + y*y + z*z) - 10 + 1 / (y + 1);\n";
+
+static float result[SIZE * SIZE];
+
+static void start_counting()
+{
+	num_calls = 0;
+	__atomic_store_n(&is_counting, 1, __ATOMIC_RELAXED);
+}
+
+static unsigned stop_counting()
+{
+	__atomic_store_n(&is_counting, 0, __ATOMIC_RELAXED);
+	return num_calls;
+}
+
+static void eval_points(const parser_program_t *program, float z)
+{
+	float registers[MAX_NUM_REGISTERS];
+
+	for(unsigned j = 0; j < SIZE; j++)
+		for(unsigned i = 0; i < SIZE; i++) {
+			registers[PARSER_REG_X] = i;
+			registers[PARSER_REG_Y] = j;
+			registers[PARSER_REG_Z] = z;
+
+			CHECK(parser_program_eval(program, registers) == 0);
+			result[i + j * SIZE] = registers[PARSER_REG_D];
+		}
+}
+
+static void eval_rows(const parser_program_t *program, float z)
+{
+	for(unsigned j = 0; j < SIZE; j++)
+		CHECK(parser_program_eval_row(program, 0.0f, j, z, SIZE, &result[j * SIZE]) == 0);
+}
+
+static void eval_text(parser_t *parser, float z)
+{
+	float_var_value_t var_table[] = {{1, 0.0f}, {2, 0.0f}, {3, 0.0f}, {4, 0.0f}, {0, 0.0f}};
+
+	for(unsigned j = 0; j < SIZE; j++)
+		for(unsigned i = 0; i < SIZE; i++) {
+			var_table[0].value = 0.0f;
+			var_table[1].value = i;
+			var_table[2].value = j;
+			var_table[3].value = z;
+
+			CHECK(parser_parse_text(parser, func, var_table) == 0);
+			result[i + j * SIZE] = var_table[0].value;
+		}
+}
+
+int main()
+{
+	parser_t parser, text_parser;
+	parser_program_t program;
+
+	TEST_INIT();
+
+	parser_create(&parser);
+	parser_create(&text_parser);
+
+	// счётчик видит вызовы библиотеки (компиляция выделяет память)
+	start_counting();
+	CHECK(parser_compile(&parser, func, &program) == 0);
+	CHECK(stop_counting() > 0);
+
+	// первое вычисление parser_parse_text компилирует функцию
+	eval_text(&text_parser, 0.0f);
+
+	for(int jit = 0; jit <= 1; jit++) {
+		parser_set_jit(jit);
+
+		for(unsigned k = 1; k < 4; k++) {
+			start_counting();
+			eval_points(&program, k);
+			CHECK_MSG(stop_counting() == 0, "parser_program_eval (jit = %i): %u calls", jit, num_calls);
+
+			start_counting();
+			eval_rows(&program, k);
+			CHECK_MSG(stop_counting() == 0, "parser_program_eval_row (jit = %i): %u calls", jit, num_calls);
+
+			start_counting();
+			CHECK(parser_program_eval_slice(&program, 0.0f, 0.0f, k, SIZE, SIZE, SIZE, result) == 0);
+			CHECK_MSG(stop_counting() == 0, "parser_program_eval_slice (jit = %i): %u calls", jit, num_calls);
+
+			start_counting();
+			eval_text(&text_parser, k);
+			CHECK_MSG(stop_counting() == 0, "parser_parse_text (jit = %i): %u calls", jit, num_calls);
+		}
+	}
+
+	parser_set_jit(1);
+
+	parser_program_destroy(&program);
+	parser_clean(&text_parser);
+	parser_clean(&parser);
+
+	printf("no heap calls during evaluation\n");
+
+	return 0;
+}
+
+#else /* __GLIBC__ */
+
+int main()
+{
+	printf("malloc interposition needs glibc, skipped\n");
+	return 0;
+}
+
+#endif /* __GLIBC__ */
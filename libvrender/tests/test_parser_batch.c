@@ -0,0 +1,109 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Пакетное вычисление (parser_program_eval_row, parser_program_eval_slice) совпадает
+ * с вычислением по точкам (parser_program_eval, интерпретатор и JIT) бит в бит,
+ * в т.ч. для точек с ошибкой (0), ?: с разными условиями и циклов
+ */
+
+#include <string.h>
+#include "common_test.h"
+#include "parser.h"
+
+#define SIZE_X 37
+#define SIZE_Y 9
+
+static const char *funcs[] = {
+	// умножения со сложениями (FMA изменил бы результат)
+	"d = x * 1.1 + y * 2.3 + z * 3.7 - x*x*0.013;",
+	"d = lerp(x, y, z * 0.01) + dot2(x, y, 0.3, 0.7) + dot3(x, y, z, 1.1, 2.3, 3.7);",
+	"d = distance3(x, y, z, 10.3, 20.7, 3.1) - length2(x * 0.3, y) + length3(x, y, z) * 0.1;",
+	// ?: с разными для точек условиями
+	"a = x*0.37 + y*1.3; d = x > 3 ? a*a - z : sqrt(abs(a)) * 1.7 + clamp(y, 1, 5);",
+	"d = (x < 0 ? sin(x) : x > 10 ? cos(x) * y : x*z) + min(x, y) * max(y, z);",
+	// циклы с одинаковыми и разными для точек границами
+	"d = 1..5: x*i*0.1 + y*z;",
+	"d = 0..y: x*0.5 + i*0.25;",
+	"d = 0..x/8: x*0.5 + i*z;",
+	// деление на ноль в одной точке строки
+	"d = 1 / (x - 3) + y;",
+	NULL
+};
+
+static float row[SIZE_X * SIZE_Y], slice[SIZE_X * SIZE_Y];
+
+/* Совпадают ли числа бит в бит */
+static int same_bits(float a, float b)
+{
+	return memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+static void check_function(const char *func, float x0, float y0, float z)
+{
+	parser_t parser;
+	parser_program_t program;
+	float registers[MAX_NUM_REGISTERS];
+
+	parser_create(&parser);
+	CHECK_MSG(parser_compile(&parser, func, &program) == 0, "%s", func);
+
+	for(unsigned j = 0; j < SIZE_Y; j++)
+		parser_program_eval_row(&program, x0, y0 + j, z, SIZE_X, &row[j * SIZE_X]);
+
+	parser_program_eval_slice(&program, x0, y0, z, SIZE_X, SIZE_Y, SIZE_X, slice);
+
+	for(int jit = 0; jit <= 1; jit++) {
+		parser_set_jit(jit);
+
+		for(unsigned j = 0; j < SIZE_Y; j++)
+			for(unsigned i = 0; i < SIZE_X; i++) {
+				registers[PARSER_REG_X] = x0 + i;
+				registers[PARSER_REG_Y] = y0 + j;
+				registers[PARSER_REG_Z] = z;
+
+				// точки с ошибкой пакетные функции заполняют 0
+				float expected = (parser_program_eval(&program, registers) == 0) ? registers[PARSER_REG_D] : 0.0f;
+				unsigned index = i + j * SIZE_X;
+
+				CHECK_MSG(same_bits(row[index], expected), "%s (%f, %f, %f) jit = %i: row %.9g, scalar %.9g",
+						  func, x0 + i, y0 + j, z, jit, row[index], expected);
+				CHECK_MSG(same_bits(slice[index], expected), "%s (%f, %f, %f) jit = %i: slice %.9g, scalar %.9g",
+						  func, x0 + i, y0 + j, z, jit, slice[index], expected);
+			}
+	}
+
+	parser_set_jit(1);
+
+	parser_program_destroy(&program);
+	parser_clean(&parser);
+}
+
+int main()
+{
+	TEST_INIT();
+
+	for(unsigned f = 0; funcs[f]; f++) {
+		check_function(funcs[f], 0.0f, 0.0f, 1.0f);
+		check_function(funcs[f], -11.25f, 3.5f, 7.75f);
+	}
+
+	printf("row, slice and scalar results are identical\n");
+
+	return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Машинный код JIT вычисляет то же, что и интерпретатор: значения d (бит в бит)
+ * и коды ошибок совпадают для ?:, циклов, деления на ноль, ошибки 18 (слишком
+ * длинный цикл); программа больше допустимого не компилируется (ошибка 17)
+ */
+
+#include <string.h>
+#include "common_test.h"
+#include "parser.h"
+
+#define SIZE 12
+
+static const char *funcs[] = {
+	"d = x * 1.1 + y * 2.3 - z / 3.7 + x**3 - 2**y + 4!;",
+	"a = x - 5; b = y * a; d = sin(a) * cos(b) + sqrt(abs(a*b)) + floor(x / 3) + atan(y - z);",
+	"d = vnoise3(x * 0.3, y * 0.3, z * 0.3) + snoise2(x * 0.1, y) + pnoise3(x, y, z) * 0.5;",
+	// ?: с разными для точек условиями, вложенные
+	"d = x > 5 ? (y < 3 ? x*y : y - x) : (z == 2 ? 1 : x == y ? 7 : 0 - x);",
+	"a = x > y; b = x < z; d = a ? b ? 1 : 2 : b ? 3 : 4;",
+	// циклы: вложенные, с обратным шагом, дробными и зависящими от точки границами
+	"d = 1..4: (0..i: x * i + y);",
+	"d = y..x: i * z - 0.5;",
+	"d = 0.7..x/2.5: sin(i + y) * z;",
+	"a = 2; d = 1..3: a = a * x; d = d + a;",
+	// деление на ноль (ошибка 15) и без проверки (/ от 0 деления на ноль нет)
+	"d = 1 / (x - y) + z;",
+	"d = x > 3 ? 1 / (x - 7) : 0;",
+	// ошибка 18: граница больше MAX_LOOP_BOUND, NaN, больше MAX_LOOP_ITERATIONS итераций
+	"d = 0..(x > 8 ? 20000000 : x): i;",
+	"d = 0..sqrt(y - 4): i + x;",
+	"d = 0..x*10000: 1;",
+	NULL
+};
+
+static int same_bits(float a, float b)
+{
+	return memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+static int eval(const parser_program_t *program, int jit, float x, float y, float z, float *d)
+{
+	float registers[MAX_NUM_REGISTERS];
+
+	registers[PARSER_REG_X] = x;
+	registers[PARSER_REG_Y] = y;
+	registers[PARSER_REG_Z] = z;
+
+	parser_set_jit(jit);
+	int error = parser_program_eval(program, registers);
+	*d = registers[PARSER_REG_D];
+
+	return error;
+}
+
+static void check_function(parser_t *parser, const char *func, unsigned *num_errors)
+{
+	parser_program_t program;
+
+	CHECK_MSG(parser_compile(parser, func, &program) == 0, "%s", func);
+	CHECK_MSG(program.jit_code != NULL, "%s: no machine code", func);
+
+	for(unsigned k = 0; k < SIZE; k++)
+		for(unsigned j = 0; j < SIZE; j++)
+			for(unsigned i = 0; i < SIZE; i++) {
+				float interp_d, jit_d;
+				int interp_error = eval(&program, 0, i, j, k, &interp_d);
+				int jit_error = eval(&program, 1, i, j, k, &jit_d);
+
+				CHECK_MSG(interp_error == jit_error, "%s (%u, %u, %u): error %i, jit %i",
+						  func, i, j, k, interp_error, jit_error);
+				CHECK_MSG(interp_error != 0 || same_bits(interp_d, jit_d), "%s (%u, %u, %u): d = %.9g, jit %.9g",
+						  func, i, j, k, interp_d, jit_d);
+
+				if(interp_error != 0)
+					num_errors[interp_error]++;
+			}
+
+	parser_program_destroy(&program);
+}
+
+int main()
+{
+	parser_t parser;
+	parser_program_t program;
+	unsigned num_errors[256] = {0};
+
+	TEST_INIT();
+
+	if(!parser_set_jit(1)) {
+		printf("JIT is not available, skipped\n");
+		return 0;
+	}
+
+	parser_create(&parser);
+
+	for(unsigned f = 0; funcs[f]; f++)
+		check_function(&parser, funcs[f], num_errors);
+
+	// ошибки выполнения действительно проверены
+	CHECK(num_errors[15] > 0);
+	CHECK(num_errors[18] > 0);
+
+	// программа из MAX_NUM_TOKENS токенов ещё компилируется, больше - ошибка 17
+	char text[MAX_NUM_TOKENS * 4 + 16] = "d = x";
+
+	for(unsigned t = 3; t + 2 < MAX_NUM_TOKENS; t += 2)
+		strcat(text, "+x");
+
+	strcat(text, ";");
+
+	CHECK(parser_compile(&parser, text, &program) == 0);
+	parser_program_destroy(&program);
+
+	strcat(text, "d = x;");
+
+	CHECK(parser_compile(&parser, text, &program) == 17);
+
+	parser_set_jit(1);
+	parser_clean(&parser);
+
+	printf("interpreter and JIT results are identical\n");
+
+	return 0;
+}
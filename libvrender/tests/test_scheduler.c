@@ -0,0 +1,152 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Каждая задача планировщика выполняется ровно один раз при неравномерных задачах
+ * и воровстве: потоки без пула вызывают scheduler_next одновременно, и интервалы
+ * очередей (next и end в одном 64-битном слове) меняются владельцем и ворами конкурентно.
+ * Отдельно проверяется воровство в одном потоке: опустошивший свою очередь поток
+ * забирает задачи остальных
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include "common_test.h"
+#include "scheduler.h"
+
+#define NUM_TASKS 4000
+#define NUM_RUNS 20
+
+typedef struct {
+	scheduler_t scheduler;
+	unsigned runs[NUM_TASKS];
+} test_job_t;
+
+typedef struct {
+	test_job_t *job;
+	unsigned thread;
+} test_thread_t;
+
+/* Неравномерная задача: первые задачи (очередь потока 0) в десятки раз дольше остальных */
+static void run_task(test_job_t *job, unsigned task)
+{
+	volatile unsigned sum = 0;
+	unsigned work = (task < NUM_TASKS / 8) ? 20000 : 200 + (task * 7919) % 500;
+
+	for(unsigned i = 0; i < work; i++)
+		sum += i;
+
+	__atomic_add_fetch(&job->runs[task], 1, __ATOMIC_RELAXED);
+}
+
+static void *test_thread(void *arg)
+{
+	test_thread_t *thread = (test_thread_t*) arg;
+	unsigned task;
+
+	while(scheduler_next(&thread->job->scheduler, thread->thread, &task)) {
+		CHECK(task < NUM_TASKS);
+		run_task(thread->job, task);
+	}
+
+	return NULL;
+}
+
+/* Все задачи выполнены ровно один раз, возвращает кол-во краж */
+static unsigned check_job(test_job_t *job)
+{
+	unsigned num_steals = 0, num_tasks = 0;
+
+	for(unsigned i = 0; i < NUM_TASKS; i++)
+		CHECK_MSG(job->runs[i] == 1, "task %u executed %u times (%u threads)", i, job->runs[i],
+				  job->scheduler.num_threads);
+
+	for(unsigned t = 0; t < job->scheduler.num_threads; t++) {
+		num_steals += job->scheduler.queues[t].num_steals;
+		num_tasks += job->scheduler.queues[t].num_tasks;
+	}
+
+	CHECK(num_tasks == NUM_TASKS);
+
+	return num_steals;
+}
+
+/* Задачи, выполняемые num_threads потоками одновременно */
+static void test_threads(unsigned num_threads)
+{
+	static test_job_t job;
+	pthread_t threads[SCHEDULER_MAX_THREADS];
+	test_thread_t args[SCHEDULER_MAX_THREADS];
+	unsigned num_steals = 0;
+
+	for(unsigned run = 0; run < NUM_RUNS; run++) {
+		memset(job.runs, 0, sizeof(job.runs));
+		CHECK(scheduler_create(&job.scheduler, num_threads, NUM_TASKS));
+
+		for(unsigned t = 0; t < num_threads; t++) {
+			args[t].job = &job;
+			args[t].thread = t;
+			CHECK(pthread_create(&threads[t], NULL, test_thread, &args[t]) == 0);
+		}
+
+		for(unsigned t = 0; t < num_threads; t++)
+			CHECK(pthread_join(threads[t], NULL) == 0);
+
+		num_steals += check_job(&job);
+		scheduler_destroy(&job.scheduler);
+	}
+
+	// поток 0 получил долгие задачи, их забирают остальные
+	if(num_threads > 1)
+		CHECK_MSG(num_steals > 0, "no steals with %u threads", num_threads);
+
+	printf("%u threads: %u steals in %u runs\n", num_threads, num_steals, NUM_RUNS);
+}
+
+/* Последний поток выполняет все задачи сам: свою очередь, затем чужие кражами */
+static void test_single_thief(unsigned num_threads)
+{
+	static test_job_t job;
+	test_thread_t arg = {&job, num_threads - 1};
+
+	memset(job.runs, 0, sizeof(job.runs));
+	CHECK(scheduler_create(&job.scheduler, num_threads, NUM_TASKS));
+
+	test_thread(&arg);
+
+	CHECK(job.scheduler.queues[num_threads - 1].num_tasks == NUM_TASKS);
+	CHECK(check_job(&job) >= num_threads - 1);
+
+	scheduler_destroy(&job.scheduler);
+}
+
+int main(void)
+{
+	static const unsigned thread_counts[] = {1, 2, 3, 4, 7, 13};
+
+	TEST_INIT();
+
+	for(unsigned n = 0; n < sizeof(thread_counts) / sizeof(thread_counts[0]); n++) {
+		test_single_thief(thread_counts[n]);
+		test_threads(thread_counts[n]);
+	}
+
+	printf("scheduler: every task executed once\n");
+
+	return 0;
+}
@@ -0,0 +1,250 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Surface Nets: сетка замкнутой поверхности (сфера, тор) замкнута и согласованно
+ * ориентирована - у каждого направленного ребра есть обратное столько же раз.
+ * Кол-ва вершин и треугольников прохода подсчёта совпадают с заполненными проходом
+ * построения при 1, 2, 4 и 7 потоках пула (проходы пропускают однородные строки
+ * по разным признакам: surface_nets_uniform8 и surface_nets_same8), а сетка не зависит
+ * от кол-ва потоков
+ */
+
+#include <math.h>
+#include <string.h>
+#include "common_test.h"
+#include "surface_nets.h"
+#include "thread_pool.h"
+
+typedef float (*field_func_t)(float x, float y, float z, float size);
+
+static float sphere_field(float x, float y, float z, float size)
+{
+	return sqrtf(x*x + y*y + z*z) - size * 0.37f;
+}
+
+static float torus_field(float x, float y, float z, float size)
+{
+	float ring = sqrtf(x*x + y*y) - size * 0.27f;
+
+	return sqrtf(ring*ring + z*z) - size * 0.11f;
+}
+
+/* Открытая поверхность, пересекающая границы объёма */
+static float sine_field(float x, float y, float z, float size)
+{
+	return z - size * 0.2f * sinf(x * 0.21f) * cosf(y * 0.17f);
+}
+
+static float *create_volume(vector3ui size, field_func_t field)
+{
+	float *volume = (float*) malloc(sizeof(float) * size.x * size.y * size.z);
+
+	CHECK(volume);
+
+	for(unsigned k = 0; k < size.z; k++)
+		for(unsigned j = 0; j < size.y; j++)
+			for(unsigned i = 0; i < size.x; i++)
+				volume[i + (j + k*size.y)*size.x] = field(i - (size.x - 1) * 0.5f, j - (size.y - 1) * 0.5f,
+														  k - (size.z - 1) * 0.5f, size.x);
+
+	return volume;
+}
+
+static int compare_edges(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+
+	return (x > y) - (x < y);
+}
+
+/* Кол-во рёбер edge в упорядоченном массиве */
+static unsigned count_edge(const uint64_t *edges, unsigned count, uint64_t edge)
+{
+	unsigned first = 0, last = count;
+
+	while(first < last) {
+		unsigned middle = (first + last) / 2;
+
+		if(edges[middle] < edge)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+
+	for(last = first; last < count && edges[last] == edge; last++);
+
+	return last - first;
+}
+
+/* Каждое направленное ребро (a, b) встречается столько же раз, сколько (b, a) */
+static void check_closed(const triangle_t *triangles, unsigned n_triangles, unsigned n_vertices)
+{
+	unsigned num_edges = n_triangles * 3;
+	uint64_t *edges = (uint64_t*) malloc(sizeof(uint64_t) * num_edges);
+
+	CHECK(edges && n_triangles > 0);
+
+	for(unsigned t = 0; t < n_triangles; t++)
+		for(unsigned e = 0; e < 3; e++) {
+			unsigned a = triangles[t].indices[e], b = triangles[t].indices[(e + 1) % 3];
+
+			CHECK(a < n_vertices && b < n_vertices && a != b);
+			edges[t*3 + e] = ((uint64_t) a << 32) | b;
+		}
+
+	qsort(edges, num_edges, sizeof(uint64_t), compare_edges);
+
+	for(unsigned n = 0; n < num_edges; ) {
+		unsigned count = count_edge(edges, num_edges, edges[n]);
+		uint64_t reverse = (edges[n] << 32) | (edges[n] >> 32);
+
+		CHECK_MSG(count_edge(edges, num_edges, reverse) == count, "edge %u-%u used %u times, reverse %u times",
+				  (unsigned) (edges[n] >> 32), (unsigned) edges[n], count, count_edge(edges, num_edges, reverse));
+		n += count;
+	}
+
+	free(edges);
+}
+
+/* Память выходных буферов до заполнения (вершины - NaN, индексы - 0xffffffff) */
+#define SENTINEL 0xff
+
+static int is_sentinel(const void *ptr, size_t size)
+{
+	const unsigned char *bytes = (const unsigned char*) ptr;
+
+	for(size_t i = 0; i < size; i++)
+		if(bytes[i] != SENTINEL)
+			return 0;
+
+	return 1;
+}
+
+/*
+ * surface_nets_create в буферы максимального размера: заполнены ровно подсчитанные
+ * элементы, каждая вершина используется, сетка совпадает с surface_nets_create_mesh
+ */
+static void check_counts(const float *volume, vector3ui volume_size, vector3ui grid_size,
+						 vector3f *vertices, triangle_t *triangles, unsigned max_vertices, unsigned max_triangles)
+{
+	const vector3f *mesh_vertices;
+	const triangle_t *mesh_triangles;
+	unsigned n_vertices, n_triangles, mesh_n_vertices, mesh_n_triangles;
+
+	memset(vertices, SENTINEL, sizeof(vector3f) * max_vertices);
+	memset(triangles, SENTINEL, sizeof(triangle_t) * max_triangles);
+
+	CHECK(surface_nets_create(volume, volume_size, grid_size, 0.0f, vertices, &n_vertices,
+							  triangles, &n_triangles) == 1);
+
+	// кол-ва на 1 больше, как у marching_cubes_create
+	n_vertices--;
+	n_triangles--;
+
+	CHECK(n_vertices > 0 && n_vertices <= max_vertices && n_triangles <= max_triangles);
+	CHECK(is_sentinel(vertices + n_vertices, sizeof(vector3f) * (max_vertices - n_vertices)));
+	CHECK(is_sentinel(triangles + n_triangles, sizeof(triangle_t) * (max_triangles - n_triangles)));
+
+	unsigned char *used = (unsigned char*) calloc(n_vertices, 1);
+
+	CHECK(used);
+
+	for(unsigned t = 0; t < n_triangles; t++)
+		for(unsigned e = 0; e < 3; e++) {
+			CHECK_MSG(triangles[t].indices[e] < n_vertices, "triangle %u of %u", t, n_triangles);
+			used[triangles[t].indices[e]] = 1;
+		}
+
+	for(unsigned v = 0; v < n_vertices; v++)
+		CHECK_MSG(used[v] && !isnan(vertices[v].x), "vertex %u of %u", v, n_vertices);
+
+	free(used);
+
+	CHECK(surface_nets_create_mesh(volume, volume_size, grid_size, 0.0f, &mesh_vertices, &mesh_n_vertices,
+								   &mesh_triangles, &mesh_n_triangles));
+	CHECK(mesh_n_vertices == n_vertices && mesh_n_triangles == n_triangles);
+	CHECK(memcmp(mesh_vertices, vertices, sizeof(vector3f) * n_vertices) == 0);
+	CHECK(memcmp(mesh_triangles, triangles, sizeof(triangle_t) * n_triangles) == 0);
+}
+
+/* Сетка поля field при разном кол-ве потоков */
+static void test_field(const char *name, field_func_t field, vector3ui volume_size, vector3ui grid_size, int is_closed)
+{
+	static const unsigned thread_counts[] = {1, 2, 4, 7};
+	float *volume = create_volume(volume_size, field);
+	unsigned max_vertices = grid_size.x * grid_size.y * grid_size.z, max_triangles = max_vertices * 6;
+	vector3f *vertices = (vector3f*) malloc(sizeof(vector3f) * max_vertices);
+	vector3f *first_vertices = (vector3f*) malloc(sizeof(vector3f) * max_vertices);
+	triangle_t *triangles = (triangle_t*) malloc(sizeof(triangle_t) * max_triangles);
+	triangle_t *first_triangles = (triangle_t*) malloc(sizeof(triangle_t) * max_triangles);
+	const vector3f *mesh_vertices;
+	const triangle_t *mesh_triangles;
+	unsigned n_vertices = 0, n_triangles = 0;
+
+	CHECK(vertices && first_vertices && triangles && first_triangles);
+
+	for(unsigned n = 0; n < sizeof(thread_counts) / sizeof(thread_counts[0]); n++) {
+		thread_pool_set_num_threads(thread_counts[n]);
+
+		check_counts(volume, volume_size, grid_size, vertices, triangles, max_vertices, max_triangles);
+		CHECK(surface_nets_create_mesh(volume, volume_size, grid_size, 0.0f, &mesh_vertices, &n_vertices,
+									   &mesh_triangles, &n_triangles));
+
+		// сетка не зависит от кол-ва потоков
+		if(n == 0) {
+			memcpy(first_vertices, mesh_vertices, sizeof(vector3f) * n_vertices);
+			memcpy(first_triangles, mesh_triangles, sizeof(triangle_t) * n_triangles);
+		} else {
+			CHECK_MSG(memcmp(first_vertices, mesh_vertices, sizeof(vector3f) * n_vertices) == 0,
+					  "%s: %u threads", name, thread_counts[n]);
+			CHECK_MSG(memcmp(first_triangles, mesh_triangles, sizeof(triangle_t) * n_triangles) == 0,
+					  "%s: %u threads", name, thread_counts[n]);
+		}
+	}
+
+	if(is_closed)
+		check_closed(mesh_triangles, n_triangles, n_vertices);
+
+	printf("%s: %ux%ux%u grid, %u vertices, %u triangles\n", name, grid_size.x, grid_size.y, grid_size.z,
+		   n_vertices, n_triangles);
+
+	free(first_triangles);
+	free(triangles);
+	free(first_vertices);
+	free(vertices);
+	free(volume);
+}
+
+int main(void)
+{
+	TEST_INIT();
+
+	// размеры не кратны 8 (хвосты строк проходов), в последнем случае шаг сетки 2 узла поля
+	test_field("sphere", sphere_field, vec3ui(64, 64, 64), vec3ui(64, 64, 64), 1);
+	test_field("sphere", sphere_field, vec3ui(61, 70, 67), vec3ui(61, 70, 67), 1);
+	test_field("torus", torus_field, vec3ui(77, 77, 45), vec3ui(77, 77, 45), 1);
+	test_field("torus", torus_field, vec3ui(122, 122, 122), vec3ui(61, 61, 61), 1);
+	test_field("sine", sine_field, vec3ui(75, 66, 59), vec3ui(75, 66, 59), 0);
+
+	thread_pool_destroy();
+
+	printf("surface nets: closed oriented meshes, counts match the filled mesh\n");
+
+	return 0;
+}
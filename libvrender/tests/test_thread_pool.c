@@ -0,0 +1,235 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Пул потоков: каждая задача работы выполняется ровно один раз, номер потока меньше
+ * кол-ва потоков работы и один поток не выполняет две задачи работы одновременно -
+ * при работах, отправленных из нескольких потоков сразу (поток построения сетки
+ * и поток отрисовки), при смене кол-ва потоков между работами и во время работ,
+ * и при thread_pool_destroy, вызванном, пока работы ещё в очереди
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include "common_test.h"
+#include "thread_pool.h"
+
+#define NUM_TASKS 1000
+#define NUM_SUBMITTERS 3
+#define NUM_ROUNDS 200
+
+typedef struct {
+	unsigned runs[NUM_TASKS];
+	// выполняет ли поток работы задачу
+	int busy[SCHEDULER_MAX_THREADS];
+	unsigned num_threads;
+} test_job_t;
+
+static void test_task(void *data, unsigned thread, unsigned task)
+{
+	test_job_t *job = (test_job_t*) data;
+	volatile unsigned sum = 0;
+
+	CHECK(thread < job->num_threads && task < NUM_TASKS);
+	CHECK_MSG(!__atomic_exchange_n(&job->busy[thread], 1, __ATOMIC_ACQ_REL), "thread %u runs two tasks", thread);
+
+	for(unsigned i = 0; i < (task % 13) * 100; i++)
+		sum += i;
+
+	__atomic_add_fetch(&job->runs[task], 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&job->busy[thread], 0, __ATOMIC_RELEASE);
+}
+
+/* Начать работу: num_threads - верхняя граница номеров потоков */
+static void submit_job(thread_pool_job_t *pool_job, test_job_t *job, unsigned num_threads)
+{
+	memset(job, 0, sizeof(*job));
+	job->num_threads = num_threads;
+
+	CHECK(thread_pool_submit(pool_job, test_task, job, NUM_TASKS));
+	CHECK(pool_job->scheduler.num_threads <= num_threads);
+}
+
+/* Дождаться работы и проверить, что все задачи выполнены один раз */
+static void finish_job(thread_pool_job_t *pool_job, test_job_t *job)
+{
+	thread_pool_wait(pool_job);
+
+	for(unsigned i = 0; i < NUM_TASKS; i++)
+		CHECK_MSG(job->runs[i] == 1, "task %u executed %u times", i, job->runs[i]);
+
+	thread_pool_release(pool_job);
+}
+
+static void *submitter_thread(void *arg)
+{
+	(void) arg;
+
+	for(unsigned round = 0; round < NUM_ROUNDS; round++) {
+		thread_pool_job_t pool_job;
+		test_job_t job;
+
+		submit_job(&pool_job, &job, SCHEDULER_MAX_THREADS);
+		finish_job(&pool_job, &job);
+	}
+
+	return NULL;
+}
+
+/* Работы из нескольких потоков одновременно, в том числе при смене кол-ва потоков пула */
+static void test_concurrent(void)
+{
+	static const unsigned sizes[] = {4, 1, 3, 7, 2};
+	pthread_t threads[NUM_SUBMITTERS];
+
+	thread_pool_set_num_threads(4);
+
+	for(unsigned t = 0; t < NUM_SUBMITTERS; t++)
+		CHECK(pthread_create(&threads[t], NULL, submitter_thread, NULL) == 0);
+
+	for(unsigned round = 0; round < NUM_ROUNDS; round++) {
+		thread_pool_job_t pool_job;
+		static test_job_t job;
+
+		thread_pool_set_num_threads(sizes[round % (sizeof(sizes) / sizeof(sizes[0]))]);
+		submit_job(&pool_job, &job, SCHEDULER_MAX_THREADS);
+		finish_job(&pool_job, &job);
+	}
+
+	for(unsigned t = 0; t < NUM_SUBMITTERS; t++)
+		CHECK(pthread_join(threads[t], NULL) == 0);
+}
+
+/* Кол-во потоков меняется между работами; во время работы - со следующей после неё */
+static void test_resize(void)
+{
+	static const unsigned sizes[] = {1, 3, 2, 5, 1, 8, 4};
+	static test_job_t job, other;
+	thread_pool_job_t pool_job, other_job;
+
+	for(unsigned n = 0; n < sizeof(sizes) / sizeof(sizes[0]); n++) {
+		thread_pool_set_num_threads(sizes[n]);
+		submit_job(&pool_job, &job, sizes[n]);
+		CHECK(pool_job.scheduler.num_threads == sizes[n]);
+		CHECK(pool_job.caller == sizes[n] - 1);
+		finish_job(&pool_job, &job);
+	}
+
+	// пока первая работа не дождана, потоки не перезапускаются
+	thread_pool_set_num_threads(2);
+	submit_job(&pool_job, &job, 2);
+	thread_pool_set_num_threads(6);
+	submit_job(&other_job, &other, 2);
+	CHECK(other_job.scheduler.num_threads == 2);
+	finish_job(&other_job, &other);
+	finish_job(&pool_job, &job);
+
+	submit_job(&pool_job, &job, 6);
+	CHECK(pool_job.scheduler.num_threads == 6);
+	finish_job(&pool_job, &job);
+}
+
+typedef struct {
+	thread_pool_job_t pool_job;
+	test_job_t job;
+	// работа отправлена, и её ожидание разрешено
+	int is_submitted, can_wait;
+} queued_job_t;
+
+static void *queued_thread(void *arg)
+{
+	queued_job_t *queued = (queued_job_t*) arg;
+
+	submit_job(&queued->pool_job, &queued->job, SCHEDULER_MAX_THREADS);
+	__atomic_store_n(&queued->is_submitted, 1, __ATOMIC_RELEASE);
+
+	while(!__atomic_load_n(&queued->can_wait, __ATOMIC_ACQUIRE))
+		sched_yield();
+
+	finish_job(&queued->pool_job, &queued->job);
+
+	return NULL;
+}
+
+static void *destroy_thread(void *arg)
+{
+	int *is_destroyed = (int*) arg;
+
+	thread_pool_destroy();
+	__atomic_store_n(is_destroyed, 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+/* thread_pool_destroy при отправленных работах ждёт, пока их дождутся, затем пул снова работает */
+static void test_destroy_queued(void)
+{
+	static queued_job_t queued[2];
+	pthread_t threads[2], destroyer;
+	int is_destroyed = 0;
+
+	thread_pool_set_num_threads(3);
+	memset(queued, 0, sizeof(queued));
+
+	for(unsigned t = 0; t < 2; t++) {
+		CHECK(pthread_create(&threads[t], NULL, queued_thread, &queued[t]) == 0);
+
+		while(!__atomic_load_n(&queued[t].is_submitted, __ATOMIC_ACQUIRE))
+			sched_yield();
+	}
+
+	CHECK(pthread_create(&destroyer, NULL, destroy_thread, &is_destroyed) == 0);
+
+	// не дождавшись работ, пул не останавливается
+	for(unsigned i = 0; i < 100; i++) {
+		sched_yield();
+		CHECK(!__atomic_load_n(&is_destroyed, __ATOMIC_ACQUIRE));
+	}
+
+	for(unsigned t = 0; t < 2; t++) {
+		__atomic_store_n(&queued[t].can_wait, 1, __ATOMIC_RELEASE);
+		CHECK(pthread_join(threads[t], NULL) == 0);
+	}
+
+	CHECK(pthread_join(destroyer, NULL) == 0);
+	CHECK(is_destroyed);
+
+	// после остановки работы выполняются вызывающим потоком
+	thread_pool_job_t pool_job;
+	static test_job_t job;
+
+	submit_job(&pool_job, &job, 1);
+	CHECK(pool_job.scheduler.num_threads == 1);
+	finish_job(&pool_job, &job);
+}
+
+int main(void)
+{
+	TEST_INIT();
+
+	test_resize();
+	test_concurrent();
+	test_destroy_queued();
+
+	thread_pool_destroy();
+
+	printf("thread pool: every task executed once\n");
+
+	return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ *  Copyright (C) 2012-2013 Evgeny Panov
+ *  This file is part of libvrender.
+ *
+ *  libvrender is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libvrender is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libvrender.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Обновление после правки поля на месте: пирамида, обновлённая по области
+ * (volume_pyramid_update_region), совпадает с построенной заново бит в бит, а сетка
+ * marching cubes после marching_cubes_invalidate_region - с построенной после
+ * marching_cubes_invalidate (в т.ч. когда правка создаёт поверхность в пустых блоках)
+ */
+
+#include <math.h>
+#include <string.h>
+#include "common_test.h"
+#include "volume_pyramid.h"
+#include "marching_cubes.h"
+#include "thread_pool.h"
+
+static float *create_volume(vector3ui size)
+{
+	float *volume = (float*) malloc(sizeof(float) * size.x * size.y * size.z);
+
+	CHECK(volume);
+
+	for(unsigned k = 0; k < size.z; k++)
+		for(unsigned j = 0; j < size.y; j++)
+			for(unsigned i = 0; i < size.x; i++) {
+				float x = i - size.x * 0.5f, y = j - size.y * 0.5f, z = k - size.z * 0.5f;
+
+				volume[i + (j + k*size.y)*size.x] = sqrtf(x*x + y*y + z*z) - size.x * 0.25f;
+			}
+
+	return volume;
+}
+
+/* Вдавить в поле шар радиуса radius с центром center (узлы [begin, end] вокруг него) */
+static void edit_volume(float *volume, vector3ui size, vector3ui center, unsigned radius,
+						vector3ui *begin, vector3ui *end)
+{
+	*begin = vec3ui((center.x > radius) ? center.x - radius : 0, (center.y > radius) ? center.y - radius : 0,
+					(center.z > radius) ? center.z - radius : 0);
+	*end = vec3ui(math_min(center.x + radius, size.x - 1), math_min(center.y + radius, size.y - 1),
+				  math_min(center.z + radius, size.z - 1));
+
+	for(unsigned k = begin->z; k <= end->z; k++)
+		for(unsigned j = begin->y; j <= end->y; j++)
+			for(unsigned i = begin->x; i <= end->x; i++) {
+				float x = (float) i - center.x, y = (float) j - center.y, z = (float) k - center.z;
+				float *value = &volume[i + (j + k*size.y)*size.x];
+				float ball = sqrtf(x*x + y*y + z*z) - radius * 0.8f;
+
+				if(ball < *value)
+					*value = ball;
+			}
+}
+
+static void check_pyramids(const volume_pyramid_t *a, const volume_pyramid_t *b)
+{
+	CHECK(a->num_levels == b->num_levels);
+
+	for(unsigned level = 1; level < a->num_levels; level++) {
+		vector3ui size = a->sizes[level];
+		size_t count = (size_t) size.x * size.y * size.z;
+
+		CHECK_MSG(memcmp(a->average[level], b->average[level], sizeof(float) * count) == 0, "level %u average", level);
+		CHECK_MSG(memcmp(a->min[level], b->min[level], sizeof(float) * count) == 0, "level %u min", level);
+		CHECK_MSG(memcmp(a->max[level], b->max[level], sizeof(float) * count) == 0, "level %u max", level);
+	}
+}
+
+static void check_pyramid_region(vector3ui size)
+{
+	float *volume = create_volume(size);
+	volume_pyramid_t updated, rebuilt;
+	vector3ui begin, end;
+
+	// центр, угол и край поля
+	const vector3ui centers[] = {vec3ui(size.x / 2, size.y / 3, size.z / 2), vec3ui(0, 0, 0),
+								 vec3ui(size.x - 1, size.y / 2, size.z - 2)};
+
+	volume_pyramid_init(&updated);
+	volume_pyramid_init(&rebuilt);
+	CHECK(volume_pyramid_build(&updated, volume, size));
+	CHECK(updated.num_levels > 2);
+
+	for(unsigned n = 0; n < sizeof(centers) / sizeof(centers[0]); n++) {
+		edit_volume(volume, size, centers[n], 5 + n, &begin, &end);
+
+		CHECK(volume_pyramid_update_region(&updated, begin, end));
+		CHECK(volume_pyramid_build(&rebuilt, volume, size));
+		check_pyramids(&updated, &rebuilt);
+	}
+
+	volume_pyramid_destroy(&updated);
+	volume_pyramid_destroy(&rebuilt);
+	free(volume);
+}
+
+static void check_mesh_region(vector3ui volume_size, vector3ui grid_size)
+{
+	float *volume = create_volume(volume_size);
+	const vector3f *vertices;
+	const triangle_t *triangles;
+	unsigned n_vertices, n_triangles, n_edited_vertices, n_edited_triangles;
+	vector3ui begin, end;
+
+	// правка вдали от сферы: поверхность появляется в блоках, которые были целиком снаружи
+	CHECK(marching_cubes_create_mesh(volume, volume_size, grid_size, 0.0f, &vertices, &n_vertices, &triangles, &n_triangles));
+
+	edit_volume(volume, volume_size, vec3ui(volume_size.x / 8, volume_size.y / 8, volume_size.z - 5), 4, &begin, &end);
+	marching_cubes_invalidate_region(volume, volume_size, begin, end);
+
+	CHECK(marching_cubes_create_mesh(volume, volume_size, grid_size, 0.0f, &vertices, &n_edited_vertices,
+									 &triangles, &n_edited_triangles));
+	CHECK(n_edited_triangles > n_triangles);
+
+	vector3f *edited_vertices = (vector3f*) malloc(sizeof(vector3f) * n_edited_vertices);
+	triangle_t *edited_triangles = (triangle_t*) malloc(sizeof(triangle_t) * n_edited_triangles);
+
+	CHECK(edited_vertices && edited_triangles);
+
+	memcpy(edited_vertices, vertices, sizeof(vector3f) * n_edited_vertices);
+	memcpy(edited_triangles, triangles, sizeof(triangle_t) * n_edited_triangles);
+
+	marching_cubes_invalidate();
+
+	CHECK(marching_cubes_create_mesh(volume, volume_size, grid_size, 0.0f, &vertices, &n_vertices, &triangles, &n_triangles));
+	CHECK_MSG(n_vertices == n_edited_vertices && n_triangles == n_edited_triangles, "%u/%u vs %u/%u vertices/triangles",
+			  n_edited_vertices, n_edited_triangles, n_vertices, n_triangles);
+	CHECK(memcmp(vertices, edited_vertices, sizeof(vector3f) * n_vertices) == 0);
+	CHECK(memcmp(triangles, edited_triangles, sizeof(triangle_t) * n_triangles) == 0);
+
+	free(edited_vertices);
+	free(edited_triangles);
+	free(volume);
+}
+
+int main()
+{
+	TEST_INIT();
+
+	thread_pool_set_num_threads(3);
+
+	check_pyramid_region(vec3ui(64, 64, 64));
+	check_pyramid_region(vec3ui(57, 40, 33));
+
+	check_mesh_region(vec3ui(64, 64, 64), vec3ui(64, 64, 64));
+	check_mesh_region(vec3ui(65, 65, 65), vec3ui(32, 32, 32));
+
+	thread_pool_destroy();
+	marching_cubes_invalidate();
+
+	printf("region updates match full rebuilds\n");
+
+	return 0;
+}
@@ -272,6 +272,12 @@ static QString get_error_string(int error)
 		case 16:
 			result = QString::fromUtf8("Встречен неизвестный токен");
 			break;
+		case 17:
+			result = QString::fromUtf8("Слишком сложное выражение");
+			break;
+		case 18:
+			result = QString::fromUtf8("Слишком длинный цикл");
+			break;
 		default:
 			result = QString::fromUtf8("Неизвестная ошибка");
 			break;
@@ -11,8 +11,8 @@ TEMPLATE = app
 INCLUDEPATH += include ../libvrender/include/
 LIBS += -L../libvrender-build/ -lvrender
 
-win32: LIBS += -lopengl32 -static -lgomp -lpthread
-unix:  LIBS += -lGL -lgomp -Bstatic
+win32: LIBS += -lopengl32 -static -lpthread
+unix:  LIBS += -lGL -lpthread -ldl -Bstatic
 
 PRE_TARGETDEPS += ../libvrender-build/libvrender.a
 